@@ -0,0 +1,310 @@
+#include "AssetPackage.h"
+#include "Lz4.h"
+#include "Hash.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#define ASSET_PACKAGE_MAGIC 0x4B415041 // "APAK"
+
+struct AssetPackageHeader
+{
+    u32 magic;
+    u32 version;
+    u32 blockSize;
+    u32 entryCount;
+};
+
+// The file starts at blocksOffset with blockCount + 1 u64 offsets (from the
+// start of the package), block i being [offsets[i], offsets[i + 1]). A block
+// as big as its uncompressed size is stored raw.
+struct AssetPackageEntry
+{
+    u64 nameHash;
+    u64 size;
+    u64 timestamp;
+    u64 blocksOffset;
+    u32 blockCount;
+    u32 padding;
+};
+
+static MappedFile               Package = {};
+static const AssetPackageEntry* PackageEntries = NULL;
+static u32                      PackageEntryCount = 0;
+
+static inline u64 Read64(const u8* p)
+{
+    u64 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static u32 GetBlockCount(u64 size)
+{
+    return (u32)((size + ASSET_PACKAGE_BLOCK_SIZE - 1) / ASSET_PACKAGE_BLOCK_SIZE);
+}
+
+// Lowercase on every platform, a package built on Linux still works on Windows
+static u64 HashAssetName(const char* filepath)
+{
+    std::string name = CanonicalizePath(filepath);
+    for (char& c : name)
+        c = (char)tolower((unsigned char)c);
+
+    return HashBytes(name.data(), name.size());
+}
+
+static const AssetPackageEntry* FindEntry(const char* filepath)
+{
+    if (!PackageEntries)
+        return NULL;
+
+    const u64 nameHash = HashAssetName(filepath);
+    const AssetPackageEntry* end = PackageEntries + PackageEntryCount;
+    const AssetPackageEntry* entry = std::lower_bound(PackageEntries, end, nameHash,
+        [](const AssetPackageEntry& e, u64 hash) { return e.nameHash < hash; });
+
+    return (entry != end && entry->nameHash == nameHash) ? entry : NULL;
+}
+
+bool MountAssetPackage(const char* filepath)
+{
+    UnmountAssetPackage();
+
+    MappedFile mapped;
+    if (!MapFile(filepath, mapped))
+        return false;
+
+    const AssetPackageHeader* header = (const AssetPackageHeader*)mapped.data;
+    const u64 tocEnd = sizeof(AssetPackageHeader) + (u64)(mapped.size >= sizeof(AssetPackageHeader) ? header->entryCount : 0) * sizeof(AssetPackageEntry);
+    if (mapped.size < sizeof(AssetPackageHeader) || header->magic != ASSET_PACKAGE_MAGIC ||
+        header->version != ASSET_PACKAGE_VERSION || header->blockSize != ASSET_PACKAGE_BLOCK_SIZE || tocEnd > mapped.size)
+    {
+        ELOG("Ignoring asset package %s: invalid or from another version", filepath);
+        UnmapFile(mapped);
+        return false;
+    }
+
+    // block tables inside the package, so reads only have to check the blocks
+    const AssetPackageEntry* entries = (const AssetPackageEntry*)(mapped.data + sizeof(AssetPackageHeader));
+    for (u32 i = 0; i < header->entryCount; ++i)
+    {
+        const AssetPackageEntry& entry = entries[i];
+        const u64 tableSize = ((u64)entry.blockCount + 1) * sizeof(u64);
+        if (entry.blockCount != GetBlockCount(entry.size) || entry.blocksOffset < tocEnd ||
+            entry.blocksOffset > mapped.size || mapped.size - entry.blocksOffset < tableSize)
+        {
+            ELOG("Ignoring asset package %s: corrupt table of contents", filepath);
+            UnmapFile(mapped);
+            return false;
+        }
+    }
+
+    Package = mapped;
+    PackageEntries = entries;
+    PackageEntryCount = header->entryCount;
+
+    ILOG("Mounted asset package %s (%u files)", filepath, PackageEntryCount);
+    return true;
+}
+
+void UnmountAssetPackage()
+{
+    UnmapFile(Package);
+    PackageEntries = NULL;
+    PackageEntryCount = 0;
+}
+
+bool FindPackagedFile(const char* filepath, u64& size, u64* timestamp)
+{
+    const AssetPackageEntry* entry = FindEntry(filepath);
+    if (!entry)
+        return false;
+
+    size = entry->size;
+    if (timestamp)
+        *timestamp = entry->timestamp;
+    return true;
+}
+
+bool ReadPackagedFile(const char* filepath, u64 offset, void* dst, u64 size)
+{
+    const AssetPackageEntry* entry = FindEntry(filepath);
+    if (!entry || offset > entry->size || entry->size - offset < size)
+        return false;
+
+    const u8* blockOffsets = Package.data + entry->blocksOffset;
+    u8* out = (u8*)dst;
+    std::vector<u8> scratch;  // for the blocks only partially read
+
+    for (u64 block = offset / ASSET_PACKAGE_BLOCK_SIZE; size > 0; ++block)
+    {
+        const u64 blockBegin = block * ASSET_PACKAGE_BLOCK_SIZE;
+        const u32 blockSize = (u32)std::min<u64>(ASSET_PACKAGE_BLOCK_SIZE, entry->size - blockBegin);
+        const u32 readBegin = (u32)(offset - blockBegin);
+        const u32 readSize = (u32)std::min<u64>(blockSize - readBegin, size);
+
+        const u64 packedBegin = Read64(blockOffsets + block * sizeof(u64));
+        const u64 packedEnd = Read64(blockOffsets + (block + 1) * sizeof(u64));
+        if (packedBegin > packedEnd || packedEnd > Package.size)
+            return false;
+
+        const u8* packed = Package.data + packedBegin;
+        const u32 packedSize = (u32)(packedEnd - packedBegin);
+
+        if (packedSize == blockSize)
+        {
+            memcpy(out, packed + readBegin, readSize);
+        }
+        else if (readSize == blockSize)
+        {
+            if (!Lz4Decompress(packed, packedSize, out, blockSize))
+                return false;
+        }
+        else
+        {
+            scratch.resize(blockSize);
+            if (!Lz4Decompress(packed, packedSize, scratch.data(), blockSize))
+                return false;
+            memcpy(out, scratch.data() + readBegin, readSize);
+        }
+
+        out += readSize;
+        offset += readSize;
+        size -= readSize;
+    }
+
+    return true;
+}
+
+struct PackedFile
+{
+    const std::string* filepath;
+    u64                nameHash;
+    u64                size;
+    u64                timestamp;
+    std::vector<u64>   blockOffsets;  // relative to the start of data
+    std::vector<u8>    data;
+    bool               read;
+};
+
+static void PackFile(PackedFile& file)
+{
+    std::vector<u8> bytes;
+    file.read = ReadBinaryFile(file.filepath->c_str(), bytes);
+    if (!file.read)
+        return;
+
+    file.size = bytes.size();
+    file.timestamp = GetFileLastWriteTimestamp(file.filepath->c_str());
+
+    const u32 blockCount = GetBlockCount(file.size);
+    std::vector<u8> compressed(Lz4CompressBound(ASSET_PACKAGE_BLOCK_SIZE));
+    file.blockOffsets.push_back(0);
+    for (u32 block = 0; block < blockCount; ++block)
+    {
+        const u8* raw = bytes.data() + (u64)block * ASSET_PACKAGE_BLOCK_SIZE;
+        const u32 rawSize = (u32)std::min<u64>(ASSET_PACKAGE_BLOCK_SIZE, file.size - (u64)block * ASSET_PACKAGE_BLOCK_SIZE);
+        const u32 compressedSize = Lz4Compress(raw, rawSize, compressed.data());
+
+        if (compressedSize < rawSize)
+            file.data.insert(file.data.end(), compressed.data(), compressed.data() + compressedSize);
+        else
+            file.data.insert(file.data.end(), raw, raw + rawSize);
+        file.blockOffsets.push_back(file.data.size());
+    }
+}
+
+bool WriteAssetPackage(const char* filepath, const std::vector<std::string>& files)
+{
+    std::vector<PackedFile> packedFiles(files.size());
+
+    JobCounter jobs;
+    for (u32 i = 0; i < files.size(); ++i)
+    {
+        PackedFile* file = &packedFiles[i];
+        file->filepath = &files[i];
+        file->nameHash = HashAssetName(files[i].c_str());
+        RunJob([file]() { PackFile(*file); }, &jobs);
+    }
+    WaitForJobCounter(jobs);
+
+    std::sort(packedFiles.begin(), packedFiles.end(),
+        [](const PackedFile& a, const PackedFile& b) { return a.nameHash < b.nameHash; });
+
+    for (u32 i = 0; i < packedFiles.size(); ++i)
+    {
+        if (!packedFiles[i].read)
+        {
+            ELOG("Could not read %s", packedFiles[i].filepath->c_str());
+            return false;
+        }
+        if (i > 0 && packedFiles[i].nameHash == packedFiles[i - 1].nameHash)
+        {
+            ELOG("%s and %s have the same name hash", packedFiles[i].filepath->c_str(), packedFiles[i - 1].filepath->c_str());
+            return false;
+        }
+    }
+
+    AssetPackageHeader header = {};
+    header.magic = ASSET_PACKAGE_MAGIC;
+    header.version = ASSET_PACKAGE_VERSION;
+    header.blockSize = ASSET_PACKAGE_BLOCK_SIZE;
+    header.entryCount = (u32)packedFiles.size();
+
+    std::vector<u8> toc(sizeof(header) + packedFiles.size() * sizeof(AssetPackageEntry));
+    memcpy(toc.data(), &header, sizeof(header));
+
+    u64 cursor = toc.size();
+    u64 packedSize = 0;
+    u64 unpackedSize = 0;
+    for (u32 i = 0; i < packedFiles.size(); ++i)
+    {
+        PackedFile& file = packedFiles[i];
+
+        AssetPackageEntry entry = {};
+        entry.nameHash = file.nameHash;
+        entry.size = file.size;
+        entry.timestamp = file.timestamp;
+        entry.blocksOffset = cursor;
+        entry.blockCount = (u32)file.blockOffsets.size() - 1;
+        memcpy(toc.data() + sizeof(header) + i * sizeof(AssetPackageEntry), &entry, sizeof(entry));
+
+        const u64 dataBegin = cursor + file.blockOffsets.size() * sizeof(u64);
+        for (u64& blockOffset : file.blockOffsets)
+            blockOffset += dataBegin;
+        cursor = dataBegin + file.data.size();
+
+        packedSize += file.data.size();
+        unpackedSize += file.size;
+    }
+
+    FILE* out = fopen(filepath, "wb");
+    if (!out)
+    {
+        ELOG("fopen() failed writing file %s", filepath);
+        return false;
+    }
+
+    bool written = fwrite(toc.data(), 1, toc.size(), out) == toc.size();
+    for (u32 i = 0; written && i < packedFiles.size(); ++i)
+    {
+        const PackedFile& file = packedFiles[i];
+        const size_t tableSize = file.blockOffsets.size() * sizeof(u64);
+        written = fwrite(file.blockOffsets.data(), 1, tableSize, out) == tableSize &&
+                  fwrite(file.data.data(), 1, file.data.size(), out) == file.data.size();
+    }
+    fclose(out);
+
+    if (!written)
+    {
+        ELOG("Could not write asset package %s", filepath);
+        return false;
+    }
+
+    ILOG("Packed %u files into %s: %llu KB -> %llu KB", (u32)packedFiles.size(), filepath,
+         (unsigned long long)(unpackedSize / 1024), (unsigned long long)(packedSize / 1024));
+    return true;
+}
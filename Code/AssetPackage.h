@@ -0,0 +1,37 @@
+#pragma once
+#include "platform.h"
+
+// Single file package with every asset of WorkingDir (see the cooker). The
+// table of contents sits right after the header, sorted by the hash of the
+// canonical lowercase path, and is searched straight in the mapping. Each file
+// is split in ASSET_PACKAGE_BLOCK_SIZE blocks compressed with LZ4 (stored raw
+// when that doesn't pay off), so ranges can be read without the whole file.
+//
+// Once mounted, the file functions of the platform layer (ReadTextFile,
+// ReadBinaryFile, MapFile...) fall back to the package for files missing on
+// disk: loose files always win, edit them without rebuilding the package.
+
+#define ASSET_PACKAGE_FILE "Assets.pak"
+
+// Bump it whenever the package layout changes
+#define ASSET_PACKAGE_VERSION 1
+#define ASSET_PACKAGE_BLOCK_SIZE KB(64)
+
+// Maps the package, returns false (and nothing falls back) if it's missing or invalid
+bool MountAssetPackage(const char* filepath);
+
+void UnmountAssetPackage();
+
+// Whether the package has the file, with its size and the last write
+// timestamp of the loose file it was packed from (what
+// GetFileLastWriteTimestamp() reports for packaged files)
+bool FindPackagedFile(const char* filepath, u64& size, u64* timestamp = NULL);
+
+// Decompresses [offset, offset + size) of a packaged file straight into dst,
+// whatever memory that is (a vector, a mapped upload buffer...). Safe to call
+// from worker threads.
+bool ReadPackagedFile(const char* filepath, u64 offset, void* dst, u64 size);
+
+// Packs the files (paths relative to the working directory), compressing their
+// blocks on the job system
+bool WriteAssetPackage(const char* filepath, const std::vector<std::string>& files);
@@ -0,0 +1,247 @@
+#include "Benchmarks.h"
+#include "ModelImport.h"
+#include "ObjLoader.h"
+#include <chrono>
+#include <stdio.h>
+#include <algorithm>
+#pragma warning(disable : 4996) //disable printf warning
+
+static f64 GetTimeMs()
+{
+    return std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+}
+
+template <typename Fn>
+static f64 MeasureBestMs(Fn fn)
+{
+    f64 best = 0.0;
+    for (u32 run = 0; run < BENCHMARK_RUNS; ++run)
+    {
+        const f64 start = GetTimeMs();
+        fn();
+        const f64 elapsed = GetTimeMs() - start;
+        best = (run == 0) ? elapsed : glm::min(best, elapsed);
+    }
+    return best;
+}
+
+// A grid-like soup of vertexCount vertices, in triangles
+static aiMesh* CreateSyntheticMesh(u32 vertexCount, bool withTexCoords, bool withTangentSpace)
+{
+    aiMesh* mesh = new aiMesh();
+    mesh->mPrimitiveTypes = aiPrimitiveType_TRIANGLE;
+    mesh->mNumVertices = vertexCount;
+    mesh->mVertices = new aiVector3D[vertexCount];
+    mesh->mNormals = new aiVector3D[vertexCount];
+    if (withTexCoords)
+    {
+        mesh->mTextureCoords[0] = new aiVector3D[vertexCount];
+        mesh->mNumUVComponents[0] = 2;
+    }
+    if (withTangentSpace)
+    {
+        mesh->mTangents = new aiVector3D[vertexCount];
+        mesh->mBitangents = new aiVector3D[vertexCount];
+    }
+
+    for (u32 i = 0; i < vertexCount; ++i)
+    {
+        const f32 x = (f32)(i % 1024), z = (f32)(i / 1024);
+        mesh->mVertices[i] = aiVector3D(x, 0.0f, z);
+        mesh->mNormals[i] = aiVector3D(0.0f, 1.0f, 0.0f);
+        if (withTexCoords)
+            mesh->mTextureCoords[0][i] = aiVector3D(x / 1024.0f, z / 1024.0f, 0.0f);
+        if (withTangentSpace)
+        {
+            mesh->mTangents[i] = aiVector3D(1.0f, 0.0f, 0.0f);
+            mesh->mBitangents[i] = aiVector3D(0.0f, 0.0f, -1.0f);
+        }
+    }
+
+    mesh->mNumFaces = vertexCount / 3;
+    mesh->mFaces = new aiFace[mesh->mNumFaces];
+    for (u32 i = 0; i < mesh->mNumFaces; ++i)
+    {
+        mesh->mFaces[i].mNumIndices = 3;
+        mesh->mFaces[i].mIndices = new unsigned int[3] { i * 3, i * 3 + 1, i * 3 + 2 };
+    }
+    return mesh;
+}
+
+// What ProcessAssimpMesh used to do
+static void LegacyInterleave(const aiMesh* mesh, std::vector<float>& vertices, std::vector<u32>& indices)
+{
+    for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+    {
+        vertices.push_back(mesh->mVertices[i].x);
+        vertices.push_back(mesh->mVertices[i].y);
+        vertices.push_back(mesh->mVertices[i].z);
+        vertices.push_back(mesh->mNormals[i].x);
+        vertices.push_back(mesh->mNormals[i].y);
+        vertices.push_back(mesh->mNormals[i].z);
+
+        if (mesh->mTextureCoords[0])
+        {
+            vertices.push_back(mesh->mTextureCoords[0][i].x);
+            vertices.push_back(mesh->mTextureCoords[0][i].y);
+        }
+
+        if (mesh->mTangents != nullptr && mesh->mBitangents)
+        {
+            vertices.push_back(mesh->mTangents[i].x);
+            vertices.push_back(mesh->mTangents[i].y);
+            vertices.push_back(mesh->mTangents[i].z);
+            vertices.push_back(-mesh->mBitangents[i].x);
+            vertices.push_back(-mesh->mBitangents[i].y);
+            vertices.push_back(-mesh->mBitangents[i].z);
+        }
+    }
+
+    for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+    {
+        aiFace face = mesh->mFaces[i];
+        for (unsigned int j = 0; j < face.mNumIndices; j++)
+            indices.push_back(face.mIndices[j]);
+    }
+}
+
+static void BenchmarkInterleave(const char* name, bool withTexCoords, bool withTangentSpace)
+{
+    aiMesh* mesh = CreateSyntheticMesh(BENCHMARK_MESH_VERTEX_COUNT, withTexCoords, withTangentSpace);
+
+    std::vector<float> legacyVertices, vertices;
+    std::vector<u32> legacyIndices, indices;
+    VertexBufferLayout layout;
+
+    const f64 legacyMs = MeasureBestMs([&]()
+    {
+        // freed every run, the reallocations are what is being measured
+        std::vector<float>().swap(legacyVertices);
+        std::vector<u32>().swap(legacyIndices);
+        LegacyInterleave(mesh, legacyVertices, legacyIndices);
+    });
+
+    const f64 bulkMs = MeasureBestMs([&]()
+    {
+        std::vector<float>().swap(vertices);
+        std::vector<u32>().swap(indices);
+        InterleaveAssimpVertices(mesh, vertices, layout);
+        CopyAssimpIndices(mesh, indices);
+    });
+
+    // the tangents used to be followed by the negated bitangent, today they
+    // carry its handedness in w: only the attributes both layouts share compare
+    const u32 sharedFloats = withTexCoords ? 8 : 6;
+    const u32 legacyStride = sharedFloats + (withTangentSpace ? 6 : 0);
+    const u32 stride = layout.stride / sizeof(float);
+    bool identical = indices == legacyIndices && vertices.size() / stride == legacyVertices.size() / legacyStride;
+    for (u32 v = 0; identical && v < vertices.size() / stride; ++v)
+        identical = std::equal(&vertices[v * stride], &vertices[v * stride] + sharedFloats, &legacyVertices[v * legacyStride]);
+
+    ILOG("Interleave %s, %u vertices: %.1f ms -> %.1f ms (%.1fx)%s", name, BENCHMARK_MESH_VERTEX_COUNT,
+         legacyMs, bulkMs, legacyMs / bulkMs, identical ? "" : " OUTPUT MISMATCH");
+
+    delete mesh;
+}
+
+void RunMeshInterleaveBenchmark()
+{
+    BenchmarkInterleave("position/normal", false, false);
+    BenchmarkInterleave("position/normal/uv", true, false);
+    BenchmarkInterleave("position/normal/uv/tangents", true, true);
+}
+
+#define BENCHMARK_OBJ_FILE "benchmark_grid.obj"
+
+// Grid with uvs and normals, as quads sharing their corners
+static bool WriteGridObj(const char* filepath, u32 size)
+{
+    FILE* file = fopen(filepath, "wb");
+    if (!file)
+        return false;
+
+    for (u32 z = 0; z <= size; ++z)
+        for (u32 x = 0; x <= size; ++x)
+            fprintf(file, "v %f %f %f\n", (f32)x, sinf(x * 0.1f) * cosf(z * 0.1f), (f32)z);
+    for (u32 z = 0; z <= size; ++z)
+        for (u32 x = 0; x <= size; ++x)
+            fprintf(file, "vt %f %f\n", (f32)x / size, (f32)z / size);
+    fprintf(file, "vn 0 1 0\n");
+
+    for (u32 z = 0; z < size; ++z)
+    {
+        for (u32 x = 0; x < size; ++x)
+        {
+            const u32 i = z * (size + 1) + x + 1;
+            fprintf(file, "f %u/%u/1 %u/%u/1 %u/%u/1 %u/%u/1\n", i, i, i + size + 1, i + size + 1, i + size + 2, i + size + 2, i + 1, i + 1);
+        }
+    }
+
+    return fclose(file) == 0;
+}
+
+static void CountImport(const ModelImport& import, u32& triangleCount, u32& vertexCount)
+{
+    triangleCount = 0;
+    vertexCount = 0;
+    for (const Submesh& submesh : import.mesh.submeshes)
+    {
+        triangleCount += submesh.indexCount / 3;
+        vertexCount += (u32)(submesh.vertices.size() / (submesh.vertexBufferLayout.stride / sizeof(float)));
+    }
+}
+
+static void BenchmarkObjImport(const std::string& filepath)
+{
+    u32 assimpTriangles = 0, assimpVertices = 0;
+    u32 nativeTriangles = 0, nativeVertices = 0;
+    bool assimpImported = true, nativeImported = true;
+
+    // Assimp also runs the cache locality and mesh merging steps of
+    // MODEL_IMPORT_FLAGS, which the native loader skips
+    const f64 assimpMs = MeasureBestMs([&]()
+    {
+        ModelImport import;
+        import.filepath = filepath;
+        import.importFlags = MODEL_IMPORT_FLAGS;
+        assimpImported = ImportAssimpModel(import) && assimpImported;
+        CountImport(import, assimpTriangles, assimpVertices);
+    });
+
+    const f64 nativeMs = MeasureBestMs([&]()
+    {
+        ModelImport import;
+        import.filepath = filepath;
+        import.importFlags = MODEL_IMPORT_FLAGS;
+        nativeImported = ImportObjModel(import) && nativeImported;
+        CountImport(import, nativeTriangles, nativeVertices);
+    });
+
+    if (!assimpImported || !nativeImported)
+    {
+        ELOG("Import of %s failed (Assimp %s, native %s)", filepath.c_str(), assimpImported ? "ok" : "failed", nativeImported ? "ok" : "failed");
+        return;
+    }
+
+    // the vertex counts can differ a little: Assimp splits the meshes per
+    // object as well and doesn't join vertices across them
+    ILOG("Import %s, %u triangles: Assimp %.1f ms (%u vertices) -> native %.1f ms (%u vertices) (%.1fx)%s",
+         filepath.c_str(), nativeTriangles, assimpMs, assimpVertices, nativeMs, nativeVertices, assimpMs / nativeMs,
+         assimpTriangles == nativeTriangles ? "" : " TRIANGLE COUNT MISMATCH");
+}
+
+void RunObjImportBenchmark()
+{
+    if (WriteGridObj(BENCHMARK_OBJ_FILE, BENCHMARK_OBJ_GRID_SIZE))
+        BenchmarkObjImport(BENCHMARK_OBJ_FILE);
+    else
+        ELOG("Could not write %s", BENCHMARK_OBJ_FILE);
+    remove(BENCHMARK_OBJ_FILE);
+
+    std::vector<std::string> files;
+    ListFiles("Models", files, true);
+    std::sort(files.begin(), files.end());
+    for (const std::string& file : files)
+        if (IsObjFile(file))
+            BenchmarkObjImport(file);
+}
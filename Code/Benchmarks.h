@@ -0,0 +1,17 @@
+#pragma once
+#include "engine.h"
+
+// Micro-benchmarks of the asset pipeline, started from the Gui. They don't
+// need a GL context and report to the log.
+
+#define BENCHMARK_MESH_VERTEX_COUNT 5000000
+#define BENCHMARK_OBJ_GRID_SIZE     512  // quads per side of the synthetic OBJ
+#define BENCHMARK_RUNS              3  // the best run is reported
+
+// Interleaving of a synthetic Assimp mesh (with and without uvs/tangents):
+// the per-float push_back loop it replaced against InterleaveAssimpVertices()
+void RunMeshInterleaveBenchmark();
+
+// Import of a synthetic grid OBJ (and of every OBJ under Models/): Assimp
+// against the native loader (see ObjLoader.h), mesh and materials only
+void RunObjImportBenchmark();
@@ -51,11 +51,17 @@ void AlignHead(Buffer& buffer, u32 alignment)
     buffer.head = Align(buffer.head, alignment);
 }
 
-void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment)
+bool PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment)
 {
     ASSERT(buffer.data != NULL, "The buffer must be mapped first");
     AlignHead(buffer, alignment);
+    if (buffer.head + size > buffer.size)
+    {
+        ELOG("Buffer %u overflow: %u bytes pushed at %u of %u, dropped", buffer.handle, size, buffer.head, buffer.size);
+        return false;
+    }
     memcpy((u8*)buffer.data + buffer.head, data, size);
     buffer.head += size;
+    return true;
 }
 
@@ -29,7 +29,8 @@ void UnmapBuffer(Buffer& buffer);
 
 void AlignHead(Buffer& buffer, u32 alignment);
 
-void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
+// False (and logged) when it doesn't fit, nothing is written then
+bool PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
 
 #define PushData(buffer, data, size) PushAlignedData(buffer, data, size, 1)
 #define PushUInt(buffer, value) { u32 v = value; PushAlignedData(buffer, &v, sizeof(v), 4); }
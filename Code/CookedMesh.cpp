@@ -0,0 +1,485 @@
+#include "CookedMesh.h"
+#include "Hash.h"
+#include "MeshProcessing.h"
+#include "VertexFormat.h"
+#include <cfloat>
+
+#define COOKED_MESH_MAGIC 0x4853454d // "MESH"
+
+// blobs start on this alignment in the file
+#define COOKED_MESH_BLOB_ALIGNMENT 16
+
+// up to this many vertices a submesh gets 16 bit indices
+#define SHORT_INDEX_VERTEX_LIMIT 65536
+
+struct CookedMeshHeader
+{
+    u32 magic;
+    u32 version;
+    u64 sourceHash;  // HashCookedMeshSource() of the model file it was cooked from
+    u64 sourceSize;
+    u32 importFlags;
+    u32 submeshCount;
+    u32 materialCount;
+    u32 stringTableSize;
+    u64 vertexBlobOffset;
+    u64 vertexBlobSize;
+    u64 indexBlobOffset;
+    u64 indexBlobSize;
+    f32 boundsMin[3];
+    f32 boundsMax[3];
+    f32 boundingRadius;
+    u32 nodeCount;
+};
+
+struct CookedAttribute
+{
+    u8 location;
+    u8 componentCount;
+    u16 offset;
+    u8 normalized;
+    u8 padding[3];
+    u32 type;
+};
+
+struct CookedSubmesh
+{
+    u32 vertexOffset;  // bytes into the vertex blob
+    u32 indexOffset;   // bytes into the index blob
+    u32 indexCount;
+    u32 indexType;
+    u32 materialIdx;   // into the materials of the file
+    u32 stride;
+    u32 attributeCount;
+    CookedAttribute attributes[COOKED_MESH_MAX_ATTRIBUTES];
+    u64 layoutHash;    // HashVertexBufferLayout() of the attributes above
+    MeshDrawStats unoptimizedStats;  // as measured on import
+    MeshDrawStats optimizedStats;
+    f32 positionScale[3];
+    f32 positionOffset[3];
+    QuantizationError quantizationError;
+};
+
+// Name is an offset into the string table
+struct CookedNode
+{
+    f32 localMatrix[16];
+    f32 modelMatrix[16];
+    u32 parent;
+    u32 firstSubmesh;
+    u32 submeshCount;
+    u32 name;
+};
+
+// Material maps are offsets into the string table, UINT32_MAX if there is none
+struct CookedMaterial
+{
+    f32 albedo[3];
+    f32 emissive[3];
+    f32 smoothness;
+    u32 name;
+    u32 albedoMap;
+    u32 emissiveMap;
+    u32 specularMap;
+    u32 normalsMap;
+    u32 bumpMap;
+};
+
+static u64 AlignOffset(u64 offset)
+{
+    return (offset + COOKED_MESH_BLOB_ALIGNMENT - 1) & ~(u64)(COOKED_MESH_BLOB_ALIGNMENT - 1);
+}
+
+void GetCookedMeshPath(const std::string& filepath, u32 importFlags, char* path, u32 pathSize)
+{
+    const u64 key = HashCombine(HashBytes(filepath.data(), filepath.size()), importFlags);
+    snprintf(path, pathSize, "%s/%016llx.mesh", COOKED_MESH_DIRECTORY, (unsigned long long)key);
+}
+
+u64 HashCookedMeshSource(const void* data, u64 size)
+{
+    return HashCombine(HashBytes(data, size), size);
+}
+
+// Mapped rather than read, the file can be large and only gets hashed
+static bool HashModelFile(const std::string& filepath, u64& hash, u64& size)
+{
+    MappedFile file;
+    if (!MapFile(filepath.c_str(), file))
+        return false;
+
+    hash = HashCookedMeshSource(file.data, file.size);
+    size = file.size;
+    UnmapFile(file);
+    return true;
+}
+
+void PackModelImport(ModelImport& import)
+{
+    const u32 submeshCount = (u32)import.mesh.submeshes.size();
+    std::vector<VertexBufferLayout> quantizedLayouts(submeshCount);
+    u64 floatVertexBytes = 0, floatIndexBytes = 0;
+    u64 vertexBlobSize = 0, indexBlobSize = 0;
+    for (u32 i = 0; i < submeshCount; ++i)
+    {
+        Submesh& submesh = import.mesh.submeshes[i];
+        const u32 strideFloats = glm::max(submesh.vertexBufferLayout.stride / (u32)sizeof(float), 1u);
+        const u32 vertexCount = (u32)(submesh.vertices.size() / strideFloats);
+        floatVertexBytes += submesh.vertices.size() * sizeof(float);
+        floatIndexBytes += submesh.indices.size() * sizeof(u32);
+
+        MakeQuantizedVertexLayout(submesh, quantizedLayouts[i]);
+        submesh.vertexOffset = (u32)vertexBlobSize;
+        vertexBlobSize += (u64)vertexCount * quantizedLayouts[i].stride;
+
+        // every submesh starts 4 byte aligned, whatever the index size
+        submesh.indexType = (vertexCount <= SHORT_INDEX_VERTEX_LIMIT) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        indexBlobSize = (indexBlobSize + 3) & ~3ull;
+        submesh.indexOffset = (u32)indexBlobSize;
+        indexBlobSize += submesh.indices.size() * ((submesh.indexType == GL_UNSIGNED_SHORT) ? sizeof(u16) : sizeof(u32));
+    }
+
+    import.vertexBlob.assign(vertexBlobSize, 0);
+    import.indexBlob.assign(indexBlobSize, 0);
+
+    vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+    f32 boundingRadius = 0.0f;
+    std::vector<vec3> submeshBoundsMin, submeshBoundsMax;
+    QuantizationError maxError = {};
+
+    for (u32 i = 0; i < submeshCount; ++i)
+    {
+        Submesh& submesh = import.mesh.submeshes[i];
+
+        // positions are the first attribute of every layout
+        vec3 submeshMin(FLT_MAX), submeshMax(-FLT_MAX);
+        const u32 strideFloats = glm::max(submesh.vertexBufferLayout.stride / (u32)sizeof(float), 1u);
+        for (u32 v = 0; v + 2 < submesh.vertices.size(); v += strideFloats)
+        {
+            vec3 position(submesh.vertices[v], submesh.vertices[v + 1], submesh.vertices[v + 2]);
+            submeshMin = glm::min(submeshMin, position);
+            submeshMax = glm::max(submeshMax, position);
+            boundingRadius = glm::max(boundingRadius, glm::length(position));
+        }
+        boundsMin = glm::min(boundsMin, submeshMin);
+        boundsMax = glm::max(boundsMax, submeshMax);
+        submeshBoundsMin.push_back(submeshMin);
+        submeshBoundsMax.push_back(submeshMax);
+
+        QuantizeVertices(submesh, quantizedLayouts[i], import.vertexBlob.data() + submesh.vertexOffset);
+        submesh.vertexBufferLayout = quantizedLayouts[i];
+        maxError.position = glm::max(maxError.position, submesh.quantizationError.position);
+        maxError.normal = glm::max(maxError.normal, submesh.quantizationError.normal);
+        maxError.tangent = glm::max(maxError.tangent, submesh.quantizationError.tangent);
+        maxError.texCoord = glm::max(maxError.texCoord, submesh.quantizationError.texCoord);
+
+        u8* indices = import.indexBlob.data() + submesh.indexOffset;
+        if (submesh.indexType == GL_UNSIGNED_SHORT)
+        {
+            for (u32 j = 0; j < submesh.indices.size(); ++j)
+                ((u16*)indices)[j] = (u16)submesh.indices[j];
+        }
+        else
+        {
+            memcpy(indices, submesh.indices.data(), submesh.indices.size() * sizeof(u32));
+        }
+
+        // the blobs are all that is uploaded, like a cooked mesh
+        std::vector<float>().swap(submesh.vertices);
+        std::vector<u32>().swap(submesh.indices);
+    }
+
+    import.vertexData = import.vertexBlob.data();
+    import.vertexDataSize = vertexBlobSize;
+    import.indexData = import.indexBlob.data();
+    import.indexDataSize = indexBlobSize;
+    import.boundsMin = boundsMin;
+    import.boundsMax = boundsMax;
+    import.mesh.boundingRadius = boundingRadius;
+
+    // the submeshes are in their node's space
+    if (!import.nodes.empty())
+        ComputeNodeBounds(import, submeshBoundsMin, submeshBoundsMax);
+
+    ILOG("%s: vertices %.1f KB -> %.1f KB, indices %.1f KB -> %.1f KB, max error: position %g (%.4f%% of the bounds), "
+         "normal %.3f deg, tangent %.3f deg, uv %g",
+         import.filepath.c_str(), floatVertexBytes / 1024.0f, vertexBlobSize / 1024.0f, floatIndexBytes / 1024.0f, indexBlobSize / 1024.0f,
+         maxError.position, 100.0f * maxError.position / glm::max(glm::length(boundsMax - boundsMin), FLT_MIN),
+         maxError.normal, maxError.tangent, maxError.texCoord);
+}
+
+static u32 AddString(std::vector<char>& stringTable, const std::string& str)
+{
+    const u32 offset = stringTable.size();
+    stringTable.insert(stringTable.end(), str.begin(), str.end());
+    stringTable.push_back('\0');
+    return offset;
+}
+
+static u32 AddMapString(std::vector<char>& stringTable, const std::string& map)
+{
+    return map.empty() ? UINT32_MAX : AddString(stringTable, map);
+}
+
+bool WriteCookedMesh(const ModelImport& import)
+{
+    u64 sourceHash, sourceSize;
+    if (!HashModelFile(import.filepath, sourceHash, sourceSize))
+        return false;
+
+    std::vector<CookedSubmesh> submeshes(import.mesh.submeshes.size());
+    for (u32 i = 0; i < submeshes.size(); ++i)
+    {
+        const Submesh& submesh = import.mesh.submeshes[i];
+        const VertexBufferLayout& layout = submesh.vertexBufferLayout;
+        if (layout.attributes.size() > COOKED_MESH_MAX_ATTRIBUTES)
+            return false;
+
+        CookedSubmesh& cooked = submeshes[i];
+        cooked = {};
+        cooked.vertexOffset = submesh.vertexOffset;
+        cooked.indexOffset = submesh.indexOffset;
+        cooked.indexCount = submesh.indexCount;
+        cooked.indexType = submesh.indexType;
+        cooked.materialIdx = import.submeshMaterialIdx[i];
+        cooked.stride = layout.stride;
+        cooked.attributeCount = layout.attributes.size();
+        cooked.layoutHash = HashVertexBufferLayout(layout);
+        cooked.unoptimizedStats = submesh.unoptimizedStats;
+        cooked.optimizedStats = submesh.optimizedStats;
+        memcpy(cooked.positionScale, &submesh.positionScale, sizeof(cooked.positionScale));
+        memcpy(cooked.positionOffset, &submesh.positionOffset, sizeof(cooked.positionOffset));
+        cooked.quantizationError = submesh.quantizationError;
+        for (u32 a = 0; a < layout.attributes.size(); ++a)
+        {
+            cooked.attributes[a].location = layout.attributes[a].location;
+            cooked.attributes[a].componentCount = layout.attributes[a].componentCount;
+            cooked.attributes[a].offset = layout.attributes[a].offset;
+            cooked.attributes[a].normalized = layout.attributes[a].normalized ? 1 : 0;
+            cooked.attributes[a].type = layout.attributes[a].type;
+        }
+    }
+
+    std::vector<char> stringTable;
+    std::vector<CookedMaterial> materials(import.materials.size());
+    for (u32 i = 0; i < materials.size(); ++i)
+    {
+        const ImportedMaterial& importedMaterial = import.materials[i];
+        const Material& material = importedMaterial.material;
+
+        CookedMaterial& cooked = materials[i];
+        memcpy(cooked.albedo, &material.albedo[0], sizeof(cooked.albedo));
+        memcpy(cooked.emissive, &material.emissive[0], sizeof(cooked.emissive));
+        cooked.smoothness = material.smoothness;
+        cooked.name = AddString(stringTable, material.name);
+        cooked.albedoMap = AddMapString(stringTable, importedMaterial.albedoMap);
+        cooked.emissiveMap = AddMapString(stringTable, importedMaterial.emissiveMap);
+        cooked.specularMap = AddMapString(stringTable, importedMaterial.specularMap);
+        cooked.normalsMap = AddMapString(stringTable, importedMaterial.normalsMap);
+        cooked.bumpMap = AddMapString(stringTable, importedMaterial.bumpMap);
+    }
+
+    std::vector<CookedNode> nodes(import.nodes.size());
+    for (u32 i = 0; i < nodes.size(); ++i)
+    {
+        const ModelNode& node = import.nodes[i];
+        CookedNode& cooked = nodes[i];
+        memcpy(cooked.localMatrix, &node.localMatrix[0][0], sizeof(cooked.localMatrix));
+        memcpy(cooked.modelMatrix, &node.modelMatrix[0][0], sizeof(cooked.modelMatrix));
+        cooked.parent = node.parent;
+        cooked.firstSubmesh = node.firstSubmesh;
+        cooked.submeshCount = node.submeshCount;
+        cooked.name = AddString(stringTable, node.name);
+    }
+
+    CookedMeshHeader header = {};
+    header.magic = COOKED_MESH_MAGIC;
+    header.version = COOKED_MESH_VERSION;
+    header.sourceHash = sourceHash;
+    header.sourceSize = sourceSize;
+    header.importFlags = import.importFlags;
+    header.submeshCount = submeshes.size();
+    header.materialCount = materials.size();
+    header.nodeCount = nodes.size();
+    header.stringTableSize = stringTable.size();
+    memcpy(header.boundsMin, &import.boundsMin[0], sizeof(header.boundsMin));
+    memcpy(header.boundsMax, &import.boundsMax[0], sizeof(header.boundsMax));
+    header.boundingRadius = import.mesh.boundingRadius;
+
+    const u64 tablesSize = sizeof(header) + submeshes.size() * sizeof(CookedSubmesh) +
+                           materials.size() * sizeof(CookedMaterial) + nodes.size() * sizeof(CookedNode) + stringTable.size();
+    header.vertexBlobOffset = AlignOffset(tablesSize);
+    header.vertexBlobSize = import.vertexDataSize;
+    header.indexBlobOffset = AlignOffset(header.vertexBlobOffset + header.vertexBlobSize);
+    header.indexBlobSize = import.indexDataSize;
+
+    std::vector<u8> bytes(header.indexBlobOffset + header.indexBlobSize, 0);
+    u8* cursor = bytes.data();
+    memcpy(cursor, &header, sizeof(header));
+    cursor += sizeof(header);
+    memcpy(cursor, submeshes.data(), submeshes.size() * sizeof(CookedSubmesh));
+    cursor += submeshes.size() * sizeof(CookedSubmesh);
+    memcpy(cursor, materials.data(), materials.size() * sizeof(CookedMaterial));
+    cursor += materials.size() * sizeof(CookedMaterial);
+    memcpy(cursor, nodes.data(), nodes.size() * sizeof(CookedNode));
+    cursor += nodes.size() * sizeof(CookedNode);
+    memcpy(cursor, stringTable.data(), stringTable.size());
+    memcpy(bytes.data() + header.vertexBlobOffset, import.vertexData, header.vertexBlobSize);
+    memcpy(bytes.data() + header.indexBlobOffset, import.indexData, header.indexBlobSize);
+
+    char path[256];
+    GetCookedMeshPath(import.filepath, import.importFlags, path, sizeof(path));
+    MakeDirectory(COOKED_MESH_DIRECTORY);
+    return WriteBinaryFile(path, bytes.data(), bytes.size());
+}
+
+static std::string GetTableString(const char* stringTable, u32 stringTableSize, u32 offset)
+{
+    if (offset >= stringTableSize)
+        return std::string();
+    return std::string(stringTable + offset, strnlen(stringTable + offset, stringTableSize - offset));
+}
+
+static bool IsCookedMeshValid(const ModelImport& import, const MappedFile& file, const CookedMeshHeader& header)
+{
+    if (header.magic != COOKED_MESH_MAGIC || header.version != COOKED_MESH_VERSION)
+        return false;
+
+    if (header.importFlags != import.importFlags)
+        return false;
+
+    // by content, a fresh checkout or copy of the cache touches every timestamp
+    u64 sourceHash, sourceSize;
+    if (!HashModelFile(import.filepath, sourceHash, sourceSize) ||
+        header.sourceSize != sourceSize || header.sourceHash != sourceHash)
+        return false;
+
+    const u64 tablesSize = sizeof(header) + (u64)header.submeshCount * sizeof(CookedSubmesh) +
+                           (u64)header.materialCount * sizeof(CookedMaterial) + (u64)header.nodeCount * sizeof(CookedNode) +
+                           header.stringTableSize;
+    return tablesSize <= header.vertexBlobOffset &&
+           header.vertexBlobOffset + header.vertexBlobSize <= header.indexBlobOffset &&
+           header.indexBlobOffset + header.indexBlobSize == file.size;
+}
+
+// The ranges of the submesh have to be inside the blobs and its material in
+// the table, whatever the file says
+static bool IsCookedSubmeshValid(const CookedMeshHeader& header, const CookedSubmesh& cooked)
+{
+    if (cooked.indexType != GL_UNSIGNED_SHORT && cooked.indexType != GL_UNSIGNED_INT)
+        return false;
+
+    const u64 indexSize = (cooked.indexType == GL_UNSIGNED_SHORT) ? sizeof(u16) : sizeof(u32);
+    return cooked.materialIdx < header.materialCount &&
+           cooked.vertexOffset < header.vertexBlobSize &&
+           cooked.indexOffset + cooked.indexCount * indexSize <= header.indexBlobSize;
+}
+
+bool MapCookedMesh(ModelImport& import)
+{
+    char path[256];
+    GetCookedMeshPath(import.filepath, import.importFlags, path, sizeof(path));
+
+    MappedFile file;
+    if (!MapFile(path, file))
+        return false;
+
+    CookedMeshHeader header;
+    if (file.size < sizeof(header))
+    {
+        UnmapFile(file);
+        return false;
+    }
+    memcpy(&header, file.data, sizeof(header));
+
+    if (!IsCookedMeshValid(import, file, header))
+    {
+        UnmapFile(file);
+        return false;
+    }
+
+    const CookedSubmesh* submeshes = (const CookedSubmesh*)(file.data + sizeof(header));
+    const CookedMaterial* materials = (const CookedMaterial*)(submeshes + header.submeshCount);
+    const CookedNode* nodes = (const CookedNode*)(materials + header.materialCount);
+    const char* stringTable = (const char*)(nodes + header.nodeCount);
+
+    import.mesh.submeshes.resize(header.submeshCount);
+    import.submeshMaterialIdx.resize(header.submeshCount);
+    for (u32 i = 0; i < header.submeshCount; ++i)
+    {
+        const CookedSubmesh& cooked = submeshes[i];
+        Submesh& submesh = import.mesh.submeshes[i];
+        submesh.vertexOffset = cooked.vertexOffset;
+        submesh.indexOffset = cooked.indexOffset;
+        submesh.indexCount = cooked.indexCount;
+        submesh.indexType = cooked.indexType;
+        submesh.vertexBufferLayout.stride = cooked.stride;
+        submesh.unoptimizedStats = cooked.unoptimizedStats;
+        submesh.optimizedStats = cooked.optimizedStats;
+        submesh.positionScale = glm::make_vec3(cooked.positionScale);
+        submesh.positionOffset = glm::make_vec3(cooked.positionOffset);
+        submesh.quantizationError = cooked.quantizationError;
+        for (u32 a = 0; a < glm::min(cooked.attributeCount, (u32)COOKED_MESH_MAX_ATTRIBUTES); ++a)
+        {
+            const CookedAttribute& attribute = cooked.attributes[a];
+            submesh.vertexBufferLayout.attributes.push_back(
+                VertexBufferAttribute{ attribute.location, attribute.componentCount, attribute.offset, attribute.type, attribute.normalized != 0 });
+        }
+        if (HashVertexBufferLayout(submesh.vertexBufferLayout) != cooked.layoutHash || !IsCookedSubmeshValid(header, cooked))
+        {
+            ELOG("Cooked mesh of %s has a broken submesh table, importing it again", import.filepath.c_str());
+            import.mesh.submeshes.clear();
+            import.submeshMaterialIdx.clear();
+            UnmapFile(file);
+            return false;
+        }
+        import.submeshMaterialIdx[i] = cooked.materialIdx;
+    }
+
+    import.materials.resize(header.materialCount);
+    for (u32 i = 0; i < header.materialCount; ++i)
+    {
+        const CookedMaterial& cooked = materials[i];
+        ImportedMaterial& importedMaterial = import.materials[i];
+        Material& material = importedMaterial.material;
+
+        material.name = GetTableString(stringTable, header.stringTableSize, cooked.name);
+        material.albedo = vec3(cooked.albedo[0], cooked.albedo[1], cooked.albedo[2]);
+        material.emissive = vec3(cooked.emissive[0], cooked.emissive[1], cooked.emissive[2]);
+        material.smoothness = cooked.smoothness;
+        material.albedoTextureIdx = UINT32_MAX;
+        material.emissiveTextureIdx = UINT32_MAX;
+        material.specularTextureIdx = UINT32_MAX;
+        material.normalsTextureIdx = UINT32_MAX;
+        material.bumpTextureIdx = UINT32_MAX;
+
+        importedMaterial.albedoMap = GetTableString(stringTable, header.stringTableSize, cooked.albedoMap);
+        importedMaterial.emissiveMap = GetTableString(stringTable, header.stringTableSize, cooked.emissiveMap);
+        importedMaterial.specularMap = GetTableString(stringTable, header.stringTableSize, cooked.specularMap);
+        importedMaterial.normalsMap = GetTableString(stringTable, header.stringTableSize, cooked.normalsMap);
+        importedMaterial.bumpMap = GetTableString(stringTable, header.stringTableSize, cooked.bumpMap);
+    }
+
+    import.nodes.resize(header.nodeCount);
+    for (u32 i = 0; i < header.nodeCount; ++i)
+    {
+        const CookedNode& cooked = nodes[i];
+        ModelNode& node = import.nodes[i];
+        node.name = GetTableString(stringTable, header.stringTableSize, cooked.name);
+        node.parent = (cooked.parent < i) ? cooked.parent : UINT32_MAX;
+        memcpy(&node.localMatrix[0][0], cooked.localMatrix, sizeof(cooked.localMatrix));
+        memcpy(&node.modelMatrix[0][0], cooked.modelMatrix, sizeof(cooked.modelMatrix));
+        node.firstSubmesh = cooked.firstSubmesh;
+        node.submeshCount = cooked.submeshCount;
+    }
+
+    import.mappedFile = file;
+    import.vertexData = file.data + header.vertexBlobOffset;
+    import.vertexDataSize = header.vertexBlobSize;
+    import.indexData = file.data + header.indexBlobOffset;
+    import.indexDataSize = header.indexBlobSize;
+    import.boundsMin = vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+    import.boundsMax = vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+    import.mesh.boundingRadius = header.boundingRadius;
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "ModelImport.h"
+
+// Models are cooked into a binary file after their first import: submesh
+// table (with the draw stats measured on import), vertex layouts, material
+// references, nodes, bounds and the vertex/index blobs exactly as they go
+// into the GL buffers. Later runs map the file and upload the blobs without
+// going through Assimp.
+//
+// A cooked mesh is rebuilt when the content of the model file or the import
+// flags change. Edits to the .mtl alone aren't detected here, the cooker (see
+// Cooker.cpp) hashes them along with the model.
+
+// Bump it whenever the cooked layout changes
+#define COOKED_MESH_VERSION 7
+#define COOKED_MESH_DIRECTORY "MeshCache"
+
+#define COOKED_MESH_MAX_ATTRIBUTES 8
+
+// What the header keeps of the model file: a hash of its bytes and size
+u64 HashCookedMeshSource(const void* data, u64 size);
+
+void GetCookedMeshPath(const std::string& filepath, u32 importFlags, char* path, u32 pathSize);
+
+// Packs the submeshes of a fresh import into the vertex/index blobs (setting
+// their buffer offsets) and computes the bounds. The vertices are quantized
+// (see MakeQuantizedVertexLayout()) and submeshes with up to 65536 vertices
+// get 16 bit indices; the float copies are released and the size and error
+// of the packed mesh are logged. Safe to call from workers.
+void PackModelImport(ModelImport& import);
+
+// Writes a packed import to the cache. Safe to call from workers.
+bool WriteCookedMesh(const ModelImport& import);
+
+// Maps the cooked mesh of the import if it is up to date and fills the
+// submesh table, materials and bounds. The blobs point into the mapping,
+// which lives as long as the import. Safe to call from workers.
+bool MapCookedMesh(ModelImport& import);
@@ -0,0 +1,385 @@
+//
+// Headless asset cooker: imports every model under Models/ into the mesh cache
+// and block compresses the textures of their materials into the texture cache,
+// so the engine finds everything cooked at startup. Run it from WorkingDir.
+//
+// Each model depends on its file, the .mtl files it references and the import
+// flags; the hash of all of them is kept in a manifest and only the models
+// whose hash changed (or whose cooked mesh is gone) are imported again.
+// Textures are keyed by content in the texture cache already, so only the new
+// or edited ones get compressed. Everything is spread over the job system and
+// no GL context is ever created.
+//
+// Nothing depends on timestamps: the cooked meshes carry the content hash of
+// their model (see CookedMesh.h), so caches cooked on a build machine stay
+// valid after a checkout on another one.
+//
+// With -pak, everything the engine reads from WorkingDir is then packed into
+// Assets.pak (see AssetPackage.h).
+//
+//   Cooker.exe [-f] [-pak]   (-f cooks everything regardless of the manifest)
+//
+
+#include "ModelImport.h"
+#include "CookedMesh.h"
+#include "GltfLoader.h"
+#include "TextureCompression.h"
+#include "AssetPackage.h"
+#include "VirtualTexturing.h"
+#include "JobSystem.h"
+#include "Hash.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#pragma warning(disable : 4996) //disable printf warning
+
+#define COOKER_MODELS_DIRECTORY "Models"
+#define COOKER_MANIFEST COOKED_MESH_DIRECTORY "/cooker.manifest"
+
+// Bump it to re-cook every model when the cooker itself changes
+#define COOKER_VERSION 1
+
+struct CookerModel
+{
+    std::string              filepath;      // canonical
+    std::vector<std::string> dependencies;  // .mtl files
+    u64                      hash = 0;      // of the inputs and import settings
+    bool                     cooked = false;
+    bool                     failed = false;
+    std::string              error;
+    std::vector<ImportedMaterial> materials;
+};
+
+struct CookerTexture
+{
+    std::string filepath;  // canonical
+    bool        isNormalMap;
+    bool        compressed;
+};
+
+static std::string GetExtension(const std::string& filepath)
+{
+    const size_t dot = filepath.find_last_of('.');
+    const size_t slash = filepath.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return "";
+
+    std::string extension = filepath.substr(dot);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension;
+}
+
+// The material libraries an .obj pulls in ("mtllib a.mtl b.mtl" lines),
+// relative to its directory
+static void FindObjDependencies(const std::string& filepath, const std::vector<u8>& bytes, std::vector<std::string>& dependencies)
+{
+    const size_t directoryEnd = filepath.find_last_of("/\\");
+    const std::string directory = directoryEnd == std::string::npos ? "." : filepath.substr(0, directoryEnd);
+
+    const char* c = (const char*)bytes.data();
+    const char* end = c + bytes.size();
+    while (c < end)
+    {
+        const char* lineEnd = (const char*)memchr(c, '\n', end - c);
+        if (!lineEnd)
+            lineEnd = end;
+
+        while (c < lineEnd && (*c == ' ' || *c == '\t'))
+            ++c;
+
+        if (lineEnd - c > 7 && strncmp(c, "mtllib", 6) == 0 && (c[6] == ' ' || c[6] == '\t'))
+        {
+            c += 7;
+            while (c < lineEnd)
+            {
+                while (c < lineEnd && (*c == ' ' || *c == '\t' || *c == '\r'))
+                    ++c;
+                const char* nameBegin = c;
+                while (c < lineEnd && *c != ' ' && *c != '\t' && *c != '\r')
+                    ++c;
+                if (c > nameBegin)
+                    dependencies.push_back(CanonicalizePath((directory + "/" + std::string(nameBegin, c)).c_str()));
+            }
+        }
+
+        c = lineEnd + 1;
+    }
+}
+
+// Hash of everything the cooked mesh depends on. A missing dependency hashes
+// differently from any file, so it gets cooked again once the file shows up.
+static u64 HashModelInputs(CookerModel& model, u32 importFlags)
+{
+    std::vector<u8> bytes;
+    if (!ReadBinaryFile(model.filepath.c_str(), bytes))
+        return 0;
+
+    if (GetExtension(model.filepath) == ".obj")
+        FindObjDependencies(model.filepath, bytes, model.dependencies);
+
+    // the same hash the cooked mesh keeps of it
+    u64 hash = HashCookedMeshSource(bytes.data(), bytes.size());
+    hash = HashCombine(hash, importFlags);
+    hash = HashCombine(hash, COOKED_MESH_VERSION);
+    hash = HashCombine(hash, COOKER_VERSION);
+
+    for (const std::string& dependency : model.dependencies)
+    {
+        hash = HashCombine(hash, HashBytes(dependency.data(), dependency.size()));
+        if (ReadBinaryFile(dependency.c_str(), bytes))
+            hash = HashCombine(hash, HashBytes(bytes.data(), bytes.size()));
+        else
+            hash = HashCombine(hash, UINT64_MAX);
+    }
+
+    return hash;
+}
+
+static void ReadManifest(std::unordered_map<std::string, u64>& manifest)
+{
+    FILE* file = fopen(COOKER_MANIFEST, "r");
+    if (!file)
+        return;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file))
+    {
+        unsigned long long hash = 0;
+        int pathBegin = 0;
+        if (sscanf(line, "%llx %n", &hash, &pathBegin) < 1 || pathBegin == 0)
+            continue;
+
+        std::string path = line + pathBegin;
+        while (!path.empty() && (path.back() == '\n' || path.back() == '\r'))
+            path.pop_back();
+        manifest[path] = (u64)hash;
+    }
+
+    fclose(file);
+}
+
+static void WriteManifest(const std::vector<CookerModel>& models)
+{
+    MakeDirectory(COOKED_MESH_DIRECTORY);
+
+    FILE* file = fopen(COOKER_MANIFEST, "w");
+    if (!file)
+    {
+        ELOG("Could not write %s", COOKER_MANIFEST);
+        return;
+    }
+
+    // failed models are left out so the next run tries them again
+    for (const CookerModel& model : models)
+        if (!model.failed)
+            fprintf(file, "%016llx %s\n", (unsigned long long)model.hash, model.filepath.c_str());
+
+    fclose(file);
+}
+
+static void CookModel(CookerModel& model, const std::unordered_map<std::string, u64>& manifest, bool force)
+{
+    const u32 importFlags = MODEL_IMPORT_FLAGS;
+
+    model.hash = HashModelInputs(model, importFlags);
+    if (model.hash == 0)
+    {
+        model.failed = true;
+        model.error = "could not read the file";
+        return;
+    }
+
+    // up to date: same inputs as last time and the cooked mesh is still valid
+    auto entry = manifest.find(model.filepath);
+    if (!force && entry != manifest.end() && entry->second == model.hash)
+    {
+        ModelImport cooked;
+        cooked.filepath = model.filepath;
+        cooked.importFlags = importFlags;
+        cooked.cookMeshes = true;
+        if (MapCookedMesh(cooked))
+        {
+            model.materials = cooked.materials;
+            return;
+        }
+    }
+
+    ModelImport import;
+    import.filepath = model.filepath;
+    import.importFlags = importFlags;
+    import.cookMeshes = true;
+    import.forceImport = true;
+
+    if (!ImportModel(import))
+    {
+        model.failed = true;
+        model.error = import.error;
+        return;
+    }
+
+    // a .glb is loaded in place, only its textures get cooked
+    model.cooked = !IsGlbFile(model.filepath);
+    model.materials = import.materials;
+}
+
+// Binaries, settings, the manifest and the virtual texture page files (built
+// by the engine itself) stay out of the package
+static bool IsPackagedFile(const std::string& filepath)
+{
+    static const char* excludedExtensions[] = { ".exe", ".dll", ".pdb", ".ini", ".rdbg", ".pak", ".manifest" };
+
+    const std::string extension = GetExtension(filepath);
+    for (const char* excludedExtension : excludedExtensions)
+        if (extension == excludedExtension)
+            return false;
+
+    // (canonical paths are lowercase on Windows)
+    std::string path = filepath;
+    std::string pageFileDirectory = VT_CACHE_DIRECTORY "/";
+    std::transform(path.begin(), path.end(), path.begin(), ::tolower);
+    std::transform(pageFileDirectory.begin(), pageFileDirectory.end(), pageFileDirectory.begin(), ::tolower);
+    return path.compare(0, pageFileDirectory.size(), pageFileDirectory) != 0;
+}
+
+static void AddTexture(std::vector<CookerTexture>& textures, const std::string& filepath, bool isNormalMap)
+{
+    if (filepath.empty())
+        return;
+
+    const std::string canonicalPath = CanonicalizePath(filepath.c_str());
+    for (const CookerTexture& texture : textures)
+        if (texture.filepath == canonicalPath && texture.isNormalMap == isNormalMap)
+            return;
+
+    textures.push_back(CookerTexture{ canonicalPath, isNormalMap, false });
+}
+
+int main(int argc, char** argv)
+{
+    bool force = false;
+    bool pack = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-f") == 0)
+            force = true;
+        else if (strcmp(argv[i], "-pak") == 0)
+            pack = true;
+    }
+
+    // same texture settings the engine starts with
+    static App defaults;
+
+    InitJobSystem();
+
+    std::vector<std::string> files;
+    ListFiles(COOKER_MODELS_DIRECTORY, files, true);
+    std::sort(files.begin(), files.end());
+
+    std::vector<CookerModel> models;
+    for (const std::string& file : files)
+    {
+        const std::string extension = GetExtension(file);
+        if (extension.empty() || extension == ".mtl" || !aiIsExtensionSupported(extension.c_str()))
+            continue;
+
+        models.push_back(CookerModel{});
+        models.back().filepath = CanonicalizePath(file.c_str());
+    }
+
+    std::unordered_map<std::string, u64> manifest;
+    ReadManifest(manifest);
+
+    JobCounter modelJobs;
+    for (CookerModel& model : models)
+    {
+        CookerModel* cookerModel = &model;
+        const std::unordered_map<std::string, u64>* cookerManifest = &manifest;
+        RunJob([cookerModel, cookerManifest, force]() { CookModel(*cookerModel, *cookerManifest, force); }, &modelJobs);
+    }
+    WaitForJobCounter(modelJobs);
+
+    u32 cookedModels = 0;
+    u32 failedModels = 0;
+    for (const CookerModel& model : models)
+    {
+        if (model.failed)
+        {
+            ELOG("Could not cook %s: %s", model.filepath.c_str(), model.error.c_str());
+            failedModels++;
+        }
+        else if (model.cooked)
+        {
+            ILOG("Cooked %s", model.filepath.c_str());
+            cookedModels++;
+        }
+    }
+
+    WriteManifest(models);
+
+    // the textures of every material, with the flags the engine loads them
+    // with (see LoadMaterialTextures). Virtual textures build their page files
+    // from the source image, so there is nothing to cook for those.
+    std::vector<CookerTexture> textures;
+    if (defaults.compressTextures)
+    {
+        for (const CookerModel& model : models)
+        {
+            for (const ImportedMaterial& material : model.materials)
+            {
+                if (!defaults.virtualTexturing)
+                    AddTexture(textures, material.albedoMap, false);
+                AddTexture(textures, material.emissiveMap, false);
+                AddTexture(textures, material.specularMap, false);
+                AddTexture(textures, material.normalsMap, true);
+                AddTexture(textures, material.bumpMap, false);
+            }
+        }
+    }
+
+    // cache hits only cost reading and hashing the file
+    JobCounter textureJobs;
+    const i32 atlasMaxTextureSize = defaults.atlasMaxTextureSize;
+    for (CookerTexture& texture : textures)
+    {
+        CookerTexture* cookerTexture = &texture;
+        RunJob([cookerTexture, atlasMaxTextureSize]()
+        {
+            std::vector<u8> fileBytes;
+            if (!ReadBinaryFile(cookerTexture->filepath.c_str(), fileBytes))
+                return;
+
+            CompressedImage compressed;
+            cookerTexture->compressed = PrepareCompressedImage(fileBytes, cookerTexture->isNormalMap, atlasMaxTextureSize, compressed);
+        }, &textureJobs);
+    }
+    WaitForJobCounter(textureJobs);
+
+    u32 compressedTextures = 0;
+    for (const CookerTexture& texture : textures)
+        compressedTextures += texture.compressed ? 1 : 0;
+
+    ILOG("%u models (%u cooked, %u failed), %u textures (%u in the texture cache, the rest go to atlases)",
+         (u32)models.size(), cookedModels, failedModels, (u32)textures.size(), compressedTextures);
+
+    bool packed = true;
+    if (pack)
+    {
+        std::vector<std::string> packageFiles;
+        ListFiles(".", packageFiles, true);
+
+        std::vector<std::string> assets;
+        for (const std::string& file : packageFiles)
+        {
+            const std::string asset = CanonicalizePath(file.c_str());
+            if (IsPackagedFile(asset))
+                assets.push_back(asset);
+        }
+        std::sort(assets.begin(), assets.end());
+
+        packed = WriteAssetPackage(ASSET_PACKAGE_FILE, assets);
+    }
+
+    ShutdownJobSystem();
+
+    return (failedModels > 0 || !packed) ? 1 : 0;
+}
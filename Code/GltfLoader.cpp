@@ -0,0 +1,955 @@
+#include "GltfLoader.h"
+#include "Json.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <string.h>
+#include <float.h>
+#pragma warning(disable : 4996) //disable printf warning
+
+#define GLB_MAGIC      0x46546C67  // "glTF"
+#define GLB_CHUNK_JSON 0x4E4F534A  // "JSON"
+#define GLB_CHUNK_BIN  0x004E4942  // "BIN\0"
+
+// accessor component types
+#define GLTF_BYTE           5120
+#define GLTF_UNSIGNED_BYTE  5121
+#define GLTF_SHORT          5122
+#define GLTF_UNSIGNED_SHORT 5123
+#define GLTF_UNSIGNED_INT   5125
+#define GLTF_FLOAT          5126
+
+#define GLTF_TRIANGLES 4
+
+struct GltfBufferView
+{
+    u64 byteOffset;  // in the BIN chunk
+    u64 byteLength;
+    u32 byteStride;  // 0: tightly packed
+};
+
+struct GltfAccessor
+{
+    u32       bufferView;
+    u64       byteOffset;  // in the view
+    u32       componentType;
+    u32       componentCount;
+    u32       count;
+    bool      normalized;
+    u32       stride;  // bytes from one element to the next
+    const u8* data;    // first element
+};
+
+struct GltfPrimitive
+{
+    GltfAccessor position;
+    GltfAccessor normal;
+    GltfAccessor texCoord;
+    GltfAccessor tangent;
+    GltfAccessor indices;
+    bool         hasNormal;
+    bool         hasTexCoord;
+    bool         hasTangent;
+    bool         hasIndices;
+    bool         validIndices;
+    u32          materialIdx;
+    vec3         boundsMin;
+    vec3         boundsMax;
+};
+
+struct GltfFile
+{
+    const u8*                   bin;
+    u64                         binSize;
+    JsonValue                   root;
+    std::vector<GltfBufferView> bufferViews;
+    std::string                 directory;
+};
+
+bool IsGlbFile(const std::string& filepath)
+{
+    const size_t dot = filepath.find_last_of('.');
+    if (dot == std::string::npos || filepath.size() - dot != 4)
+        return false;
+
+    return tolower(filepath[dot + 1]) == 'g' && tolower(filepath[dot + 2]) == 'l' && tolower(filepath[dot + 3]) == 'b';
+}
+
+static inline u32 Read32(const u8* p)
+{
+    u32 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static u32 GetComponentSize(u32 componentType)
+{
+    switch (componentType)
+    {
+        case GLTF_BYTE:
+        case GLTF_UNSIGNED_BYTE:  return 1;
+        case GLTF_SHORT:
+        case GLTF_UNSIGNED_SHORT: return 2;
+        case GLTF_UNSIGNED_INT:
+        case GLTF_FLOAT:          return 4;
+        default:                  return 0;
+    }
+}
+
+static u32 GetComponentCount(const std::string& type)
+{
+    if (type == "SCALAR") return 1;
+    if (type == "VEC2")   return 2;
+    if (type == "VEC3")   return 3;
+    if (type == "VEC4")   return 4;
+    return 0;
+}
+
+static u64 GetJsonOffset(const JsonValue* object, const char* key)
+{
+    return (u64)glm::max(GetJsonNumber(object, key, 0.0), 0.0);
+}
+
+// UINT32_MAX when the element isn't a valid index
+static u32 GetJsonElementIndex(const JsonValue* array, u32 i)
+{
+    const JsonValue* element = GetJsonElement(array, i);
+    if (!element || element->type != JsonType_Number || element->number < 0.0 || element->number >= (f64)UINT32_MAX)
+        return UINT32_MAX;
+    return (u32)element->number;
+}
+
+static vec3 GetJsonVec3(const JsonValue* array, vec3 defaultValue)
+{
+    vec3 value = defaultValue;
+    for (u32 i = 0; i < 3; ++i)
+    {
+        const JsonValue* element = GetJsonElement(array, i);
+        if (element && element->type == JsonType_Number)
+            value[i] = (f32)element->number;
+    }
+    return value;
+}
+
+static bool ReadAccessor(const GltfFile& file, u32 accessorIdx, GltfAccessor& accessor, std::string& error)
+{
+    const JsonValue* json = GetJsonElement(FindJsonMember(&file.root, "accessors"), accessorIdx);
+    if (!json)
+    {
+        error = "Invalid accessor index";
+        return false;
+    }
+    if (FindJsonMember(json, "sparse"))
+    {
+        error = "Sparse accessors are not supported";
+        return false;
+    }
+
+    accessor.bufferView = GetJsonIndex(json, "bufferView");
+    accessor.byteOffset = GetJsonOffset(json, "byteOffset");
+    accessor.componentType = GetJsonIndex(json, "componentType", 0);
+    accessor.componentCount = GetComponentCount(GetJsonString(json, "type"));
+    accessor.count = GetJsonIndex(json, "count", 0);
+    accessor.normalized = GetJsonBool(json, "normalized", false);
+
+    const u32 componentSize = GetComponentSize(accessor.componentType);
+    if (accessor.bufferView >= file.bufferViews.size() || componentSize == 0 || accessor.componentCount == 0 || accessor.count == 0)
+    {
+        error = "Unsupported or empty accessor";
+        return false;
+    }
+
+    const GltfBufferView& view = file.bufferViews[accessor.bufferView];
+    const u32 elementSize = componentSize * accessor.componentCount;
+    accessor.stride = view.byteStride ? view.byteStride : elementSize;
+
+    // the last element has to be inside the view, and every component aligned
+    if (accessor.byteOffset > view.byteLength ||
+        (u64)(accessor.count - 1) * accessor.stride + elementSize > view.byteLength - accessor.byteOffset ||
+        (view.byteOffset + accessor.byteOffset) % componentSize != 0 || accessor.stride % componentSize != 0)
+    {
+        error = "Accessor out of its buffer view";
+        return false;
+    }
+
+    accessor.data = file.bin + view.byteOffset + accessor.byteOffset;
+    return true;
+}
+
+static f32 ReadComponent(const u8* p, u32 componentType, bool normalized)
+{
+    switch (componentType)
+    {
+        case GLTF_BYTE:
+        {
+            const i8 value = (i8)*p;
+            return normalized ? glm::max(value / 127.0f, -1.0f) : (f32)value;
+        }
+        case GLTF_UNSIGNED_BYTE:
+            return normalized ? *p / 255.0f : (f32)*p;
+        case GLTF_SHORT:
+        {
+            i16 value;
+            memcpy(&value, p, sizeof(value));
+            return normalized ? glm::max(value / 32767.0f, -1.0f) : (f32)value;
+        }
+        case GLTF_UNSIGNED_SHORT:
+        {
+            u16 value;
+            memcpy(&value, p, sizeof(value));
+            return normalized ? value / 65535.0f : (f32)value;
+        }
+        case GLTF_UNSIGNED_INT:
+            return (f32)Read32(p);
+        default:
+        {
+            f32 value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+    }
+}
+
+static vec4 ReadElement(const GltfAccessor& accessor, u32 idx)
+{
+    const u8* element = accessor.data + (u64)idx * accessor.stride;
+    const u32 componentSize = GetComponentSize(accessor.componentType);
+
+    vec4 value(0.0f);
+    for (u32 c = 0; c < accessor.componentCount && c < 4; ++c)
+        value[c] = ReadComponent(element + c * componentSize, accessor.componentType, accessor.normalized);
+    return value;
+}
+
+static u32 ReadIndex(const GltfAccessor& accessor, u32 idx)
+{
+    const u8* element = accessor.data + (u64)idx * accessor.stride;
+    switch (accessor.componentType)
+    {
+        case GLTF_UNSIGNED_BYTE:
+            return *element;
+        case GLTF_UNSIGNED_SHORT:
+        {
+            u16 value;
+            memcpy(&value, element, sizeof(value));
+            return value;
+        }
+        default:
+            return Read32(element);
+    }
+}
+
+static bool ReadAttribute(const GltfFile& file, const JsonValue* attributes, const char* name, u32 componentCount,
+                          u32 vertexCount, GltfAccessor& accessor, bool& present, std::string& error)
+{
+    const u32 accessorIdx = GetJsonIndex(attributes, name);
+    present = accessorIdx != UINT32_MAX;
+    if (!present)
+        return true;
+
+    if (!ReadAccessor(file, accessorIdx, accessor, error))
+        return false;
+
+    if (accessor.componentCount != componentCount || accessor.count != vertexCount || accessor.componentType == GLTF_UNSIGNED_INT)
+    {
+        error = std::string("Unsupported ") + name + " accessor";
+        return false;
+    }
+    return true;
+}
+
+static bool ReadPrimitive(const GltfFile& file, const JsonValue* json, GltfPrimitive& primitive, std::string& error)
+{
+    const JsonValue* attributes = FindJsonMember(json, "attributes");
+
+    const u32 positionIdx = GetJsonIndex(attributes, "POSITION");
+    if (positionIdx == UINT32_MAX)
+    {
+        error = "Primitive without positions";
+        return false;
+    }
+    if (!ReadAccessor(file, positionIdx, primitive.position, error))
+        return false;
+    if (primitive.position.componentCount != 3 || primitive.position.componentType == GLTF_UNSIGNED_INT)
+    {
+        error = "Unsupported POSITION accessor";
+        return false;
+    }
+
+    const u32 vertexCount = primitive.position.count;
+    if (!ReadAttribute(file, attributes, "NORMAL", 3, vertexCount, primitive.normal, primitive.hasNormal, error) ||
+        !ReadAttribute(file, attributes, "TEXCOORD_0", 2, vertexCount, primitive.texCoord, primitive.hasTexCoord, error) ||
+        !ReadAttribute(file, attributes, "TANGENT", 4, vertexCount, primitive.tangent, primitive.hasTangent, error))
+        return false;
+
+    const u32 indicesIdx = GetJsonIndex(json, "indices");
+    primitive.hasIndices = indicesIdx != UINT32_MAX;
+    if (primitive.hasIndices)
+    {
+        if (!ReadAccessor(file, indicesIdx, primitive.indices, error))
+            return false;
+
+        const u32 type = primitive.indices.componentType;
+        if (primitive.indices.componentCount != 1 ||
+            (type != GLTF_UNSIGNED_BYTE && type != GLTF_UNSIGNED_SHORT && type != GLTF_UNSIGNED_INT))
+        {
+            error = "Unsupported indices accessor";
+            return false;
+        }
+    }
+
+    primitive.materialIdx = GetJsonIndex(json, "material");
+
+    // POSITION min/max are required by the spec (in the stored values, so
+    // only usable for float positions)
+    const JsonValue* accessor = GetJsonElement(FindJsonMember(&file.root, "accessors"), positionIdx);
+    const JsonValue* min = FindJsonMember(accessor, "min");
+    const JsonValue* max = FindJsonMember(accessor, "max");
+    if (primitive.position.componentType == GLTF_FLOAT && GetJsonElementCount(min) == 3 && GetJsonElementCount(max) == 3)
+    {
+        primitive.boundsMin = GetJsonVec3(min, vec3(0.0f));
+        primitive.boundsMax = GetJsonVec3(max, vec3(0.0f));
+    }
+    else
+    {
+        primitive.boundsMin = vec3(FLT_MAX);
+        primitive.boundsMax = vec3(-FLT_MAX);
+        for (u32 v = 0; v < vertexCount; ++v)
+        {
+            const vec3 position = vec3(ReadElement(primitive.position, v));
+            primitive.boundsMin = glm::min(primitive.boundsMin, position);
+            primitive.boundsMax = glm::max(primitive.boundsMax, position);
+        }
+    }
+
+    return true;
+}
+
+// Position, normal and uv floats interleaved in one view: a VertexBufferLayout
+// as it is, the shader flips v (uFlipTexCoordV). Tangents are laid out like
+// the layouts' (xyz and the handedness in w), but the handedness has to flip
+// along with v, so they always go through ConvertVertices().
+static bool IsInterleavedFloatLayout(const GltfPrimitive& primitive)
+{
+    if (!primitive.hasNormal || primitive.hasTangent)
+        return false;
+
+    const GltfAccessor* attributes[] = { &primitive.position, &primitive.normal, primitive.hasTexCoord ? &primitive.texCoord : NULL };
+    const u32 stride = primitive.position.stride;
+    if (stride > UINT8_MAX || stride % sizeof(float) != 0)
+        return false;
+
+    u64 base = UINT64_MAX;
+    for (const GltfAccessor* attribute : attributes)
+        if (attribute)
+            base = glm::min(base, attribute->byteOffset);
+
+    for (const GltfAccessor* attribute : attributes)
+    {
+        if (!attribute)
+            continue;
+
+        if (attribute->componentType != GLTF_FLOAT || attribute->normalized || attribute->bufferView != primitive.position.bufferView ||
+            attribute->byteOffset - base + attribute->componentCount * sizeof(float) > stride)
+            return false;
+    }
+    return true;
+}
+
+static void SetInterleavedLayout(const GltfPrimitive& primitive, u64 viewBase, Submesh& submesh)
+{
+    u64 base = glm::min(primitive.position.byteOffset, primitive.normal.byteOffset);
+    if (primitive.hasTexCoord)
+        base = glm::min(base, primitive.texCoord.byteOffset);
+
+    VertexBufferLayout& layout = submesh.vertexBufferLayout;
+    layout = {};
+    layout.attributes.push_back(VertexBufferAttribute{ 0, 3, (u16)(primitive.position.byteOffset - base) });
+    layout.attributes.push_back(VertexBufferAttribute{ 1, 3, (u16)(primitive.normal.byteOffset - base) });
+    if (primitive.hasTexCoord)
+        layout.attributes.push_back(VertexBufferAttribute{ 2, 2, (u16)(primitive.texCoord.byteOffset - base) });
+    layout.stride = (u16)primitive.position.stride;
+
+    submesh.vertexOffset = (u32)(viewBase + base);
+    submesh.flipTexCoordV = primitive.hasTexCoord;
+}
+
+// The layout of MakeModelVertexLayout(). Without normals every triangle gets
+// its own corners with the face normal (flat shading, as the spec asks).
+static void ConvertVertices(const GltfPrimitive& primitive, Submesh& submesh)
+{
+    const bool flatNormals = !primitive.hasNormal;
+    const bool hasTangentSpace = primitive.hasTangent && primitive.hasNormal;
+    MakeModelVertexLayout(primitive.hasTexCoord, hasTangentSpace, submesh.vertexBufferLayout);
+    const u32 strideFloats = submesh.vertexBufferLayout.stride / sizeof(float);
+
+    const u32 cornerCount = (primitive.hasIndices ? primitive.indices.count : primitive.position.count) / 3 * 3;
+    const u32 vertexCount = flatNormals ? cornerCount : primitive.position.count;
+    submesh.vertices.resize((size_t)vertexCount * strideFloats);
+
+    float* dst = submesh.vertices.data();
+    for (u32 v = 0; v < vertexCount; ++v, dst += strideFloats)
+    {
+        u32 src = v;
+        vec3 normal;
+        if (flatNormals)
+        {
+            const u32 first = v - v % 3;
+            u32 corners[3];
+            for (u32 k = 0; k < 3; ++k)
+                corners[k] = primitive.hasIndices ? ReadIndex(primitive.indices, first + k) : first + k;
+
+            const vec3 p0 = vec3(ReadElement(primitive.position, corners[0]));
+            const vec3 p1 = vec3(ReadElement(primitive.position, corners[1]));
+            const vec3 p2 = vec3(ReadElement(primitive.position, corners[2]));
+            const vec3 faceNormal = glm::cross(p1 - p0, p2 - p0);
+            const f32 length = glm::length(faceNormal);
+            normal = (length > 0.0f) ? faceNormal / length : vec3(0.0f, 1.0f, 0.0f);
+            src = corners[v % 3];
+        }
+        else
+        {
+            normal = vec3(ReadElement(primitive.normal, src));
+        }
+
+        const vec3 position = vec3(ReadElement(primitive.position, src));
+        dst[0] = position.x;
+        dst[1] = position.y;
+        dst[2] = position.z;
+        dst[3] = normal.x;
+        dst[4] = normal.y;
+        dst[5] = normal.z;
+
+        if (primitive.hasTexCoord)
+        {
+            // top left origin in glTF, images are loaded bottom up
+            const vec4 texCoord = ReadElement(primitive.texCoord, src);
+            dst[6] = texCoord.x;
+            dst[7] = 1.0f - texCoord.y;
+        }
+
+        if (hasTangentSpace)
+        {
+            // the bitangent follows +v, the handedness flips along with it
+            const vec4 tangent = ReadElement(primitive.tangent, src);
+            dst[8] = tangent.x;
+            dst[9] = tangent.y;
+            dst[10] = tangent.z;
+            dst[11] = (tangent.w < 0.0f) ? 1.0f : -1.0f;
+        }
+    }
+
+    if (flatNormals)
+    {
+        submesh.indices.resize(vertexCount);
+        for (u32 i = 0; i < vertexCount; ++i)
+            submesh.indices[i] = i;
+    }
+}
+
+static void ConvertIndices(const GltfPrimitive& primitive, Submesh& submesh)
+{
+    const u32 indexCount = (primitive.hasIndices ? primitive.indices.count : primitive.position.count) / 3 * 3;
+    submesh.indices.resize(indexCount);
+    for (u32 i = 0; i < indexCount; ++i)
+        submesh.indices[i] = primitive.hasIndices ? ReadIndex(primitive.indices, i) : i;
+}
+
+static bool ValidateIndices(const GltfPrimitive& primitive)
+{
+    if (!primitive.hasIndices)
+        return true;
+
+    for (u32 i = 0; i < primitive.indices.count; ++i)
+        if (ReadIndex(primitive.indices, i) >= primitive.position.count)
+            return false;
+    return true;
+}
+
+// The views go into the GL buffer as they are: straight from the mapping when
+// they are (nearly) contiguous in the file, otherwise copied back to back
+static void PackBufferViews(const GltfFile& file, std::vector<u32> views, std::vector<u8>& blob,
+                            const u8*& data, u64& dataSize, std::vector<u64>& viewBases)
+{
+    std::sort(views.begin(), views.end());
+    views.erase(std::unique(views.begin(), views.end()), views.end());
+
+    u64 begin = UINT64_MAX, end = 0, usedBytes = 0;
+    for (u32 view : views)
+    {
+        begin = glm::min(begin, file.bufferViews[view].byteOffset);
+        end = glm::max(end, file.bufferViews[view].byteOffset + file.bufferViews[view].byteLength);
+        usedBytes += file.bufferViews[view].byteLength;
+    }
+
+    viewBases.assign(file.bufferViews.size(), 0);
+    if (end - begin <= usedBytes + usedBytes / 4)
+    {
+        for (u32 view : views)
+            viewBases[view] = file.bufferViews[view].byteOffset - begin;
+        data = file.bin + begin;
+        dataSize = end - begin;
+        return;
+    }
+
+    for (u32 view : views)
+    {
+        blob.resize((blob.size() + 3) & ~(size_t)3);
+        viewBases[view] = blob.size();
+        const u8* viewData = file.bin + file.bufferViews[view].byteOffset;
+        blob.insert(blob.end(), viewData, viewData + file.bufferViews[view].byteLength);
+    }
+    data = blob.data();
+    dataSize = blob.size();
+}
+
+static std::string DecodeUri(const std::string& uri)
+{
+    std::string decoded;
+    for (size_t i = 0; i < uri.size(); ++i)
+    {
+        if (uri[i] == '%' && i + 2 < uri.size() && isxdigit((u8)uri[i + 1]) && isxdigit((u8)uri[i + 2]))
+        {
+            decoded += (char)strtol(uri.substr(i + 1, 2).c_str(), NULL, 16);
+            i += 2;
+        }
+        else
+        {
+            decoded += uri[i];
+        }
+    }
+    return decoded;
+}
+
+// The image of a textureInfo, relative to the model. KTX2 sources are only
+// referenced when the texture has no other image.
+static std::string GetImagePath(const GltfFile& file, const JsonValue* textureInfo, u32& skippedImages)
+{
+    if (!textureInfo)
+        return "";
+
+    const JsonValue* texture = GetJsonElement(FindJsonMember(&file.root, "textures"), GetJsonIndex(textureInfo, "index"));
+    u32 source = GetJsonIndex(texture, "source");
+    if (source == UINT32_MAX)
+        source = GetJsonIndex(FindJsonMember(FindJsonMember(texture, "extensions"), "KHR_texture_basisu"), "source");
+
+    const JsonValue* image = GetJsonElement(FindJsonMember(&file.root, "images"), source);
+    if (!image)
+        return "";
+
+    const std::string uri = GetJsonString(image, "uri");
+    // embedded in the BIN chunk or a data uri: the textures load from files
+    if (uri.empty() || uri.compare(0, 5, "data:") == 0)
+    {
+        skippedImages++;
+        return "";
+    }
+
+    return file.directory + "/" + DecodeUri(uri);
+}
+
+// glTF defaults for anything not in the material
+static ImportedMaterial MakeGltfMaterial(const std::string& name)
+{
+    ImportedMaterial importedMaterial;
+    Material& material = importedMaterial.material;
+    material.name = name;
+    material.albedo = vec3(1.0f);
+    material.emissive = vec3(0.0f);
+    material.smoothness = 0.0f;
+    material.albedoTextureIdx = UINT32_MAX;
+    material.emissiveTextureIdx = UINT32_MAX;
+    material.specularTextureIdx = UINT32_MAX;
+    material.normalsTextureIdx = UINT32_MAX;
+    material.bumpTextureIdx = UINT32_MAX;
+    return importedMaterial;
+}
+
+// Metallic/roughness maps to the engine's albedo, smoothness (1 - roughness)
+// and emissive, metalness has nowhere to go
+static void ReadMaterials(const GltfFile& file, std::vector<ImportedMaterial>& materials, u32& skippedImages)
+{
+    const JsonValue* materialsJson = FindJsonMember(&file.root, "materials");
+    for (u32 i = 0; i < GetJsonElementCount(materialsJson); ++i)
+    {
+        const JsonValue* json = GetJsonElement(materialsJson, i);
+        const JsonValue* pbr = FindJsonMember(json, "pbrMetallicRoughness");
+
+        materials.push_back(MakeGltfMaterial(GetJsonString(json, "name", ("Material " + std::to_string(i)).c_str())));
+        ImportedMaterial& material = materials.back();
+        material.material.albedo = GetJsonVec3(FindJsonMember(pbr, "baseColorFactor"), vec3(1.0f));
+        material.material.emissive = GetJsonVec3(FindJsonMember(json, "emissiveFactor"), vec3(0.0f));
+        material.material.smoothness = 1.0f - (f32)glm::clamp(GetJsonNumber(pbr, "roughnessFactor", 1.0), 0.0, 1.0);
+        material.albedoMap = GetImagePath(file, FindJsonMember(pbr, "baseColorTexture"), skippedImages);
+        material.emissiveMap = GetImagePath(file, FindJsonMember(json, "emissiveTexture"), skippedImages);
+        material.normalsMap = GetImagePath(file, FindJsonMember(json, "normalTexture"), skippedImages);
+    }
+}
+
+static mat4x4 ReadNodeMatrix(const JsonValue* node)
+{
+    const JsonValue* matrix = FindJsonMember(node, "matrix");
+    if (GetJsonElementCount(matrix) == 16)
+    {
+        // column major, like glm
+        mat4x4 result;
+        for (u32 i = 0; i < 16; ++i)
+            result[i / 4][i % 4] = (f32)GetJsonElement(matrix, i)->number;
+        return result;
+    }
+
+    const vec3 translation = GetJsonVec3(FindJsonMember(node, "translation"), vec3(0.0f));
+    const vec3 scale = GetJsonVec3(FindJsonMember(node, "scale"), vec3(1.0f));
+    const JsonValue* rotationJson = FindJsonMember(node, "rotation");
+    quat rotation(1.0f, 0.0f, 0.0f, 0.0f);
+    if (GetJsonElementCount(rotationJson) == 4)
+    {
+        rotation = quat((f32)GetJsonElement(rotationJson, 3)->number, (f32)GetJsonElement(rotationJson, 0)->number,
+                        (f32)GetJsonElement(rotationJson, 1)->number, (f32)GetJsonElement(rotationJson, 2)->number);
+    }
+
+    return glm::translate(IdentityMatrix, translation) * glm::mat4_cast(rotation) * glm::scale(IdentityMatrix, scale);
+}
+
+// Depth first from the roots of the default scene (or from every node without
+// a parent when there are no scenes), so parents come before their children
+static void ReadNodes(const GltfFile& file, const std::vector<u32>& meshFirstSubmesh, const std::vector<u32>& meshSubmeshCount,
+                      std::vector<ModelNode>& nodes)
+{
+    const JsonValue* nodesJson = FindJsonMember(&file.root, "nodes");
+    const u32 nodeCount = GetJsonElementCount(nodesJson);
+
+    std::vector<u32> roots;
+    const JsonValue* scene = GetJsonElement(FindJsonMember(&file.root, "scenes"), GetJsonIndex(&file.root, "scene", 0));
+    if (scene)
+    {
+        const JsonValue* sceneNodes = FindJsonMember(scene, "nodes");
+        for (u32 i = 0; i < GetJsonElementCount(sceneNodes); ++i)
+            roots.push_back(GetJsonElementIndex(sceneNodes, i));
+    }
+    else
+    {
+        std::vector<bool> hasParent(nodeCount, false);
+        for (u32 i = 0; i < nodeCount; ++i)
+        {
+            const JsonValue* children = FindJsonMember(GetJsonElement(nodesJson, i), "children");
+            for (u32 c = 0; c < GetJsonElementCount(children); ++c)
+            {
+                const u32 child = GetJsonElementIndex(children, c);
+                if (child < nodeCount)
+                    hasParent[child] = true;
+            }
+        }
+        for (u32 i = 0; i < nodeCount; ++i)
+            if (!hasParent[i])
+                roots.push_back(i);
+    }
+
+    // (glTF node, parent ModelNode)
+    std::vector<std::pair<u32, u32>> stack;
+    for (auto root = roots.rbegin(); root != roots.rend(); ++root)
+        stack.push_back(std::make_pair(*root, UINT32_MAX));
+
+    std::vector<bool> visited(nodeCount, false);
+    while (!stack.empty())
+    {
+        const u32 nodeIdx = stack.back().first;
+        const u32 parent = stack.back().second;
+        stack.pop_back();
+
+        // out of range, or a second parent / a cycle in a broken file
+        if (nodeIdx >= nodeCount || visited[nodeIdx])
+            continue;
+        visited[nodeIdx] = true;
+
+        const JsonValue* json = GetJsonElement(nodesJson, nodeIdx);
+
+        ModelNode node;
+        node.name = GetJsonString(json, "name", ("Node " + std::to_string(nodeIdx)).c_str());
+        node.parent = parent;
+        node.localMatrix = ReadNodeMatrix(json);
+        node.modelMatrix = (parent == UINT32_MAX) ? node.localMatrix : nodes[parent].modelMatrix * node.localMatrix;
+
+        const u32 mesh = GetJsonIndex(json, "mesh");
+        node.firstSubmesh = (mesh < meshFirstSubmesh.size()) ? meshFirstSubmesh[mesh] : 0;
+        node.submeshCount = (mesh < meshSubmeshCount.size()) ? meshSubmeshCount[mesh] : 0;
+
+        nodes.push_back(node);
+        const u32 modelNodeIdx = (u32)nodes.size() - 1;
+
+        const JsonValue* children = FindJsonMember(json, "children");
+        for (u32 c = GetJsonElementCount(children); c-- > 0;)
+            stack.push_back(std::make_pair(GetJsonElementIndex(children, c), modelNodeIdx));
+    }
+}
+
+static bool ReadGlbChunks(const MappedFile& mapped, GltfFile& file, std::string& error)
+{
+    if (mapped.size < 20 || Read32(mapped.data) != GLB_MAGIC)
+    {
+        error = "Not a binary glTF file";
+        return false;
+    }
+    if (Read32(mapped.data + 4) != GLB_VERSION)
+    {
+        error = "Unsupported glTF version " + std::to_string(Read32(mapped.data + 4));
+        return false;
+    }
+
+    const u64 length = glm::min<u64>(Read32(mapped.data + 8), mapped.size);
+    const u64 jsonLength = Read32(mapped.data + 12);
+    if (Read32(mapped.data + 16) != GLB_CHUNK_JSON || 20 + jsonLength > length)
+    {
+        error = "Invalid JSON chunk";
+        return false;
+    }
+
+    // the BIN chunk is optional
+    file.bin = NULL;
+    file.binSize = 0;
+    const u64 binChunk = 20 + ((jsonLength + 3) & ~3ull);
+    if (binChunk + 8 <= length && Read32(mapped.data + binChunk + 4) == GLB_CHUNK_BIN)
+    {
+        file.bin = mapped.data + binChunk + 8;
+        file.binSize = glm::min<u64>(Read32(mapped.data + binChunk), length - binChunk - 8);
+    }
+
+    if (!ParseJson((const char*)mapped.data + 20, jsonLength, file.root, error))
+        return false;
+
+    // nothing can be read right if the file needs an extension we don't know
+    const JsonValue* required = FindJsonMember(&file.root, "extensionsRequired");
+    for (u32 i = 0; i < GetJsonElementCount(required); ++i)
+    {
+        const std::string& extension = GetJsonElement(required, i)->string;
+        if (extension != "KHR_texture_basisu" && extension != "KHR_mesh_quantization")
+        {
+            error = "Requires the unsupported extension " + extension;
+            return false;
+        }
+    }
+
+    const JsonValue* buffers = FindJsonMember(&file.root, "buffers");
+    const JsonValue* bufferViews = FindJsonMember(&file.root, "bufferViews");
+    for (u32 i = 0; i < GetJsonElementCount(bufferViews); ++i)
+    {
+        const JsonValue* json = GetJsonElement(bufferViews, i);
+        const u32 buffer = GetJsonIndex(json, "buffer", 0);
+        if (buffer != 0 || FindJsonMember(GetJsonElement(buffers, 0), "uri"))
+        {
+            error = "External buffers are not supported";
+            return false;
+        }
+
+        GltfBufferView view;
+        view.byteOffset = GetJsonOffset(json, "byteOffset");
+        view.byteLength = GetJsonOffset(json, "byteLength");
+        view.byteStride = GetJsonIndex(json, "byteStride", 0);
+        if (view.byteOffset > file.binSize || view.byteLength > file.binSize - view.byteOffset)
+        {
+            error = "Buffer view out of the BIN chunk";
+            return false;
+        }
+        file.bufferViews.push_back(view);
+    }
+
+    return true;
+}
+
+// Everything is read and validated before the import is touched
+static bool ImportMappedGlb(ModelImport& import, const MappedFile& mapped, std::string& error)
+{
+    GltfFile file;
+    if (!ReadGlbChunks(mapped, file, error))
+        return false;
+
+    const size_t directoryEnd = import.filepath.find_last_of("/\\");
+    file.directory = directoryEnd == std::string::npos ? "." : import.filepath.substr(0, directoryEnd);
+
+    // every triangle list primitive is a submesh, the primitives of a mesh follow each other
+    std::vector<GltfPrimitive> primitives;
+    std::vector<u32> meshFirstSubmesh, meshSubmeshCount;
+    u32 skippedPrimitives = 0;
+
+    const JsonValue* meshes = FindJsonMember(&file.root, "meshes");
+    for (u32 m = 0; m < GetJsonElementCount(meshes); ++m)
+    {
+        meshFirstSubmesh.push_back((u32)primitives.size());
+
+        const JsonValue* primitivesJson = FindJsonMember(GetJsonElement(meshes, m), "primitives");
+        for (u32 p = 0; p < GetJsonElementCount(primitivesJson); ++p)
+        {
+            const JsonValue* json = GetJsonElement(primitivesJson, p);
+            if (GetJsonIndex(json, "mode", GLTF_TRIANGLES) != GLTF_TRIANGLES)
+            {
+                skippedPrimitives++;
+                continue;
+            }
+
+            primitives.push_back(GltfPrimitive{});
+            if (!ReadPrimitive(file, json, primitives.back(), error))
+                return false;
+        }
+
+        meshSubmeshCount.push_back((u32)primitives.size() - meshFirstSubmesh.back());
+    }
+
+    if (primitives.empty())
+    {
+        error = "No triangles";
+        return false;
+    }
+
+    JobCounter jobs;
+    for (GltfPrimitive& primitive : primitives)
+    {
+        GltfPrimitive* gltfPrimitive = &primitive;
+        RunJob([gltfPrimitive]() { gltfPrimitive->validIndices = ValidateIndices(*gltfPrimitive); }, &jobs);
+    }
+
+    u32 skippedImages = 0;
+    std::vector<ImportedMaterial> materials;
+    ReadMaterials(file, materials, skippedImages);
+
+    std::vector<ModelNode> nodes;
+    ReadNodes(file, meshFirstSubmesh, meshSubmeshCount, nodes);
+
+    WaitForJobCounter(jobs);
+    for (const GltfPrimitive& primitive : primitives)
+    {
+        if (!primitive.validIndices)
+        {
+            error = "Index out of range";
+            return false;
+        }
+    }
+
+    // whole buffers from the file, or everything converted
+    bool zeroCopyVertices = true;
+    bool zeroCopyIndices = true;
+    for (const GltfPrimitive& primitive : primitives)
+    {
+        zeroCopyVertices = zeroCopyVertices && IsInterleavedFloatLayout(primitive);
+        zeroCopyIndices = zeroCopyIndices && primitive.hasIndices && primitive.hasNormal &&
+                          primitive.indices.componentType == GLTF_UNSIGNED_INT && primitive.indices.count % 3 == 0;
+    }
+
+    // nothing can fail from here on
+    const u32 materialCount = (u32)materials.size();
+    u32 defaultMaterial = UINT32_MAX;
+    for (GltfPrimitive& primitive : primitives)
+    {
+        if (primitive.materialIdx < materialCount)
+            continue;
+
+        if (defaultMaterial == UINT32_MAX)
+        {
+            defaultMaterial = (u32)materials.size();
+            materials.push_back(MakeGltfMaterial("DefaultMaterial"));
+        }
+        primitive.materialIdx = defaultMaterial;
+    }
+
+    import.materials = std::move(materials);
+    if (import.materialsImported)
+        import.materialsImported(import);
+
+    import.mappedFile = mapped;
+    import.nodes = std::move(nodes);
+    import.mesh.submeshes.resize(primitives.size());
+    for (const GltfPrimitive& primitive : primitives)
+        import.submeshMaterialIdx.push_back(primitive.materialIdx);
+
+    for (u32 i = 0; i < primitives.size(); ++i)
+    {
+        const GltfPrimitive* primitive = &primitives[i];
+        Submesh* submesh = &import.mesh.submeshes[i];
+        if (!zeroCopyVertices)
+            RunJob([primitive, submesh]() { ConvertVertices(*primitive, *submesh); }, &jobs);
+        if (!zeroCopyIndices && primitive->hasNormal)
+            RunJob([primitive, submesh]() { ConvertIndices(*primitive, *submesh); }, &jobs);
+    }
+    WaitForJobCounter(jobs);
+
+    if (zeroCopyVertices)
+    {
+        std::vector<u32> views;
+        for (const GltfPrimitive& primitive : primitives)
+            views.push_back(primitive.position.bufferView);
+
+        std::vector<u64> viewBases;
+        PackBufferViews(file, views, import.vertexBlob, import.vertexData, import.vertexDataSize, viewBases);
+        for (u32 i = 0; i < primitives.size(); ++i)
+            SetInterleavedLayout(primitives[i], viewBases[primitives[i].position.bufferView], import.mesh.submeshes[i]);
+    }
+    else
+    {
+        for (Submesh& submesh : import.mesh.submeshes)
+        {
+            submesh.vertexOffset = (u32)import.vertexBlob.size();
+            const u8* vertices = (const u8*)submesh.vertices.data();
+            import.vertexBlob.insert(import.vertexBlob.end(), vertices, vertices + submesh.vertices.size() * sizeof(float));
+        }
+        import.vertexData = import.vertexBlob.data();
+        import.vertexDataSize = import.vertexBlob.size();
+    }
+
+    if (zeroCopyIndices)
+    {
+        std::vector<u32> views;
+        for (const GltfPrimitive& primitive : primitives)
+            views.push_back(primitive.indices.bufferView);
+
+        std::vector<u64> viewBases;
+        PackBufferViews(file, views, import.indexBlob, import.indexData, import.indexDataSize, viewBases);
+        for (u32 i = 0; i < primitives.size(); ++i)
+        {
+            import.mesh.submeshes[i].indexOffset = (u32)(viewBases[primitives[i].indices.bufferView] + primitives[i].indices.byteOffset);
+            import.mesh.submeshes[i].indexCount = primitives[i].indices.count;
+        }
+    }
+    else
+    {
+        for (Submesh& submesh : import.mesh.submeshes)
+        {
+            submesh.indexOffset = (u32)import.indexBlob.size();
+            submesh.indexCount = (u32)submesh.indices.size();
+            const u8* indices = (const u8*)submesh.indices.data();
+            import.indexBlob.insert(import.indexBlob.end(), indices, indices + submesh.indices.size() * sizeof(u32));
+        }
+        import.indexData = import.indexBlob.data();
+        import.indexDataSize = import.indexBlob.size();
+    }
+
+    std::vector<vec3> boundsMin, boundsMax;
+    for (const GltfPrimitive& primitive : primitives)
+    {
+        boundsMin.push_back(primitive.boundsMin);
+        boundsMax.push_back(primitive.boundsMax);
+    }
+    ComputeNodeBounds(import, boundsMin, boundsMax);
+
+    if (skippedPrimitives > 0 || skippedImages > 0)
+        ILOG("%s: skipped %u non triangle primitives and %u embedded images", import.filepath.c_str(), skippedPrimitives, skippedImages);
+
+    return true;
+}
+
+bool ImportGlbModel(ModelImport& import)
+{
+    MappedFile mapped;
+    if (!MapFile(import.filepath.c_str(), mapped))
+    {
+        import.error = "Could not open the file";
+        return false;
+    }
+
+    std::string error;
+    if (!ImportMappedGlb(import, mapped, error))
+    {
+        UnmapFile(mapped);
+        import.error = error;
+        return false;
+    }
+
+    return true;
+}
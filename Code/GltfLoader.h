@@ -0,0 +1,27 @@
+#pragma once
+#include "ModelImport.h"
+
+// Native loader for binary glTF 2.0 (.glb). The file is mapped and stays
+// mapped until the buffers are uploaded: primitives whose attributes are
+// interleaved floats in one bufferView (position, normal and optionally uv)
+// already are a VertexBufferLayout, so the GL buffers are uploaded straight
+// from the BIN chunk without touching the vertices. So are uint indices.
+// Anything else (separate attribute streams, quantized attributes, tangents,
+// 8/16 bit indices, missing normals) is converted to the usual interleaved
+// layout of MakeModelVertexLayout().
+//
+// The node hierarchy is kept as ModelNodes, every node instancing a glTF mesh
+// draws the same submeshes. Images are referenced by their uri, relative to
+// the file; KTX2 (KHR_texture_basisu) sources only when there is no fallback
+// image, since they can't be decoded. Images embedded in the BIN chunk are
+// skipped, as are sparse accessors (the import fails, Assimp takes over) and
+// primitives other than triangle lists.
+
+#define GLB_VERSION 2
+
+bool IsGlbFile(const std::string& filepath);
+
+// Fills the mesh, buffers, bounds, materials and nodes of the import, calling
+// materialsImported once the materials are known. Returns false, with the
+// import untouched (but the error), if the file isn't a valid .glb.
+bool ImportGlbModel(ModelImport& import);
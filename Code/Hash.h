@@ -0,0 +1,8 @@
+#pragma once
+#include "platform.h"
+
+// 64 bit xxHash (XXH64) of a block of memory. Used to key on-disk caches
+// by content, so it must stay stable across versions of the engine.
+u64 HashBytes(const void* data, u64 size, u64 seed = 0);
+
+u64 HashCombine(u64 hash, u64 value);
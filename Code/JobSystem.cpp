@@ -0,0 +1,127 @@
+#include "JobSystem.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+struct QueuedJob
+{
+    Job         job;
+    JobCounter* counter;
+};
+
+static std::vector<std::thread> Workers;
+static std::deque<QueuedJob>    JobQueue;
+static std::mutex               JobQueueMutex;
+static std::condition_variable  JobQueueCondition;
+static bool                     JobSystemRunning = false;
+
+static bool PopJob(QueuedJob& queuedJob, bool wait)
+{
+    std::unique_lock<std::mutex> lock(JobQueueMutex);
+    if (wait)
+        JobQueueCondition.wait(lock, [] { return !JobQueue.empty() || !JobSystemRunning; });
+
+    if (JobQueue.empty())
+        return false;
+
+    queuedJob = std::move(JobQueue.front());
+    JobQueue.pop_front();
+    return true;
+}
+
+static void ExecuteJob(QueuedJob& queuedJob)
+{
+    queuedJob.job();
+    if (queuedJob.counter)
+        queuedJob.counter->pending.fetch_sub(1);
+}
+
+static void WorkerLoop()
+{
+    QueuedJob queuedJob;
+    while (PopJob(queuedJob, true))
+        ExecuteJob(queuedJob);
+}
+
+void InitJobSystem(u32 workerCount)
+{
+    ASSERT(!JobSystemRunning, "The job system is already running");
+
+    // leave one core for the main thread
+    if (workerCount == 0)
+        workerCount = glm::max(std::thread::hardware_concurrency(), 2u) - 1u;
+
+    JobSystemRunning = true;
+    for (u32 i = 0; i < workerCount; ++i)
+        Workers.emplace_back(WorkerLoop);
+}
+
+void ShutdownJobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(JobQueueMutex);
+        JobSystemRunning = false;
+    }
+    JobQueueCondition.notify_all();
+
+    // workers drain the remaining jobs before leaving
+    for (u32 i = 0; i < Workers.size(); ++i)
+        Workers[i].join();
+    Workers.clear();
+}
+
+u32 GetJobWorkerCount()
+{
+    return (u32)Workers.size();
+}
+
+void RunJob(Job job, JobCounter* counter)
+{
+    if (counter)
+        counter->pending.fetch_add(1);
+
+    // without workers (not initialized, e.g. command line tools) jobs run inline
+    if (Workers.empty())
+    {
+        QueuedJob queuedJob = { std::move(job), counter };
+        ExecuteJob(queuedJob);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(JobQueueMutex);
+        JobQueue.push_back(QueuedJob{ std::move(job), counter });
+    }
+    JobQueueCondition.notify_one();
+}
+
+bool IsJobCounterDone(const JobCounter& counter)
+{
+    return counter.pending.load() == 0;
+}
+
+void WaitForJobCounter(JobCounter& counter)
+{
+    while (!IsJobCounterDone(counter))
+    {
+        QueuedJob queuedJob;
+        if (PopJob(queuedJob, false))
+            ExecuteJob(queuedJob);
+        else
+            std::this_thread::yield();
+    }
+}
+
+void ParallelFor(u32 count, u32 batchSize, const std::function<void(u32 begin, u32 end)>& body)
+{
+    ASSERT(batchSize > 0, "The batch size must be greater than zero");
+
+    JobCounter counter;
+    for (u32 begin = 0; begin < count; begin += batchSize)
+    {
+        u32 end = glm::min(begin + batchSize, count);
+        RunJob([&body, begin, end] { body(begin, end); }, &counter);
+    }
+    WaitForJobCounter(counter);
+}
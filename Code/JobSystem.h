@@ -0,0 +1,30 @@
+#pragma once
+#include "platform.h"
+#include <functional>
+#include <atomic>
+
+typedef std::function<void()> Job;
+
+// Counts the jobs still running from a batch. Jobs pushed with a counter
+// decrement it when they finish, so the owner can poll or wait on it.
+struct JobCounter
+{
+    std::atomic<u32> pending{ 0 };
+};
+
+void InitJobSystem(u32 workerCount = 0);
+
+void ShutdownJobSystem();
+
+u32 GetJobWorkerCount();
+
+void RunJob(Job job, JobCounter* counter = NULL);
+
+bool IsJobCounterDone(const JobCounter& counter);
+
+// Blocks until the counter reaches zero. The calling thread executes
+// queued jobs meanwhile instead of sleeping.
+void WaitForJobCounter(JobCounter& counter);
+
+// Splits [0, count) into batches of batchSize run on the workers and waits for all of them.
+void ParallelFor(u32 count, u32 batchSize, const std::function<void(u32 begin, u32 end)>& body);
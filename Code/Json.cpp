@@ -0,0 +1,388 @@
+#include "Json.h"
+#include <stdlib.h>
+#include <string.h>
+#pragma warning(disable : 4996) //disable printf warning
+
+struct JsonParser
+{
+    const char* begin;
+    const char* c;
+    const char* end;
+    std::string error;
+};
+
+static bool JsonFail(JsonParser& parser, const char* message)
+{
+    if (parser.error.empty())
+    {
+        char error[128];
+        snprintf(error, sizeof(error), "%s at byte %llu", message, (unsigned long long)(parser.c - parser.begin));
+        parser.error = error;
+    }
+    return false;
+}
+
+static void SkipJsonSpaces(JsonParser& parser)
+{
+    while (parser.c < parser.end && (*parser.c == ' ' || *parser.c == '\t' || *parser.c == '\n' || *parser.c == '\r'))
+        ++parser.c;
+}
+
+static bool ParseJsonLiteral(JsonParser& parser, const char* literal)
+{
+    const size_t length = strlen(literal);
+    if ((size_t)(parser.end - parser.c) < length || memcmp(parser.c, literal, length) != 0)
+        return JsonFail(parser, "Invalid literal");
+
+    parser.c += length;
+    return true;
+}
+
+static i32 ParseHexDigit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool ParseJsonCodeUnit(JsonParser& parser, u32& codeUnit)
+{
+    if (parser.end - parser.c < 4)
+        return JsonFail(parser, "Truncated \\u escape");
+
+    codeUnit = 0;
+    for (u32 i = 0; i < 4; ++i)
+    {
+        const i32 digit = ParseHexDigit(*parser.c++);
+        if (digit < 0)
+            return JsonFail(parser, "Invalid \\u escape");
+        codeUnit = (codeUnit << 4) | (u32)digit;
+    }
+    return true;
+}
+
+static void AppendUtf8(std::string& str, u32 codePoint)
+{
+    if (codePoint < 0x80)
+    {
+        str += (char)codePoint;
+    }
+    else if (codePoint < 0x800)
+    {
+        str += (char)(0xC0 | (codePoint >> 6));
+        str += (char)(0x80 | (codePoint & 0x3F));
+    }
+    else if (codePoint < 0x10000)
+    {
+        str += (char)(0xE0 | (codePoint >> 12));
+        str += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+        str += (char)(0x80 | (codePoint & 0x3F));
+    }
+    else
+    {
+        str += (char)(0xF0 | (codePoint >> 18));
+        str += (char)(0x80 | ((codePoint >> 12) & 0x3F));
+        str += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+        str += (char)(0x80 | (codePoint & 0x3F));
+    }
+}
+
+static bool ParseJsonString(JsonParser& parser, std::string& str)
+{
+    ++parser.c;  // "
+    str.clear();
+
+    while (parser.c < parser.end)
+    {
+        // the unescaped run at once
+        const char* run = parser.c;
+        while (parser.c < parser.end && *parser.c != '"' && *parser.c != '\\' && (u8)*parser.c >= 0x20)
+            ++parser.c;
+        str.append(run, parser.c);
+
+        if (parser.c >= parser.end)
+            break;
+
+        const char c = *parser.c++;
+        if (c == '"')
+            return true;
+        if (c != '\\')
+            return JsonFail(parser, "Control character in string");
+        if (parser.c >= parser.end)
+            break;
+
+        const char escape = *parser.c++;
+        switch (escape)
+        {
+            case '"':  str += '"'; break;
+            case '\\': str += '\\'; break;
+            case '/':  str += '/'; break;
+            case 'b':  str += '\b'; break;
+            case 'f':  str += '\f'; break;
+            case 'n':  str += '\n'; break;
+            case 'r':  str += '\r'; break;
+            case 't':  str += '\t'; break;
+            case 'u':
+            {
+                u32 codePoint;
+                if (!ParseJsonCodeUnit(parser, codePoint))
+                    return false;
+
+                // surrogate pair
+                if (codePoint >= 0xD800 && codePoint < 0xDC00 &&
+                    parser.end - parser.c >= 2 && parser.c[0] == '\\' && parser.c[1] == 'u')
+                {
+                    parser.c += 2;
+                    u32 low;
+                    if (!ParseJsonCodeUnit(parser, low))
+                        return false;
+                    if (low < 0xDC00 || low >= 0xE000)
+                        return JsonFail(parser, "Invalid surrogate pair");
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                }
+
+                AppendUtf8(str, codePoint);
+                break;
+            }
+            default:
+                return JsonFail(parser, "Invalid escape");
+        }
+    }
+
+    return JsonFail(parser, "Unterminated string");
+}
+
+static bool ParseJsonNumber(JsonParser& parser, f64& number)
+{
+    // validated here, converted by strtod (the text isn't null terminated)
+    const char* start = parser.c;
+    const char* c = parser.c;
+    if (c < parser.end && *c == '-')
+        ++c;
+
+    const char* digits = c;
+    while (c < parser.end && *c >= '0' && *c <= '9')
+        ++c;
+    if (c == digits)
+        return JsonFail(parser, "Invalid number");
+
+    if (c < parser.end && *c == '.')
+    {
+        digits = ++c;
+        while (c < parser.end && *c >= '0' && *c <= '9')
+            ++c;
+        if (c == digits)
+            return JsonFail(parser, "Invalid number");
+    }
+
+    if (c < parser.end && (*c == 'e' || *c == 'E'))
+    {
+        ++c;
+        if (c < parser.end && (*c == '+' || *c == '-'))
+            ++c;
+        digits = c;
+        while (c < parser.end && *c >= '0' && *c <= '9')
+            ++c;
+        if (c == digits)
+            return JsonFail(parser, "Invalid number");
+    }
+
+    char buffer[64];
+    const size_t length = c - start;
+    if (length >= sizeof(buffer))
+    {
+        std::string copy(start, c);
+        number = strtod(copy.c_str(), NULL);
+    }
+    else
+    {
+        memcpy(buffer, start, length);
+        buffer[length] = '\0';
+        number = strtod(buffer, NULL);
+    }
+
+    parser.c = c;
+    return true;
+}
+
+static bool ParseJsonValue(JsonParser& parser, JsonValue& value, u32 depth)
+{
+    if (depth > JSON_MAX_DEPTH)
+        return JsonFail(parser, "Nesting too deep");
+
+    SkipJsonSpaces(parser);
+    if (parser.c >= parser.end)
+        return JsonFail(parser, "Unexpected end");
+
+    switch (*parser.c)
+    {
+        case 'n':
+            value.type = JsonType_Null;
+            return ParseJsonLiteral(parser, "null");
+        case 't':
+            value.type = JsonType_Bool;
+            value.boolean = true;
+            return ParseJsonLiteral(parser, "true");
+        case 'f':
+            value.type = JsonType_Bool;
+            value.boolean = false;
+            return ParseJsonLiteral(parser, "false");
+        case '"':
+            value.type = JsonType_String;
+            return ParseJsonString(parser, value.string);
+        case '[':
+        {
+            value.type = JsonType_Array;
+            ++parser.c;
+            SkipJsonSpaces(parser);
+            if (parser.c < parser.end && *parser.c == ']')
+            {
+                ++parser.c;
+                return true;
+            }
+
+            for (;;)
+            {
+                value.elements.push_back(JsonValue{});
+                if (!ParseJsonValue(parser, value.elements.back(), depth + 1))
+                    return false;
+
+                SkipJsonSpaces(parser);
+                if (parser.c < parser.end && *parser.c == ',')
+                {
+                    ++parser.c;
+                    continue;
+                }
+                if (parser.c < parser.end && *parser.c == ']')
+                {
+                    ++parser.c;
+                    return true;
+                }
+                return JsonFail(parser, "Expected , or ]");
+            }
+        }
+        case '{':
+        {
+            value.type = JsonType_Object;
+            ++parser.c;
+            SkipJsonSpaces(parser);
+            if (parser.c < parser.end && *parser.c == '}')
+            {
+                ++parser.c;
+                return true;
+            }
+
+            for (;;)
+            {
+                SkipJsonSpaces(parser);
+                if (parser.c >= parser.end || *parser.c != '"')
+                    return JsonFail(parser, "Expected member name");
+
+                value.keys.push_back(std::string());
+                if (!ParseJsonString(parser, value.keys.back()))
+                    return false;
+
+                SkipJsonSpaces(parser);
+                if (parser.c >= parser.end || *parser.c != ':')
+                    return JsonFail(parser, "Expected :");
+                ++parser.c;
+
+                value.elements.push_back(JsonValue{});
+                if (!ParseJsonValue(parser, value.elements.back(), depth + 1))
+                    return false;
+
+                SkipJsonSpaces(parser);
+                if (parser.c < parser.end && *parser.c == ',')
+                {
+                    ++parser.c;
+                    continue;
+                }
+                if (parser.c < parser.end && *parser.c == '}')
+                {
+                    ++parser.c;
+                    return true;
+                }
+                return JsonFail(parser, "Expected , or }");
+            }
+        }
+        default:
+            value.type = JsonType_Number;
+            return ParseJsonNumber(parser, value.number);
+    }
+}
+
+bool ParseJson(const char* text, u64 size, JsonValue& root, std::string& error)
+{
+    JsonParser parser = { text, text, text + size, std::string() };
+
+    // a UTF-8 BOM is tolerated
+    if (size >= 3 && memcmp(text, "\xEF\xBB\xBF", 3) == 0)
+        parser.c += 3;
+
+    root = JsonValue{};
+    bool parsed = ParseJsonValue(parser, root, 0);
+    if (parsed)
+    {
+        // trailing null padding is allowed too (.glb chunks are padded with spaces)
+        SkipJsonSpaces(parser);
+        while (parser.c < parser.end && *parser.c == '\0')
+            ++parser.c;
+        if (parser.c != parser.end)
+            parsed = JsonFail(parser, "Unexpected data after the root value");
+    }
+
+    error = parser.error;
+    return parsed;
+}
+
+const JsonValue* FindJsonMember(const JsonValue* object, const char* key)
+{
+    if (!object || object->type != JsonType_Object)
+        return NULL;
+
+    for (u32 i = 0; i < object->keys.size(); ++i)
+        if (object->keys[i] == key)
+            return &object->elements[i];
+    return NULL;
+}
+
+const JsonValue* GetJsonElement(const JsonValue* array, u32 index)
+{
+    if (!array || array->type != JsonType_Array || index >= array->elements.size())
+        return NULL;
+
+    return &array->elements[index];
+}
+
+u32 GetJsonElementCount(const JsonValue* array)
+{
+    return (array && array->type == JsonType_Array) ? (u32)array->elements.size() : 0;
+}
+
+f64 GetJsonNumber(const JsonValue* object, const char* key, f64 defaultValue)
+{
+    const JsonValue* member = FindJsonMember(object, key);
+    return (member && member->type == JsonType_Number) ? member->number : defaultValue;
+}
+
+u32 GetJsonIndex(const JsonValue* object, const char* key, u32 defaultValue)
+{
+    const JsonValue* member = FindJsonMember(object, key);
+    if (!member || member->type != JsonType_Number || member->number < 0.0 || member->number >= (f64)UINT32_MAX)
+        return defaultValue;
+
+    return (u32)member->number;
+}
+
+bool GetJsonBool(const JsonValue* object, const char* key, bool defaultValue)
+{
+    const JsonValue* member = FindJsonMember(object, key);
+    return (member && member->type == JsonType_Bool) ? member->boolean : defaultValue;
+}
+
+std::string GetJsonString(const JsonValue* object, const char* key, const char* defaultValue)
+{
+    const JsonValue* member = FindJsonMember(object, key);
+    return (member && member->type == JsonType_String) ? member->string : std::string(defaultValue);
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "platform.h"
+
+// Minimal JSON reader (RFC 8259) into a tree of values, enough for the
+// glTF headers. Numbers are kept as doubles, \u escapes are decoded to UTF-8.
+
+enum JsonType
+{
+    JsonType_Null,
+    JsonType_Bool,
+    JsonType_Number,
+    JsonType_String,
+    JsonType_Array,
+    JsonType_Object
+};
+
+struct JsonValue
+{
+    JsonType                 type = JsonType_Null;
+    bool                     boolean = false;
+    f64                      number = 0.0;
+    std::string              string;
+    std::vector<std::string> keys;      // objects, one per element
+    std::vector<JsonValue>   elements;  // array elements or object members
+};
+
+// Fails (with the position in the error) on malformed input or nesting
+// deeper than JSON_MAX_DEPTH
+#define JSON_MAX_DEPTH 64
+bool ParseJson(const char* text, u64 size, JsonValue& root, std::string& error);
+
+// NULL when the value isn't an object or the member/element is missing
+const JsonValue* FindJsonMember(const JsonValue* object, const char* key);
+const JsonValue* GetJsonElement(const JsonValue* array, u32 index);
+
+u32  GetJsonElementCount(const JsonValue* array);
+f64  GetJsonNumber(const JsonValue* object, const char* key, f64 defaultValue);
+u32  GetJsonIndex(const JsonValue* object, const char* key, u32 defaultValue = UINT32_MAX);
+bool GetJsonBool(const JsonValue* object, const char* key, bool defaultValue);
+std::string GetJsonString(const JsonValue* object, const char* key, const char* defaultValue = "");
@@ -0,0 +1,187 @@
+#include "Lz4.h"
+#include <string.h>
+
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5   // the block always ends with literals
+#define LZ4_MATCH_LIMIT   12  // and no match starts in its last bytes
+#define LZ4_MAX_OFFSET    65535
+#define LZ4_HASH_BITS     12
+
+// Bigger jumps the longer no match is found, so incompressible data goes fast
+#define LZ4_SKIP_STRENGTH 6
+
+static inline u32 Read32(const u8* p)
+{
+    u32 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline u32 HashSequence(u32 sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// Lengths that don't fit in the token nibble continue in bytes of 255
+static inline u8* WriteLength(u8* dst, u32 length)
+{
+    while (length >= 255)
+    {
+        *dst++ = 255;
+        length -= 255;
+    }
+    *dst++ = (u8)length;
+    return dst;
+}
+
+static inline u8* WriteLiterals(u8* dst, u8* token, const u8* literals, u32 literalLength)
+{
+    *token = (u8)((literalLength >= 15 ? 15 : literalLength) << 4);
+    if (literalLength >= 15)
+        dst = WriteLength(dst, literalLength - 15);
+
+    memcpy(dst, literals, literalLength);
+    return dst + literalLength;
+}
+
+u32 Lz4CompressBound(u32 size)
+{
+    return size + size / 255 + 16;
+}
+
+u32 Lz4Compress(const u8* src, u32 srcSize, u8* dst)
+{
+    const u8* end = src + srcSize;
+    const u8* anchor = src;
+    u8* op = dst;
+
+    if (srcSize > LZ4_MATCH_LIMIT)
+    {
+        // last position seen for each hashed 4 byte sequence
+        u32 table[1 << LZ4_HASH_BITS] = {};
+
+        const u8* matchLimit = end - LZ4_MATCH_LIMIT;
+        const u8* matchEndLimit = end - LZ4_LAST_LITERALS;
+        const u8* ip = src + 1;
+
+        while (ip < matchLimit)
+        {
+            const u32 sequence = Read32(ip);
+            const u32 hash = HashSequence(sequence);
+            const u8* ref = src + table[hash];
+            table[hash] = (u32)(ip - src);
+
+            if (ip - ref > LZ4_MAX_OFFSET || Read32(ref) != sequence)
+            {
+                ip += 1 + ((ip - anchor) >> LZ4_SKIP_STRENGTH);
+                continue;
+            }
+
+            // extend backwards over the pending literals, then forwards
+            while (ip > anchor && ref > src && ip[-1] == ref[-1])
+            {
+                --ip;
+                --ref;
+            }
+
+            const u8* matchEnd = ip + LZ4_MIN_MATCH;
+            const u8* refEnd = ref + LZ4_MIN_MATCH;
+            while (matchEnd < matchEndLimit && *matchEnd == *refEnd)
+            {
+                ++matchEnd;
+                ++refEnd;
+            }
+
+            u8* token = op++;
+            op = WriteLiterals(op, token, anchor, (u32)(ip - anchor));
+
+            const u32 offset = (u32)(ip - ref);
+            op[0] = (u8)offset;
+            op[1] = (u8)(offset >> 8);
+            op += 2;
+
+            const u32 matchLength = (u32)(matchEnd - ip) - LZ4_MIN_MATCH;
+            *token |= (u8)(matchLength >= 15 ? 15 : matchLength);
+            if (matchLength >= 15)
+                op = WriteLength(op, matchLength - 15);
+
+            ip = matchEnd;
+            anchor = ip;
+        }
+    }
+
+    u8* token = op++;
+    op = WriteLiterals(op, token, anchor, (u32)(end - anchor));
+
+    return (u32)(op - dst);
+}
+
+static inline bool ReadLength(const u8*& ip, const u8* ipEnd, u32& length)
+{
+    u8 byte;
+    do
+    {
+        if (ip >= ipEnd)
+            return false;
+        byte = *ip++;
+        length += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+bool Lz4Decompress(const u8* src, u32 srcSize, u8* dst, u32 dstSize)
+{
+    const u8* ip = src;
+    const u8* ipEnd = src + srcSize;
+    u8* op = dst;
+    u8* opEnd = dst + dstSize;
+
+    while (ip < ipEnd)
+    {
+        const u32 token = *ip++;
+
+        u32 literalLength = token >> 4;
+        if (literalLength == 15 && !ReadLength(ip, ipEnd, literalLength))
+            return false;
+        if ((u64)(ipEnd - ip) < literalLength || (u64)(opEnd - op) < literalLength)
+            return false;
+
+        memcpy(op, ip, literalLength);
+        op += literalLength;
+        ip += literalLength;
+
+        // the last sequence has no match
+        if (ip == ipEnd)
+            break;
+
+        if (ipEnd - ip < 2)
+            return false;
+        const u32 offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (u32)(op - dst))
+            return false;
+
+        u32 matchLength = token & 15;
+        if (matchLength == 15 && !ReadLength(ip, ipEnd, matchLength))
+            return false;
+        matchLength += LZ4_MIN_MATCH;
+        if ((u64)(opEnd - op) < matchLength)
+            return false;
+
+        const u8* match = op - offset;
+        if (offset >= matchLength)
+        {
+            memcpy(op, match, matchLength);
+            op += matchLength;
+        }
+        else
+        {
+            // overlapping, repeats the last offset bytes
+            for (u32 i = 0; i < matchLength; ++i)
+                *op++ = match[i];
+        }
+    }
+
+    return op == opEnd;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "platform.h"
+
+// LZ4 block format (no frame): sequences of literals + (offset, length) matches
+// within the previous 64 KB. Decompression is a few copies per sequence, fast
+// enough that reading less from disk always wins.
+
+// Worst case size of the compressed data (incompressible input)
+u32 Lz4CompressBound(u32 size);
+
+// Greedy single pass compressor. dst needs Lz4CompressBound(srcSize) bytes,
+// returns the compressed size.
+u32 Lz4Compress(const u8* src, u32 srcSize, u8* dst);
+
+// Bounds checked, fails on corrupt input or if it doesn't decompress to exactly dstSize bytes
+bool Lz4Decompress(const u8* src, u32 srcSize, u8* dst, u32 dstSize);
@@ -0,0 +1,195 @@
+#include "Materials.h"
+#include "TextureRegistry.h"
+#include "VirtualTexturing.h"
+
+GLuint CreateTextureArrayStorage(const TextureArray& array)
+{
+    GLuint handle;
+    glGenTextures(1, &handle);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, handle);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, array.mipCount, array.internalFormat, array.size.x, array.size.y, array.layerCount);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return handle;
+}
+
+void CreateTextureLayerView(App* app, u32 texIdx)
+{
+    Texture& tex = app->textures[texIdx];
+    const TextureArray& array = app->textureArrays[tex.arrayIdx];
+
+    GLuint view;
+    glGenTextures(1, &view);
+    glTextureView(view, GL_TEXTURE_2D, array.handle, array.internalFormat, 0, array.mipCount, tex.arrayLayer, 1);
+    glDeleteTextures(1, &tex.handle);
+
+    tex.handle = view;
+    tex.image.size = array.size;
+    tex.mipCount = array.mipCount;
+    tex.baseLevel = 0;
+}
+
+void BuildTextureArrays(App* app)
+{
+    ErrorGuardOGL error("BuildTextureArrays()", __FILE__, __LINE__);
+
+    GLint maxLayers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+    // group the textures by size and internal format
+    std::vector<u32> pending;
+    for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
+        if (app->textures[texIdx].arrayIdx == UINT32_MAX && app->textures[texIdx].state == TextureState_Resident)
+            pending.push_back(texIdx);
+
+    while (!pending.empty())
+    {
+        const Texture& first = app->textures[pending[0]];
+
+        std::vector<u32> group;
+        std::vector<u32> remaining;
+        for (u32 i = 0; i < pending.size(); ++i)
+        {
+            const Texture& tex = app->textures[pending[i]];
+            bool sameKind = tex.image.size == first.image.size && tex.internalFormat == first.internalFormat;
+            if (sameKind && group.size() < (u32)maxLayers)
+                group.push_back(pending[i]);
+            else
+                remaining.push_back(pending[i]);
+        }
+        pending.swap(remaining);
+
+        TextureArray array = {};
+        array.size = first.image.size;
+        array.internalFormat = first.internalFormat;
+        array.mipCount = ComputeMipCount(array.size);
+        array.layerCount = group.size();
+
+        array.handle = CreateTextureArrayStorage(array);
+
+        u32 arrayIdx = app->textureArrays.size();
+        app->textureArrays.push_back(array);
+
+        for (u32 layer = 0; layer < group.size(); ++layer)
+        {
+            Texture& tex = app->textures[group[layer]];
+
+            // copy the whole mip chain (generated at load) into the layer
+            ivec2 mipSize = array.size;
+            for (u32 mip = 0; mip < array.mipCount; ++mip)
+            {
+                glCopyImageSubData(tex.handle, GL_TEXTURE_2D, mip, 0, 0, 0,
+                                   array.handle, GL_TEXTURE_2D_ARRAY, mip, 0, 0, layer,
+                                   mipSize.x, mipSize.y, 1);
+                mipSize = glm::max(mipSize / 2, ivec2(1));
+            }
+
+            // replace the standalone texture by a view of its layer, so code that
+            // still wants a plain GL_TEXTURE_2D (Gui, screen quad...) keeps working
+            // without keeping two copies in VRAM
+            tex.arrayIdx = arrayIdx;
+            tex.arrayLayer = layer;
+            CreateTextureLayerView(app, group[layer]);
+        }
+    }
+}
+
+// Texture actually sampled for a material map: the fallback while it is still
+// loading, magenta if it failed to load
+static u32 ResolveTextureIdx(App* app, u32 texIdx, u32 fallbackTexIdx)
+{
+    if (texIdx >= app->textures.size())
+        return fallbackTexIdx;
+
+    switch (app->textures[texIdx].state)
+    {
+        case TextureState_Loading:  return fallbackTexIdx;
+        case TextureState_Virtual:  return fallbackTexIdx;  // see albedoVirtual
+        case TextureState_Failed:   return app->magentaTexIdx;
+        case TextureState_Unloaded: return fallbackTexIdx;
+        default:                    return texIdx;
+    }
+}
+
+static void ResolveMaterialMap(App* app, u32 texIdx, u32 fallbackTexIdx, ivec4& map, vec4& uvScaleOffset)
+{
+    const Texture& tex = app->textures[ResolveTextureIdx(app, texIdx, fallbackTexIdx)];
+
+    // a streamed texture is sampled on its own (x = -1) until it joins an array
+    map = (tex.arrayIdx != UINT32_MAX) ? ivec4((i32)tex.arrayIdx, (i32)tex.arrayLayer, 0, 0) : ivec4(-1, 0, 0, 0);
+    uvScaleOffset = tex.uvScaleOffset;
+}
+
+void UploadMaterialTable(App* app)
+{
+    std::vector<GpuMaterial> gpuMaterials(app->materials.size());
+
+    for (u32 i = 0; i < app->materials.size(); ++i)
+    {
+        const Material& material = app->materials[i];
+        GpuMaterial& gpuMaterial = gpuMaterials[i];
+
+        gpuMaterial.albedo = vec4(material.albedo, material.smoothness);
+        gpuMaterial.emissive = vec4(material.emissive, 0.0f);
+        ResolveMaterialMap(app, material.albedoTextureIdx, app->whiteTexIdx, gpuMaterial.albedoMap, gpuMaterial.albedoUvScaleOffset);
+        ResolveMaterialMap(app, material.emissiveTextureIdx, app->blackTexIdx, gpuMaterial.emissiveMap, gpuMaterial.emissiveUvScaleOffset);
+        ResolveMaterialMap(app, material.normalsTextureIdx, app->normalTexIdx, gpuMaterial.normalMap, gpuMaterial.normalUvScaleOffset);
+        gpuMaterial.albedoVirtual = GetVirtualTextureInfo(app, material.albedoTextureIdx);
+    }
+
+    u32 tableSize = glm::max((u32)(gpuMaterials.size() * sizeof(GpuMaterial)), (u32)sizeof(GpuMaterial));
+    if (app->materialBuffer.handle == 0 || app->materialBuffer.size < tableSize)
+    {
+        if (app->materialBuffer.handle != 0)
+            glDeleteBuffers(1, &app->materialBuffer.handle);
+        app->materialBuffer = CreateBuffer(tableSize, GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW);
+    }
+
+    BindBuffer(app->materialBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpuMaterials.size() * sizeof(GpuMaterial), gpuMaterials.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void BindMaterial(App* app, const Program& program, u32 materialIdx)
+{
+    glUniform1ui(program.uniforms.materialIdx, materialIdx);
+
+    // only touch the texture units when the array actually changes, so
+    // consecutive draws sharing an array share all of their state
+    const Material& material = app->materials[materialIdx];
+    const Texture& tex = app->textures[ResolveTextureIdx(app, material.albedoTextureIdx, app->whiteTexIdx)];
+
+    if (tex.arrayIdx == UINT32_MAX)
+    {
+        if (tex.handle != app->boundAlbedoTexture)
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, tex.handle);
+            app->boundAlbedoTexture = tex.handle;
+        }
+        return;
+    }
+
+    GLuint arrayHandle = app->textureArrays[tex.arrayIdx].handle;
+    if (arrayHandle != app->boundAlbedoArray)
+    {
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, arrayHandle);
+        app->boundAlbedoArray = arrayHandle;
+    }
+}
+
+void ReleaseMaterialTextures(App* app, Material& material)
+{
+    u32* maps[] = { &material.albedoTextureIdx, &material.emissiveTextureIdx, &material.specularTextureIdx,
+                    &material.normalsTextureIdx, &material.bumpTextureIdx };
+
+    for (u32* texIdx : maps)
+    {
+        ReleaseTexture2D(app, *texIdx);
+        *texIdx = UINT32_MAX;
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "engine.h"
+
+// GPU copy of a Material, read per draw from the material table SSBO.
+// Must match the Material struct in shaders.glsl (std430 layout).
+struct GpuMaterial
+{
+    vec4  albedo;       // rgb: albedo color, a: smoothness
+    vec4  emissive;     // rgb: emissive color
+    ivec4 albedoMap;    // x: texture array index (-1: standalone texture), y: layer
+    ivec4 emissiveMap;  // x: texture array index, y: layer
+    ivec4 normalMap;    // x: texture array index, y: layer
+    vec4  albedoUvScaleOffset;   // atlas placement: xy scale, zw offset
+    vec4  emissiveUvScaleOffset;
+    vec4  normalUvScaleOffset;
+    ivec4 albedoVirtual;  // x: virtual texture (-1 if none), yz: size, w: coarsest mip
+};
+
+// Immutable storage for array.size/mipCount/layerCount/internalFormat
+GLuint CreateTextureArrayStorage(const TextureArray& array);
+
+// Points app->textures[texIdx].handle at its layer of the array it belongs to
+// (the previous handle is deleted). Needed again whenever the array is reallocated.
+void CreateTextureLayerView(App* app, u32 texIdx);
+
+void BuildTextureArrays(App* app);
+
+void UploadMaterialTable(App* app);
+
+void BindMaterial(App* app, const Program& program, u32 materialIdx);
+
+// Gives back the texture references the material took when it was loaded
+void ReleaseMaterialTextures(App* app, Material& material);
@@ -0,0 +1,957 @@
+#include "MeshProcessing.h"
+#include "JobSystem.h"
+#include "VertexFormat.h"
+#include <string.h>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <glm/gtc/packing.hpp>
+
+// WeldVertices() partitions, by the top bits of the vertex hash
+#define WELD_PARTITION_BITS 8
+#define WELD_PARTITION_COUNT (1u << WELD_PARTITION_BITS)
+#define WELD_PARTITIONS_PER_JOB 8
+
+static inline u32 CanonicalBits(float value)
+{
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits == 0x80000000u) ? 0u : bits;  // -0 joins +0
+}
+
+static u64 HashVertex(const float* vertex, u32 strideFloats)
+{
+    u64 hash = 0xCBF29CE484222325ull;
+    for (u32 i = 0; i < strideFloats; ++i)
+        hash = (hash ^ CanonicalBits(vertex[i])) * 0x100000001B3ull;
+
+    // the partition comes from the top bits, the table slot from the bottom ones
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static bool VerticesEqual(const float* a, const float* b, u32 strideFloats)
+{
+    for (u32 i = 0; i < strideFloats; ++i)
+        if (CanonicalBits(a[i]) != CanonicalBits(b[i]))
+            return false;
+    return true;
+}
+
+void WeldVertices(std::vector<float>& vertices, u32 strideFloats, std::vector<u32>& indices)
+{
+    const u32 vertexCount = strideFloats ? (u32)(vertices.size() / strideFloats) : 0;
+    if (vertexCount < 2)
+        return;
+
+    // hashes and a histogram of the partitions per chunk of vertices
+    const float* data = vertices.data();
+    const u32 chunkCount = (vertexCount + MESH_PROCESSING_BATCH_SIZE - 1) / MESH_PROCESSING_BATCH_SIZE;
+    std::vector<u64> hashes(vertexCount);
+    std::vector<u32> chunkOffsets((size_t)chunkCount * WELD_PARTITION_COUNT, 0);
+    ParallelFor(chunkCount, 1, [&](u32 begin, u32 end)
+    {
+        for (u32 chunk = begin; chunk < end; ++chunk)
+        {
+            u32* counts = &chunkOffsets[(size_t)chunk * WELD_PARTITION_COUNT];
+            const u32 last = glm::min((chunk + 1) * MESH_PROCESSING_BATCH_SIZE, vertexCount);
+            for (u32 v = chunk * MESH_PROCESSING_BATCH_SIZE; v < last; ++v)
+            {
+                hashes[v] = HashVertex(data + (size_t)v * strideFloats, strideFloats);
+                counts[hashes[v] >> (64 - WELD_PARTITION_BITS)]++;
+            }
+        }
+    });
+
+    // partitions back to back, the chunks of each one in order
+    std::vector<u32> partitionBegin(WELD_PARTITION_COUNT + 1);
+    u32 offset = 0;
+    for (u32 p = 0; p < WELD_PARTITION_COUNT; ++p)
+    {
+        partitionBegin[p] = offset;
+        for (u32 chunk = 0; chunk < chunkCount; ++chunk)
+        {
+            u32& chunkOffset = chunkOffsets[(size_t)chunk * WELD_PARTITION_COUNT + p];
+            const u32 count = chunkOffset;
+            chunkOffset = offset;
+            offset += count;
+        }
+    }
+    partitionBegin[WELD_PARTITION_COUNT] = offset;
+
+    // so every partition lists its vertices in increasing order
+    std::vector<u32> order(vertexCount);
+    ParallelFor(chunkCount, 1, [&](u32 begin, u32 end)
+    {
+        for (u32 chunk = begin; chunk < end; ++chunk)
+        {
+            u32* offsets = &chunkOffsets[(size_t)chunk * WELD_PARTITION_COUNT];
+            const u32 last = glm::min((chunk + 1) * MESH_PROCESSING_BATCH_SIZE, vertexCount);
+            for (u32 v = chunk * MESH_PROCESSING_BATCH_SIZE; v < last; ++v)
+                order[offsets[hashes[v] >> (64 - WELD_PARTITION_BITS)]++] = v;
+        }
+    });
+
+    // equal vertices hash the same, so they are in the same partition: the
+    // first one found (the lowest index) represents the others
+    std::vector<u32> representative(vertexCount);
+    ParallelFor(WELD_PARTITION_COUNT, WELD_PARTITIONS_PER_JOB, [&](u32 begin, u32 end)
+    {
+        std::vector<u32> table;
+        for (u32 p = begin; p < end; ++p)
+        {
+            const u32 first = partitionBegin[p];
+            const u32 count = partitionBegin[p + 1] - first;
+            if (count == 0)
+                continue;
+
+            u32 tableSize = 1;
+            while (tableSize < count * 2)
+                tableSize <<= 1;
+            table.assign(tableSize, UINT32_MAX);
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                const u32 v = order[first + i];
+                for (u32 slot = (u32)hashes[v] & (tableSize - 1);; slot = (slot + 1) & (tableSize - 1))
+                {
+                    const u32 candidate = table[slot];
+                    if (candidate == UINT32_MAX)
+                    {
+                        table[slot] = v;
+                        representative[v] = v;
+                        break;
+                    }
+                    if (hashes[candidate] == hashes[v] &&
+                        VerticesEqual(data + (size_t)candidate * strideFloats, data + (size_t)v * strideFloats, strideFloats))
+                    {
+                        representative[v] = candidate;
+                        break;
+                    }
+                }
+            }
+        }
+    });
+
+    // representatives move down in place, in their original order
+    std::vector<u32> remap(vertexCount);
+    u32 weldedCount = 0;
+    float* dst = vertices.data();
+    for (u32 v = 0; v < vertexCount; ++v)
+    {
+        if (representative[v] != v)
+        {
+            remap[v] = remap[representative[v]];
+            continue;
+        }
+
+        if (weldedCount != v)
+            memcpy(dst + (size_t)weldedCount * strideFloats, dst + (size_t)v * strideFloats, strideFloats * sizeof(float));
+        remap[v] = weldedCount++;
+    }
+
+    if (weldedCount == vertexCount)
+        return;
+
+    vertices.resize((size_t)weldedCount * strideFloats);
+    ParallelFor((u32)indices.size(), MESH_PROCESSING_BATCH_SIZE, [&](u32 begin, u32 end)
+    {
+        for (u32 i = begin; i < end; ++i)
+            indices[i] = remap[indices[i]];
+    });
+}
+
+static i32 FindAttributeOffset(const VertexBufferLayout& layout, u8 location, u8 componentCount)
+{
+    for (const VertexBufferAttribute& attribute : layout.attributes)
+        if (attribute.location == location && attribute.componentCount == componentCount)
+            return attribute.offset / sizeof(float);
+    return -1;
+}
+
+static vec3 ProjectOnPlane(const vec3& v, const vec3& n)
+{
+    return v - n * glm::dot(n, v);
+}
+
+static vec3 SafeNormalize(const vec3& v)
+{
+    const f32 length = glm::length(v);
+    return (length > 1e-12f) ? v / length : vec3(0.0f);
+}
+
+// Any unit vector perpendicular to n
+static vec3 MakePerpendicular(const vec3& n)
+{
+    const vec3 axis = (fabsf(n.x) < 0.9f) ? vec3(1.0f, 0.0f, 0.0f) : vec3(0.0f, 1.0f, 0.0f);
+    const vec3 perpendicular = SafeNormalize(glm::cross(n, axis));
+    return (perpendicular != vec3(0.0f)) ? perpendicular : vec3(1.0f, 0.0f, 0.0f);
+}
+
+void ComputeTangents(Submesh& submesh)
+{
+    const VertexBufferLayout& layout = submesh.vertexBufferLayout;
+    const i32 normalOffset = FindAttributeOffset(layout, 1, 3);
+    const i32 texCoordOffset = FindAttributeOffset(layout, 2, 2);
+    const i32 tangentOffset = FindAttributeOffset(layout, 3, 4);
+    const u32 strideFloats = layout.stride / sizeof(float);
+    if (normalOffset < 0 || texCoordOffset < 0 || tangentOffset < 0 || strideFloats == 0)
+        return;
+
+    float* vertices = submesh.vertices.data();
+    const std::vector<u32>& indices = submesh.indices;
+    const u32 vertexCount = (u32)(submesh.vertices.size() / strideFloats);
+    const u32 triangleCount = (u32)(indices.size() / 3);
+
+    // tangent and bitangent of every corner, weighted by its angle
+    std::vector<vec3> cornerTangents((size_t)triangleCount * 3);
+    std::vector<vec3> cornerBitangents((size_t)triangleCount * 3);
+    ParallelFor(triangleCount, MESH_PROCESSING_BATCH_SIZE, [&](u32 begin, u32 end)
+    {
+        for (u32 t = begin; t < end; ++t)
+        {
+            const float* corners[3];
+            for (u32 k = 0; k < 3; ++k)
+                corners[k] = vertices + (size_t)indices[t * 3 + k] * strideFloats;
+
+            const vec3 p0 = glm::make_vec3(corners[0]);
+            const vec3 e1 = glm::make_vec3(corners[1]) - p0;
+            const vec3 e2 = glm::make_vec3(corners[2]) - p0;
+            const vec2 uv0 = glm::make_vec2(corners[0] + texCoordOffset);
+            const vec2 s1 = glm::make_vec2(corners[1] + texCoordOffset) - uv0;
+            const vec2 s2 = glm::make_vec2(corners[2] + texCoordOffset) - uv0;
+
+            // no uv gradient: nothing from this triangle
+            const f32 det = s1.x * s2.y - s1.y * s2.x;
+            if (det == 0.0f || !std::isfinite(det))
+            {
+                for (u32 k = 0; k < 3; ++k)
+                {
+                    cornerTangents[t * 3 + k] = vec3(0.0f);
+                    cornerBitangents[t * 3 + k] = vec3(0.0f);
+                }
+                continue;
+            }
+
+            // only the directions, like MikkTSpace the uv stretch is dropped
+            const vec3 faceTangent = SafeNormalize((e1 * s2.y - e2 * s1.y) / det);
+            const vec3 faceBitangent = SafeNormalize((e2 * s1.x - e1 * s2.x) / det);
+
+            for (u32 k = 0; k < 3; ++k)
+            {
+                const vec3 n = SafeNormalize(glm::make_vec3(corners[k] + normalOffset));
+                const vec3 p = glm::make_vec3(corners[k]);
+                const vec3 a = SafeNormalize(ProjectOnPlane(glm::make_vec3(corners[(k + 1) % 3]) - p, n));
+                const vec3 b = SafeNormalize(ProjectOnPlane(glm::make_vec3(corners[(k + 2) % 3]) - p, n));
+                const f32 angle = acosf(glm::clamp(glm::dot(a, b), -1.0f, 1.0f));
+
+                cornerTangents[t * 3 + k] = SafeNormalize(ProjectOnPlane(faceTangent, n)) * angle;
+                cornerBitangents[t * 3 + k] = SafeNormalize(ProjectOnPlane(faceBitangent, n)) * angle;
+            }
+        }
+    });
+
+    // corners of each vertex
+    std::vector<u32> cornerBegin(vertexCount + 1, 0);
+    for (u32 i = 0; i < triangleCount * 3; ++i)
+        cornerBegin[indices[i] + 1]++;
+    for (u32 v = 0; v < vertexCount; ++v)
+        cornerBegin[v + 1] += cornerBegin[v];
+
+    std::vector<u32> vertexCorners((size_t)triangleCount * 3);
+    std::vector<u32> cursor(cornerBegin.begin(), cornerBegin.end() - 1);
+    for (u32 i = 0; i < triangleCount * 3; ++i)
+        vertexCorners[cursor[indices[i]]++] = i;
+
+    ParallelFor(vertexCount, MESH_PROCESSING_BATCH_SIZE, [&](u32 begin, u32 end)
+    {
+        for (u32 v = begin; v < end; ++v)
+        {
+            vec3 tangentSum(0.0f), bitangentSum(0.0f);
+            for (u32 c = cornerBegin[v]; c < cornerBegin[v + 1]; ++c)
+            {
+                tangentSum += cornerTangents[vertexCorners[c]];
+                bitangentSum += cornerBitangents[vertexCorners[c]];
+            }
+
+            float* vertex = vertices + (size_t)v * strideFloats;
+            const vec3 n = SafeNormalize(glm::make_vec3(vertex + normalOffset));
+            vec3 tangent = SafeNormalize(ProjectOnPlane(tangentSum, n));
+            if (tangent == vec3(0.0f))
+                tangent = MakePerpendicular(n);
+
+            vertex[tangentOffset + 0] = tangent.x;
+            vertex[tangentOffset + 1] = tangent.y;
+            vertex[tangentOffset + 2] = tangent.z;
+            vertex[tangentOffset + 3] = (glm::dot(glm::cross(n, tangent), bitangentSum) < 0.0f) ? -1.0f : 1.0f;
+        }
+    });
+}
+
+// Forsyth's scoring: the last triangle's vertices get a fixed score, the rest
+// of the cache decays with the position, and vertices with few triangles
+// left get a boost so they are finished (and stop being needed) first
+#define FORSYTH_CACHE_DECAY_POWER   1.5f
+#define FORSYTH_LAST_TRIANGLE_SCORE 0.75f
+#define FORSYTH_VALENCE_BOOST_SCALE 2.0f
+#define FORSYTH_VALENCE_BOOST_POWER 0.5f
+
+static f32 ForsythVertexScore(i32 cachePosition, u32 remainingTriangles)
+{
+    if (remainingTriangles == 0)
+        return -1.0f;
+
+    f32 score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        if (cachePosition < 3)
+        {
+            score = FORSYTH_LAST_TRIANGLE_SCORE;
+        }
+        else
+        {
+            const f32 scaler = 1.0f / (VERTEX_CACHE_SIZE - 3);
+            score = powf(1.0f - (cachePosition - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+        }
+    }
+
+    return score + FORSYTH_VALENCE_BOOST_SCALE * powf((f32)remainingTriangles, -FORSYTH_VALENCE_BOOST_POWER);
+}
+
+void OptimizeVertexCache(std::vector<u32>& indices, u32 vertexCount)
+{
+    const u32 triangleCount = (u32)(indices.size() / 3);
+    if (triangleCount < 2 || vertexCount == 0)
+        return;
+
+    // triangles of each vertex, the ones still to emit first
+    std::vector<u32> triangleBegin(vertexCount + 1, 0);
+    for (u32 i = 0; i < triangleCount * 3; ++i)
+        triangleBegin[indices[i] + 1]++;
+    std::vector<u32> remaining(vertexCount);
+    for (u32 v = 0; v < vertexCount; ++v)
+    {
+        remaining[v] = triangleBegin[v + 1];
+        triangleBegin[v + 1] += triangleBegin[v];
+    }
+
+    std::vector<u32> vertexTriangles((size_t)triangleCount * 3);
+    std::vector<u32> cursor(triangleBegin.begin(), triangleBegin.end() - 1);
+    for (u32 i = 0; i < triangleCount * 3; ++i)
+        vertexTriangles[cursor[indices[i]]++] = i / 3;
+
+    std::vector<i32> cachePosition(vertexCount, -1);
+    std::vector<f32> vertexScore(vertexCount);
+    for (u32 v = 0; v < vertexCount; ++v)
+        vertexScore[v] = ForsythVertexScore(-1, remaining[v]);
+
+    std::vector<f32> triangleScore(triangleCount);
+    u32 bestTriangle = 0;
+    for (u32 t = 0; t < triangleCount; ++t)
+    {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+        if (triangleScore[t] > triangleScore[bestTriangle])
+            bestTriangle = t;
+    }
+
+    std::vector<u8> emitted(triangleCount, 0);
+    std::vector<u32> output;
+    output.reserve((size_t)triangleCount * 3);
+
+    u32 cache[VERTEX_CACHE_SIZE + 3];
+    u32 cacheCount = 0;
+    u32 scanCursor = 0;
+
+    for (u32 emittedCount = 0; emittedCount < triangleCount; ++emittedCount)
+    {
+        // nothing left around the cache: the next triangle in the original order
+        if (bestTriangle == UINT32_MAX)
+        {
+            while (emitted[scanCursor])
+                scanCursor++;
+            bestTriangle = scanCursor;
+        }
+
+        emitted[bestTriangle] = 1;
+        const u32* triangle = &indices[bestTriangle * 3];
+        output.insert(output.end(), triangle, triangle + 3);
+
+        // the triangle is done for its vertices
+        for (u32 k = 0; k < 3; ++k)
+        {
+            const u32 v = triangle[k];
+            u32* triangles = &vertexTriangles[triangleBegin[v]];
+            for (u32 i = 0; i < remaining[v]; ++i)
+            {
+                if (triangles[i] == bestTriangle)
+                {
+                    std::swap(triangles[i], triangles[remaining[v] - 1]);
+                    break;
+                }
+            }
+            remaining[v]--;
+        }
+
+        // its vertices go to the front, the ones pushed past the end fall out
+        u32 newCache[VERTEX_CACHE_SIZE + 3];
+        u32 newCacheCount = 0;
+        for (u32 k = 0; k < 3; ++k)
+            if (newCacheCount == 0 || (triangle[k] != newCache[0] && (newCacheCount < 2 || triangle[k] != newCache[1])))
+                newCache[newCacheCount++] = triangle[k];
+        for (u32 i = 0; i < cacheCount; ++i)
+            if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+                newCache[newCacheCount++] = cache[i];
+
+        for (u32 i = 0; i < newCacheCount; ++i)
+        {
+            const u32 v = newCache[i];
+            cachePosition[v] = (i < VERTEX_CACHE_SIZE) ? (i32)i : -1;
+
+            const f32 score = ForsythVertexScore(cachePosition[v], remaining[v]);
+            const f32 delta = score - vertexScore[v];
+            vertexScore[v] = score;
+
+            const u32* triangles = &vertexTriangles[triangleBegin[v]];
+            for (u32 j = 0; j < remaining[v]; ++j)
+                triangleScore[triangles[j]] += delta;
+        }
+
+        // the next one among the triangles of the cached vertices
+        bestTriangle = UINT32_MAX;
+        f32 bestScore = -FLT_MAX;
+        for (u32 i = 0; i < newCacheCount && i < VERTEX_CACHE_SIZE; ++i)
+        {
+            const u32 v = newCache[i];
+            const u32* triangles = &vertexTriangles[triangleBegin[v]];
+            for (u32 j = 0; j < remaining[v]; ++j)
+            {
+                if (triangleScore[triangles[j]] > bestScore)
+                {
+                    bestScore = triangleScore[triangles[j]];
+                    bestTriangle = triangles[j];
+                }
+            }
+        }
+
+        cacheCount = glm::min(newCacheCount, (u32)VERTEX_CACHE_SIZE);
+        memcpy(cache, newCache, cacheCount * sizeof(u32));
+    }
+
+    indices.swap(output);
+}
+
+// FIFO post transform cache: a vertex is cached while fewer than the cache
+// size misses happened since its own. Flushing just moves the clock ahead.
+struct SimulatedVertexCache
+{
+    std::vector<u32> timestamps;
+    u32 timestamp = VERTEX_CACHE_SIMULATED_SIZE + 1;
+
+    explicit SimulatedVertexCache(u32 vertexCount) : timestamps(vertexCount, 0) {}
+
+    bool Miss(u32 v)
+    {
+        if (timestamp - timestamps[v] <= VERTEX_CACHE_SIMULATED_SIZE)
+            return false;
+        timestamps[v] = timestamp++;
+        return true;
+    }
+
+    u32 Misses(const u32* triangle)
+    {
+        return (u32)Miss(triangle[0]) + (u32)Miss(triangle[1]) + (u32)Miss(triangle[2]);
+    }
+
+    void Flush()
+    {
+        timestamp += VERTEX_CACHE_SIMULATED_SIZE + 1;
+    }
+};
+
+void OptimizeOverdraw(const std::vector<float>& vertices, u32 strideFloats, std::vector<u32>& indices, f32 threshold)
+{
+    const u32 triangleCount = (u32)(indices.size() / 3);
+    const u32 vertexCount = strideFloats ? (u32)(vertices.size() / strideFloats) : 0;
+    if (triangleCount < 2 || vertexCount == 0)
+        return;
+
+    // hard boundaries: triangles none of whose vertices are in the cache
+    SimulatedVertexCache cache(vertexCount);
+    std::vector<u32> hardClusters;
+    for (u32 t = 0; t < triangleCount; ++t)
+        if (cache.Misses(&indices[t * 3]) == 3 || t == 0)
+            hardClusters.push_back(t);
+    hardClusters.push_back(triangleCount);
+
+    // soft boundaries: as soon as the ACMR since the last cut gets within the
+    // threshold of the whole cluster's
+    std::vector<u32> clusters;
+    for (u32 c = 0; c + 1 < hardClusters.size(); ++c)
+    {
+        const u32 begin = hardClusters[c];
+        const u32 end = hardClusters[c + 1];
+
+        cache.Flush();
+        u32 clusterMisses = 0;
+        for (u32 t = begin; t < end; ++t)
+            clusterMisses += cache.Misses(&indices[t * 3]);
+        const f32 clusterThreshold = threshold * clusterMisses / (f32)(end - begin);
+
+        clusters.push_back(begin);
+        cache.Flush();
+        u32 misses = 0, triangles = 0;
+        for (u32 t = begin; t < end; ++t)
+        {
+            misses += cache.Misses(&indices[t * 3]);
+            triangles++;
+            if (misses <= clusterThreshold * triangles)
+            {
+                clusters.push_back(t + 1);
+                cache.Flush();
+                misses = 0;
+                triangles = 0;
+            }
+        }
+
+        // the last triangle may have cut an empty cluster
+        if (clusters.back() == end)
+            clusters.pop_back();
+    }
+    clusters.push_back(triangleCount);
+    const u32 clusterCount = (u32)clusters.size() - 1;
+
+    // area weighted centroid and normal of every cluster
+    std::vector<vec3> clusterCentroids(clusterCount);
+    std::vector<vec3> clusterNormals(clusterCount);
+    std::vector<f32> clusterAreas(clusterCount);
+    const float* data = vertices.data();
+    ParallelFor(clusterCount, 64, [&](u32 begin, u32 end)
+    {
+        for (u32 c = begin; c < end; ++c)
+        {
+            vec3 centroid(0.0f), normal(0.0f);
+            f32 area = 0.0f;
+            for (u32 t = clusters[c]; t < clusters[c + 1]; ++t)
+            {
+                const vec3 p0 = glm::make_vec3(data + (size_t)indices[t * 3 + 0] * strideFloats);
+                const vec3 p1 = glm::make_vec3(data + (size_t)indices[t * 3 + 1] * strideFloats);
+                const vec3 p2 = glm::make_vec3(data + (size_t)indices[t * 3 + 2] * strideFloats);
+                const vec3 triangleNormal = glm::cross(p1 - p0, p2 - p0);
+                const f32 triangleArea = glm::length(triangleNormal);
+
+                centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+                normal += triangleNormal;
+                area += triangleArea;
+            }
+            clusterCentroids[c] = (area > 0.0f) ? centroid / area : vec3(0.0f);
+            clusterNormals[c] = SafeNormalize(normal);
+            clusterAreas[c] = area;
+        }
+    });
+
+    vec3 meshCentroid(0.0f);
+    f32 meshArea = 0.0f;
+    for (u32 c = 0; c < clusterCount; ++c)
+    {
+        meshCentroid += clusterCentroids[c] * clusterAreas[c];
+        meshArea += clusterAreas[c];
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    std::vector<f32> sortKeys(clusterCount);
+    for (u32 c = 0; c < clusterCount; ++c)
+        sortKeys[c] = glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c]);
+
+    std::vector<u32> order(clusterCount);
+    for (u32 c = 0; c < clusterCount; ++c)
+        order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&](u32 a, u32 b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<u32> output;
+    output.reserve(indices.size());
+    for (u32 c : order)
+        output.insert(output.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+    indices.swap(output);
+}
+
+void OptimizeVertexFetch(std::vector<float>& vertices, u32 strideFloats, std::vector<u32>& indices)
+{
+    const u32 vertexCount = strideFloats ? (u32)(vertices.size() / strideFloats) : 0;
+    if (vertexCount == 0)
+        return;
+
+    std::vector<u32> remap(vertexCount, UINT32_MAX);
+    u32 usedCount = 0;
+    for (u32& index : indices)
+    {
+        if (remap[index] == UINT32_MAX)
+            remap[index] = usedCount++;
+        index = remap[index];
+    }
+
+    std::vector<float> reordered((size_t)usedCount * strideFloats);
+    ParallelFor(vertexCount, MESH_PROCESSING_BATCH_SIZE, [&](u32 begin, u32 end)
+    {
+        for (u32 v = begin; v < end; ++v)
+            if (remap[v] != UINT32_MAX)
+                memcpy(&reordered[(size_t)remap[v] * strideFloats], &vertices[(size_t)v * strideFloats], strideFloats * sizeof(float));
+    });
+    vertices.swap(reordered);
+}
+
+void AnalyzeVertexCache(const std::vector<u32>& indices, u32 vertexCount, f32& acmr, f32& atvr)
+{
+    acmr = 0.0f;
+    atvr = 0.0f;
+    if (indices.size() < 3 || vertexCount == 0)
+        return;
+
+    SimulatedVertexCache cache(vertexCount);
+    std::vector<u8> referenced(vertexCount, 0);
+    u32 misses = 0, referencedCount = 0;
+    for (u32 index : indices)
+    {
+        misses += cache.Miss(index);
+        referencedCount += !referenced[index];
+        referenced[index] = 1;
+    }
+
+    acmr = misses / (f32)(indices.size() / 3);
+    atvr = misses / (f32)referencedCount;
+}
+
+f32 AnalyzeVertexFetch(const std::vector<u32>& indices, u32 vertexCount, u32 vertexSize)
+{
+    if (indices.empty() || vertexCount == 0 || vertexSize == 0)
+        return 0.0f;
+
+    // only what misses the post transform cache is fetched, a line at a time
+    const u32 lineCount = VERTEX_FETCH_CACHE_SIZE / VERTEX_FETCH_CACHE_LINE;
+    std::vector<u64> lines(lineCount, UINT64_MAX);
+    SimulatedVertexCache cache(vertexCount);
+    std::vector<u8> referenced(vertexCount, 0);
+    u64 fetchedBytes = 0, referencedBytes = 0;
+    for (u32 index : indices)
+    {
+        if (!referenced[index])
+            referencedBytes += vertexSize;
+        referenced[index] = 1;
+
+        if (!cache.Miss(index))
+            continue;
+
+        const u64 first = (u64)index * vertexSize / VERTEX_FETCH_CACHE_LINE;
+        const u64 last = ((u64)index * vertexSize + vertexSize - 1) / VERTEX_FETCH_CACHE_LINE;
+        for (u64 line = first; line <= last; ++line)
+        {
+            u64& cached = lines[line % lineCount];
+            if (cached != line)
+                fetchedBytes += VERTEX_FETCH_CACHE_LINE;
+            cached = line;
+        }
+    }
+
+    return fetchedBytes / (f32)referencedBytes;
+}
+
+// Half space rasterizer for one axis: triangles facing +axis go to the first
+// view, the rest to the one looking from the other side. Depth is the
+// distance to the camera, fragments closer than the buffer are shaded.
+static void RasterizeOverdrawAxis(const std::vector<float>& vertices, u32 strideFloats, const std::vector<u32>& indices,
+                                  u32 axis, const vec3& boundsMin, const vec3& boundsMax, f32 scale, u64& shaded, u64& covered)
+{
+    const u32 uAxis = (axis + 1) % 3;
+    const u32 vAxis = (axis + 2) % 3;
+    std::vector<f32> depth[2];
+    depth[0].assign(OVERDRAW_VIEW_SIZE * OVERDRAW_VIEW_SIZE, FLT_MAX);
+    depth[1].assign(OVERDRAW_VIEW_SIZE * OVERDRAW_VIEW_SIZE, FLT_MAX);
+
+    for (u32 t = 0; t < indices.size() / 3; ++t)
+    {
+        vec3 p[3];  // view space: pixels and depth from the +axis camera
+        for (u32 k = 0; k < 3; ++k)
+        {
+            const float* position = &vertices[(size_t)indices[t * 3 + k] * strideFloats];
+            p[k] = vec3((position[uAxis] - boundsMin[uAxis]) * scale,
+                        (position[vAxis] - boundsMin[vAxis]) * scale,
+                        boundsMax[axis] - position[axis]);
+        }
+
+        f32 area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+        if (area == 0.0f)
+            continue;
+
+        // seen from -axis: counter clockwise once mirrored, depth from the other side
+        const u32 view = (area > 0.0f) ? 0 : 1;
+        if (view == 1)
+        {
+            std::swap(p[1], p[2]);
+            area = -area;
+            for (u32 k = 0; k < 3; ++k)
+                p[k].z = (boundsMax[axis] - boundsMin[axis]) - p[k].z;
+        }
+
+        const i32 minX = glm::max((i32)floorf(glm::min(p[0].x, glm::min(p[1].x, p[2].x))), 0);
+        const i32 minY = glm::max((i32)floorf(glm::min(p[0].y, glm::min(p[1].y, p[2].y))), 0);
+        const i32 maxX = glm::min((i32)ceilf(glm::max(p[0].x, glm::max(p[1].x, p[2].x))), OVERDRAW_VIEW_SIZE - 1);
+        const i32 maxY = glm::min((i32)ceilf(glm::max(p[0].y, glm::max(p[1].y, p[2].y))), OVERDRAW_VIEW_SIZE - 1);
+
+        f32* buffer = depth[view].data();
+        for (i32 y = minY; y <= maxY; ++y)
+        {
+            for (i32 x = minX; x <= maxX; ++x)
+            {
+                const vec2 center(x + 0.5f, y + 0.5f);
+                const f32 w0 = (p[2].x - p[1].x) * (center.y - p[1].y) - (p[2].y - p[1].y) * (center.x - p[1].x);
+                const f32 w1 = (p[0].x - p[2].x) * (center.y - p[2].y) - (p[0].y - p[2].y) * (center.x - p[2].x);
+                const f32 w2 = area - w0 - w1;
+                if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                    continue;
+
+                const f32 z = (w0 * p[0].z + w1 * p[1].z + w2 * p[2].z) / area;
+                f32& stored = buffer[y * OVERDRAW_VIEW_SIZE + x];
+                if (z >= stored)
+                    continue;
+
+                covered += (stored == FLT_MAX);
+                shaded++;
+                stored = z;
+            }
+        }
+    }
+}
+
+f32 AnalyzeOverdraw(const std::vector<float>& vertices, u32 strideFloats, const std::vector<u32>& indices)
+{
+    const u32 vertexCount = strideFloats ? (u32)(vertices.size() / strideFloats) : 0;
+    if (indices.size() < 3 || vertexCount == 0)
+        return 0.0f;
+
+    vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+    for (u32 v = 0; v < vertexCount; ++v)
+    {
+        const vec3 position = glm::make_vec3(&vertices[(size_t)v * strideFloats]);
+        boundsMin = glm::min(boundsMin, position);
+        boundsMax = glm::max(boundsMax, position);
+    }
+
+    // the same pixel size on every axis
+    const vec3 extent = boundsMax - boundsMin;
+    const f32 maxExtent = glm::max(extent.x, glm::max(extent.y, extent.z));
+    if (maxExtent <= 0.0f)
+        return 0.0f;
+    const f32 scale = OVERDRAW_VIEW_SIZE / maxExtent;
+
+    u64 shaded[3] = {}, covered[3] = {};
+    ParallelFor(3, 1, [&](u32 begin, u32 end)
+    {
+        for (u32 axis = begin; axis < end; ++axis)
+            RasterizeOverdrawAxis(vertices, strideFloats, indices, axis, boundsMin, boundsMax, scale, shaded[axis], covered[axis]);
+    });
+
+    const u64 totalCovered = covered[0] + covered[1] + covered[2];
+    return totalCovered ? (shaded[0] + shaded[1] + shaded[2]) / (f32)totalCovered : 0.0f;
+}
+
+MeshDrawStats AnalyzeSubmesh(const Submesh& submesh)
+{
+    MeshDrawStats stats = {};
+    const u32 stride = submesh.vertexBufferLayout.stride;
+    const u32 strideFloats = stride / sizeof(float);
+    const u32 vertexCount = strideFloats ? (u32)(submesh.vertices.size() / strideFloats) : 0;
+
+    AnalyzeVertexCache(submesh.indices, vertexCount, stats.acmr, stats.atvr);
+    stats.overfetch = AnalyzeVertexFetch(submesh.indices, vertexCount, stride);
+    stats.overdraw = AnalyzeOverdraw(submesh.vertices, strideFloats, submesh.indices);
+    return stats;
+}
+
+void MakeQuantizedVertexLayout(const Submesh& submesh, VertexBufferLayout& quantized)
+{
+    const VertexBufferLayout& layout = submesh.vertexBufferLayout;
+    const u32 strideFloats = layout.stride / sizeof(float);
+    const i32 texCoordOffset = FindAttributeOffset(layout, 2, 2);
+    f32 maxTexCoord = 0.0f;
+    if (texCoordOffset >= 0)
+        for (size_t i = texCoordOffset; i + 1 < submesh.vertices.size(); i += strideFloats)
+            maxTexCoord = glm::max(maxTexCoord, glm::max(fabsf(submesh.vertices[i]), fabsf(submesh.vertices[i + 1])));
+
+    quantized.attributes.clear();
+    u32 offset = 0;
+    for (const VertexBufferAttribute& attribute : layout.attributes)
+    {
+        VertexBufferAttribute packed = attribute;
+        packed.offset = (u16)offset;
+        if (attribute.type == GL_FLOAT && attribute.location == 0 && attribute.componentCount == 3)
+        {
+            packed.type = GL_SHORT;
+            packed.normalized = true;
+            offset += 4 * sizeof(i16);
+        }
+        else if (attribute.type == GL_FLOAT && attribute.location == 1 && attribute.componentCount == 3)
+        {
+            packed = MakeVertexAttribute<Normal4n>(offset);
+            offset += Normal4n::size;
+        }
+        else if (attribute.type == GL_FLOAT && attribute.location == 3 && attribute.componentCount == 4)
+        {
+            packed = MakeVertexAttribute<Tangent4n>(offset);
+            offset += Tangent4n::size;
+        }
+        else if (attribute.type == GL_FLOAT && attribute.location == 2 && attribute.componentCount == 2 && maxTexCoord < HALF_TEXCOORD_MAX)
+        {
+            packed = MakeVertexAttribute<TexCoord2h>(offset);
+            offset += TexCoord2h::size;
+        }
+        else
+        {
+            offset += attribute.componentCount * sizeof(float);
+        }
+        quantized.attributes.push_back(packed);
+    }
+    quantized.stride = (u16)offset;
+}
+
+// Zero vectors (missing normals) pack as zero, no error there
+static f32 AngleDegrees(const vec3& a, const vec3& b)
+{
+    const vec3 na = SafeNormalize(a), nb = SafeNormalize(b);
+    if (na == vec3(0.0f) || nb == vec3(0.0f))
+        return 0.0f;
+    return glm::degrees(acosf(glm::clamp(glm::dot(na, nb), -1.0f, 1.0f)));
+}
+
+void QuantizeVertices(Submesh& submesh, const VertexBufferLayout& quantizedLayout, u8* dst)
+{
+    const VertexBufferLayout& layout = submesh.vertexBufferLayout;
+    const u32 strideFloats = layout.stride / sizeof(float);
+    const u32 vertexCount = strideFloats ? (u32)(submesh.vertices.size() / strideFloats) : 0;
+    const float* vertices = submesh.vertices.data();
+
+    vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+    const i32 positionOffset = FindAttributeOffset(layout, 0, 3);
+    if (positionOffset >= 0)
+    {
+        for (u32 v = 0; v < vertexCount; ++v)
+        {
+            const vec3 position = glm::make_vec3(vertices + (size_t)v * strideFloats + positionOffset);
+            boundsMin = glm::min(boundsMin, position);
+            boundsMax = glm::max(boundsMax, position);
+        }
+    }
+    const vec3 center = (vertexCount > 0) ? (boundsMin + boundsMax) * 0.5f : vec3(0.0f);
+    const vec3 halfExtent = (vertexCount > 0) ? (boundsMax - boundsMin) * 0.5f : vec3(0.0f);
+    const vec3 invHalfExtent(halfExtent.x > 0.0f ? 1.0f / halfExtent.x : 0.0f,
+                             halfExtent.y > 0.0f ? 1.0f / halfExtent.y : 0.0f,
+                             halfExtent.z > 0.0f ? 1.0f / halfExtent.z : 0.0f);
+
+    // worst error of each batch, measured on what was actually packed
+    const u32 batchCount = (vertexCount + MESH_PROCESSING_BATCH_SIZE - 1) / MESH_PROCESSING_BATCH_SIZE;
+    std::vector<QuantizationError> batchErrors(batchCount, QuantizationError{});
+    ParallelFor(batchCount, 1, [&](u32 begin, u32 end)
+    {
+        for (u32 batch = begin; batch < end; ++batch)
+        {
+            QuantizationError& error = batchErrors[batch];
+            const u32 last = glm::min((batch + 1) * MESH_PROCESSING_BATCH_SIZE, vertexCount);
+            for (u32 v = batch * MESH_PROCESSING_BATCH_SIZE; v < last; ++v)
+            {
+                const float* src = vertices + (size_t)v * strideFloats;
+                u8* vertex = dst + (size_t)v * quantizedLayout.stride;
+                for (u32 a = 0; a < layout.attributes.size(); ++a)
+                {
+                    const VertexBufferAttribute& attribute = layout.attributes[a];
+                    const VertexBufferAttribute& packed = quantizedLayout.attributes[a];
+                    const float* value = src + attribute.offset / sizeof(float);
+                    u8* out = vertex + packed.offset;
+
+                    if (packed.type == GL_SHORT)
+                    {
+                        const vec3 position = glm::make_vec3(value);
+                        const u64 bits = glm::packSnorm4x16(vec4((position - center) * invHalfExtent, 0.0f));
+                        memcpy(out, &bits, sizeof(bits));
+
+                        const vec3 unpacked = vec3(glm::unpackSnorm4x16(bits)) * halfExtent + center;
+                        error.position = glm::max(error.position, glm::length(unpacked - position));
+                    }
+                    else if (packed.type == Normal4n::type && packed.location == Normal4n::location)
+                    {
+                        const vec3 normal = glm::make_vec3(value);
+                        const u32 bits = Normal4n::Pack(SafeNormalize(normal));
+                        memcpy(out, &bits, sizeof(bits));
+
+                        error.normal = glm::max(error.normal, AngleDegrees(Normal4n::Unpack(bits), normal));
+                    }
+                    else if (packed.type == Tangent4n::type && packed.location == Tangent4n::location)
+                    {
+                        const vec4 tangent = glm::make_vec4(value);
+                        const u32 bits = Tangent4n::Pack(vec4(SafeNormalize(vec3(tangent)), tangent.w));
+                        memcpy(out, &bits, sizeof(bits));
+
+                        error.tangent = glm::max(error.tangent, AngleDegrees(vec3(Tangent4n::Unpack(bits)), vec3(tangent)));
+                    }
+                    else if (packed.type == TexCoord2h::type && packed.location == TexCoord2h::location)
+                    {
+                        const vec2 texCoord = glm::make_vec2(value);
+                        const u32 bits = TexCoord2h::Pack(texCoord);
+                        memcpy(out, &bits, sizeof(bits));
+
+                        const vec2 difference = glm::abs(TexCoord2h::Unpack(bits) - texCoord);
+                        error.texCoord = glm::max(error.texCoord, glm::max(difference.x, difference.y));
+                    }
+                    else
+                    {
+                        memcpy(out, value, attribute.componentCount * sizeof(float));
+                    }
+                }
+            }
+        }
+    });
+
+    submesh.quantizationError = QuantizationError{};
+    for (const QuantizationError& error : batchErrors)
+    {
+        submesh.quantizationError.position = glm::max(submesh.quantizationError.position, error.position);
+        submesh.quantizationError.normal = glm::max(submesh.quantizationError.normal, error.normal);
+        submesh.quantizationError.tangent = glm::max(submesh.quantizationError.tangent, error.tangent);
+        submesh.quantizationError.texCoord = glm::max(submesh.quantizationError.texCoord, error.texCoord);
+    }
+    if (positionOffset >= 0)
+    {
+        submesh.positionScale = halfExtent;
+        submesh.positionOffset = center;
+    }
+}
+
+void ProcessSubmesh(Submesh& submesh, u32 steps)
+{
+    const u32 strideFloats = submesh.vertexBufferLayout.stride / sizeof(float);
+
+    if (steps & MeshProcessing_WeldVertices)
+        WeldVertices(submesh.vertices, strideFloats, submesh.indices);
+
+    if (steps & MeshProcessing_Tangents)
+        ComputeTangents(submesh);
+
+    const u32 reorderSteps = MeshProcessing_VertexCache | MeshProcessing_Overdraw | MeshProcessing_VertexFetch;
+    const bool reorder = (steps & reorderSteps) && strideFloats > 0;
+    if (reorder)
+        submesh.unoptimizedStats = AnalyzeSubmesh(submesh);
+
+    if ((steps & MeshProcessing_VertexCache) && strideFloats > 0)
+        OptimizeVertexCache(submesh.indices, (u32)(submesh.vertices.size() / strideFloats));
+
+    if ((steps & MeshProcessing_Overdraw) && strideFloats > 0)
+        OptimizeOverdraw(submesh.vertices, strideFloats, submesh.indices, OVERDRAW_ACMR_THRESHOLD);
+
+    if ((steps & MeshProcessing_VertexFetch) && strideFloats > 0)
+        OptimizeVertexFetch(submesh.vertices, strideFloats, submesh.indices);
+
+    if (reorder)
+        submesh.optimizedStats = AnalyzeSubmesh(submesh);
+
+    submesh.indexCount = (u32)submesh.indices.size();
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "engine.h"
+
+// Engine side versions of the Assimp steps that used to dominate the import
+// of large meshes (aiProcess_JoinIdenticalVertices, aiProcess_CalcTangentSpace
+// and aiProcess_ImproveCacheLocality), split over the job system, plus the
+// overdraw and vertex fetch reorders Assimp doesn't have. They work on the
+// interleaved vertices of a submesh, in the layout of MakeModelVertexLayout().
+//
+// The Analyze functions measure an order on the CPU, so the reorders can be
+// checked without a GPU (the cooker logs them too).
+
+// Vertices (or triangles) per job
+#define MESH_PROCESSING_BATCH_SIZE 16384
+
+// Entries of the LRU post transform cache the reorder optimizes for
+#define VERTEX_CACHE_SIZE 32
+
+// What the reports simulate: a FIFO post transform cache, a direct mapped
+// cache in front of the vertex buffer and 6 axis aligned views of the mesh
+#define VERTEX_CACHE_SIMULATED_SIZE 16
+#define VERTEX_FETCH_CACHE_LINE 64
+#define VERTEX_FETCH_CACHE_SIZE KB(128)
+#define OVERDRAW_VIEW_SIZE 256
+
+// ACMR the overdraw reorder may give up, relative to the cache order
+#define OVERDRAW_ACMR_THRESHOLD 1.05f
+
+enum MeshProcessingSteps
+{
+    MeshProcessing_WeldVertices  = 1 << 0,
+    MeshProcessing_Tangents      = 1 << 1,
+    MeshProcessing_VertexCache   = 1 << 2,
+    MeshProcessing_Overdraw      = 1 << 3,
+    MeshProcessing_VertexFetch   = 1 << 4,
+};
+
+// Joins the vertices whose attributes are bitwise equal (+0 and -0 alike),
+// keeping the first one of each group in its original order, and remaps the
+// indices. The vertices are hashed into partitions, each partition is joined
+// by its own job.
+void WeldVertices(std::vector<float>& vertices, u32 strideFloats, std::vector<u32>& indices);
+
+// Tangents the way MikkTSpace builds them: per triangle from the uv
+// derivatives, projected on the tangent plane of each corner and weighted by
+// the corner angle, then summed per vertex and orthonormalized against its
+// normal. Vertices aren't split where the uv mapping is mirrored (the welded
+// vertices are kept), the handedness in w follows the summed bitangent:
+// bitangent = cross(normal, tangent.xyz) * tangent.w, pointing towards +v.
+// Needs uvs and tangents in the layout.
+void ComputeTangents(Submesh& submesh);
+
+// Triangle order for the post transform vertex cache (Tom Forsyth's "Linear-
+// Speed Vertex Cache Optimisation"): greedily emits the triangle whose
+// vertices score best by cache position and remaining valence.
+void OptimizeVertexCache(std::vector<u32>& indices, u32 vertexCount);
+
+// Tipsify's second half (Sander et al., "Fast Triangle Reordering for Vertex
+// Locality and Reduced Overdraw"): cuts the cache ordered triangles into
+// clusters where the cache starts over, or where the ACMR so far is within
+// the threshold of the cluster's, and draws the clusters facing away from the
+// mesh center first, since those tend to occlude the rest.
+void OptimizeOverdraw(const std::vector<float>& vertices, u32 strideFloats, std::vector<u32>& indices, f32 threshold);
+
+// Vertices in the order the indices first use them, so the fetches walk the
+// buffer forward. Vertices no triangle uses are dropped.
+void OptimizeVertexFetch(std::vector<float>& vertices, u32 strideFloats, std::vector<u32>& indices);
+
+void AnalyzeVertexCache(const std::vector<u32>& indices, u32 vertexCount, f32& acmr, f32& atvr);
+f32 AnalyzeVertexFetch(const std::vector<u32>& indices, u32 vertexCount, u32 vertexSize);
+f32 AnalyzeOverdraw(const std::vector<float>& vertices, u32 strideFloats, const std::vector<u32>& indices);
+MeshDrawStats AnalyzeSubmesh(const Submesh& submesh);
+
+// Half uvs only below this, where their error stays under 1/2048
+#define HALF_TEXCOORD_MAX 2.0f
+
+// Uploaded layout of a submesh in a float layout of MakeModelVertexLayout():
+// positions as snorm16 relative to the submesh bounds (4 shorts, the last one
+// padding), normals and tangents as GL_INT_2_10_10_10_REV (the handedness fits
+// the 2 bits of w) and uvs as halfs: 20 bytes instead of 48. Tiled uvs past
+// HALF_TEXCOORD_MAX and other attributes stay floats.
+void MakeQuantizedVertexLayout(const Submesh& submesh, VertexBufferLayout& quantized);
+
+// Packs the float vertices of the submesh into dst, in the quantized layout.
+// Sets the position scale and offset and the error of the packed vertices.
+void QuantizeVertices(Submesh& submesh, const VertexBufferLayout& quantizedLayout, u8* dst);
+
+// The steps asked for on one submesh (with its indices), in the order above.
+// Sets indexCount, and the stats before and after the reorders if any ran.
+void ProcessSubmesh(Submesh& submesh, u32 steps);
@@ -0,0 +1,349 @@
+#include "ModelImport.h"
+#include "CookedMesh.h"
+#include "ObjLoader.h"
+#include "GltfLoader.h"
+#include "MeshProcessing.h"
+#include "VertexFormat.h"
+#include <cfloat>
+#pragma warning(disable : 4996) //disable printf warning
+
+// The layouts of MakeModelVertexLayout(). Meshes whose tangents Assimp didn't
+// compute leave them zero for ComputeTangents(), in the same layout.
+typedef VertexFormat<Position3f, Normal3f> PlainVertexFormat;
+typedef VertexFormat<Position3f, Normal3f, TexCoord2f> TexturedVertexFormat;
+typedef VertexFormat<Position3f, Normal3f, Tangent4f> TangentVertexFormat;
+typedef VertexFormat<Position3f, Normal3f, TexCoord2f, Tangent4f> TexturedTangentVertexFormat;
+typedef VertexFormat<Position3f, Normal3f, TexCoord2f, EmptyTangent4f> TexturedEmptyTangentVertexFormat;
+
+static_assert(TexturedEmptyTangentVertexFormat::hash == TexturedTangentVertexFormat::hash, "tangents left to ComputeTangents() need the same layout");
+
+// Sized once up front, then written by the format's own loop
+template <typename Format>
+static void InterleaveVertices(const aiMesh* mesh, std::vector<float>& vertices, VertexBufferLayout& vertexBufferLayout)
+{
+    Format::MakeLayout(vertexBufferLayout);
+    vertices.resize((size_t)mesh->mNumVertices * (Format::stride / sizeof(float)));
+    if (mesh->mNumVertices > 0)
+        Format::Convert(mesh, (u8*)vertices.data());
+}
+
+void MakeModelVertexLayout(bool hasTexCoords, bool hasTangentSpace, VertexBufferLayout& vertexBufferLayout)
+{
+    if (hasTexCoords && hasTangentSpace) TexturedTangentVertexFormat::MakeLayout(vertexBufferLayout);
+    else if (hasTexCoords)               TexturedVertexFormat::MakeLayout(vertexBufferLayout);
+    else if (hasTangentSpace)            TangentVertexFormat::MakeLayout(vertexBufferLayout);
+    else                                 PlainVertexFormat::MakeLayout(vertexBufferLayout);
+}
+
+void InterleaveAssimpVertices(const aiMesh* mesh, std::vector<float>& vertices, VertexBufferLayout& vertexBufferLayout)
+{
+    // tangents with any uvs, from Assimp if it computed them
+    const bool hasTexCoords = mesh->mTextureCoords[0] != nullptr;
+    const bool copyTangents = mesh->mTangents != nullptr && mesh->mBitangents != nullptr;
+
+    if (hasTexCoords && copyTangents) InterleaveVertices<TexturedTangentVertexFormat>(mesh, vertices, vertexBufferLayout);
+    else if (hasTexCoords)            InterleaveVertices<TexturedEmptyTangentVertexFormat>(mesh, vertices, vertexBufferLayout);
+    else                              InterleaveVertices<PlainVertexFormat>(mesh, vertices, vertexBufferLayout);
+}
+
+void CopyAssimpIndices(const aiMesh* mesh, std::vector<u32>& indices)
+{
+    // triangles only after aiProcess_Triangulate + aiProcess_SortByPType
+    if (mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE)
+    {
+        indices.resize((size_t)mesh->mNumFaces * 3);
+        u32* dst = indices.data();
+        for (u32 i = 0; i < mesh->mNumFaces; ++i, dst += 3)
+        {
+            const unsigned int* faceIndices = mesh->mFaces[i].mIndices;
+            dst[0] = faceIndices[0];
+            dst[1] = faceIndices[1];
+            dst[2] = faceIndices[2];
+        }
+        return;
+    }
+
+    size_t indexCount = 0;
+    for (u32 i = 0; i < mesh->mNumFaces; ++i)
+        indexCount += mesh->mFaces[i].mNumIndices;
+
+    indices.resize(indexCount);
+    u32* dst = indices.data();
+    for (u32 i = 0; i < mesh->mNumFaces; ++i)
+    {
+        const aiFace& face = mesh->mFaces[i];
+        memcpy(dst, face.mIndices, face.mNumIndices * sizeof(u32));
+        dst += face.mNumIndices;
+    }
+}
+
+void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+{
+    // store the proper (previously proceessed) material for this mesh
+    submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
+
+    // add the submesh into the mesh
+    myMesh->submeshes.push_back(Submesh{});
+    Submesh& submesh = myMesh->submeshes.back();
+    InterleaveAssimpVertices(mesh, submesh.vertices, submesh.vertexBufferLayout);
+    CopyAssimpIndices(mesh, submesh.indices);
+    submesh.indexCount = submesh.indices.size();
+}
+
+void ProcessAssimpMaterial(aiMaterial* material, ImportedMaterial& myImportedMaterial, const std::string& directory)
+{
+    Material& myMaterial = myImportedMaterial.material;
+
+    aiString name;
+    aiColor3D diffuseColor;
+    aiColor3D emissiveColor;
+    aiColor3D specularColor;
+    ai_real shininess;
+    material->Get(AI_MATKEY_NAME, name);
+    material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuseColor);
+    material->Get(AI_MATKEY_COLOR_EMISSIVE, emissiveColor);
+    material->Get(AI_MATKEY_COLOR_SPECULAR, specularColor);
+    material->Get(AI_MATKEY_SHININESS, shininess);
+
+    myMaterial.name = name.C_Str();
+
+    // no texture unless the material says otherwise (resolved to the
+    // white/black/normal placeholder textures when building the material table)
+    myMaterial.albedoTextureIdx = UINT32_MAX;
+    myMaterial.emissiveTextureIdx = UINT32_MAX;
+    myMaterial.specularTextureIdx = UINT32_MAX;
+    myMaterial.normalsTextureIdx = UINT32_MAX;
+    myMaterial.bumpTextureIdx = UINT32_MAX;
+    myMaterial.albedo = vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b);
+    myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
+    myMaterial.smoothness = shininess / 256.0f;
+
+    // (std::string paths, the String helpers allocate from the frame arena
+    // which isn't safe to use from the workers)
+    aiString aiFilename;
+    if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
+    {
+        material->GetTexture(aiTextureType_DIFFUSE, 0, &aiFilename);
+        myImportedMaterial.albedoMap = directory + "/" + aiFilename.C_Str();
+    }
+    if (material->GetTextureCount(aiTextureType_EMISSIVE) > 0)
+    {
+        material->GetTexture(aiTextureType_EMISSIVE, 0, &aiFilename);
+        myImportedMaterial.emissiveMap = directory + "/" + aiFilename.C_Str();
+    }
+    if (material->GetTextureCount(aiTextureType_SPECULAR) > 0)
+    {
+        material->GetTexture(aiTextureType_SPECULAR, 0, &aiFilename);
+        myImportedMaterial.specularMap = directory + "/" + aiFilename.C_Str();
+    }
+    if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
+    {
+        material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
+        myImportedMaterial.normalsMap = directory + "/" + aiFilename.C_Str();
+    }
+    if (material->GetTextureCount(aiTextureType_HEIGHT) > 0)
+    {
+        material->GetTexture(aiTextureType_HEIGHT, 0, &aiFilename);
+        myImportedMaterial.bumpMap = directory + "/" + aiFilename.C_Str();
+    }
+
+    //myMaterial.createNormalFromBump();
+}
+
+void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+{
+    // process all the node's meshes (if any)
+    for (unsigned int i = 0; i < node->mNumMeshes; i++)
+    {
+        aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+        ProcessAssimpMesh(scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+    }
+
+    // then do the same for each of its children
+    for (unsigned int i = 0; i < node->mNumChildren; i++)
+    {
+        ProcessAssimpNode(scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+    }
+}
+
+void ComputeNodeBounds(ModelImport& import, const std::vector<vec3>& submeshBoundsMin, const std::vector<vec3>& submeshBoundsMax)
+{
+    import.boundsMin = vec3(FLT_MAX);
+    import.boundsMax = vec3(-FLT_MAX);
+    import.mesh.boundingRadius = 0.0f;
+
+    const u32 submeshCount = (u32)submeshBoundsMin.size();
+    const ModelNode identityNode = { "", UINT32_MAX, IdentityMatrix, IdentityMatrix, 0, submeshCount };
+    const u32 nodeCount = import.nodes.empty() ? 1 : (u32)import.nodes.size();
+    for (u32 n = 0; n < nodeCount; ++n)
+    {
+        const ModelNode& node = import.nodes.empty() ? identityNode : import.nodes[n];
+        for (u32 i = node.firstSubmesh; i < node.firstSubmesh + node.submeshCount && i < submeshCount; ++i)
+        {
+            // (no vertices)
+            if (submeshBoundsMin[i].x > submeshBoundsMax[i].x)
+                continue;
+
+            // the corners of the box, the radius is conservative
+            for (u32 corner = 0; corner < 8; ++corner)
+            {
+                const vec3 local((corner & 1) ? submeshBoundsMax[i].x : submeshBoundsMin[i].x,
+                                 (corner & 2) ? submeshBoundsMax[i].y : submeshBoundsMin[i].y,
+                                 (corner & 4) ? submeshBoundsMax[i].z : submeshBoundsMin[i].z);
+                const vec3 position = vec3(node.modelMatrix * vec4(local, 1.0f));
+                import.boundsMin = glm::min(import.boundsMin, position);
+                import.boundsMax = glm::max(import.boundsMax, position);
+                import.mesh.boundingRadius = glm::max(import.mesh.boundingRadius, glm::length(position));
+            }
+        }
+    }
+}
+
+static mat4x4 ToMat4x4(const aiMatrix4x4& matrix)
+{
+    // row major in Assimp
+    return mat4x4(matrix.a1, matrix.b1, matrix.c1, matrix.d1,
+                  matrix.a2, matrix.b2, matrix.c2, matrix.d2,
+                  matrix.a3, matrix.b3, matrix.c3, matrix.d3,
+                  matrix.a4, matrix.b4, matrix.c4, matrix.d4);
+}
+
+// Submesh i is scene->mMeshes[i]. A ModelNode draws a range of submeshes, so
+// an aiNode whose meshes aren't consecutive gets one extra child per run.
+static void ProcessAssimpNodeHierarchy(const aiNode* node, u32 parent, std::vector<ModelNode>& nodes)
+{
+    ModelNode modelNode;
+    modelNode.name = node->mName.C_Str();
+    modelNode.parent = parent;
+    modelNode.localMatrix = ToMat4x4(node->mTransformation);
+    modelNode.modelMatrix = (parent == UINT32_MAX) ? modelNode.localMatrix : nodes[parent].modelMatrix * modelNode.localMatrix;
+    modelNode.firstSubmesh = 0;
+    modelNode.submeshCount = 0;
+    nodes.push_back(modelNode);
+    const u32 nodeIdx = (u32)nodes.size() - 1;
+
+    for (u32 i = 0; i < node->mNumMeshes;)
+    {
+        u32 runLength = 1;
+        while (i + runLength < node->mNumMeshes && node->mMeshes[i + runLength] == node->mMeshes[i] + runLength)
+            runLength++;
+
+        if (nodes[nodeIdx].submeshCount == 0)
+        {
+            nodes[nodeIdx].firstSubmesh = node->mMeshes[i];
+            nodes[nodeIdx].submeshCount = runLength;
+        }
+        else
+        {
+            ModelNode run = nodes[nodeIdx];
+            run.parent = nodeIdx;
+            run.localMatrix = IdentityMatrix;
+            run.firstSubmesh = node->mMeshes[i];
+            run.submeshCount = runLength;
+            nodes.push_back(run);
+        }
+        i += runLength;
+    }
+
+    for (u32 i = 0; i < node->mNumChildren; ++i)
+        ProcessAssimpNodeHierarchy(node->mChildren[i], nodeIdx, nodes);
+}
+
+bool ImportAssimpModel(ModelImport& import)
+{
+    const aiScene* scene = aiImportFile(import.filepath.c_str(), import.importFlags);
+
+    if (!scene)
+    {
+        import.error = aiGetErrorString();
+        return false;
+    }
+
+    const size_t directoryEnd = import.filepath.find_last_of("/\\");
+    const std::string directory = directoryEnd == std::string::npos ? "." : import.filepath.substr(0, directoryEnd);
+
+    import.materials.resize(scene->mNumMaterials);
+    for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+        ProcessAssimpMaterial(scene->mMaterials[i], import.materials[i], directory);
+
+    if (import.materialsImported)
+        import.materialsImported(import);
+
+    // material indices are relative to the materials of the model until it is finished
+    if (import.importFlags & aiProcess_PreTransformVertices)
+    {
+        ProcessAssimpNode(scene, scene->mRootNode, &import.mesh, 0, import.submeshMaterialIdx);
+    }
+    else
+    {
+        // every mesh once, the nodes instance them
+        for (u32 i = 0; i < scene->mNumMeshes; ++i)
+            ProcessAssimpMesh(scene, scene->mMeshes[i], &import.mesh, 0, import.submeshMaterialIdx);
+        ProcessAssimpNodeHierarchy(scene->mRootNode, UINT32_MAX, import.nodes);
+    }
+
+    aiReleaseImport(scene);
+
+    // the steps the flags don't ask Assimp for, on the workers
+    u32 steps = 0;
+    if (!(import.importFlags & aiProcess_JoinIdenticalVertices))
+        steps |= MeshProcessing_WeldVertices;
+    if (!(import.importFlags & aiProcess_CalcTangentSpace))
+        steps |= MeshProcessing_Tangents;
+    if (!(import.importFlags & aiProcess_ImproveCacheLocality))
+        steps |= MeshProcessing_VertexCache;
+    steps |= MeshProcessing_Overdraw | MeshProcessing_VertexFetch;
+
+    JobCounter jobs;
+    for (Submesh& submesh : import.mesh.submeshes)
+    {
+        Submesh* processedSubmesh = &submesh;
+        RunJob([processedSubmesh, steps]() { ProcessSubmesh(*processedSubmesh, steps); }, &jobs);
+    }
+    WaitForJobCounter(jobs);
+
+    return true;
+}
+
+// What the reorders of MeshProcessing did, from the CPU simulators
+static void LogMeshDrawStats(const ModelImport& import)
+{
+    for (u32 i = 0; i < import.mesh.submeshes.size(); ++i)
+    {
+        const MeshDrawStats& before = import.mesh.submeshes[i].unoptimizedStats;
+        const MeshDrawStats& after = import.mesh.submeshes[i].optimizedStats;
+        if (after.acmr == 0.0f)
+            continue;
+
+        ILOG("%s submesh %u: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overdraw %.3f -> %.3f, overfetch %.3f -> %.3f",
+             import.filepath.c_str(), i, before.acmr, after.acmr, before.atvr, after.atvr,
+             before.overdraw, after.overdraw, before.overfetch, after.overfetch);
+    }
+}
+
+bool ImportModel(ModelImport& import)
+{
+    // already in a layout the buffers can be uploaded from
+    if (IsGlbFile(import.filepath) && ImportGlbModel(import))
+        return true;
+
+    if (import.cookMeshes && !import.forceImport && MapCookedMesh(import))
+    {
+        if (import.materialsImported)
+            import.materialsImported(import);
+        return true;
+    }
+
+    // Assimp only when the native loader can't read it
+    const bool imported = (import.fastObjImport && IsObjFile(import.filepath) && ImportObjModel(import)) ||
+                          ImportAssimpModel(import);
+    if (!imported)
+        return false;
+
+    LogMeshDrawStats(import);
+    PackModelImport(import);
+    if (import.cookMeshes && !WriteCookedMesh(import))
+        ELOG("Could not cook %s", import.filepath.c_str());
+
+    return true;
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <assimp/cimport.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include "engine.h"
+#include "JobSystem.h"
+#include "TextureStreaming.h"
+
+// Material as read from the file. Its textures are loaded on the main thread
+// when the import is finished.
+struct ImportedMaterial
+{
+    Material    material;
+    std::string albedoMap;
+    std::string emissiveMap;
+    std::string specularMap;
+    std::string normalsMap;
+    std::string bumpMap;
+};
+
+// A material texture decoded on a worker while the model is imported
+struct TexturePrefetch
+{
+    std::string    filepath;  // canonical
+    u32            flags;
+    bool           decoded;
+    DecodedTexture texture;
+};
+
+// CPU side result of importing a model on a worker
+struct ModelImport
+{
+    std::string filepath;
+    u32         importFlags;
+    u32         modelIdx;
+
+    // texture settings of the app, copied when the import is queued
+    bool        compressTextures;
+    bool        virtualTexturing;
+    i32         atlasMaxTextureSize;
+
+    bool        cookMeshes;
+    bool        fastObjImport = true;  // see ObjLoader.h
+    bool        forceImport = false;  // ignores (and rewrites) the cooked mesh
+
+    // called on the importing thread as soon as the materials are known, so
+    // their textures can start decoding while the mesh is processed
+    void (*materialsImported)(ModelImport& import) = NULL;
+
+    Mesh                          mesh;  // vertices and indices, no GL buffers yet
+    std::vector<u32>              submeshMaterialIdx;
+    std::vector<ModelNode>        nodes;  // glTF or MODEL_IMPORT_FLAGS_KEEP_NODES, empty otherwise
+    std::vector<ImportedMaterial> materials;
+    std::vector<TexturePrefetch>  textures;
+
+    // contents of the GL buffers: packed from the submeshes of a fresh
+    // import, or straight from the mapped cooked mesh (see CookedMesh.h) or
+    // .glb (see GltfLoader.h)
+    const u8*       vertexData = NULL;
+    u64             vertexDataSize = 0;
+    const u8*       indexData = NULL;
+    u64             indexDataSize = 0;
+    std::vector<u8> vertexBlob;
+    std::vector<u8> indexBlob;
+    MappedFile      mappedFile = {};
+    vec3            boundsMin;
+    vec3            boundsMax;
+
+    JobCounter  jobs;  // the import and the decode of its textures
+    bool        failed = false;
+    std::string error;
+
+    ~ModelImport() { UnmapFile(mappedFile); }
+};
+
+// Position, normal and, when present, uv and tangent (w: handedness, the
+// bitangent is cross(normal, tangent) * w), all floats: the vertex layout of
+// every imported submesh until PackModelImport() quantizes it. Each combination
+// is a VertexFormat (see VertexFormat.h).
+void MakeModelVertexLayout(bool hasTexCoords, bool hasTangentSpace, VertexBufferLayout& vertexBufferLayout);
+
+// Interleaved vertices of the mesh and their layout (position, normal and, when
+// present, uv and tangent), converted by the VertexFormat of the attributes the
+// mesh has. Meshes with uvs always get tangents, zero when Assimp didn't
+// compute them.
+void InterleaveAssimpVertices(const aiMesh* mesh, std::vector<float>& vertices, VertexBufferLayout& vertexBufferLayout);
+
+void CopyAssimpIndices(const aiMesh* mesh, std::vector<u32>& indices);
+
+void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
+void ProcessAssimpMaterial(aiMaterial* material, ImportedMaterial& myImportedMaterial, const std::string& directory);
+void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
+
+// Welding, tangents and the vertex cache order are left out: ImportAssimpModel()
+// runs its own parallel versions (see MeshProcessing.h) for whichever of
+// aiProcess_JoinIdenticalVertices, aiProcess_CalcTangentSpace and
+// aiProcess_ImproveCacheLocality the flags don't have, then always the overdraw
+// and vertex fetch orders, logging what they measure
+#define MODEL_IMPORT_FLAGS (aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_PreTransformVertices | \
+                            aiProcess_OptimizeMeshes | aiProcess_SortByPType)
+
+// Keeps the node tree instead of baking it into the vertices: every aiMesh is
+// imported (and uploaded) once and the nodes become ModelNodes drawing it
+// with their transform. Pass it to LoadModel() for assets instancing meshes.
+#define MODEL_IMPORT_FLAGS_KEEP_NODES (MODEL_IMPORT_FLAGS & ~aiProcess_PreTransformVertices)
+
+// Bounds (and bounding radius) of the model: the bounds of every submesh, in
+// its own space, placed by each node drawing it. Without nodes the submeshes
+// are already in model space.
+void ComputeNodeBounds(ModelImport& import, const std::vector<vec3>& submeshBoundsMin, const std::vector<vec3>& submeshBoundsMax);
+
+// Mesh and materials of the model through Assimp, before packing
+bool ImportAssimpModel(ModelImport& import);
+
+// CPU side part of the import, safe to run on the workers and without a GL
+// context: maps the cooked mesh when it is up to date, otherwise imports it
+// (OBJ natively, anything else through Assimp), packs the buffers and (with
+// cookMeshes) writes the cooked mesh back. A .glb is mapped and used as it is,
+// it never gets cooked.
+bool ImportModel(ModelImport& import);
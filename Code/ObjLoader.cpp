@@ -0,0 +1,725 @@
+#include "ObjLoader.h"
+#include "JobSystem.h"
+#include "MeshProcessing.h"
+#include <unordered_map>
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+
+// Index a corner doesn't have (no uv or no normal), or that is out of range
+#define OBJ_NO_INDEX INT32_MIN
+
+// Bits of ObjCorner::chunkRelative. Negative OBJ indices count back from the
+// last vertex read, and a chunk only knows its own vertices until all of them
+// are parsed, so they are kept relative to the chunk until then.
+#define OBJ_RELATIVE_POSITION 1
+#define OBJ_RELATIVE_TEXCOORD 2
+#define OBJ_RELATIVE_NORMAL   4
+
+struct ObjCorner
+{
+    i32 position;
+    i32 texCoord;
+    i32 normal;
+    u32 chunkRelative;
+};
+
+struct ObjCornerHash
+{
+    size_t operator()(const ObjCorner& c) const
+    {
+        u64 hash = (u64)(u32)c.position * 0x9E3779B97F4A7C15ULL ^
+                   (u64)(u32)c.texCoord * 0xC2B2AE3D27D4EB4FULL ^
+                   (u64)(u32)c.normal * 0x165667B19E3779F9ULL;
+        return (size_t)(hash ^ (hash >> 32));
+    }
+};
+
+struct ObjCornerEqual
+{
+    bool operator()(const ObjCorner& a, const ObjCorner& b) const
+    {
+        return a.position == b.position && a.texCoord == b.texCoord && a.normal == b.normal;
+    }
+};
+
+// Triangles from firstTriangle on use the material
+struct ObjMaterialRun
+{
+    u32         firstTriangle;
+    std::string material;
+};
+
+struct ObjChunk
+{
+    const char* begin;
+    const char* end;
+
+    std::vector<vec3>           positions;
+    std::vector<vec2>           texCoords;
+    std::vector<vec3>           normals;
+    std::vector<ObjCorner>      corners;  // 3 per triangle
+    std::vector<ObjMaterialRun> materialRuns;
+    std::vector<std::string>    materialLibraries;
+};
+
+// Consecutive triangles of a chunk with the same material
+struct ObjSpan
+{
+    const ObjCorner* corners;
+    u32              triangleCount;
+};
+
+struct ObjVertexData
+{
+    std::vector<vec3> positions;
+    std::vector<vec2> texCoords;
+    std::vector<vec3> normals;
+    std::vector<vec3> smoothNormals;  // per position, for the corners without normal
+};
+
+bool IsObjFile(const std::string& filepath)
+{
+    const size_t dot = filepath.find_last_of('.');
+    if (dot == std::string::npos || filepath.size() - dot != 4)
+        return false;
+
+    return tolower(filepath[dot + 1]) == 'o' && tolower(filepath[dot + 2]) == 'b' && tolower(filepath[dot + 3]) == 'j';
+}
+
+static inline bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool IsDigit(char c)
+{
+    return (u32)(c - '0') < 10;
+}
+
+static inline const char* SkipSpaces(const char* c, const char* end)
+{
+    while (c < end && IsSpace(*c))
+        ++c;
+    return c;
+}
+
+static inline bool StartsWithKeyword(const char* c, const char* end, const char* keyword)
+{
+    const size_t length = strlen(keyword);
+    return (size_t)(end - c) > length && memcmp(c, keyword, length) == 0 && IsSpace(c[length]);
+}
+
+// Trimmed rest of the line
+static std::string ReadName(const char* c, const char* end)
+{
+    c = SkipSpaces(c, end);
+    while (end > c && IsSpace(end[-1]))
+        --end;
+    return std::string(c, end);
+}
+
+// Texture options ("-bm 0.5 file.png") come first, the file is the last token
+static std::string ReadTextureName(const char* c, const char* end)
+{
+    while (end > c && IsSpace(end[-1]))
+        --end;
+    const char* begin = end;
+    while (begin > c && !IsSpace(begin[-1]))
+        --begin;
+    return std::string(begin, end);
+}
+
+static const f64 PowersOf10[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Decimal float with an optional exponent, without strtod (locale lookups,
+// arbitrary precision). Keeps the first 19 significant digits, way more than
+// a f32 needs.
+static const char* ParseFloat(const char* c, const char* end, f32& value)
+{
+    c = SkipSpaces(c, end);
+
+    bool negative = false;
+    if (c < end && (*c == '-' || *c == '+'))
+    {
+        negative = *c == '-';
+        ++c;
+    }
+
+    u64 mantissa = 0;
+    i32 exponent = 0;
+    u32 digits = 0;
+    for (; c < end && IsDigit(*c); ++c)
+    {
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (u32)(*c - '0');
+            digits += mantissa ? 1 : 0;
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+
+    if (c < end && *c == '.')
+    {
+        for (++c; c < end && IsDigit(*c); ++c)
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (u32)(*c - '0');
+                digits += mantissa ? 1 : 0;
+                exponent--;
+            }
+        }
+    }
+
+    if (c < end && (*c == 'e' || *c == 'E'))
+    {
+        ++c;
+        bool negativeExponent = false;
+        if (c < end && (*c == '-' || *c == '+'))
+        {
+            negativeExponent = *c == '-';
+            ++c;
+        }
+
+        i32 explicitExponent = 0;
+        for (; c < end && IsDigit(*c); ++c)
+            explicitExponent = glm::min(explicitExponent * 10 + (i32)(*c - '0'), 10000);
+        exponent += negativeExponent ? -explicitExponent : explicitExponent;
+    }
+
+    f64 result = (f64)mantissa;
+    if (exponent < 0)
+        result = (exponent >= -22) ? result / PowersOf10[-exponent] : result * pow(10.0, exponent);
+    else if (exponent > 0)
+        result = (exponent <= 22) ? result * PowersOf10[exponent] : result * pow(10.0, exponent);
+
+    value = (f32)(negative ? -result : result);
+    return c;
+}
+
+// 1-based index, or negative relative to the count of elements read so far
+static const char* ParseIndex(const char* c, const char* end, u32 count, u32 relativeBit, i32& index, u32& chunkRelative)
+{
+    bool negative = false;
+    if (c < end && *c == '-')
+    {
+        negative = true;
+        ++c;
+    }
+
+    i64 value = 0;
+    const char* digitsBegin = c;
+    for (; c < end && IsDigit(*c); ++c)
+        value = glm::min<i64>(value * 10 + (*c - '0'), INT32_MAX);
+
+    if (c == digitsBegin || value == 0)
+    {
+        index = OBJ_NO_INDEX;
+    }
+    else if (!negative)
+    {
+        index = (i32)(value - 1);
+    }
+    else
+    {
+        index = (i32)((i64)count - value);
+        chunkRelative |= relativeBit;
+    }
+
+    return c;
+}
+
+// "v", "v/vt", "v//vn" or "v/vt/vn"
+static const char* ParseCorner(const char* c, const char* end, const ObjChunk& chunk, ObjCorner& corner)
+{
+    corner.chunkRelative = 0;
+    corner.texCoord = OBJ_NO_INDEX;
+    corner.normal = OBJ_NO_INDEX;
+    c = ParseIndex(c, end, (u32)chunk.positions.size(), OBJ_RELATIVE_POSITION, corner.position, corner.chunkRelative);
+
+    if (c < end && *c == '/')
+    {
+        ++c;
+        if (c < end && *c != '/')
+            c = ParseIndex(c, end, (u32)chunk.texCoords.size(), OBJ_RELATIVE_TEXCOORD, corner.texCoord, corner.chunkRelative);
+        if (c < end && *c == '/')
+            c = ParseIndex(c + 1, end, (u32)chunk.normals.size(), OBJ_RELATIVE_NORMAL, corner.normal, corner.chunkRelative);
+    }
+
+    return c;
+}
+
+static void ParseObjChunk(ObjChunk& chunk)
+{
+    std::vector<ObjCorner> polygon;
+
+    const char* end = chunk.end;
+    for (const char* c = chunk.begin; c < end;)
+    {
+        const char* lineEnd = (const char*)memchr(c, '\n', end - c);
+        if (!lineEnd)
+            lineEnd = end;
+
+        c = SkipSpaces(c, lineEnd);
+
+        if (lineEnd - c > 2 && c[0] == 'v')
+        {
+            if (IsSpace(c[1]))
+            {
+                vec3 position;
+                c = ParseFloat(c + 2, lineEnd, position.x);
+                c = ParseFloat(c, lineEnd, position.y);
+                c = ParseFloat(c, lineEnd, position.z);
+                chunk.positions.push_back(position);
+            }
+            else if (c[1] == 't' && IsSpace(c[2]))
+            {
+                vec2 texCoord;
+                c = ParseFloat(c + 3, lineEnd, texCoord.x);
+                c = ParseFloat(c, lineEnd, texCoord.y);
+                chunk.texCoords.push_back(texCoord);
+            }
+            else if (c[1] == 'n' && IsSpace(c[2]))
+            {
+                vec3 normal;
+                c = ParseFloat(c + 3, lineEnd, normal.x);
+                c = ParseFloat(c, lineEnd, normal.y);
+                c = ParseFloat(c, lineEnd, normal.z);
+                chunk.normals.push_back(normal);
+            }
+        }
+        else if (lineEnd - c > 2 && c[0] == 'f' && IsSpace(c[1]))
+        {
+            polygon.clear();
+            for (c += 2;;)
+            {
+                c = SkipSpaces(c, lineEnd);
+                if (c >= lineEnd)
+                    break;
+
+                ObjCorner corner;
+                c = ParseCorner(c, lineEnd, chunk, corner);
+                polygon.push_back(corner);
+
+                // skip whatever isn't an index
+                while (c < lineEnd && !IsSpace(*c))
+                    ++c;
+            }
+
+            // fan, fine for the convex polygons exporters write
+            for (u32 i = 2; i < polygon.size(); ++i)
+            {
+                chunk.corners.push_back(polygon[0]);
+                chunk.corners.push_back(polygon[i - 1]);
+                chunk.corners.push_back(polygon[i]);
+            }
+        }
+        else if (StartsWithKeyword(c, lineEnd, "usemtl"))
+        {
+            chunk.materialRuns.push_back(ObjMaterialRun{ (u32)(chunk.corners.size() / 3), ReadName(c + 6, lineEnd) });
+        }
+        else if (StartsWithKeyword(c, lineEnd, "mtllib"))
+        {
+            for (c += 6;;)
+            {
+                c = SkipSpaces(c, lineEnd);
+                const char* nameBegin = c;
+                while (c < lineEnd && !IsSpace(*c))
+                    ++c;
+                if (c == nameBegin)
+                    break;
+                chunk.materialLibraries.push_back(std::string(nameBegin, c));
+            }
+        }
+
+        c = lineEnd + 1;
+    }
+}
+
+static inline i32 ResolveIndex(i32 index, bool chunkRelative, u32 base, u32 count)
+{
+    if (index == OBJ_NO_INDEX)
+        return OBJ_NO_INDEX;
+
+    const i64 resolved = chunkRelative ? (i64)base + index : (i64)index;
+    return (resolved >= 0 && resolved < (i64)count) ? (i32)resolved : OBJ_NO_INDEX;
+}
+
+static void ResolveCorners(ObjChunk& chunk, u32 positionBase, u32 texCoordBase, u32 normalBase, const ObjVertexData& data)
+{
+    for (ObjCorner& corner : chunk.corners)
+    {
+        corner.position = ResolveIndex(corner.position, corner.chunkRelative & OBJ_RELATIVE_POSITION, positionBase, (u32)data.positions.size());
+        corner.texCoord = ResolveIndex(corner.texCoord, corner.chunkRelative & OBJ_RELATIVE_TEXCOORD, texCoordBase, (u32)data.texCoords.size());
+        corner.normal = ResolveIndex(corner.normal, corner.chunkRelative & OBJ_RELATIVE_NORMAL, normalBase, (u32)data.normals.size());
+        corner.chunkRelative = 0;
+    }
+}
+
+// Same defaults as Assimp's OBJ importer
+static ImportedMaterial MakeObjMaterial(const std::string& name)
+{
+    ImportedMaterial importedMaterial;
+    Material& material = importedMaterial.material;
+    material.name = name;
+    material.albedo = vec3(0.6f);
+    material.emissive = vec3(0.0f);
+    material.smoothness = 0.0f;
+    material.albedoTextureIdx = UINT32_MAX;
+    material.emissiveTextureIdx = UINT32_MAX;
+    material.specularTextureIdx = UINT32_MAX;
+    material.normalsTextureIdx = UINT32_MAX;
+    material.bumpTextureIdx = UINT32_MAX;
+    return importedMaterial;
+}
+
+static vec3 ReadColor(const char* c, const char* end)
+{
+    vec3 color;
+    c = ParseFloat(c, end, color.r);
+    c = ParseFloat(c, end, color.g);
+    ParseFloat(c, end, color.b);
+    return color;
+}
+
+// The maps map to the texture types ProcessAssimpMaterial() reads
+static void ParseMtlFile(const std::string& filepath, const std::string& directory, std::vector<ImportedMaterial>& materials)
+{
+    std::vector<u8> bytes;
+    if (!ReadBinaryFile(filepath.c_str(), bytes))
+    {
+        ELOG("Could not open material library %s", filepath.c_str());
+        return;
+    }
+
+    const char* end = (const char*)bytes.data() + bytes.size();
+    for (const char* c = (const char*)bytes.data(); c < end;)
+    {
+        const char* lineEnd = (const char*)memchr(c, '\n', end - c);
+        if (!lineEnd)
+            lineEnd = end;
+
+        c = SkipSpaces(c, lineEnd);
+
+        if (StartsWithKeyword(c, lineEnd, "newmtl"))
+        {
+            materials.push_back(MakeObjMaterial(ReadName(c + 6, lineEnd)));
+        }
+        else if (!materials.empty())
+        {
+            ImportedMaterial& material = materials.back();
+
+            if (StartsWithKeyword(c, lineEnd, "Kd"))
+                material.material.albedo = ReadColor(c + 2, lineEnd);
+            else if (StartsWithKeyword(c, lineEnd, "Ke"))
+                material.material.emissive = ReadColor(c + 2, lineEnd);
+            else if (StartsWithKeyword(c, lineEnd, "Ns"))
+            {
+                f32 shininess = 0.0f;
+                ParseFloat(c + 2, lineEnd, shininess);
+                material.material.smoothness = shininess / 256.0f;
+            }
+            else if (StartsWithKeyword(c, lineEnd, "map_Kd"))
+                material.albedoMap = directory + "/" + ReadTextureName(c + 6, lineEnd);
+            else if (StartsWithKeyword(c, lineEnd, "map_Ke"))
+                material.emissiveMap = directory + "/" + ReadTextureName(c + 6, lineEnd);
+            else if (StartsWithKeyword(c, lineEnd, "map_Ks"))
+                material.specularMap = directory + "/" + ReadTextureName(c + 6, lineEnd);
+            else if (StartsWithKeyword(c, lineEnd, "map_Kn") || StartsWithKeyword(c, lineEnd, "norm"))
+                material.normalsMap = directory + "/" + ReadTextureName(c + 4, lineEnd);
+            else if (StartsWithKeyword(c, lineEnd, "map_Bump") || StartsWithKeyword(c, lineEnd, "map_bump"))
+                material.bumpMap = directory + "/" + ReadTextureName(c + 8, lineEnd);
+            else if (StartsWithKeyword(c, lineEnd, "bump"))
+                material.bumpMap = directory + "/" + ReadTextureName(c + 4, lineEnd);
+        }
+
+        c = lineEnd + 1;
+    }
+}
+
+static inline bool IsValidTriangle(const ObjCorner* corners)
+{
+    return corners[0].position != OBJ_NO_INDEX && corners[1].position != OBJ_NO_INDEX && corners[2].position != OBJ_NO_INDEX;
+}
+
+// Unweighted average of the face normals around each position, like
+// aiProcess_GenSmoothNormals
+static void ComputeSmoothNormals(const std::vector<std::vector<ObjSpan>>& spansByMaterial, ObjVertexData& data)
+{
+    data.smoothNormals.assign(data.positions.size(), vec3(0.0f));
+
+    for (const std::vector<ObjSpan>& spans : spansByMaterial)
+    {
+        for (const ObjSpan& span : spans)
+        {
+            for (u32 t = 0; t < span.triangleCount; ++t)
+            {
+                const ObjCorner* corners = span.corners + t * 3;
+                if (!IsValidTriangle(corners))
+                    continue;
+
+                const vec3& p0 = data.positions[corners[0].position];
+                const vec3& p1 = data.positions[corners[1].position];
+                const vec3& p2 = data.positions[corners[2].position];
+                const vec3 faceNormal = glm::cross(p1 - p0, p2 - p0);
+                const f32 length = glm::length(faceNormal);
+                if (length <= 0.0f)
+                    continue;
+
+                for (u32 k = 0; k < 3; ++k)
+                    data.smoothNormals[corners[k].position] += faceNormal / length;
+            }
+        }
+    }
+
+    for (vec3& normal : data.smoothNormals)
+    {
+        const f32 length = glm::length(normal);
+        normal = (length > 0.0f) ? normal / length : vec3(0.0f, 1.0f, 0.0f);
+    }
+}
+
+// Joins the corners with the same (position, uv, normal) and interleaves them,
+// then computes the tangents and the vertex cache order (see MeshProcessing.h)
+static void BuildObjSubmesh(const std::vector<ObjSpan>& spans, const ObjVertexData& data, Submesh& submesh)
+{
+    const bool hasTexCoords = !data.texCoords.empty();
+    MakeModelVertexLayout(hasTexCoords, hasTexCoords, submesh.vertexBufferLayout);
+
+    u32 triangleCount = 0;
+    for (const ObjSpan& span : spans)
+        triangleCount += span.triangleCount;
+
+    std::unordered_map<ObjCorner, u32, ObjCornerHash, ObjCornerEqual> vertexIndices;
+    vertexIndices.reserve(triangleCount);
+    std::vector<ObjCorner> vertices;
+    vertices.reserve(triangleCount);
+    submesh.indices.reserve((size_t)triangleCount * 3);
+
+    for (const ObjSpan& span : spans)
+    {
+        for (u32 t = 0; t < span.triangleCount; ++t)
+        {
+            const ObjCorner* corners = span.corners + t * 3;
+            if (!IsValidTriangle(corners))
+                continue;
+
+            for (u32 k = 0; k < 3; ++k)
+            {
+                auto inserted = vertexIndices.emplace(corners[k], (u32)vertices.size());
+                if (inserted.second)
+                    vertices.push_back(corners[k]);
+                submesh.indices.push_back(inserted.first->second);
+            }
+        }
+    }
+    submesh.indexCount = (u32)submesh.indices.size();
+
+    const u32 strideFloats = submesh.vertexBufferLayout.stride / sizeof(float);
+    submesh.vertices.resize(vertices.size() * strideFloats);
+
+    float* dst = submesh.vertices.data();
+    for (const ObjCorner& corner : vertices)
+    {
+        const vec3& position = data.positions[corner.position];
+        const vec3& normal = (corner.normal != OBJ_NO_INDEX) ? data.normals[corner.normal] : data.smoothNormals[corner.position];
+        dst[0] = position.x;
+        dst[1] = position.y;
+        dst[2] = position.z;
+        dst[3] = normal.x;
+        dst[4] = normal.y;
+        dst[5] = normal.z;
+
+        if (hasTexCoords)
+        {
+            const vec2 texCoord = (corner.texCoord != OBJ_NO_INDEX) ? data.texCoords[corner.texCoord] : vec2(0.0f);
+            dst[6] = texCoord.x;
+            dst[7] = texCoord.y;
+        }
+
+        dst += strideFloats;
+    }
+
+    const u32 steps = MeshProcessing_VertexCache | MeshProcessing_Overdraw | MeshProcessing_VertexFetch |
+                      (hasTexCoords ? MeshProcessing_Tangents : 0);
+    ProcessSubmesh(submesh, steps);
+}
+
+bool ImportObjModel(ModelImport& import)
+{
+    MappedFile file;
+    if (!MapFile(import.filepath.c_str(), file))
+        return false;
+
+    // line aligned chunks, a few per worker so they even out
+    const u32 maxChunkCount = glm::max(GetJobWorkerCount(), 1u) * 4;
+    const u32 chunkCount = (u32)glm::clamp<u64>(file.size / OBJ_CHUNK_SIZE, 1, maxChunkCount);
+    std::vector<ObjChunk> chunks(chunkCount);
+
+    const char* text = (const char*)file.data;
+    const char* textEnd = text + file.size;
+    const char* chunkBegin = text;
+    for (u32 i = 0; i < chunkCount; ++i)
+    {
+        const char* chunkEnd = std::max(chunkBegin, text + file.size * (i + 1) / chunkCount);
+        const char* newline = (const char*)memchr(chunkEnd, '\n', textEnd - chunkEnd);
+        chunkEnd = (i + 1 == chunkCount || !newline) ? textEnd : newline + 1;
+
+        chunks[i].begin = chunkBegin;
+        chunks[i].end = chunkEnd;
+        chunkBegin = chunkEnd;
+    }
+
+    JobCounter jobs;
+    for (ObjChunk& chunk : chunks)
+    {
+        ObjChunk* objChunk = &chunk;
+        RunJob([objChunk]() { ParseObjChunk(*objChunk); }, &jobs);
+    }
+    WaitForJobCounter(jobs);
+    UnmapFile(file);
+
+    ObjVertexData data;
+    std::vector<u32> positionBases, texCoordBases, normalBases;
+    for (ObjChunk& chunk : chunks)
+    {
+        positionBases.push_back((u32)data.positions.size());
+        texCoordBases.push_back((u32)data.texCoords.size());
+        normalBases.push_back((u32)data.normals.size());
+        data.positions.insert(data.positions.end(), chunk.positions.begin(), chunk.positions.end());
+        data.texCoords.insert(data.texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+        data.normals.insert(data.normals.end(), chunk.normals.begin(), chunk.normals.end());
+        chunk.positions = std::vector<vec3>();
+        chunk.texCoords = std::vector<vec2>();
+        chunk.normals = std::vector<vec3>();
+    }
+
+    const ObjVertexData* vertexData = &data;
+    for (u32 i = 0; i < chunkCount; ++i)
+    {
+        ObjChunk* chunk = &chunks[i];
+        const u32 positionBase = positionBases[i], texCoordBase = texCoordBases[i], normalBase = normalBases[i];
+        RunJob([chunk, positionBase, texCoordBase, normalBase, vertexData]()
+        {
+            ResolveCorners(*chunk, positionBase, texCoordBase, normalBase, *vertexData);
+        }, &jobs);
+    }
+
+    // the material libraries meanwhile, relative to the model like its maps
+    const size_t directoryEnd = import.filepath.find_last_of("/\\");
+    const std::string directory = directoryEnd == std::string::npos ? "." : import.filepath.substr(0, directoryEnd);
+
+    std::vector<std::string> libraries;
+    for (const ObjChunk& chunk : chunks)
+        for (const std::string& library : chunk.materialLibraries)
+            if (std::find(libraries.begin(), libraries.end(), library) == libraries.end())
+                libraries.push_back(library);
+
+    std::vector<ImportedMaterial> materials;
+    for (const std::string& library : libraries)
+        ParseMtlFile(directory + "/" + library, directory, materials);
+
+    std::unordered_map<std::string, u32> materialsByName;
+    for (u32 i = 0; i < materials.size(); ++i)
+        materialsByName.emplace(materials[i].material.name, i);
+
+    WaitForJobCounter(jobs);
+
+    // faces before any usemtl, or with an unknown one, get a default material
+    std::vector<std::vector<ObjSpan>> spansByMaterial(materials.size());
+    u32 defaultMaterial = UINT32_MAX;
+    u32 currentMaterial = UINT32_MAX;
+    auto addSpan = [&](const ObjChunk& chunk, u32 firstTriangle, u32 endTriangle)
+    {
+        if (endTriangle <= firstTriangle)
+            return;
+
+        if (currentMaterial == UINT32_MAX)
+        {
+            if (defaultMaterial == UINT32_MAX)
+            {
+                defaultMaterial = (u32)materials.size();
+                materials.push_back(MakeObjMaterial("DefaultMaterial"));
+                spansByMaterial.resize(materials.size());
+            }
+            currentMaterial = defaultMaterial;
+        }
+
+        spansByMaterial[currentMaterial].push_back(ObjSpan{ chunk.corners.data() + firstTriangle * 3, endTriangle - firstTriangle });
+    };
+
+    for (const ObjChunk& chunk : chunks)
+    {
+        u32 firstTriangle = 0;
+        for (const ObjMaterialRun& run : chunk.materialRuns)
+        {
+            addSpan(chunk, firstTriangle, run.firstTriangle);
+            firstTriangle = run.firstTriangle;
+
+            auto material = materialsByName.find(run.material);
+            currentMaterial = (material != materialsByName.end()) ? material->second : UINT32_MAX;
+        }
+        addSpan(chunk, firstTriangle, (u32)(chunk.corners.size() / 3));
+    }
+
+    u32 validTriangles = 0;
+    bool missingNormals = false;
+    for (const std::vector<ObjSpan>& spans : spansByMaterial)
+    {
+        for (const ObjSpan& span : spans)
+        {
+            for (u32 t = 0; t < span.triangleCount; ++t)
+            {
+                const ObjCorner* corners = span.corners + t * 3;
+                if (!IsValidTriangle(corners))
+                    continue;
+
+                validTriangles++;
+                missingNormals = missingNormals || corners[0].normal == OBJ_NO_INDEX ||
+                                 corners[1].normal == OBJ_NO_INDEX || corners[2].normal == OBJ_NO_INDEX;
+            }
+        }
+    }
+
+    if (validTriangles == 0)
+        return false;
+
+    // nothing can fail from here on
+    import.materials = std::move(materials);
+    if (import.materialsImported)
+        import.materialsImported(import);
+
+    if (missingNormals)
+        ComputeSmoothNormals(spansByMaterial, data);
+
+    for (u32 i = 0; i < spansByMaterial.size(); ++i)
+    {
+        if (spansByMaterial[i].empty())
+            continue;
+
+        import.mesh.submeshes.push_back(Submesh{});
+        import.submeshMaterialIdx.push_back(i);
+    }
+
+    u32 submeshIdx = 0;
+    for (u32 i = 0; i < spansByMaterial.size(); ++i)
+    {
+        if (spansByMaterial[i].empty())
+            continue;
+
+        const std::vector<ObjSpan>* spans = &spansByMaterial[i];
+        Submesh* submesh = &import.mesh.submeshes[submeshIdx++];
+        RunJob([spans, vertexData, submesh]() { BuildObjSubmesh(*spans, *vertexData, *submesh); }, &jobs);
+    }
+    WaitForJobCounter(jobs);
+
+    return true;
+}
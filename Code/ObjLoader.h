@@ -0,0 +1,21 @@
+#pragma once
+#include "ModelImport.h"
+
+// Native loader for OBJ/MTL, the format of every shipped model (Assimp still
+// imports anything else). The file is mapped and split in line aligned chunks
+// parsed in parallel, then the corners of each material are deduplicated into
+// one submesh, in the vertex layout of MakeModelVertexLayout(). It does what
+// the import does for Assimp models: triangulation (fans), smooth normals
+// where the file has none, tangent space when there are uvs, joined identical
+// vertices, the vertex cache, overdraw and fetch orders and one submesh per
+// material. Lines and points are skipped.
+
+// Minimum bytes of the file parsed by each job
+#define OBJ_CHUNK_SIZE KB(256)
+
+bool IsObjFile(const std::string& filepath);
+
+// Fills the mesh, materials and submesh materials of the import (calling
+// materialsImported as soon as the materials are known). Returns false, with
+// the import untouched, if the file can't be read or has no triangles.
+bool ImportObjModel(ModelImport& import);
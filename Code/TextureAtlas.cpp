@@ -0,0 +1,163 @@
+#include "TextureAtlas.h"
+#include "Materials.h"
+
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include <imstb_rectpack.h>
+
+#define ATLAS_GUTTER (1 << (ATLAS_MIP_COUNT - 1))
+#define ATLAS_CELL_SIZE ATLAS_GUTTER
+#define ATLAS_PAGE_CELLS (ATLAS_PAGE_SIZE / ATLAS_CELL_SIZE)
+
+static void BlitWithGutter(u8* page, const u8* pixels, ivec2 size, ivec2 origin)
+{
+    // copies the image at origin + gutter, replicating its edge texels over the
+    // gutter (the same result GL_CLAMP_TO_EDGE would give sampling outside it)
+    const i32 gutter = ATLAS_GUTTER;
+    for (i32 y = -gutter; y < size.y + gutter; ++y)
+    {
+        i32 srcY = glm::clamp(y, 0, size.y - 1);
+        u8* dstRow = page + ((origin.y + gutter + y) * ATLAS_PAGE_SIZE + origin.x + gutter) * 4;
+        const u8* srcRow = pixels + srcY * size.x * 4;
+
+        for (i32 x = -gutter; x < size.x + gutter; ++x)
+        {
+            i32 srcX = glm::clamp(x, 0, size.x - 1);
+            memcpy(dstRow + x * 4, srcRow + srcX * 4, 4);
+        }
+    }
+}
+
+void BuildTextureAtlases(App* app)
+{
+    ErrorGuardOGL error("BuildTextureAtlases()", __FILE__, __LINE__);
+
+    const i32 maxSize = glm::min(app->atlasMaxTextureSize, ATLAS_PAGE_SIZE - 2 * ATLAS_GUTTER);
+
+    std::vector<u32> candidates;
+    for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
+    {
+        const Texture& tex = app->textures[texIdx];
+        if (tex.arrayIdx == UINT32_MAX &&
+            tex.state == TextureState_Resident &&
+            tex.image.size.x <= maxSize &&
+            tex.image.size.y <= maxSize)
+        {
+            candidates.push_back(texIdx);
+        }
+    }
+
+    if (candidates.empty())
+        return;
+
+    // pack in cell units so every rect starts on a cell boundary
+    std::vector<stbrp_rect> rects(candidates.size());
+    for (u32 i = 0; i < candidates.size(); ++i)
+    {
+        const ivec2 size = app->textures[candidates[i]].image.size;
+        rects[i] = {};
+        rects[i].id = (int)i;
+        rects[i].w = (stbrp_coord)((size.x + 2 * ATLAS_GUTTER + ATLAS_CELL_SIZE - 1) / ATLAS_CELL_SIZE);
+        rects[i].h = (stbrp_coord)((size.y + 2 * ATLAS_GUTTER + ATLAS_CELL_SIZE - 1) / ATLAS_CELL_SIZE);
+    }
+
+    std::vector<u32> rectPage(rects.size(), UINT32_MAX);
+    std::vector<stbrp_node> nodes(ATLAS_PAGE_CELLS);
+    u32 pageCount = 0;
+    u32 packedCount = 0;
+
+    while (packedCount < rects.size())
+    {
+        std::vector<stbrp_rect> pending;
+        for (u32 i = 0; i < rects.size(); ++i)
+            if (rectPage[i] == UINT32_MAX)
+                pending.push_back(rects[i]);
+
+        stbrp_context context;
+        stbrp_init_target(&context, ATLAS_PAGE_CELLS, ATLAS_PAGE_CELLS, nodes.data(), (int)nodes.size());
+        stbrp_pack_rects(&context, pending.data(), (int)pending.size());
+
+        u32 packedInPage = 0;
+        for (u32 i = 0; i < pending.size(); ++i)
+        {
+            if (pending[i].was_packed)
+            {
+                rects[pending[i].id] = pending[i];
+                rectPage[pending[i].id] = pageCount;
+                packedInPage++;
+            }
+        }
+
+        ASSERT(packedInPage > 0, "Atlas candidates must fit in an empty page");
+        packedCount += packedInPage;
+        pageCount++;
+    }
+
+    TextureArray atlas = {};
+    atlas.atlas = true;
+    atlas.size = ivec2(ATLAS_PAGE_SIZE);
+    atlas.internalFormat = GL_RGBA8;
+    atlas.mipCount = ATLAS_MIP_COUNT;
+    atlas.layerCount = pageCount;
+
+    glGenTextures(1, &atlas.handle);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, atlas.handle);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, atlas.mipCount, atlas.internalFormat, atlas.size.x, atlas.size.y, atlas.layerCount);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // in place before the layer views of the packed textures get made
+    u32 atlasIdx = app->textureArrays.size();
+    app->textureArrays.push_back(atlas);
+    std::vector<u8> page(ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE * 4);
+    std::vector<u8> pixels;
+
+    for (u32 pageIdx = 0; pageIdx < pageCount; ++pageIdx)
+    {
+        std::fill(page.begin(), page.end(), 0);
+
+        for (u32 i = 0; i < rects.size(); ++i)
+        {
+            if (rectPage[i] != pageIdx)
+                continue;
+
+            Texture& tex = app->textures[candidates[i]];
+            const ivec2 size = tex.image.size;
+            const ivec2 origin = ivec2(rects[i].x, rects[i].y) * ATLAS_CELL_SIZE;
+
+            // the decoded image is gone by now, read it back from its texture
+            pixels.resize(size.x * size.y * 4);
+            glBindTexture(GL_TEXTURE_2D, tex.handle);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            BlitWithGutter(page.data(), pixels.data(), size, origin);
+
+            const vec2 texel = vec2(1.0f / ATLAS_PAGE_SIZE);
+            tex.arrayIdx = atlasIdx;
+            tex.arrayLayer = pageIdx;
+            tex.uvScaleOffset = vec4(vec2(size) * texel, vec2(origin + ATLAS_GUTTER) * texel);
+        }
+
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, pageIdx, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, 1, GL_RGBA, GL_UNSIGNED_BYTE, page.data());
+    }
+
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // the atlas holds the only copy now: the textures of their own are deleted
+    // and the handles become views of the pages
+    for (u32 texIdx : candidates)
+    {
+        Texture& tex = app->textures[texIdx];
+        const ivec2 size = tex.image.size;
+        CreateTextureLayerView(app, texIdx);
+        tex.internalFormat = atlas.internalFormat;
+        tex.image.size = size;  // of the region, the view spans the whole page
+    }
+
+    ILOG("Packed %u small textures into %u atlas page(s)", (u32)candidates.size(), pageCount);
+}
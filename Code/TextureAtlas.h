@@ -0,0 +1,16 @@
+#pragma once
+#include "engine.h"
+
+// Atlas pages are the layers of one RGBA8 texture array.
+#define ATLAS_PAGE_SIZE 1024
+
+// Mip levels kept in the atlas. Every packed image is surrounded by a gutter of
+// 2^(ATLAS_MIP_COUNT-1) replicated edge texels and placed on a cell of that same
+// size, so even the smallest mip keeps a 1 texel gutter and never bleeds into
+// its neighbours.
+#define ATLAS_MIP_COUNT 4
+
+// Packs the textures no bigger than app->atlasMaxTextureSize into shared atlas
+// pages and sets their array/layer and uvScaleOffset. Must run before
+// BuildTextureArrays (which only groups the textures left out of the atlas).
+void BuildTextureAtlases(App* app);
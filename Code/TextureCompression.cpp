@@ -0,0 +1,607 @@
+#include "TextureCompression.h"
+#include "JobSystem.h"
+#include "Hash.h"
+#include <stb_image.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLOCK_COMPRESSION_SSE2
+#endif
+
+#define TEXTURE_CACHE_MAGIC 0x58544342 // "BCTX"
+
+// block rows compressed by each job
+#define COMPRESSION_BATCH_ROWS 8
+
+struct TextureCacheHeader
+{
+    u32 magic;
+    u32 version;
+    u32 format;
+    i32 width;
+    i32 height;
+    i32 nchannels;
+    u32 mipCount;
+};
+
+static u32 GetBlockFormatBlockBytes(BlockFormat format)
+{
+    return (format == BlockFormat_BC1) ? 8 : 16;
+}
+
+GLenum GetBlockFormatInternalFormat(BlockFormat format)
+{
+    switch (format)
+    {
+        case BlockFormat_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BlockFormat_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BlockFormat_BC5: return GL_COMPRESSED_RG_RGTC2;
+        default: ELOG("GetBlockFormatInternalFormat() - Unknown block format"); return GL_NONE;
+    }
+}
+
+bool IsBlockCompressionSupported()
+{
+    GLint extensionCount = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i = 0; i < extensionCount; ++i)
+    {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (extension && strcmp(extension, "GL_EXT_texture_compression_s3tc") == 0)
+            return true;
+    }
+    return false;
+}
+
+void ExpandToRGBA(const Image& image, std::vector<u8>& rgba)
+{
+    const u32 pixelCount = image.size.x * image.size.y;
+    const u8* src = (const u8*)image.pixels;
+    rgba.resize(pixelCount * 4);
+
+    for (u32 i = 0; i < pixelCount; ++i)
+    {
+        u8* dst = &rgba[i * 4];
+        switch (image.nchannels)
+        {
+            case 1: dst[0] = dst[1] = dst[2] = src[i]; dst[3] = 255; break;
+            case 2: dst[0] = dst[1] = dst[2] = src[i * 2]; dst[3] = src[i * 2 + 1]; break;
+            case 3: dst[0] = src[i * 3]; dst[1] = src[i * 3 + 1]; dst[2] = src[i * 3 + 2]; dst[3] = 255; break;
+            default: memcpy(dst, src + i * 4, 4); break;
+        }
+    }
+}
+
+BlockFormat ChooseBlockFormat(const Image& image, bool isNormalMap)
+{
+    if (isNormalMap)
+        return BlockFormat_BC5;
+
+    if (image.nchannels == 2 || image.nchannels == 4)
+    {
+        // only pay for BC3 when the alpha channel is actually used
+        const u8* pixels = (const u8*)image.pixels;
+        const u32 pixelCount = image.size.x * image.size.y;
+        for (u32 i = 0; i < pixelCount; ++i)
+            if (pixels[i * image.nchannels + image.nchannels - 1] != 255)
+                return BlockFormat_BC3;
+    }
+
+    return BlockFormat_BC1;
+}
+
+void GenerateMipChain(const u8* rgba, ivec2 size, bool isNormalMap, std::vector<std::vector<u8>>& levels)
+{
+    levels.clear();
+    levels.emplace_back(rgba, rgba + size.x * size.y * 4);
+
+    while (size.x > 1 || size.y > 1)
+    {
+        const std::vector<u8>& src = levels.back();
+        const ivec2 srcSize = size;
+        size = glm::max(size / 2, ivec2(1));
+
+        std::vector<u8> dst(size.x * size.y * 4);
+        for (i32 y = 0; y < size.y; ++y)
+        {
+            const i32 y0 = glm::min(y * 2, srcSize.y - 1);
+            const i32 y1 = glm::min(y * 2 + 1, srcSize.y - 1);
+            for (i32 x = 0; x < size.x; ++x)
+            {
+                const i32 x0 = glm::min(x * 2, srcSize.x - 1);
+                const i32 x1 = glm::min(x * 2 + 1, srcSize.x - 1);
+                const u8* p00 = &src[(y0 * srcSize.x + x0) * 4];
+                const u8* p01 = &src[(y0 * srcSize.x + x1) * 4];
+                const u8* p10 = &src[(y1 * srcSize.x + x0) * 4];
+                const u8* p11 = &src[(y1 * srcSize.x + x1) * 4];
+                u8* out = &dst[(y * size.x + x) * 4];
+
+                for (u32 c = 0; c < 4; ++c)
+                    out[c] = (u8)((p00[c] + p01[c] + p10[c] + p11[c] + 2) / 4);
+
+                if (isNormalMap)
+                {
+                    // averaged normals get shorter, push them back to unit length
+                    vec3 n = vec3(out[0], out[1], out[2]) / 127.5f - 1.0f;
+                    float len = glm::length(n);
+                    n = (len > 0.0f) ? n / len : vec3(0.0f, 0.0f, 1.0f);
+                    out[0] = (u8)glm::clamp((n.x + 1.0f) * 127.5f + 0.5f, 0.0f, 255.0f);
+                    out[1] = (u8)glm::clamp((n.y + 1.0f) * 127.5f + 0.5f, 0.0f, 255.0f);
+                    out[2] = (u8)glm::clamp((n.z + 1.0f) * 127.5f + 0.5f, 0.0f, 255.0f);
+                }
+            }
+        }
+
+        levels.push_back(std::move(dst));
+    }
+}
+
+// Gathers a 4x4 block (RGBA8, row major), replicating the edges of images
+// smaller than a block or not multiple of 4
+static void FetchBlock(const u8* rgba, ivec2 size, i32 blockX, i32 blockY, u8 block[64])
+{
+    for (i32 y = 0; y < 4; ++y)
+    {
+        const i32 srcY = glm::min(blockY * 4 + y, size.y - 1);
+        for (i32 x = 0; x < 4; ++x)
+        {
+            const i32 srcX = glm::min(blockX * 4 + x, size.x - 1);
+            memcpy(&block[(y * 4 + x) * 4], &rgba[(srcY * size.x + srcX) * 4], 4);
+        }
+    }
+}
+
+static void ComputeBlockBounds(const u8 block[64], u8 minColor[4], u8 maxColor[4])
+{
+#ifdef BLOCK_COMPRESSION_SSE2
+    const __m128i p0 = _mm_loadu_si128((const __m128i*)(block + 0));
+    const __m128i p1 = _mm_loadu_si128((const __m128i*)(block + 16));
+    const __m128i p2 = _mm_loadu_si128((const __m128i*)(block + 32));
+    const __m128i p3 = _mm_loadu_si128((const __m128i*)(block + 48));
+
+    __m128i mn = _mm_min_epu8(_mm_min_epu8(p0, p1), _mm_min_epu8(p2, p3));
+    __m128i mx = _mm_max_epu8(_mm_max_epu8(p0, p1), _mm_max_epu8(p2, p3));
+
+    // reduce the 4 pixels left in each register
+    mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(2, 3, 0, 1)));
+    mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(1, 0, 3, 2)));
+    mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(2, 3, 0, 1)));
+    mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(1, 0, 3, 2)));
+
+    const u32 minPacked = (u32)_mm_cvtsi128_si32(mn);
+    const u32 maxPacked = (u32)_mm_cvtsi128_si32(mx);
+    memcpy(minColor, &minPacked, 4);
+    memcpy(maxColor, &maxPacked, 4);
+#else
+    for (u32 c = 0; c < 4; ++c)
+    {
+        minColor[c] = 255;
+        maxColor[c] = 0;
+    }
+    for (u32 i = 0; i < 16; ++i)
+    {
+        for (u32 c = 0; c < 4; ++c)
+        {
+            minColor[c] = glm::min(minColor[c], block[i * 4 + c]);
+            maxColor[c] = glm::max(maxColor[c], block[i * 4 + c]);
+        }
+    }
+#endif
+}
+
+static u16 PackRGB565(const i32 color[3])
+{
+    return (u16)(((color[0] >> 3) << 11) | ((color[1] >> 2) << 5) | (color[2] >> 3));
+}
+
+static void UnpackRGB565(u16 packed, i32 color[3])
+{
+    const i32 r = (packed >> 11) & 31;
+    const i32 g = (packed >> 5) & 63;
+    const i32 b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// Returns the 2 bit palette index of the 16 texels packed in BC1 order
+static u32 FindColorIndices(const u8 block[64], const i32 palette[4][3])
+{
+    u32 indices = 0;
+
+#ifdef BLOCK_COMPRESSION_SSE2
+    // Work on 4 texels at a time with (r,g) and (b,0) pairs of 16 bit values,
+    // so _mm_madd_epi16 yields the per texel squared distance in 32 bit lanes
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i blueMask = _mm_set1_epi32(0x0000FFFF);
+
+    for (u32 group = 0; group < 4; ++group)
+    {
+        const __m128i texels = _mm_loadu_si128((const __m128i*)(block + group * 16));
+        __m128i lo = _mm_unpacklo_epi8(texels, zero); // r0 g0 b0 a0 r1 g1 b1 a1
+        __m128i hi = _mm_unpackhi_epi8(texels, zero); // r2 g2 b2 a2 r3 g3 b3 a3
+        lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+        hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+        const __m128i rg = _mm_unpacklo_epi64(lo, hi);
+        const __m128i b0 = _mm_and_si128(_mm_unpackhi_epi64(lo, hi), blueMask);
+
+        __m128i bestDistance = _mm_set1_epi32(0x7FFFFFFF);
+        __m128i bestIndex = zero;
+
+        for (i32 k = 0; k < 4; ++k)
+        {
+            const __m128i paletteRG = _mm_set1_epi32(palette[k][0] | (palette[k][1] << 16));
+            const __m128i paletteB = _mm_set1_epi32(palette[k][2]);
+            const __m128i dRG = _mm_sub_epi16(rg, paletteRG);
+            const __m128i dB = _mm_sub_epi16(b0, paletteB);
+            const __m128i distance = _mm_add_epi32(_mm_madd_epi16(dRG, dRG), _mm_madd_epi16(dB, dB));
+
+            const __m128i closer = _mm_cmplt_epi32(distance, bestDistance);
+            bestDistance = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, bestDistance));
+            bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, bestIndex));
+        }
+
+        u32 groupIndices[4];
+        _mm_storeu_si128((__m128i*)groupIndices, bestIndex);
+        for (u32 i = 0; i < 4; ++i)
+            indices |= groupIndices[i] << ((group * 4 + i) * 2);
+    }
+#else
+    for (u32 i = 0; i < 16; ++i)
+    {
+        i32 bestDistance = INT32_MAX;
+        u32 bestIndex = 0;
+        for (u32 k = 0; k < 4; ++k)
+        {
+            const i32 dr = block[i * 4 + 0] - palette[k][0];
+            const i32 dg = block[i * 4 + 1] - palette[k][1];
+            const i32 db = block[i * 4 + 2] - palette[k][2];
+            const i32 distance = dr * dr + dg * dg + db * db;
+            if (distance < bestDistance)
+            {
+                bestDistance = distance;
+                bestIndex = k;
+            }
+        }
+        indices |= bestIndex << (i * 2);
+    }
+#endif
+
+    return indices;
+}
+
+static void EncodeColorBlock(const u8 block[64], u8* out)
+{
+    u8 minColor[4], maxColor[4];
+    ComputeBlockBounds(block, minColor, maxColor);
+
+    // inset the bounding box a bit, extremes are usually outliers
+    i32 lo[3], hi[3], center[3];
+    for (u32 c = 0; c < 3; ++c)
+    {
+        const i32 inset = (maxColor[c] - minColor[c]) >> 4;
+        lo[c] = glm::min(minColor[c] + inset, 255);
+        hi[c] = glm::max(maxColor[c] - inset, 0);
+        center[c] = (minColor[c] + maxColor[c] + 1) >> 1;
+    }
+
+    // pick the bounding box diagonal that follows the colors: flip the
+    // green/blue extents when they decrease as red increases
+    i32 covarianceRG = 0, covarianceRB = 0;
+    for (u32 i = 0; i < 16; ++i)
+    {
+        const i32 r = block[i * 4 + 0] - center[0];
+        covarianceRG += r * (block[i * 4 + 1] - center[1]);
+        covarianceRB += r * (block[i * 4 + 2] - center[2]);
+    }
+    if (covarianceRG < 0) std::swap(lo[1], hi[1]);
+    if (covarianceRB < 0) std::swap(lo[2], hi[2]);
+
+    u16 color0 = PackRGB565(hi);
+    u16 color1 = PackRGB565(lo);
+
+    // color0 > color1 selects the 4 color mode
+    if (color0 < color1)
+        std::swap(color0, color1);
+
+    u32 indices = 0;
+    if (color0 != color1)
+    {
+        i32 palette[4][3];
+        UnpackRGB565(color0, palette[0]);
+        UnpackRGB565(color1, palette[1]);
+        for (u32 c = 0; c < 3; ++c)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        indices = FindColorIndices(block, palette);
+    }
+
+    memcpy(out + 0, &color0, 2);
+    memcpy(out + 2, &color1, 2);
+    memcpy(out + 4, &indices, 4);
+}
+
+// BC4 block of one channel (the one at channelOffset in the RGBA block)
+static void EncodeChannelBlock(const u8 block[64], u32 channelOffset, u8* out)
+{
+    u8 minValue = 255, maxValue = 0;
+    for (u32 i = 0; i < 16; ++i)
+    {
+        minValue = glm::min(minValue, block[i * 4 + channelOffset]);
+        maxValue = glm::max(maxValue, block[i * 4 + channelOffset]);
+    }
+
+    // value0 > value1 selects the 8 value mode:
+    // index 0 = value0, 1 = value1, 2..7 = interpolated from value0 to value1
+    const i32 value0 = maxValue;
+    const i32 value1 = minValue;
+
+    i32 palette[8];
+    palette[0] = value0;
+    palette[1] = value1;
+    for (i32 i = 1; i < 7; ++i)
+        palette[i + 1] = ((7 - i) * value0 + i * value1) / 7;
+
+    u64 indices = 0;
+    if (value0 != value1)
+    {
+        for (u32 i = 0; i < 16; ++i)
+        {
+            const i32 value = block[i * 4 + channelOffset];
+            i32 bestDistance = INT32_MAX;
+            u64 bestIndex = 0;
+            for (u32 k = 0; k < 8; ++k)
+            {
+                const i32 distance = glm::abs(value - palette[k]);
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    bestIndex = k;
+                }
+            }
+            indices |= bestIndex << (i * 3);
+        }
+    }
+
+    out[0] = (u8)value0;
+    out[1] = (u8)value1;
+    for (u32 i = 0; i < 6; ++i)
+        out[2 + i] = (u8)(indices >> (i * 8));
+}
+
+static void CompressLevel(const u8* rgba, ivec2 size, BlockFormat format, u8* out)
+{
+    const i32 blocksX = (size.x + 3) / 4;
+    const i32 blocksY = (size.y + 3) / 4;
+    const u32 blockBytes = GetBlockFormatBlockBytes(format);
+
+    ParallelFor(blocksY, COMPRESSION_BATCH_ROWS, [=](u32 beginRow, u32 endRow)
+    {
+        u8 block[64];
+        for (u32 blockY = beginRow; blockY < endRow; ++blockY)
+        {
+            for (i32 blockX = 0; blockX < blocksX; ++blockX)
+            {
+                FetchBlock(rgba, size, blockX, blockY, block);
+                u8* dst = out + (blockY * blocksX + blockX) * blockBytes;
+
+                switch (format)
+                {
+                    case BlockFormat_BC1:
+                        EncodeColorBlock(block, dst);
+                        break;
+                    case BlockFormat_BC3:
+                        EncodeChannelBlock(block, 3, dst);
+                        EncodeColorBlock(block, dst + 8);
+                        break;
+                    case BlockFormat_BC5:
+                        EncodeChannelBlock(block, 0, dst);
+                        EncodeChannelBlock(block, 1, dst + 8);
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+    });
+}
+
+void CompressImage(const Image& image, BlockFormat format, bool isNormalMap, CompressedImage& compressed)
+{
+    std::vector<u8> rgba;
+    ExpandToRGBA(image, rgba);
+
+    std::vector<std::vector<u8>> levels;
+    GenerateMipChain(rgba.data(), image.size, isNormalMap, levels);
+
+    compressed.format = format;
+    compressed.size = image.size;
+    compressed.nchannels = image.nchannels;
+    compressed.levelOffsets.clear();
+    compressed.levelSizes.clear();
+
+    u32 totalSize = 0;
+    ivec2 levelSize = image.size;
+    for (u32 level = 0; level < levels.size(); ++level)
+    {
+        const u32 levelBytes = ((levelSize.x + 3) / 4) * ((levelSize.y + 3) / 4) * GetBlockFormatBlockBytes(format);
+        compressed.levelOffsets.push_back(totalSize);
+        compressed.levelSizes.push_back(levelBytes);
+        totalSize += levelBytes;
+        levelSize = glm::max(levelSize / 2, ivec2(1));
+    }
+
+    compressed.data.resize(totalSize);
+
+    levelSize = image.size;
+    for (u32 level = 0; level < levels.size(); ++level)
+    {
+        CompressLevel(levels[level].data(), levelSize, format, &compressed.data[compressed.levelOffsets[level]]);
+        levelSize = glm::max(levelSize / 2, ivec2(1));
+    }
+}
+
+u64 ComputeTextureCacheKey(const std::vector<u8>& fileBytes, bool isNormalMap)
+{
+    u64 key = HashBytes(fileBytes.data(), fileBytes.size());
+    key = HashCombine(key, isNormalMap ? 1 : 0);
+    key = HashCombine(key, TEXTURE_COMPRESSION_VERSION);
+    return key;
+}
+
+static void GetTextureCachePath(u64 key, char* path, u32 pathSize)
+{
+    snprintf(path, pathSize, "%s/%016llx.bct", TEXTURE_CACHE_DIRECTORY, (unsigned long long)key);
+}
+
+bool ReadTextureCache(u64 key, CompressedImage& compressed)
+{
+    char path[256];
+    GetTextureCachePath(key, path, sizeof(path));
+
+    std::vector<u8> bytes;
+    if (!ReadBinaryFile(path, bytes) || bytes.size() < sizeof(TextureCacheHeader))
+        return false;
+
+    TextureCacheHeader header;
+    memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != TEXTURE_CACHE_MAGIC || header.version != TEXTURE_COMPRESSION_VERSION || header.format >= BlockFormat_Count)
+        return false;
+
+    const u64 tableSize = header.mipCount * sizeof(u32);
+    if (bytes.size() < sizeof(header) + tableSize)
+        return false;
+
+    compressed.format = (BlockFormat)header.format;
+    compressed.size = ivec2(header.width, header.height);
+    compressed.nchannels = header.nchannels;
+    compressed.levelSizes.resize(header.mipCount);
+    compressed.levelOffsets.resize(header.mipCount);
+    memcpy(compressed.levelSizes.data(), bytes.data() + sizeof(header), tableSize);
+
+    u32 totalSize = 0;
+    for (u32 level = 0; level < header.mipCount; ++level)
+    {
+        compressed.levelOffsets[level] = totalSize;
+        totalSize += compressed.levelSizes[level];
+    }
+
+    if (bytes.size() != sizeof(header) + tableSize + totalSize)
+        return false;
+
+    compressed.data.assign(bytes.begin() + sizeof(header) + tableSize, bytes.end());
+    return true;
+}
+
+void WriteTextureCache(u64 key, const CompressedImage& compressed)
+{
+    MakeDirectory(TEXTURE_CACHE_DIRECTORY);
+
+    TextureCacheHeader header = {};
+    header.magic = TEXTURE_CACHE_MAGIC;
+    header.version = TEXTURE_COMPRESSION_VERSION;
+    header.format = compressed.format;
+    header.width = compressed.size.x;
+    header.height = compressed.size.y;
+    header.nchannels = compressed.nchannels;
+    header.mipCount = compressed.levelSizes.size();
+
+    std::vector<u8> bytes(sizeof(header) + header.mipCount * sizeof(u32) + compressed.data.size());
+    u8* cursor = bytes.data();
+    memcpy(cursor, &header, sizeof(header));
+    cursor += sizeof(header);
+    memcpy(cursor, compressed.levelSizes.data(), header.mipCount * sizeof(u32));
+    cursor += header.mipCount * sizeof(u32);
+    memcpy(cursor, compressed.data.data(), compressed.data.size());
+
+    char path[256];
+    GetTextureCachePath(key, path, sizeof(path));
+    WriteBinaryFile(path, bytes.data(), bytes.size());
+}
+
+GLuint CreateTexture2DFromCompressedImage(const CompressedImage& compressed)
+{
+    const GLenum internalFormat = GetBlockFormatInternalFormat(compressed.format);
+    const u32 mipCount = compressed.levelSizes.size();
+
+    GLuint texHandle;
+    glGenTextures(1, &texHandle);
+    glBindTexture(GL_TEXTURE_2D, texHandle);
+    glTexStorage2D(GL_TEXTURE_2D, mipCount, internalFormat, compressed.size.x, compressed.size.y);
+
+    ivec2 levelSize = compressed.size;
+    for (u32 level = 0; level < mipCount; ++level)
+    {
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, levelSize.x, levelSize.y, internalFormat,
+                                  compressed.levelSizes[level], &compressed.data[compressed.levelOffsets[level]]);
+        levelSize = glm::max(levelSize / 2, ivec2(1));
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return texHandle;
+}
+
+bool PrepareCompressedImage(const std::vector<u8>& fileBytes, bool isNormalMap, i32 atlasMaxTextureSize,
+                            CompressedImage& compressed, Image* decodedImage)
+{
+    if (decodedImage)
+        *decodedImage = {};
+
+    const u64 key = ComputeTextureCacheKey(fileBytes, isNormalMap);
+    if (ReadTextureCache(key, compressed))
+        return true;
+
+    Image image = {};
+    stbi_set_flip_vertically_on_load_thread(true);
+    image.pixels = stbi_load_from_memory(fileBytes.data(), (int)fileBytes.size(), &image.size.x, &image.size.y, &image.nchannels, 0);
+    if (!image.pixels)
+        return false;
+    image.stride = image.size.x * image.nchannels;
+
+    // small images go to the atlas, and blocks need at least 4x4 texels
+    const bool atlasCandidate = image.size.x <= atlasMaxTextureSize && image.size.y <= atlasMaxTextureSize;
+    if (atlasCandidate || image.size.x < 4 || image.size.y < 4)
+    {
+        if (decodedImage)
+            *decodedImage = image;
+        else
+            stbi_image_free(image.pixels);
+        return false;
+    }
+
+    CompressImage(image, ChooseBlockFormat(image, isNormalMap), isNormalMap, compressed);
+    stbi_image_free(image.pixels);
+
+    WriteTextureCache(key, compressed);
+
+    ILOG("Compressed texture %016llx: %u KB -> %u KB", (unsigned long long)key,
+         (u32)(compressed.size.x * compressed.size.y * compressed.nchannels * 4 / 3 / 1024),
+         (u32)(compressed.data.size() / 1024));
+    return true;
+}
+
+bool LoadCompressedTexture2D(App* app, const char* filepath, bool isNormalMap, Texture& tex)
+{
+    std::vector<u8> fileBytes;
+    if (!ReadBinaryFile(filepath, fileBytes))
+        return false;
+
+    CompressedImage compressed;
+    if (!PrepareCompressedImage(fileBytes, isNormalMap, app->atlasMaxTextureSize, compressed))
+        return false;
+
+    tex.handle = CreateTexture2DFromCompressedImage(compressed);
+    tex.filepath = filepath;
+    tex.image.size = compressed.size;
+    tex.image.nchannels = compressed.nchannels;
+    tex.internalFormat = GetBlockFormatInternalFormat(compressed.format);
+    tex.mipCount = compressed.levelSizes.size();
+    return true;
+}
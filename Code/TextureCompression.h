@@ -0,0 +1,72 @@
+#pragma once
+#include "engine.h"
+
+// S3TC is an extension, so glad (core profile only) doesn't define these
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// Bump it whenever the encoder output changes, so stale cache entries are ignored
+#define TEXTURE_COMPRESSION_VERSION 1
+
+#define TEXTURE_CACHE_DIRECTORY "TextureCache"
+
+enum BlockFormat
+{
+    BlockFormat_BC1, // opaque color
+    BlockFormat_BC3, // color + alpha
+    BlockFormat_BC5, // normal maps (two channels, z is reconstructed)
+    BlockFormat_Count
+};
+
+struct CompressedImage
+{
+    BlockFormat      format;
+    ivec2            size;
+    i32              nchannels;  // channels of the source image
+    std::vector<u32> levelOffsets;
+    std::vector<u32> levelSizes;
+    std::vector<u8>  data;
+};
+
+GLenum GetBlockFormatInternalFormat(BlockFormat format);
+
+// Whether the context can sample BC1/BC3 (GL_EXT_texture_compression_s3tc,
+// BC5 is core). Needs a current context.
+bool IsBlockCompressionSupported();
+
+// Converts an 8-bit image with any channel count to tightly packed RGBA
+void ExpandToRGBA(const Image& image, std::vector<u8>& rgba);
+
+BlockFormat ChooseBlockFormat(const Image& image, bool isNormalMap);
+
+// Full mip chain (down to 1x1) of an RGBA8 image, box filtered on the CPU.
+// levels[0] is a copy of the source.
+void GenerateMipChain(const u8* rgba, ivec2 size, bool isNormalMap, std::vector<std::vector<u8>>& levels);
+
+// Compresses the image and its whole mip chain, spreading the blocks over the job system
+void CompressImage(const Image& image, BlockFormat format, bool isNormalMap, CompressedImage& compressed);
+
+u64 ComputeTextureCacheKey(const std::vector<u8>& fileBytes, bool isNormalMap);
+
+bool ReadTextureCache(u64 key, CompressedImage& compressed);
+
+void WriteTextureCache(u64 key, const CompressedImage& compressed);
+
+GLuint CreateTexture2DFromCompressedImage(const CompressedImage& compressed);
+
+// CPU half of LoadCompressedTexture2D (cache lookup or decode + compress), safe to
+// call from worker threads. When the image gets decoded but is too small to be
+// compressed it returns false and, if decodedImage is given, hands the decoded
+// pixels over (to be released with stbi_image_free) so they aren't decoded twice.
+bool PrepareCompressedImage(const std::vector<u8>& fileBytes, bool isNormalMap, i32 atlasMaxTextureSize,
+                            CompressedImage& compressed, Image* decodedImage = NULL);
+
+// Loads the image as a block compressed texture, straight from the on-disk cache
+// when an entry for the same file contents exists. Returns false if the file can't
+// be read or the image is too small to be worth compressing (it will likely end up
+// in an atlas), so the caller can fall back to the uncompressed path.
+bool LoadCompressedTexture2D(App* app, const char* filepath, bool isNormalMap, Texture& tex);
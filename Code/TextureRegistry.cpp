@@ -0,0 +1,179 @@
+#include "TextureRegistry.h"
+#include "Hash.h"
+#include <unordered_map>
+
+struct TextureRegistry
+{
+    std::unordered_map<std::string, u32> byPath;     // several paths can lead to the same texture
+    std::unordered_map<u64, u32>         byContent;
+    std::vector<u32>                     freeSlots;
+    std::vector<u32>                     pendingUnloads;
+    u32                                  contentHits;
+};
+
+void InitTextureRegistry(App* app)
+{
+    app->textureRegistry = new TextureRegistry();
+}
+
+void ShutdownTextureRegistry(App* app)
+{
+    delete app->textureRegistry;
+    app->textureRegistry = NULL;
+}
+
+u32 AcquireTexture(App* app, const std::string& canonicalPath, u32 flags, u64& contentHash, u64 fileHash)
+{
+    TextureRegistry* registry = app->textureRegistry;
+    contentHash = 0;
+
+    u32 texIdx = UINT32_MAX;
+
+    auto path = registry->byPath.find(canonicalPath);
+    if (path != registry->byPath.end())
+    {
+        texIdx = path->second;
+    }
+    else if (app->dedupeTextureContents)
+    {
+        // only hashed the first time a path shows up, it costs a read of the file
+        std::vector<u8> bytes;
+        if (!fileHash && ReadBinaryFile(canonicalPath.c_str(), bytes) && !bytes.empty())
+            fileHash = HashBytes(bytes.data(), bytes.size());
+
+        if (fileHash)
+        {
+            // normal maps are compressed differently, they can't share with color maps
+            contentHash = HashCombine(fileHash, flags & TextureFlags_NormalMap);
+
+            auto content = registry->byContent.find(contentHash);
+            if (content != registry->byContent.end())
+            {
+                texIdx = content->second;
+                registry->byPath[canonicalPath] = texIdx;
+                registry->contentHits++;
+                ILOG("%s shares the texture of %s", canonicalPath.c_str(), app->textures[texIdx].filepath.c_str());
+            }
+        }
+    }
+
+    if (texIdx != UINT32_MAX)
+        app->textures[texIdx].refCount++;
+
+    return texIdx;
+}
+
+u32 RegisterTexture(App* app, const Texture& tex, u64 contentHash)
+{
+    TextureRegistry* registry = app->textureRegistry;
+
+    u32 texIdx;
+    if (!registry->freeSlots.empty())
+    {
+        texIdx = registry->freeSlots.back();
+        registry->freeSlots.pop_back();
+        app->textures[texIdx] = tex;
+    }
+    else
+    {
+        texIdx = app->textures.size();
+        app->textures.push_back(tex);
+    }
+
+    Texture& registered = app->textures[texIdx];
+    registered.refCount = 1;
+    registered.contentHash = contentHash;
+
+    registry->byPath[registered.filepath] = texIdx;
+    if (contentHash)
+        registry->byContent[contentHash] = texIdx;
+
+    return texIdx;
+}
+
+static void UnloadTexture(App* app, u32 texIdx)
+{
+    TextureRegistry* registry = app->textureRegistry;
+    Texture& tex = app->textures[texIdx];
+
+    for (auto it = registry->byPath.begin(); it != registry->byPath.end();)
+    {
+        if (it->second == texIdx)
+            it = registry->byPath.erase(it);
+        else
+            ++it;
+    }
+    if (tex.contentHash)
+        registry->byContent.erase(tex.contentHash);
+
+    // standalone textures and views of array layers or atlas pages alike. The
+    // layer (or atlas region) itself stays allocated until the arrays are
+    // rebuilt, and a virtual texture keeps its indirection layer while its
+    // pages age out of the cache.
+    if (tex.handle)
+        glDeleteTextures(1, &tex.handle);
+
+    ILOG("Unloaded %s", tex.filepath.c_str());
+
+    Texture unloaded = {};
+    unloaded.state = TextureState_Unloaded;
+    tex = unloaded;
+
+    registry->freeSlots.push_back(texIdx);
+    app->materialTableDirty = true;
+}
+
+static bool IsTextureInFlight(const Texture& tex)
+{
+    // a worker or the uploads still hold on to the slot
+    return tex.state == TextureState_Loading || tex.state == TextureState_Streaming;
+}
+
+void ReleaseTexture2D(App* app, u32 texIdx)
+{
+    if (texIdx >= app->textures.size())
+        return;
+
+    Texture& tex = app->textures[texIdx];
+    ASSERT(tex.refCount > 0, "Texture released more times than it was loaded");
+
+    if (--tex.refCount > 0)
+        return;
+
+    if (IsTextureInFlight(tex))
+        app->textureRegistry->pendingUnloads.push_back(texIdx);
+    else
+        UnloadTexture(app, texIdx);
+}
+
+void UpdateTextureRegistry(App* app)
+{
+    TextureRegistry* registry = app->textureRegistry;
+
+    for (u32 i = 0; i < registry->pendingUnloads.size();)
+    {
+        const u32 texIdx = registry->pendingUnloads[i];
+        const Texture& tex = app->textures[texIdx];
+
+        if (tex.refCount > 0)
+        {
+            // loaded again in the meantime
+            registry->pendingUnloads.erase(registry->pendingUnloads.begin() + i);
+        }
+        else if (!IsTextureInFlight(tex))
+        {
+            UnloadTexture(app, texIdx);
+            registry->pendingUnloads.erase(registry->pendingUnloads.begin() + i);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+void GetTextureRegistryStats(App* app, u32& loadedTextures, u32& sharedByContent)
+{
+    loadedTextures = app->textures.size() - app->textureRegistry->freeSlots.size();
+    sharedByContent = app->textureRegistry->contentHits;
+}
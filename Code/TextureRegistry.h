@@ -0,0 +1,32 @@
+#pragma once
+#include "engine.h"
+
+// Finds already loaded textures by canonical path and, when
+// app->dedupeTextureContents is set, by a hash of the file bytes, so the same
+// image reached through different paths (or copied to several folders) is
+// only uploaded once. Every LoadTexture2D() takes a reference on the texture
+// it returns and ReleaseTexture2D() gives it back.
+
+void InitTextureRegistry(App* app);
+
+void ShutdownTextureRegistry(App* app);
+
+// Returns the texture loaded from canonicalPath or with the same contents and
+// flags, taking a reference on it, or UINT32_MAX. contentHash is set to the
+// key the texture should be registered with if it has to be loaded (0 if the
+// contents aren't hashed). fileHash saves reading the file when the caller
+// already hashed its bytes.
+u32 AcquireTexture(App* app, const std::string& canonicalPath, u32 flags, u64& contentHash, u64 fileHash = 0);
+
+// Adds a texture with a single reference, reusing the slot of an unloaded one
+// if any. The index stays valid until the texture is released.
+u32 RegisterTexture(App* app, const Texture& tex, u64 contentHash);
+
+// Drops a reference. Unreferenced textures free their GL storage, right away
+// or once they are done streaming in (see UpdateTextureRegistry).
+void ReleaseTexture2D(App* app, u32 texIdx);
+
+// Called once per frame: unloads the released textures that were still loading
+void UpdateTextureRegistry(App* app);
+
+void GetTextureRegistryStats(App* app, u32& loadedTextures, u32& sharedByContent);
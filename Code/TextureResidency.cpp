@@ -0,0 +1,399 @@
+#include "TextureResidency.h"
+#include "TextureStreaming.h"
+#include "TextureCompression.h"
+#include "Materials.h"
+#include "JobSystem.h"
+#include <algorithm>
+
+// Dropped level of an array being decoded again, one layer per job
+struct ResidencyRestore
+{
+    u32 arrayIdx;
+    std::vector<u32> layerTexIdx;
+    std::vector<DecodedTexture> layers;
+    std::vector<u8> decoded;  // per layer, false if the file couldn't be decoded
+    JobCounter counter;
+};
+
+struct TextureResidency
+{
+    ResidencyRestore* restore;
+    u64 residentBytes;
+
+    // arrays whose files don't decode to what is in VRAM anymore, never restored
+    std::vector<u32> unrestorableArrays;
+};
+
+u64 ComputeTextureLevelBytes(GLenum internalFormat, ivec2 size)
+{
+    const u64 blocks = (u64)((size.x + 3) / 4) * ((size.y + 3) / 4);
+    switch (internalFormat)
+    {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:  return blocks * 8;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_RG_RGTC2:           return blocks * 16;
+        default:                               return (u64)size.x * size.y * 4; // RGB8 is padded to 4 bytes too
+    }
+}
+
+static u64 ComputeTextureBytes(GLenum internalFormat, ivec2 size, u32 firstLevel, u32 mipCount, u32 layerCount)
+{
+    u64 bytes = 0;
+    for (u32 level = firstLevel; level < mipCount; ++level)
+        bytes += ComputeTextureLevelBytes(internalFormat, GetMipSize(size, level));
+    return bytes * layerCount;
+}
+
+void InitTextureResidency(App* app)
+{
+    app->textureResidency = new TextureResidency();
+}
+
+void ShutdownTextureResidency(App* app)
+{
+    TextureResidency* residency = app->textureResidency;
+    if (!residency)
+        return;
+
+    if (residency->restore)
+    {
+        WaitForJobCounter(residency->restore->counter);
+        delete residency->restore;
+    }
+
+    delete residency;
+    app->textureResidency = NULL;
+}
+
+f32 EstimateScreenSize(App* app, SceneObject& sceneObject)
+{
+    Mesh& mesh = app->meshes[app->models[sceneObject.modelIdx].meshIdx];
+    if (mesh.boundingRadius < 0.0f)
+    {
+        mesh.boundingRadius = 0.0f;
+        for (const Submesh& submesh : mesh.submeshes)
+        {
+            // positions are the first attribute of every layout
+            const u32 strideFloats = glm::max(submesh.vertexBufferLayout.stride / (u32)sizeof(float), 1u);
+            for (u32 v = 0; v + 2 < submesh.vertices.size(); v += strideFloats)
+            {
+                vec3 position(submesh.vertices[v], submesh.vertices[v + 1], submesh.vertices[v + 2]);
+                mesh.boundingRadius = glm::max(mesh.boundingRadius, glm::length(position));
+            }
+        }
+    }
+
+    const mat4x4& world = sceneObject.worldMatrix;
+    const f32 scale = glm::max(glm::length(vec3(world[0])), glm::max(glm::length(vec3(world[1])), glm::length(vec3(world[2]))));
+    const f32 radius = mesh.boundingRadius * scale;
+    const f32 distance = glm::length(vec3(world[3]) - app->camera.Position);
+
+    if (distance <= radius)
+        return (f32)app->displaySize.y;
+
+    const f32 tanHalfFov = glm::tan(glm::radians(app->camera.fov) * 0.5f);
+    return glm::min(radius / (distance * tanHalfFov), 1.0f) * app->displaySize.y;
+}
+
+static void MarkTextureDrawn(App* app, u32 texIdx, f32 screenSize)
+{
+    if (texIdx >= app->textures.size())
+        return;
+
+    Texture& tex = app->textures[texIdx];
+    if (tex.lastUsedFrame != app->frameIndex)
+    {
+        tex.lastUsedFrame = app->frameIndex;
+        tex.screenSize = screenSize;
+    }
+    else
+    {
+        tex.screenSize = glm::max(tex.screenSize, screenSize);
+    }
+}
+
+void MarkMaterialDrawn(App* app, u32 materialIdx, f32 screenSize)
+{
+    const Material& material = app->materials[materialIdx];
+    MarkTextureDrawn(app, material.albedoTextureIdx, screenSize);
+    MarkTextureDrawn(app, material.emissiveTextureIdx, screenSize);
+    MarkTextureDrawn(app, material.specularTextureIdx, screenSize);
+    MarkTextureDrawn(app, material.normalsTextureIdx, screenSize);
+    MarkTextureDrawn(app, material.bumpTextureIdx, screenSize);
+}
+
+// Moves the array into new storage of newSize/newMipCount. Levels are copied
+// from srcFirstLevel on into dstFirstLevel on, and the layer views recreated.
+static void ReallocateTextureArray(App* app, u32 arrayIdx, ivec2 newSize, u32 newMipCount, u32 srcFirstLevel, u32 dstFirstLevel)
+{
+    TextureArray& array = app->textureArrays[arrayIdx];
+
+    TextureArray resized = array;
+    resized.size = newSize;
+    resized.mipCount = newMipCount;
+    resized.handle = CreateTextureArrayStorage(resized);
+
+    const u32 copyCount = glm::min(array.mipCount - srcFirstLevel, newMipCount - dstFirstLevel);
+    for (u32 i = 0; i < copyCount; ++i)
+    {
+        const ivec2 levelSize = GetMipSize(array.size, srcFirstLevel + i);
+        glCopyImageSubData(array.handle, GL_TEXTURE_2D_ARRAY, srcFirstLevel + i, 0, 0, 0,
+                           resized.handle, GL_TEXTURE_2D_ARRAY, dstFirstLevel + i, 0, 0, 0,
+                           levelSize.x, levelSize.y, array.layerCount);
+    }
+
+    // the old views keep the old storage alive, so replace them before deleting it
+    GLuint oldHandle = array.handle;
+    array = resized;
+    for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
+        if (app->textures[texIdx].arrayIdx == arrayIdx)
+            CreateTextureLayerView(app, texIdx);
+
+    glDeleteTextures(1, &oldHandle);
+}
+
+static bool IsArrayEvictable(App* app, u32 arrayIdx)
+{
+    const TextureArray& array = app->textureArrays[arrayIdx];
+    if (array.atlas || glm::min(array.size.x, array.size.y) <= RESIDENCY_MIN_SIZE)
+        return false;
+
+    TextureResidency* residency = app->textureResidency;
+    if (residency->restore && residency->restore->arrayIdx == arrayIdx)
+        return false;
+
+    // dropped mips are decoded again from the file, so it has to give back exactly
+    // the same texture (textures loaded synchronously may use other formats)
+    for (const Texture& tex : app->textures)
+        if (tex.arrayIdx == arrayIdx && (tex.flags & TextureFlags_Immediate))
+            return false;
+
+    return true;
+}
+
+struct ArrayUsage
+{
+    u32 arrayIdx;
+    u64 lastUsedFrame;
+    f32 screenSize;
+};
+
+static void GatherArrayUsage(App* app, std::vector<ArrayUsage>& usages)
+{
+    usages.resize(app->textureArrays.size());
+    for (u32 i = 0; i < usages.size(); ++i)
+        usages[i] = { i, 0, 0.0f };
+
+    for (const Texture& tex : app->textures)
+    {
+        if (tex.arrayIdx == UINT32_MAX)
+            continue;
+
+        ArrayUsage& usage = usages[tex.arrayIdx];
+        usage.lastUsedFrame = glm::max(usage.lastUsedFrame, tex.lastUsedFrame);
+        if (app->frameIndex - tex.lastUsedFrame <= RESIDENCY_IDLE_FRAMES)
+            usage.screenSize = glm::max(usage.screenSize, tex.screenSize);
+    }
+}
+
+static void UpdateResidentBytes(App* app)
+{
+    u64 total = 0;
+
+    for (const TextureArray& array : app->textureArrays)
+        total += ComputeTextureBytes(array.internalFormat, array.size, 0, array.mipCount, array.layerCount);
+
+    for (Texture& tex : app->textures)
+    {
+        if (tex.state == TextureState_Loading || tex.state == TextureState_Failed || tex.state == TextureState_Virtual ||
+            tex.state == TextureState_Unloaded)
+        {
+            // (virtual textures live in the page cache, a fixed allocation)
+            tex.residentBytes = 0;
+        }
+        else if (tex.arrayIdx == UINT32_MAX)
+        {
+            tex.residentBytes = ComputeTextureBytes(tex.internalFormat, tex.image.size, tex.baseLevel, tex.mipCount, 1);
+            total += tex.residentBytes;
+        }
+        else
+        {
+            // its layer, or its region of an atlas page (counted with the arrays)
+            const TextureArray& array = app->textureArrays[tex.arrayIdx];
+            const ivec2 size = array.atlas ? tex.image.size : array.size;
+            tex.residentBytes = ComputeTextureBytes(array.internalFormat, size, 0, array.mipCount, 1);
+        }
+    }
+
+    app->textureResidency->residentBytes = total;
+}
+
+static void DropTopLevel(App* app, u32 arrayIdx)
+{
+    TextureArray& array = app->textureArrays[arrayIdx];
+    ReallocateTextureArray(app, arrayIdx, GetMipSize(array.size, 1), array.mipCount - 1, 1, 0);
+    array.droppedLevels++;
+
+    ILOG("Texture array %u dropped to %dx%d", arrayIdx, array.size.x, array.size.y);
+}
+
+static void StartRestore(App* app, u32 arrayIdx)
+{
+    ResidencyRestore* restore = new ResidencyRestore();
+    restore->arrayIdx = arrayIdx;
+
+    for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
+        if (app->textures[texIdx].arrayIdx == arrayIdx)
+            restore->layerTexIdx.push_back(texIdx);
+
+    restore->layers.resize(restore->layerTexIdx.size());
+    restore->decoded.resize(restore->layerTexIdx.size());
+
+    for (u32 i = 0; i < restore->layerTexIdx.size(); ++i)
+    {
+        const Texture& tex = app->textures[restore->layerTexIdx[i]];
+        const std::string filepath = tex.filepath;
+        const bool isNormalMap = (tex.flags & TextureFlags_NormalMap) != 0;
+        const bool compress = app->compressTextures;
+        const i32 atlasMaxTextureSize = app->atlasMaxTextureSize;
+
+        RunJob([restore, i, filepath, isNormalMap, compress, atlasMaxTextureSize]()
+        {
+            restore->decoded[i] = DecodeTextureFile(filepath.c_str(), isNormalMap, compress, atlasMaxTextureSize, restore->layers[i]);
+        }, &restore->counter);
+    }
+
+    app->textureResidency->restore = restore;
+}
+
+static void FinishRestore(App* app)
+{
+    TextureResidency* residency = app->textureResidency;
+    ResidencyRestore* restore = residency->restore;
+    TextureArray& array = app->textureArrays[restore->arrayIdx];
+
+    // the level above the current top, of the full chains decoded from the files
+    const u32 level = array.droppedLevels - 1;
+
+    bool valid = true;
+    for (u32 i = 0; i < restore->layers.size(); ++i)
+    {
+        const DecodedTexture& decoded = restore->layers[i];
+        valid = valid && restore->decoded[i] &&
+                decoded.internalFormat == array.internalFormat &&
+                level < decoded.levels.size() &&
+                decoded.size == restore->layers[0].size &&
+                GetMipSize(decoded.size, level + 1) == array.size;
+    }
+
+    if (!valid)
+    {
+        ELOG("Texture array %u can't be restored, its files changed", restore->arrayIdx);
+        residency->unrestorableArrays.push_back(restore->arrayIdx);
+    }
+    else
+    {
+        const ivec2 newSize = GetMipSize(restore->layers[0].size, level);
+        ReallocateTextureArray(app, restore->arrayIdx, newSize, array.mipCount + 1, 0, 1);
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, array.handle);
+        for (u32 i = 0; i < restore->layers.size(); ++i)
+        {
+            const DecodedTexture& decoded = restore->layers[i];
+            const std::vector<u8>& data = decoded.levels[level];
+            const u32 layer = app->textures[restore->layerTexIdx[i]].arrayLayer;
+
+            if (decoded.compressed)
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, newSize.x, newSize.y, 1,
+                                          array.internalFormat, data.size(), data.data());
+            else
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, newSize.x, newSize.y, 1,
+                                GL_RGBA, GL_UNSIGNED_BYTE, data.data());
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        array.droppedLevels--;
+        ILOG("Texture array %u restored to %dx%d", restore->arrayIdx, array.size.x, array.size.y);
+    }
+
+    delete restore;
+    residency->restore = NULL;
+}
+
+void UpdateTextureResidency(App* app)
+{
+    ErrorGuardOGL error("UpdateTextureResidency()", __FILE__, __LINE__);
+
+    TextureResidency* residency = app->textureResidency;
+
+    if (residency->restore && IsJobCounterDone(residency->restore->counter))
+        FinishRestore(app);
+
+    UpdateResidentBytes(app);
+
+    std::vector<ArrayUsage> usages;
+    GatherArrayUsage(app, usages);
+
+    if (residency->residentBytes > app->textureVramBudget)
+    {
+        // idle arrays go first (oldest first), then the ones drawn the most
+        // minified, where losing the top mip is the least visible
+        std::vector<ArrayUsage> candidates;
+        for (const ArrayUsage& usage : usages)
+            if (IsArrayEvictable(app, usage.arrayIdx))
+                candidates.push_back(usage);
+
+        const u64 frameIndex = app->frameIndex;
+        std::sort(candidates.begin(), candidates.end(), [app, frameIndex](const ArrayUsage& a, const ArrayUsage& b)
+        {
+            const bool aIdle = frameIndex - a.lastUsedFrame > RESIDENCY_IDLE_FRAMES;
+            const bool bIdle = frameIndex - b.lastUsedFrame > RESIDENCY_IDLE_FRAMES;
+            if (aIdle != bIdle)
+                return aIdle;
+            if (aIdle)
+                return a.lastUsedFrame < b.lastUsedFrame;
+            return a.screenSize / app->textureArrays[a.arrayIdx].size.y < b.screenSize / app->textureArrays[b.arrayIdx].size.y;
+        });
+
+        for (u32 i = 0; i < candidates.size() && i < RESIDENCY_MAX_DROPS_PER_FRAME; ++i)
+        {
+            if (residency->residentBytes <= app->textureVramBudget)
+                break;
+
+            DropTopLevel(app, candidates[i].arrayIdx);
+            UpdateResidentBytes(app);
+        }
+    }
+    else if (!residency->restore)
+    {
+        // bring back the most magnified array whose next level fits in the budget
+        u32 bestArrayIdx = UINT32_MAX;
+        f32 bestMagnification = 1.0f;
+        for (const ArrayUsage& usage : usages)
+        {
+            const TextureArray& array = app->textureArrays[usage.arrayIdx];
+            if (array.droppedLevels == 0 || app->frameIndex - usage.lastUsedFrame > RESIDENCY_IDLE_FRAMES)
+                continue;
+
+            const std::vector<u32>& blocked = residency->unrestorableArrays;
+            if (std::find(blocked.begin(), blocked.end(), usage.arrayIdx) != blocked.end())
+                continue;
+
+            const u64 cost = ComputeTextureLevelBytes(array.internalFormat, array.size * 2) * array.layerCount;
+            const f32 magnification = usage.screenSize / array.size.y;
+            if (residency->residentBytes + cost <= app->textureVramBudget && magnification > bestMagnification)
+            {
+                bestArrayIdx = usage.arrayIdx;
+                bestMagnification = magnification;
+            }
+        }
+
+        if (bestArrayIdx != UINT32_MAX)
+            StartRestore(app, bestArrayIdx);
+    }
+}
+
+u64 GetResidentTextureBytes(App* app)
+{
+    return app->textureResidency->residentBytes;
+}
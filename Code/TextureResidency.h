@@ -0,0 +1,32 @@
+#pragma once
+#include "engine.h"
+
+// Arrays never lose mips below this size, which keeps block compressed levels
+// at 4x4 or more and everything that small lives in the atlases anyway
+#define RESIDENCY_MIN_SIZE 64
+
+// Frames without being drawn after which a texture is evicted before any other
+#define RESIDENCY_IDLE_FRAMES 120
+
+// Top mips dropped per frame at most while over budget
+#define RESIDENCY_MAX_DROPS_PER_FRAME 4
+
+void InitTextureResidency(App* app);
+
+void ShutdownTextureResidency(App* app);
+
+u64 ComputeTextureLevelBytes(GLenum internalFormat, ivec2 size);
+
+// Height in pixels of the object's bounding sphere on screen
+f32 EstimateScreenSize(App* app, SceneObject& sceneObject);
+
+// Records that the textures of the material were drawn this frame
+void MarkMaterialDrawn(App* app, u32 materialIdx, f32 screenSize);
+
+// Called once per frame: updates the bytes of every texture, drops the top mip
+// of the least recently drawn (then least magnified) arrays while over
+// app->textureVramBudget, and re-streams dropped mips of arrays that are drawn
+// bigger than their resident size again once there is room for them.
+void UpdateTextureResidency(App* app);
+
+u64 GetResidentTextureBytes(App* app);
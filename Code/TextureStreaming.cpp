@@ -0,0 +1,515 @@
+#include "TextureStreaming.h"
+#include "TextureCompression.h"
+#include "TextureAtlas.h"
+#include "Materials.h"
+#include "JobSystem.h"
+#include "Hash.h"
+#include <stb_image.h>
+#include <atomic>
+
+struct TextureStreamRequest
+{
+    u32         texIdx;
+    std::string filepath;
+    bool        isNormalMap;
+    bool        compress;
+    i32         atlasMaxTextureSize;
+
+    // filled by the decode job
+    std::atomic<bool> decoded{ false };
+    bool        failed = false;
+    DecodedTexture texture;
+
+    // upload progress (main thread)
+    bool        storageCreated = false;
+    i32         uploadLevel = -1;  // counts down to 0
+    u32         uploadRow = 0;     // texel rows, or block rows when compressed
+};
+
+struct StreamedLevel
+{
+    u32 texIdx;
+    u32 level;
+};
+
+struct PixelUploadBuffer
+{
+    GLuint handle;
+    GLsync fence;
+    std::vector<StreamedLevel> completedLevels;
+};
+
+struct TextureStreamer
+{
+    PixelUploadBuffer pbos[TEXTURE_STREAMING_PBO_COUNT];
+    u32 pboSize;
+    u32 nextPbo;
+
+    JobCounter decodeJobs;
+    std::vector<TextureStreamRequest*> requests;
+
+    // a texture finished streaming since the atlases/arrays were last built
+    bool texturesArrived;
+    u64 uploadedBytes;
+};
+
+struct UploadCommand
+{
+    u32 texIdx;
+    u32 level;
+    u32 firstRow;
+    u32 rowCount;
+    u32 pboOffset;
+};
+
+bool DecodeTextureFile(const char* filepath, bool isNormalMap, bool compress, i32 atlasMaxTextureSize, DecodedTexture& decoded)
+{
+    std::vector<u8> fileBytes;
+    if (!ReadBinaryFile(filepath, fileBytes))
+        return false;
+
+    decoded.fileHash = HashBytes(fileBytes.data(), fileBytes.size());
+
+    Image image = {};
+    CompressedImage compressed;
+    if (compress && PrepareCompressedImage(fileBytes, isNormalMap, atlasMaxTextureSize, compressed, &image))
+    {
+        decoded.compressed = true;
+        decoded.internalFormat = GetBlockFormatInternalFormat(compressed.format);
+        decoded.size = compressed.size;
+        decoded.nchannels = compressed.nchannels;
+
+        decoded.levels.resize(compressed.levelSizes.size());
+        for (u32 level = 0; level < compressed.levelSizes.size(); ++level)
+        {
+            const u8* begin = &compressed.data[compressed.levelOffsets[level]];
+            decoded.levels[level].assign(begin, begin + compressed.levelSizes[level]);
+        }
+        return true;
+    }
+
+    // too small to compress (or compression disabled): RGBA8 levels built on
+    // the CPU, there's no glGenerateMipmap on a partially uploaded texture
+    if (!image.pixels)
+    {
+        stbi_set_flip_vertically_on_load_thread(true);
+        image.pixels = stbi_load_from_memory(fileBytes.data(), (int)fileBytes.size(), &image.size.x, &image.size.y, &image.nchannels, 0);
+    }
+
+    if (!image.pixels)
+        return false;
+
+    std::vector<u8> rgba;
+    ExpandToRGBA(image, rgba);
+    GenerateMipChain(rgba.data(), image.size, isNormalMap, decoded.levels);
+
+    decoded.compressed = false;
+    decoded.internalFormat = GL_RGBA8;
+    decoded.size = image.size;
+    decoded.nchannels = image.nchannels;
+    stbi_image_free(image.pixels);
+    return true;
+}
+
+GLuint CreateTexture2DFromDecoded(const DecodedTexture& decoded)
+{
+    const u32 mipCount = decoded.levels.size();
+
+    GLuint texHandle;
+    glGenTextures(1, &texHandle);
+    glBindTexture(GL_TEXTURE_2D, texHandle);
+    glTexStorage2D(GL_TEXTURE_2D, mipCount, decoded.internalFormat, decoded.size.x, decoded.size.y);
+
+    for (u32 level = 0; level < mipCount; ++level)
+    {
+        const ivec2 levelSize = GetMipSize(decoded.size, level);
+        if (decoded.compressed)
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, levelSize.x, levelSize.y, decoded.internalFormat,
+                                      decoded.levels[level].size(), decoded.levels[level].data());
+        else
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, levelSize.x, levelSize.y, GL_RGBA, GL_UNSIGNED_BYTE,
+                            decoded.levels[level].data());
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return texHandle;
+}
+
+static void DecodeStreamedTexture(TextureStreamRequest* request)
+{
+    request->failed = !DecodeTextureFile(request->filepath.c_str(), request->isNormalMap, request->compress,
+                                         request->atlasMaxTextureSize, request->texture);
+    request->decoded.store(true, std::memory_order_release);
+}
+
+void InitTextureStreaming(App* app)
+{
+    TextureStreamer* streamer = new TextureStreamer();
+    streamer->pboSize = app->textureStreamingBudget;
+
+    for (u32 i = 0; i < TEXTURE_STREAMING_PBO_COUNT; ++i)
+    {
+        glGenBuffers(1, &streamer->pbos[i].handle);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, streamer->pbos[i].handle);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, streamer->pboSize, NULL, GL_STREAM_DRAW);
+        streamer->pbos[i].fence = 0;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    app->textureStreamer = streamer;
+}
+
+void ShutdownTextureStreaming(App* app)
+{
+    TextureStreamer* streamer = app->textureStreamer;
+    if (!streamer)
+        return;
+
+    // the decode jobs write into the requests
+    WaitForJobCounter(streamer->decodeJobs);
+
+    for (TextureStreamRequest* request : streamer->requests)
+        delete request;
+
+    for (u32 i = 0; i < TEXTURE_STREAMING_PBO_COUNT; ++i)
+    {
+        if (streamer->pbos[i].fence)
+            glDeleteSync(streamer->pbos[i].fence);
+        glDeleteBuffers(1, &streamer->pbos[i].handle);
+    }
+
+    delete streamer;
+    app->textureStreamer = NULL;
+}
+
+void RequestTextureStream(App* app, u32 texIdx, u32 flags, DecodedTexture* decoded)
+{
+    TextureStreamer* streamer = app->textureStreamer;
+
+    TextureStreamRequest* request = new TextureStreamRequest();
+    request->texIdx = texIdx;
+    request->filepath = app->textures[texIdx].filepath;
+    request->isNormalMap = (flags & TextureFlags_NormalMap) != 0;
+    request->compress = app->compressTextures;
+    request->atlasMaxTextureSize = app->atlasMaxTextureSize;
+    streamer->requests.push_back(request);
+
+    if (decoded)
+    {
+        request->texture = std::move(*decoded);
+        request->decoded.store(true, std::memory_order_release);
+        return;
+    }
+
+    RunJob([request]() { DecodeStreamedTexture(request); }, &streamer->decodeJobs);
+}
+
+static void RetireUploadBatches(App* app)
+{
+    TextureStreamer* streamer = app->textureStreamer;
+
+    for (u32 i = 0; i < TEXTURE_STREAMING_PBO_COUNT; ++i)
+    {
+        PixelUploadBuffer& pbo = streamer->pbos[i];
+        if (!pbo.fence)
+            continue;
+
+        GLenum status = glClientWaitSync(pbo.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            continue;
+
+        glDeleteSync(pbo.fence);
+        pbo.fence = 0;
+
+        // the levels of this batch are in VRAM, let the samplers see them
+        for (const StreamedLevel& streamed : pbo.completedLevels)
+        {
+            Texture& tex = app->textures[streamed.texIdx];
+            if (streamed.level < tex.baseLevel)
+            {
+                tex.baseLevel = streamed.level;
+                glBindTexture(GL_TEXTURE_2D, tex.handle);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, tex.baseLevel);
+            }
+
+            if (tex.state == TextureState_Loading)
+            {
+                tex.state = TextureState_Streaming;
+                app->materialTableDirty = true;
+            }
+
+            if (tex.baseLevel == 0)
+            {
+                tex.state = TextureState_Resident;
+                streamer->texturesArrived = true;
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        pbo.completedLevels.clear();
+    }
+}
+
+static void CreateStreamedTexture(App* app, TextureStreamRequest* request)
+{
+    Texture& tex = app->textures[request->texIdx];
+    tex.image.size = request->texture.size;
+    tex.image.nchannels = request->texture.nchannels;
+    tex.internalFormat = request->texture.internalFormat;
+    tex.mipCount = request->texture.levels.size();
+    tex.baseLevel = tex.mipCount - 1;
+
+    // immutable storage for the whole chain, nothing is sampled before the
+    // fence of the first batch lowers the base level to the uploaded mip tail
+    glGenTextures(1, &tex.handle);
+    glBindTexture(GL_TEXTURE_2D, tex.handle);
+    glTexStorage2D(GL_TEXTURE_2D, tex.mipCount, tex.internalFormat, tex.image.size.x, tex.image.size.y);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, tex.baseLevel);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    request->storageCreated = true;
+    request->uploadLevel = tex.mipCount - 1;
+    request->uploadRow = 0;
+}
+
+// rows are texel rows for RGBA8 and 4 texel high block rows when compressed
+static u32 GetLevelRowCount(const TextureStreamRequest* request, u32 level)
+{
+    ivec2 levelSize = GetMipSize(request->texture.size, level);
+    return request->texture.compressed ? (levelSize.y + 3) / 4 : levelSize.y;
+}
+
+// Copies as many rows as fit in the budget into the mapped buffer, mip tail
+// first. Returns false when the budget ran out before the texture was done.
+static bool StageTextureLevels(TextureStreamRequest* request, u8* mapped, u32 budget, u32& used,
+                               std::vector<UploadCommand>& commands, std::vector<StreamedLevel>& completedLevels)
+{
+    while (request->uploadLevel >= 0)
+    {
+        const u32 level = request->uploadLevel;
+        std::vector<u8>& data = request->texture.levels[level];
+        const u32 rowCount = GetLevelRowCount(request, level);
+        const u32 rowBytes = data.size() / rowCount;
+
+        const u32 fittingRows = (budget - used) / rowBytes;
+        if (fittingRows == 0)
+            return false;
+
+        UploadCommand command = {};
+        command.texIdx = request->texIdx;
+        command.level = level;
+        command.firstRow = request->uploadRow;
+        command.rowCount = glm::min(fittingRows, rowCount - request->uploadRow);
+        command.pboOffset = used;
+        commands.push_back(command);
+
+        memcpy(mapped + used, data.data() + command.firstRow * rowBytes, command.rowCount * rowBytes);
+        used = glm::min((used + command.rowCount * rowBytes + 15) & ~15u, budget);
+
+        request->uploadRow += command.rowCount;
+        if (request->uploadRow == rowCount)
+        {
+            completedLevels.push_back({ request->texIdx, level });
+            std::vector<u8>().swap(data);
+            request->uploadLevel--;
+            request->uploadRow = 0;
+        }
+    }
+    return true;
+}
+
+// pixels is NULL to read from the bound unpack buffer at the command's offset
+static void IssueUploadCommand(App* app, const TextureStreamRequest* request, const UploadCommand& command, const u8* pixels = NULL)
+{
+    const Texture& tex = app->textures[command.texIdx];
+    const ivec2 levelSize = GetMipSize(request->texture.size, command.level);
+    const void* offset = pixels ? (const void*)pixels : (const void*)(uintptr_t)command.pboOffset;
+
+    glBindTexture(GL_TEXTURE_2D, tex.handle);
+    if (request->texture.compressed)
+    {
+        const i32 y = command.firstRow * 4;
+        const i32 height = glm::min((i32)command.rowCount * 4, levelSize.y - y);
+        const u32 blocksX = (levelSize.x + 3) / 4;
+        const u32 blockBytes = (tex.internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) ? 8 : 16;
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, command.level, 0, y, levelSize.x, height, tex.internalFormat,
+                                  command.rowCount * blocksX * blockBytes, offset);
+    }
+    else
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, command.level, 0, command.firstRow, levelSize.x, command.rowCount,
+                        GL_RGBA, GL_UNSIGNED_BYTE, offset);
+    }
+}
+
+// For rows that don't fit the budget at all: the rest of the chain goes up
+// straight from the decoded levels, the texture is complete once it returns
+static void UploadRemainingLevels(App* app, TextureStreamRequest* request)
+{
+    for (; request->uploadLevel >= 0; request->uploadLevel--, request->uploadRow = 0)
+    {
+        const u32 level = request->uploadLevel;
+        std::vector<u8>& data = request->texture.levels[level];
+        const u32 rowCount = GetLevelRowCount(request, level);
+        const u32 rowBytes = data.size() / rowCount;
+
+        UploadCommand command = {};
+        command.texIdx = request->texIdx;
+        command.level = level;
+        command.firstRow = request->uploadRow;
+        command.rowCount = rowCount - request->uploadRow;
+        IssueUploadCommand(app, request, command, data.data() + command.firstRow * rowBytes);
+        std::vector<u8>().swap(data);
+    }
+
+    Texture& tex = app->textures[request->texIdx];
+    tex.baseLevel = 0;
+    glBindTexture(GL_TEXTURE_2D, tex.handle);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    tex.state = TextureState_Resident;
+    app->textureStreamer->texturesArrived = true;
+    app->materialTableDirty = true;
+}
+
+void UpdateTextureStreaming(App* app)
+{
+    ErrorGuardOGL error("UpdateTextureStreaming()", __FILE__, __LINE__);
+
+    TextureStreamer* streamer = app->textureStreamer;
+
+    RetireUploadBatches(app);
+
+    // textures that could not be read or decoded show the magenta placeholder
+    for (u32 i = 0; i < streamer->requests.size();)
+    {
+        TextureStreamRequest* request = streamer->requests[i];
+        if (request->decoded.load(std::memory_order_acquire) && request->failed)
+        {
+            ELOG("Failed streaming %s", request->filepath.c_str());
+            app->textures[request->texIdx].state = TextureState_Failed;
+            app->materialTableDirty = true;
+
+            delete request;
+            streamer->requests.erase(streamer->requests.begin() + i);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    // fill the next pixel buffer, unless the GPU hasn't consumed it yet
+    PixelUploadBuffer& pbo = streamer->pbos[streamer->nextPbo];
+    bool anyDecoded = false;
+    for (TextureStreamRequest* request : streamer->requests)
+        anyDecoded |= request->decoded.load(std::memory_order_acquire);
+
+    if (anyDecoded && !pbo.fence)
+    {
+        const u32 budget = glm::min(app->textureStreamingBudget, streamer->pboSize);
+        u32 used = 0;
+        std::vector<UploadCommand> commands;
+        std::vector<TextureStreamRequest*> commandRequests;
+        TextureStreamRequest* oversized = NULL;
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo.handle);
+        u8* mapped = (u8*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, streamer->pboSize,
+                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+        for (TextureStreamRequest* request : streamer->requests)
+        {
+            if (!request->decoded.load(std::memory_order_acquire))
+                continue;
+
+            if (!request->storageCreated)
+                CreateStreamedTexture(app, request);
+
+            u32 firstCommand = commands.size();
+            bool done = StageTextureLevels(request, mapped, budget, used, commands, pbo.completedLevels);
+            for (u32 i = firstCommand; i < commands.size(); ++i)
+                commandRequests.push_back(request);
+
+            if (!done)
+            {
+                // a single row bigger than the whole budget would never fit
+                if (used == 0)
+                    oversized = request;
+                break;
+            }
+        }
+
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        // the offsets are relative to the bound unpack buffer
+        for (u32 i = 0; i < commands.size(); ++i)
+            IssueUploadCommand(app, commandRequests[i], commands[i]);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        if (oversized)
+        {
+            ILOG("%s has rows bigger than the streaming budget, uploading it at once", oversized->filepath.c_str());
+            UploadRemainingLevels(app, oversized);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        if (!commands.empty())
+        {
+            pbo.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            streamer->nextPbo = (streamer->nextPbo + 1) % TEXTURE_STREAMING_PBO_COUNT;
+            streamer->uploadedBytes += used;
+        }
+
+        // every level is in flight, the fences take it from here
+        for (u32 i = 0; i < streamer->requests.size();)
+        {
+            TextureStreamRequest* request = streamer->requests[i];
+            if (request->storageCreated && request->uploadLevel < 0 && !request->failed)
+            {
+                delete request;
+                streamer->requests.erase(streamer->requests.begin() + i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    // atlases and arrays need complete textures, so they are only rebuilt once
+    // nothing is in flight (until then streamed textures are bound on their own)
+    bool batchesInFlight = false;
+    for (u32 i = 0; i < TEXTURE_STREAMING_PBO_COUNT; ++i)
+        batchesInFlight |= streamer->pbos[i].fence != 0;
+
+    if (streamer->texturesArrived && streamer->requests.empty() && !batchesInFlight)
+    {
+        BuildTextureAtlases(app);
+        BuildTextureArrays(app);
+        streamer->texturesArrived = false;
+        app->materialTableDirty = true;
+    }
+
+    if (app->materialTableDirty)
+    {
+        UploadMaterialTable(app);
+        app->materialTableDirty = false;
+    }
+}
+
+void GetTextureStreamingStats(App* app, u32& pendingTextures, u64& uploadedBytes)
+{
+    pendingTextures = 0;
+    for (const Texture& tex : app->textures)
+        if (tex.state == TextureState_Loading || tex.state == TextureState_Streaming)
+            pendingTextures++;
+
+    uploadedBytes = app->textureStreamer->uploadedBytes;
+}
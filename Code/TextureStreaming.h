@@ -0,0 +1,42 @@
+#pragma once
+#include "engine.h"
+
+// Pixel buffers cycled by the uploads, one is filled per frame. A buffer is only
+// reused once the fence of its previous batch has signaled, so the CPU never
+// writes memory the GPU may still be reading from.
+#define TEXTURE_STREAMING_PBO_COUNT 3
+
+// CPU side mip chain of an image file, as it gets uploaded: block compressed
+// (through the texture cache) or RGBA8
+struct DecodedTexture
+{
+    bool   compressed = false;
+    GLenum internalFormat = GL_RGBA8;
+    ivec2  size;
+    i32    nchannels = 0;
+    std::vector<std::vector<u8>> levels;  // level 0 first
+    u64    fileHash = 0;                  // of the file bytes, see AcquireTexture()
+};
+
+// Reads and decodes a texture file, safe to call from worker threads
+bool DecodeTextureFile(const char* filepath, bool isNormalMap, bool compress, i32 atlasMaxTextureSize, DecodedTexture& decoded);
+
+// Immutable texture with the whole decoded mip chain, uploaded right away
+GLuint CreateTexture2DFromDecoded(const DecodedTexture& decoded);
+
+void InitTextureStreaming(App* app);
+
+void ShutdownTextureStreaming(App* app);
+
+// Queues the decode of app->textures[texIdx] (state TextureState_Loading) on a
+// worker. Once decoded, its levels are uploaded from the smallest to the biggest
+// so a blurry version shows up after a couple of frames. Textures decoded
+// beforehand (see LoadModelAsync) skip the decode, their levels are taken over.
+void RequestTextureStream(App* app, u32 texIdx, u32 flags, DecodedTexture* decoded = NULL);
+
+// Called once per frame from the main thread: uploads decoded levels within
+// app->textureStreamingBudget, retires the batches the GPU is done with and,
+// once everything arrived, folds the new textures into atlases/arrays.
+void UpdateTextureStreaming(App* app);
+
+void GetTextureStreamingStats(App* app, u32& pendingTextures, u64& uploadedBytes);
@@ -0,0 +1,272 @@
+#include "UniformBlocks.h"
+
+// Orphans the page: the driver hands out fresh memory instead of waiting for
+// the draws of the last frame that still read it
+static void MapUniformPage(Buffer& page)
+{
+    glBindBuffer(page.type, page.handle);
+    page.data = glMapBufferRange(page.type, 0, page.size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    page.head = 0;
+}
+
+static bool BeginUniformPage(App* app, u32 pageIdx)
+{
+    if (pageIdx >= UNIFORM_MAX_PAGE_COUNT)
+        return false;
+
+    if (pageIdx == app->uniformPages.size())
+        app->uniformPages.push_back(CreateUniformBuffer(UNIFORM_PAGE_SIZE));
+    app->uniformPageIdx = pageIdx;
+    MapUniformPage(app->uniformPages[pageIdx]);
+    return app->uniformPages[pageIdx].data != NULL;
+}
+
+static void EndUniformPage(App* app)
+{
+    Buffer& page = app->uniformPages[app->uniformPageIdx];
+    if (page.data)
+    {
+        BindBuffer(page);
+        UnmapBuffer(page);
+    }
+    page.data = NULL;
+}
+
+void BeginUniformBlocks(App* app)
+{
+    app->uniformOverflowBlocks = 0;
+    BeginUniformPage(app, 0);
+}
+
+u8* PushUniformBlocks(App* app, u32 blockSize, u32 count, u32& page, u32& offset)
+{
+    ASSERT(count > 0, "At least one block has to be pushed");
+    const u32 alignment = (u32)app->uniformBlockAlignment;
+    const u32 size = (count - 1) * Align(blockSize, alignment) + blockSize;
+
+    Buffer* current = &app->uniformPages[app->uniformPageIdx];
+    u32 head = Align(current->head, alignment);
+    if (current->data && head + size > current->size && size <= UNIFORM_PAGE_SIZE)
+    {
+        // the next page, the rest of this one stays unused
+        EndUniformPage(app);
+        if (BeginUniformPage(app, app->uniformPageIdx + 1))
+        {
+            current = &app->uniformPages[app->uniformPageIdx];
+            head = 0;
+        }
+    }
+
+    if (!current->data || head + size > current->size)
+    {
+        app->uniformOverflowBlocks += count;
+        page = UINT32_MAX;
+        offset = 0;
+        return NULL;
+    }
+
+    current->head = head + size;
+    page = app->uniformPageIdx;
+    offset = head;
+    return (u8*)current->data + head;
+}
+
+void EndUniformBlocks(App* app)
+{
+    EndUniformPage(app);
+
+    // logged when it starts, the gui shows it every frame
+    if (app->uniformOverflowBlocks > 0 && app->uniformDroppedBlocks == 0)
+        ELOG("%u uniform blocks didn't fit in %u pages of %u KB, their objects aren't drawn",
+             app->uniformOverflowBlocks, UNIFORM_MAX_PAGE_COUNT, UNIFORM_PAGE_SIZE / 1024);
+    app->uniformDroppedBlocks = app->uniformOverflowBlocks;
+    app->uniformPagesUsed = app->uniformPageIdx + 1;
+}
+
+GLuint GetUniformPageHandle(const App* app, u32 page)
+{
+    return app->uniformPages[page].handle;
+}
+
+void DestroyUniformPages(App* app)
+{
+    for (Buffer& page : app->uniformPages)
+        glDeleteBuffers(1, &page.handle);
+    app->uniformPages.clear();
+}
+
+void UpdateGlobalParams(App* app, const mat4x4& viewProjectionMatrix)
+{
+    // the shaders light at most UNIFORM_MAX_LIGHT_COUNT
+    GlobalParamsBlock globalParams = {};
+    globalParams.viewProjectionMatrix = viewProjectionMatrix;
+    globalParams.cameraPosition = app->camera.Position;
+    globalParams.lightCount = (u32)glm::min(app->lightObjects.size(), (size_t)UNIFORM_MAX_LIGHT_COUNT);
+    for (u32 i = 0; i < globalParams.lightCount; i++)
+    {
+        const Light& light = app->lightObjects[i].light;
+        UniformLight& uniformLight = globalParams.lights[i];
+        uniformLight.type = light.type;
+        uniformLight.color = light.color;
+        uniformLight.direction = light.direction;
+        uniformLight.position = light.position;
+    }
+
+    BindBuffer(app->globalParamsBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(globalParams), &globalParams);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    app->uniformUploadBytes += sizeof(globalParams);
+}
+
+// Bytes from the first block of the object to the end of its last one
+static u32 GetObjectParamsSize(const App* app, const SceneObject& sceneObject)
+{
+    return (sceneObject.localParamsCount - 1) * Align(sizeof(LocalParamsBlock), app->uniformBlockAlignment) + sizeof(LocalParamsBlock);
+}
+
+// One block per node, with the node transform on top of the object's
+static void WriteObjectParams(const App* app, const SceneObject& sceneObject, u8* dst)
+{
+    const Model& model = app->models[sceneObject.modelIdx];
+    const u32 blockStride = Align(sizeof(LocalParamsBlock), app->uniformBlockAlignment);
+    for (u32 n = 0; n < sceneObject.localParamsCount; ++n)
+    {
+        LocalParamsBlock localParams;
+        localParams.worldMatrix = model.nodes.empty() ? sceneObject.worldMatrix : sceneObject.worldMatrix * model.nodes[n].modelMatrix;
+        memcpy(dst + n * blockStride, &localParams, sizeof(localParams));
+    }
+}
+
+static void RewriteObjectParams(App* app)
+{
+    BeginUniformBlocks(app);
+    for (SceneObject& sceneObject : app->sceneObjects)
+    {
+        sceneObject.localParamsCount = GetModelNodeCount(app->models[sceneObject.modelIdx]);
+        sceneObject.localParamsSize = sizeof(LocalParamsBlock);
+        sceneObject.transformDirty = false;
+        u8* blocks = PushUniformBlocks(app, sizeof(LocalParamsBlock), sceneObject.localParamsCount,
+                                       sceneObject.localParamsPage, sceneObject.localParamsOffset);
+        if (blocks)
+        {
+            WriteObjectParams(app, sceneObject, blocks);
+            app->uniformUploadBytes += GetObjectParamsSize(app, sceneObject);
+        }
+    }
+    EndUniformBlocks(app);
+    app->objectParamsRelayout = false;
+}
+
+void UpdateObjectParams(App* app)
+{
+    bool rewrite = app->objectParamsRelayout;
+    u32 dirtyCount = 0;
+    for (const SceneObject& sceneObject : app->sceneObjects)
+    {
+        // new objects have no blocks yet, loaded models can bring nodes and
+        // objects that didn't fit get another try whenever they move
+        rewrite = rewrite || sceneObject.localParamsCount != GetModelNodeCount(app->models[sceneObject.modelIdx]) ||
+                  (sceneObject.transformDirty && sceneObject.localParamsPage == UINT32_MAX);
+        dirtyCount += sceneObject.transformDirty ? 1 : 0;
+    }
+
+    if (rewrite || dirtyCount > app->sceneObjects.size() * UNIFORM_REWRITE_DIRTY_RATIO)
+    {
+        RewriteObjectParams(app);
+        return;
+    }
+
+    if (dirtyCount == 0)
+        return;
+
+    // written with the alignment gaps, so each object is a single upload
+    std::vector<u8> blocks;
+    for (SceneObject& sceneObject : app->sceneObjects)
+    {
+        if (!sceneObject.transformDirty)
+            continue;
+        sceneObject.transformDirty = false;
+
+        const u32 size = GetObjectParamsSize(app, sceneObject);
+        blocks.resize(size);
+        WriteObjectParams(app, sceneObject, blocks.data());
+        glBindBuffer(GL_UNIFORM_BUFFER, GetUniformPageHandle(app, sceneObject.localParamsPage));
+        glBufferSubData(GL_UNIFORM_BUFFER, sceneObject.localParamsOffset, size, blocks.data());
+        app->uniformUploadBytes += size;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+struct UniformBlockMember
+{
+    const char* name;
+    u32         offset;
+};
+
+#define LIGHT_MEMBER(index, glslName, member) \
+    { "uLight[" #index "]." glslName, (u32)(offsetof(GlobalParamsBlock, lights) + index * sizeof(UniformLight) + offsetof(UniformLight, member)) }
+
+// the first two lights give the array stride as well
+static const UniformBlockMember GlobalParamsMembers[] =
+{
+    { "uViewProjectionMatrix", offsetof(GlobalParamsBlock, viewProjectionMatrix) },
+    { "uCameraPosition", offsetof(GlobalParamsBlock, cameraPosition) },
+    { "uLightCount", offsetof(GlobalParamsBlock, lightCount) },
+    LIGHT_MEMBER(0, "type", type),
+    LIGHT_MEMBER(0, "color", color),
+    LIGHT_MEMBER(0, "direction", direction),
+    LIGHT_MEMBER(0, "position", position),
+    LIGHT_MEMBER(1, "type", type),
+    LIGHT_MEMBER(1, "color", color),
+    LIGHT_MEMBER(1, "direction", direction),
+    LIGHT_MEMBER(1, "position", position),
+};
+
+static const UniformBlockMember LocalParamsMembers[] =
+{
+    { "uWorldMatrix", offsetof(LocalParamsBlock, worldMatrix) },
+};
+
+static bool CheckUniformBlockLayout(GLuint program, const char* programName, const char* blockName, u32 blockSize,
+                                    const UniformBlockMember* members, u32 memberCount)
+{
+    const GLuint blockIndex = glGetUniformBlockIndex(program, blockName);
+    if (blockIndex == GL_INVALID_INDEX)
+        return true;
+
+    bool matches = true;
+    GLint dataSize = 0;
+    glGetActiveUniformBlockiv(program, blockIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+    if ((u32)dataSize != blockSize)
+    {
+        ELOG("Program %s: uniform block %s is %d bytes, the engine writes %u", programName, blockName, dataSize, blockSize);
+        matches = false;
+    }
+
+    for (u32 i = 0; i < memberCount; ++i)
+    {
+        // members the compiler dropped have no index, nothing to compare
+        GLuint uniformIndex = GL_INVALID_INDEX;
+        glGetUniformIndices(program, 1, &members[i].name, &uniformIndex);
+        if (uniformIndex == GL_INVALID_INDEX)
+            continue;
+
+        GLint offset = -1;
+        glGetActiveUniformsiv(program, 1, &uniformIndex, GL_UNIFORM_OFFSET, &offset);
+        if ((u32)offset != members[i].offset)
+        {
+            ELOG("Program %s: %s.%s is at offset %d, the engine writes it at %u", programName, blockName, members[i].name, offset, members[i].offset);
+            matches = false;
+        }
+    }
+    return matches;
+}
+
+bool CheckUniformBlockLayouts(GLuint program, const char* programName)
+{
+    const bool globalMatches = CheckUniformBlockLayout(program, programName, "globalParams", sizeof(GlobalParamsBlock),
+                                                       GlobalParamsMembers, ARRAY_COUNT(GlobalParamsMembers));
+    const bool localMatches = CheckUniformBlockLayout(program, programName, "localParams", sizeof(LocalParamsBlock),
+                                                      LocalParamsMembers, ARRAY_COUNT(LocalParamsMembers));
+    return globalMatches && localMatches;
+}
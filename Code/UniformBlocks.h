@@ -0,0 +1,102 @@
+#pragma once
+#include "engine.h"
+#include <cstddef>
+
+// C++ mirrors of the std140 uniform blocks of shaders.glsl. Each one is built
+// on the stack and goes into its uniform buffer with a single copy.
+// The offsets are checked here at compile time against the std140 rules and,
+// when a program is linked, against what the driver reports for the block
+// (see CheckUniformBlockLayouts()).
+
+// MAX_LIGHT_COUNT of the shaders
+#define UNIFORM_MAX_LIGHT_COUNT 8
+
+// std140: vec3 and structs start on 16 bytes, a vec3 leaves room for one scalar
+struct UniformLight
+{
+    u32  type;
+    u32  padding0[3];
+    vec3 color;
+    f32  padding1;
+    vec3 direction;
+    f32  padding2;
+    vec3 position;
+    f32  padding3;
+};
+
+static_assert(offsetof(UniformLight, type) == 0, "std140 layout of Light");
+static_assert(offsetof(UniformLight, color) == 16, "std140 layout of Light");
+static_assert(offsetof(UniformLight, direction) == 32, "std140 layout of Light");
+static_assert(offsetof(UniformLight, position) == 48, "std140 layout of Light");
+static_assert(sizeof(UniformLight) == 64, "std140 layout of Light");
+
+// binding 0, the camera and lights, rewritten every frame
+struct GlobalParamsBlock
+{
+    mat4x4       viewProjectionMatrix;
+    vec3         cameraPosition;
+    u32          lightCount;
+    UniformLight lights[UNIFORM_MAX_LIGHT_COUNT];
+};
+
+static_assert(offsetof(GlobalParamsBlock, viewProjectionMatrix) == 0, "std140 layout of globalParams");
+static_assert(offsetof(GlobalParamsBlock, cameraPosition) == 64, "std140 layout of globalParams");
+static_assert(offsetof(GlobalParamsBlock, lightCount) == 76, "std140 layout of globalParams");
+static_assert(offsetof(GlobalParamsBlock, lights) == 80, "std140 layout of globalParams");
+static_assert(sizeof(GlobalParamsBlock) == 80 + UNIFORM_MAX_LIGHT_COUNT * 64, "std140 layout of globalParams");
+
+// binding 1, one per node of a scene object. Independent of the camera, so
+// it only changes when the object (or its model) does.
+struct LocalParamsBlock
+{
+    mat4x4 worldMatrix;
+};
+
+static_assert(offsetof(LocalParamsBlock, worldMatrix) == 0, "std140 layout of localParams");
+static_assert(sizeof(LocalParamsBlock) == 64, "std140 layout of localParams");
+
+// The blocks of the scene objects live in pages of UNIFORM_PAGE_SIZE bytes,
+// each its own uniform buffer, kept from frame to frame. The blocks of one
+// allocation share a page, so a draw binds a range of the page (at most
+// GL_MAX_UNIFORM_BLOCK_SIZE) the way it did with a single buffer. Past
+// UNIFORM_MAX_PAGE_COUNT pages the allocations fail: the objects aren't drawn
+// and the number of blocks dropped is reported.
+//
+// Allocating starts over from the first page (orphaning each one as it gets
+// mapped), so every block has to be written again: see UpdateObjectParams().
+#define UNIFORM_PAGE_SIZE MB(1)
+#define UNIFORM_MAX_PAGE_COUNT 128
+
+// Past this fraction of objects with dirty transforms, every page is mapped
+// and rewritten instead of updating the objects one by one
+#define UNIFORM_REWRITE_DIRTY_RATIO 0.25f
+
+void BeginUniformBlocks(App* app);
+
+// Room for count blocks of blockSize bytes, each aligned to the uniform
+// block alignment, all in one page. Returns where to write them, or NULL when
+// they don't fit (page set to UINT32_MAX).
+u8* PushUniformBlocks(App* app, u32 blockSize, u32 count, u32& page, u32& offset);
+
+// Unmaps the last page and reports the blocks dropped this frame
+void EndUniformBlocks(App* app);
+
+GLuint GetUniformPageHandle(const App* app, u32 page);
+
+void DestroyUniformPages(App* app);
+
+// Camera and lights into the global block, every frame
+void UpdateGlobalParams(App* app, const mat4x4& viewProjectionMatrix);
+
+// Uploads the blocks of the scene objects whose transform is dirty (see
+// MarkTransformDirty()) with one glBufferSubData() each. Objects whose node
+// count changed, added or removed objects, dirty objects that have no blocks
+// (they didn't fit) and many dirty ones make it allocate and write every
+// block again instead.
+void UpdateObjectParams(App* app);
+
+// Compares the blocks the program uses with the structs above through the
+// driver's reflection (block size and the offset of every member), logging
+// each difference. Blocks the program doesn't have are skipped. Returns false
+// on any mismatch.
+bool CheckUniformBlockLayouts(GLuint program, const char* programName);
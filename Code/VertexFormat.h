@@ -0,0 +1,263 @@
+#pragma once
+#include <assimp/mesh.h>
+#include <glm/gtc/packing.hpp>
+#include <utility>
+#include "engine.h"
+
+// Vertex formats known at compile time. VertexFormat<Position3f, Normal3f, ...>
+// lays its attributes out back to back, in order: their offsets, the stride
+// and a hash of the layout are constants, MakeLayout() gives the
+// VertexBufferLayout to upload it with and Convert() fills it from an aiMesh in
+// one loop with every attribute write inlined, no per vertex checks.
+//
+// An attribute type has the location, components, GL type, normalization and
+// size of the attribute, and writes it from vertex i of an aiMesh. The packed
+// ones also Pack()/Unpack() a single value, the one encoding of that format
+// (QuantizeVertices() packs with them too).
+
+struct Position3f
+{
+    static constexpr u8 location = 0;
+    static constexpr u8 componentCount = 3;
+    static constexpr GLenum type = GL_FLOAT;
+    static constexpr bool normalized = false;
+    static constexpr u32 size = 3 * sizeof(float);
+
+    static void Write(const aiMesh* mesh, u32 i, u8* dst)
+    {
+        const aiVector3D& position = mesh->mVertices[i];
+        const float values[3] = { position.x, position.y, position.z };
+        memcpy(dst, values, sizeof(values));
+    }
+};
+
+struct Normal3f
+{
+    static constexpr u8 location = 1;
+    static constexpr u8 componentCount = 3;
+    static constexpr GLenum type = GL_FLOAT;
+    static constexpr bool normalized = false;
+    static constexpr u32 size = 3 * sizeof(float);
+
+    static void Write(const aiMesh* mesh, u32 i, u8* dst)
+    {
+        const aiVector3D& normal = mesh->mNormals[i];
+        const float values[3] = { normal.x, normal.y, normal.z };
+        memcpy(dst, values, sizeof(values));
+    }
+};
+
+// w is 0, the packed format always has 4 components
+struct Normal4n
+{
+    static constexpr u8 location = 1;
+    static constexpr u8 componentCount = 4;
+    static constexpr GLenum type = GL_INT_2_10_10_10_REV;
+    static constexpr bool normalized = true;
+    static constexpr u32 size = sizeof(u32);
+
+    static u32 Pack(const vec3& normal) { return glm::packSnorm3x10_1x2(vec4(normal, 0.0f)); }
+    static vec3 Unpack(u32 packed) { return vec3(glm::unpackSnorm3x10_1x2(packed)); }
+
+    static void Write(const aiMesh* mesh, u32 i, u8* dst)
+    {
+        const aiVector3D& normal = mesh->mNormals[i];
+        const u32 packed = Pack(vec3(normal.x, normal.y, normal.z));
+        memcpy(dst, &packed, sizeof(packed));
+    }
+};
+
+struct TexCoord2f
+{
+    static constexpr u8 location = 2;
+    static constexpr u8 componentCount = 2;
+    static constexpr GLenum type = GL_FLOAT;
+    static constexpr bool normalized = false;
+    static constexpr u32 size = 2 * sizeof(float);
+
+    static void Write(const aiMesh* mesh, u32 i, u8* dst)
+    {
+        const aiVector3D& texCoord = mesh->mTextureCoords[0][i];
+        const float values[2] = { texCoord.x, texCoord.y };
+        memcpy(dst, values, sizeof(values));
+    }
+};
+
+// Only for uvs below HALF_TEXCOORD_MAX (see MeshProcessing.h)
+struct TexCoord2h
+{
+    static constexpr u8 location = 2;
+    static constexpr u8 componentCount = 2;
+    static constexpr GLenum type = GL_HALF_FLOAT;
+    static constexpr bool normalized = false;
+    static constexpr u32 size = sizeof(u32);
+
+    static u32 Pack(const vec2& texCoord) { return glm::packHalf2x16(texCoord); }
+    static vec2 Unpack(u32 packed) { return glm::unpackHalf2x16(packed); }
+
+    static void Write(const aiMesh* mesh, u32 i, u8* dst)
+    {
+        const aiVector3D& texCoord = mesh->mTextureCoords[0][i];
+        const u32 packed = Pack(vec2(texCoord.x, texCoord.y));
+        memcpy(dst, &packed, sizeof(packed));
+    }
+};
+
+// The bitangent is rebuilt as cross(normal, tangent) * w, only its side of the
+// normal/tangent plane is kept
+inline f32 AssimpTangentHandedness(const aiMesh* mesh, u32 i)
+{
+    const aiVector3D& n = mesh->mNormals[i];
+    const aiVector3D& t = mesh->mTangents[i];
+    const aiVector3D& b = mesh->mBitangents[i];
+    const f32 handedness = (n.y * t.z - n.z * t.y) * b.x + (n.z * t.x - n.x * t.z) * b.y + (n.x * t.y - n.y * t.x) * b.z;
+    return (handedness < 0.0f) ? -1.0f : 1.0f;
+}
+
+// xyz: tangent, w: handedness of the bitangent
+struct Tangent4f
+{
+    static constexpr u8 location = 3;
+    static constexpr u8 componentCount = 4;
+    static constexpr GLenum type = GL_FLOAT;
+    static constexpr bool normalized = false;
+    static constexpr u32 size = 4 * sizeof(float);
+
+    static void Write(const aiMesh* mesh, u32 i, u8* dst)
+    {
+        const aiVector3D& tangent = mesh->mTangents[i];
+        const float values[4] = { tangent.x, tangent.y, tangent.z, AssimpTangentHandedness(mesh, i) };
+        memcpy(dst, values, sizeof(values));
+    }
+};
+
+// The handedness fits the 2 bits of w
+struct Tangent4n
+{
+    static constexpr u8 location = 3;
+    static constexpr u8 componentCount = 4;
+    static constexpr GLenum type = GL_INT_2_10_10_10_REV;
+    static constexpr bool normalized = true;
+    static constexpr u32 size = sizeof(u32);
+
+    // xyz: tangent, w: handedness
+    static u32 Pack(const vec4& tangent) { return glm::packSnorm3x10_1x2(tangent); }
+    static vec4 Unpack(u32 packed) { return glm::unpackSnorm3x10_1x2(packed); }
+
+    static void Write(const aiMesh* mesh, u32 i, u8* dst)
+    {
+        const aiVector3D& tangent = mesh->mTangents[i];
+        const u32 packed = Pack(vec4(tangent.x, tangent.y, tangent.z, AssimpTangentHandedness(mesh, i)));
+        memcpy(dst, &packed, sizeof(packed));
+    }
+};
+
+// Room for the tangents of Tangent4f, left as they are (zero in a fresh
+// array) for ComputeTangents() when Assimp didn't compute them
+struct EmptyTangent4f
+{
+    static constexpr u8 location = Tangent4f::location;
+    static constexpr u8 componentCount = Tangent4f::componentCount;
+    static constexpr GLenum type = Tangent4f::type;
+    static constexpr bool normalized = Tangent4f::normalized;
+    static constexpr u32 size = Tangent4f::size;
+
+    static void Write(const aiMesh*, u32, u8*) {}
+};
+
+// FNV-1a over every attribute and the stride, the same at compile time and for
+// a layout built at runtime (see HashVertexBufferLayout())
+constexpr u64 HashVertexAttribute(u64 hash, u32 location, u32 componentCount, GLenum type, bool normalized, u32 offset)
+{
+    const u64 words[3] = { location | componentCount << 8 | (normalized ? 1u : 0u) << 16, type, offset };
+    for (u32 i = 0; i < 3; ++i)
+        hash = (hash ^ words[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+#define VERTEX_LAYOUT_HASH_SEED 0xcbf29ce484222325ull
+
+// Offset of the attribute at index, after the ones before it
+template <typename... Attributes>
+constexpr u32 VertexFormatOffset(u32 index)
+{
+    const u32 sizes[] = { Attributes::size..., 0 };
+    u32 offset = 0;
+    for (u32 i = 0; i < index; ++i)
+        offset += sizes[i];
+    return offset;
+}
+
+template <typename... Attributes>
+constexpr u64 VertexFormatHash()
+{
+    const u32 locations[] = { Attributes::location..., 0 };
+    const u32 componentCounts[] = { Attributes::componentCount..., 0 };
+    const GLenum types[] = { Attributes::type..., 0 };
+    const bool normalized[] = { Attributes::normalized..., false };
+    u64 hash = VERTEX_LAYOUT_HASH_SEED;
+    for (u32 i = 0; i < sizeof...(Attributes); ++i)
+        hash = HashVertexAttribute(hash, locations[i], componentCounts[i], types[i], normalized[i], VertexFormatOffset<Attributes...>(i));
+    return (hash ^ VertexFormatOffset<Attributes...>(sizeof...(Attributes))) * 0x100000001b3ull;
+}
+
+template <typename... Attributes>
+struct VertexFormat
+{
+    static constexpr u32 attributeCount = sizeof...(Attributes);
+    static constexpr u32 stride = VertexFormatOffset<Attributes...>(sizeof...(Attributes));
+    static constexpr u64 hash = VertexFormatHash<Attributes...>();
+
+    // the shaders pull vertices as uints (see BindVertexPullingSubmesh())
+    static_assert(stride % sizeof(u32) == 0, "vertex formats have to keep 4 byte alignment");
+    static_assert(stride <= UINT16_MAX, "the stride of a vertex format has to fit VertexBufferLayout::stride");
+
+    template <u32 Index>
+    static constexpr u32 Offset() { return VertexFormatOffset<Attributes...>(Index); }
+
+    static void MakeLayout(VertexBufferLayout& layout)
+    {
+        MakeLayout(layout, std::make_index_sequence<sizeof...(Attributes)>());
+    }
+
+    // dst holds mNumVertices * stride bytes
+    static void Convert(const aiMesh* mesh, u8* dst)
+    {
+        for (u32 i = 0; i < mesh->mNumVertices; ++i, dst += stride)
+            WriteVertex(mesh, i, dst, std::make_index_sequence<sizeof...(Attributes)>());
+    }
+
+private:
+    template <size_t... Indices>
+    static void MakeLayout(VertexBufferLayout& layout, std::index_sequence<Indices...>)
+    {
+        layout = {};
+        layout.attributes = { VertexBufferAttribute{ Attributes::location, Attributes::componentCount,
+                                                     (u16)VertexFormatOffset<Attributes...>(Indices),
+                                                     Attributes::type, Attributes::normalized }... };
+        layout.stride = (u16)VertexFormatOffset<Attributes...>(sizeof...(Attributes));
+    }
+
+    template <size_t... Indices>
+    static void WriteVertex(const aiMesh* mesh, u32 i, u8* dst, std::index_sequence<Indices...>)
+    {
+        const int expand[] = { (Attributes::Write(mesh, i, dst + std::integral_constant<u32, VertexFormatOffset<Attributes...>(Indices)>::value), 0)..., 0 };
+        (void)expand;
+    }
+};
+
+// Same value as VertexFormat<...>::hash for the layout that format makes
+inline u64 HashVertexBufferLayout(const VertexBufferLayout& layout)
+{
+    u64 hash = VERTEX_LAYOUT_HASH_SEED;
+    for (const VertexBufferAttribute& attribute : layout.attributes)
+        hash = HashVertexAttribute(hash, attribute.location, attribute.componentCount, attribute.type, attribute.normalized, attribute.offset);
+    return (hash ^ layout.stride) * 0x100000001b3ull;
+}
+
+// The attribute of the type at the given offset, for layouts built at runtime
+template <typename Attribute>
+VertexBufferAttribute MakeVertexAttribute(u32 offset)
+{
+    return VertexBufferAttribute{ Attribute::location, Attribute::componentCount, (u16)offset, Attribute::type, Attribute::normalized };
+}
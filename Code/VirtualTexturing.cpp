@@ -0,0 +1,765 @@
+#include "VirtualTexturing.h"
+#include "TextureStreaming.h"
+#include "TextureCompression.h"
+#include "JobSystem.h"
+#include "Hash.h"
+#include "UniformBlocks.h"
+#include <stb_image.h>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+
+// Page file: this header, then every page (VT_SLOT_SIZE^2 RGBA8 texels, border
+// included) of mip 0 in row order, then the pages of mip 1, and so on
+struct VirtualTextureFileHeader
+{
+    char magic[4];
+    u32  version;
+    i32  width;
+    i32  height;
+    u32  mipCount;
+    u32  padding;
+};
+
+static const u64 VT_PAGE_BYTES = VT_SLOT_SIZE * VT_SLOT_SIZE * 4;
+
+struct VirtualTextureBuild
+{
+    u32         texIdx;
+    u32         flags;
+    std::string filepath;
+
+    // filled by the build job
+    std::atomic<bool> done{ false };
+    bool        isVirtual = false;  // false: not a candidate, stream it regularly
+    std::string pageFilePath;
+    ivec2       size;
+    u32         mipCount;
+};
+
+struct PageLoad
+{
+    u32         key;
+    std::string pageFilePath;
+    u64         offset;
+    bool        pinned;
+
+    // filled by the load job
+    std::atomic<bool> done{ false };
+    bool        ok = false;
+    std::vector<u8> pixels;
+};
+
+struct VirtualTexture
+{
+    u32         texIdx;
+    std::string pageFilePath;
+    ivec2       size;
+    u32         mipCount;  // down to the mip that fits a single page
+    std::vector<u32> levelFirstPage;
+    bool        ready;     // its coarsest page is resident, materials can use it
+    bool        dirty;     // indirection needs to be uploaded again
+};
+
+struct PageSlot
+{
+    u32  key;  // UINT32_MAX if free
+    u64  lastUsedFrame;
+    bool pinned;
+};
+
+struct VirtualTextureSystem
+{
+    std::vector<VirtualTexture> textures;
+
+    JobCounter buildJobs;
+    std::vector<VirtualTextureBuild*> builds;
+
+    JobCounter loadJobs;
+    std::vector<PageLoad*> loads;
+
+    std::unordered_map<u32, u32> residentPages;  // page key -> slot
+    std::vector<PageSlot> slots;
+
+    GLuint cacheTexture;
+    GLuint indirectionTexture;
+
+    GLuint feedbackFramebuffer;
+    GLuint feedbackColor;
+    GLuint feedbackDepth;
+    ivec2  feedbackSize;
+
+    GLuint readbackBuffers[VT_FEEDBACK_READBACKS];
+    GLsync readbackFences[VT_FEEDBACK_READBACKS];
+    u32    readbackHead;
+};
+
+static u32 MakePageKey(u32 vtIdx, u32 mip, u32 pageX, u32 pageY)
+{
+    return (vtIdx << 16) | (mip << 12) | (pageY << 6) | pageX;
+}
+
+static void SplitPageKey(u32 key, u32& vtIdx, u32& mip, u32& pageX, u32& pageY)
+{
+    vtIdx = key >> 16;
+    mip = (key >> 12) & 0xf;
+    pageY = (key >> 6) & 0x3f;
+    pageX = key & 0x3f;
+}
+
+static ivec2 GetPageCount(ivec2 size, u32 mip)
+{
+    ivec2 levelSize = GetMipSize(size, mip);
+    return (levelSize + ivec2(VT_PAGE_SIZE - 1)) / VT_PAGE_SIZE;
+}
+
+static u32 ComputeVirtualMipCount(ivec2 size)
+{
+    u32 mipCount = 1;
+    while (glm::max(GetMipSize(size, mipCount - 1).x, GetMipSize(size, mipCount - 1).y) > VT_PAGE_SIZE)
+        mipCount++;
+    return mipCount;
+}
+
+static u32 ComputePageTotal(ivec2 size, u32 mipCount)
+{
+    u32 total = 0;
+    for (u32 mip = 0; mip < mipCount; ++mip)
+    {
+        ivec2 pages = GetPageCount(size, mip);
+        total += pages.x * pages.y;
+    }
+    return total;
+}
+
+static bool BuildPageFile(VirtualTextureBuild* build)
+{
+    std::vector<u8> fileBytes;
+    if (!ReadBinaryFile(build->filepath.c_str(), fileBytes))
+        return false;
+
+    const u64 key = HashCombine(HashBytes(fileBytes.data(), fileBytes.size()), VT_PAGE_FILE_VERSION);
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%016llx.vtp", VT_CACHE_DIRECTORY, (unsigned long long)key);
+    build->pageFilePath = path;
+
+    // reuse the page file if a complete one exists
+    VirtualTextureFileHeader header = {};
+    if (ReadBinaryFileRange(path, 0, &header, sizeof(header)) &&
+        memcmp(header.magic, "VTPG", 4) == 0 && header.version == VT_PAGE_FILE_VERSION)
+    {
+        build->size = ivec2(header.width, header.height);
+        build->mipCount = header.mipCount;
+
+        const u64 fileSize = sizeof(header) + ComputePageTotal(build->size, build->mipCount) * VT_PAGE_BYTES;
+        u8 lastByte;
+        if (ReadBinaryFileRange(path, fileSize - 1, &lastByte, 1))
+            return true;
+    }
+
+    int width, height, nchannels;
+    if (!stbi_info_from_memory(fileBytes.data(), (int)fileBytes.size(), &width, &height, &nchannels))
+        return false;
+
+    const i32 maxSide = glm::max(width, height);
+    if (maxSide < VT_MIN_SIZE || maxSide > VT_MAX_SIZE)
+        return false;
+
+    Image image = {};
+    stbi_set_flip_vertically_on_load_thread(true);
+    image.pixels = stbi_load_from_memory(fileBytes.data(), (int)fileBytes.size(), &image.size.x, &image.size.y, &image.nchannels, 0);
+    if (!image.pixels)
+        return false;
+
+    std::vector<std::vector<u8>> levels;
+    {
+        std::vector<u8> rgba;
+        ExpandToRGBA(image, rgba);
+        stbi_image_free(image.pixels);
+        GenerateMipChain(rgba.data(), image.size, false, levels);
+    }
+
+    build->size = image.size;
+    build->mipCount = ComputeVirtualMipCount(image.size);
+
+    memcpy(header.magic, "VTPG", 4);
+    header.version = VT_PAGE_FILE_VERSION;
+    header.width = image.size.x;
+    header.height = image.size.y;
+    header.mipCount = build->mipCount;
+
+    MakeDirectory(VT_CACHE_DIRECTORY);
+    if (!WriteBinaryFile(path, &header, sizeof(header)))
+        return false;
+
+    // a level at a time, the pages of the whole chain can be hundreds of MB
+    for (u32 mip = 0; mip < build->mipCount; ++mip)
+    {
+        const ivec2 levelSize = GetMipSize(image.size, mip);
+        const ivec2 pages = GetPageCount(image.size, mip);
+        const u8* src = levels[mip].data();
+
+        std::vector<u8> levelPages(pages.x * pages.y * VT_PAGE_BYTES);
+        for (i32 py = 0; py < pages.y; ++py)
+        for (i32 px = 0; px < pages.x; ++px)
+        {
+            u8* dst = &levelPages[(py * pages.x + px) * VT_PAGE_BYTES];
+            for (i32 y = 0; y < VT_SLOT_SIZE; ++y)
+            {
+                // borders (and pages past the edge of the level) clamp to it
+                const i32 srcY = glm::clamp(py * VT_PAGE_SIZE - VT_PAGE_BORDER + y, 0, levelSize.y - 1);
+                for (i32 x = 0; x < VT_SLOT_SIZE; ++x)
+                {
+                    const i32 srcX = glm::clamp(px * VT_PAGE_SIZE - VT_PAGE_BORDER + x, 0, levelSize.x - 1);
+                    memcpy(dst + (y * VT_SLOT_SIZE + x) * 4, src + (srcY * levelSize.x + srcX) * 4, 4);
+                }
+            }
+        }
+
+        if (!AppendBinaryFile(path, levelPages.data(), levelPages.size()))
+            return false;
+    }
+
+    ILOG("Built virtual texture pages for %s (%dx%d, %u mips)", build->filepath.c_str(), image.size.x, image.size.y, build->mipCount);
+    return true;
+}
+
+void InitVirtualTexturing(App* app)
+{
+    ErrorGuardOGL error("InitVirtualTexturing()", __FILE__, __LINE__);
+
+    VirtualTextureSystem* vt = new VirtualTextureSystem();
+
+    glGenTextures(1, &vt->cacheTexture);
+    glBindTexture(GL_TEXTURE_2D, vt->cacheTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, VT_CACHE_SIZE, VT_CACHE_SIZE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // integer textures have to use nearest filtering to be complete
+    glGenTextures(1, &vt->indirectionTexture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, vt->indirectionTexture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, VT_INDIRECTION_LEVELS, GL_RGBA8UI, VT_INDIRECTION_SIZE, VT_INDIRECTION_SIZE, VT_MAX_COUNT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    const u32 slotsPerSide = VT_CACHE_SIZE / VT_SLOT_SIZE;
+    vt->slots.resize(slotsPerSide * slotsPerSide);
+    for (PageSlot& slot : vt->slots)
+        slot = { UINT32_MAX, 0, false };
+
+    app->virtualTextureSystem = vt;
+}
+
+static void DestroyFeedbackTargets(VirtualTextureSystem* vt)
+{
+    if (vt->feedbackFramebuffer == 0)
+        return;
+
+    glDeleteFramebuffers(1, &vt->feedbackFramebuffer);
+    glDeleteTextures(1, &vt->feedbackColor);
+    glDeleteRenderbuffers(1, &vt->feedbackDepth);
+    glDeleteBuffers(VT_FEEDBACK_READBACKS, vt->readbackBuffers);
+    for (u32 i = 0; i < VT_FEEDBACK_READBACKS; ++i)
+    {
+        if (vt->readbackFences[i])
+            glDeleteSync(vt->readbackFences[i]);
+        vt->readbackFences[i] = 0;
+    }
+    vt->feedbackFramebuffer = 0;
+}
+
+void ShutdownVirtualTexturing(App* app)
+{
+    VirtualTextureSystem* vt = app->virtualTextureSystem;
+    if (!vt)
+        return;
+
+    WaitForJobCounter(vt->buildJobs);
+    WaitForJobCounter(vt->loadJobs);
+
+    for (VirtualTextureBuild* build : vt->builds)
+        delete build;
+    for (PageLoad* load : vt->loads)
+        delete load;
+
+    DestroyFeedbackTargets(vt);
+    glDeleteTextures(1, &vt->cacheTexture);
+    glDeleteTextures(1, &vt->indirectionTexture);
+
+    delete vt;
+    app->virtualTextureSystem = NULL;
+}
+
+void RequestVirtualTexture(App* app, u32 texIdx, u32 flags)
+{
+    VirtualTextureSystem* vt = app->virtualTextureSystem;
+
+    VirtualTextureBuild* build = new VirtualTextureBuild();
+    build->texIdx = texIdx;
+    build->flags = flags;
+    build->filepath = app->textures[texIdx].filepath;
+    vt->builds.push_back(build);
+
+    RunJob([build]()
+    {
+        build->isVirtual = BuildPageFile(build);
+        build->done.store(true, std::memory_order_release);
+    }, &vt->buildJobs);
+}
+
+static void RequestPage(VirtualTextureSystem* vt, u32 key, u64 frameIndex, std::vector<u32>& missing)
+{
+    auto resident = vt->residentPages.find(key);
+    if (resident != vt->residentPages.end())
+    {
+        vt->slots[resident->second].lastUsedFrame = frameIndex;
+        return;
+    }
+
+    for (PageLoad* load : vt->loads)
+        if (load->key == key)
+            return;
+
+    missing.push_back(key);
+}
+
+static void StartPageLoad(VirtualTextureSystem* vt, u32 key, bool pinned)
+{
+    u32 vtIdx, mip, pageX, pageY;
+    SplitPageKey(key, vtIdx, mip, pageX, pageY);
+    const VirtualTexture& texture = vt->textures[vtIdx];
+    const ivec2 pages = GetPageCount(texture.size, mip);
+
+    PageLoad* load = new PageLoad();
+    load->key = key;
+    load->pinned = pinned;
+    load->pageFilePath = texture.pageFilePath;
+    load->offset = sizeof(VirtualTextureFileHeader) + (texture.levelFirstPage[mip] + pageY * pages.x + pageX) * VT_PAGE_BYTES;
+    vt->loads.push_back(load);
+
+    RunJob([load]()
+    {
+        load->pixels.resize(VT_PAGE_BYTES);
+        load->ok = ReadBinaryFileRange(load->pageFilePath.c_str(), load->offset, load->pixels.data(), VT_PAGE_BYTES);
+        load->done.store(true, std::memory_order_release);
+    }, &vt->loadJobs);
+}
+
+static void FinishBuilds(App* app)
+{
+    VirtualTextureSystem* vt = app->virtualTextureSystem;
+
+    for (u32 i = 0; i < vt->builds.size();)
+    {
+        VirtualTextureBuild* build = vt->builds[i];
+        if (!build->done.load(std::memory_order_acquire))
+        {
+            ++i;
+            continue;
+        }
+
+        Texture& tex = app->textures[build->texIdx];
+        if (build->isVirtual && vt->textures.size() < VT_MAX_COUNT)
+        {
+            VirtualTexture texture = {};
+            texture.texIdx = build->texIdx;
+            texture.pageFilePath = build->pageFilePath;
+            texture.size = build->size;
+            texture.mipCount = build->mipCount;
+
+            u32 firstPage = 0;
+            for (u32 mip = 0; mip < texture.mipCount; ++mip)
+            {
+                texture.levelFirstPage.push_back(firstPage);
+                ivec2 pages = GetPageCount(texture.size, mip);
+                firstPage += pages.x * pages.y;
+            }
+
+            u32 vtIdx = vt->textures.size();
+            vt->textures.push_back(texture);
+
+            tex.state = TextureState_Virtual;
+            tex.virtualIdx = vtIdx;
+            tex.image.size = texture.size;
+
+            // the coarsest mip is a single page that never leaves the cache,
+            // every missing page falls back to it at worst
+            StartPageLoad(vt, MakePageKey(vtIdx, texture.mipCount - 1, 0, 0), true);
+        }
+        else
+        {
+            RequestTextureStream(app, build->texIdx, build->flags & ~TextureFlags_Virtual);
+        }
+
+        delete build;
+        vt->builds.erase(vt->builds.begin() + i);
+    }
+}
+
+static void ProcessFeedback(App* app, const u8* pixels, u32 pixelCount, std::vector<u32>& missing)
+{
+    VirtualTextureSystem* vt = app->virtualTextureSystem;
+
+    std::vector<u32> keys;
+    for (u32 i = 0; i < pixelCount; ++i)
+    {
+        const u8* texel = pixels + i * 4;
+        if (texel[0] == 0 || texel[0] > vt->textures.size())
+            continue;
+        keys.push_back(MakePageKey(texel[0] - 1, texel[1], texel[2], texel[3]));
+    }
+
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    // the ancestors are needed too, they are what gets sampled until the page arrives
+    for (u32 key : keys)
+    {
+        u32 vtIdx, mip, pageX, pageY;
+        SplitPageKey(key, vtIdx, mip, pageX, pageY);
+        const VirtualTexture& texture = vt->textures[vtIdx];
+        for (; mip < texture.mipCount; ++mip, pageX >>= 1, pageY >>= 1)
+        {
+            const ivec2 pages = GetPageCount(texture.size, mip);
+            RequestPage(vt, MakePageKey(vtIdx, mip, glm::min((i32)pageX, pages.x - 1), glm::min((i32)pageY, pages.y - 1)),
+                        app->frameIndex, missing);
+        }
+    }
+}
+
+static void ReadBackFeedback(App* app, std::vector<u32>& missing)
+{
+    VirtualTextureSystem* vt = app->virtualTextureSystem;
+
+    for (u32 i = 0; i < VT_FEEDBACK_READBACKS; ++i)
+    {
+        GLsync& fence = vt->readbackFences[i];
+        if (!fence)
+            continue;
+
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            continue;
+
+        glDeleteSync(fence);
+        fence = 0;
+
+        const u32 pixelCount = vt->feedbackSize.x * vt->feedbackSize.y;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, vt->readbackBuffers[i]);
+        const u8* pixels = (const u8*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixelCount * 4, GL_MAP_READ_BIT);
+        if (pixels)
+        {
+            ProcessFeedback(app, pixels, pixelCount, missing);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+}
+
+// A free slot, or the least recently requested page not needed by the last
+// frames. Returns UINT32_MAX when every page in the cache is still in use.
+static u32 AllocatePageSlot(App* app)
+{
+    VirtualTextureSystem* vt = app->virtualTextureSystem;
+
+    u32 victim = UINT32_MAX;
+    for (u32 i = 0; i < vt->slots.size(); ++i)
+    {
+        const PageSlot& slot = vt->slots[i];
+        if (slot.key == UINT32_MAX)
+            return i;
+        if (!slot.pinned && (victim == UINT32_MAX || slot.lastUsedFrame < vt->slots[victim].lastUsedFrame))
+            victim = i;
+    }
+
+    if (victim == UINT32_MAX || vt->slots[victim].lastUsedFrame + VT_FEEDBACK_READBACKS >= app->frameIndex)
+        return UINT32_MAX;
+
+    u32 vtIdx, mip, pageX, pageY;
+    SplitPageKey(vt->slots[victim].key, vtIdx, mip, pageX, pageY);
+    vt->textures[vtIdx].dirty = true;
+    vt->residentPages.erase(vt->slots[victim].key);
+    vt->slots[victim].key = UINT32_MAX;
+    return victim;
+}
+
+static void UploadLoadedPages(App* app)
+{
+    VirtualTextureSystem* vt = app->virtualTextureSystem;
+    const u32 slotsPerSide = VT_CACHE_SIZE / VT_SLOT_SIZE;
+    u32 uploads = 0;
+
+    glBindTexture(GL_TEXTURE_2D, vt->cacheTexture);
+    for (u32 i = 0; i < vt->loads.size();)
+    {
+        PageLoad* load = vt->loads[i];
+        if (!load->done.load(std::memory_order_acquire) || (load->ok && uploads == VT_MAX_PAGE_UPLOADS))
+        {
+            ++i;
+            continue;
+        }
+
+        u32 slotIdx = load->ok ? AllocatePageSlot(app) : UINT32_MAX;
+        if (slotIdx == UINT32_MAX && load->ok && load->pinned)
+        {
+            // nothing requests a pinned page again, it waits for a slot to free
+            ++i;
+            continue;
+        }
+
+        if (slotIdx != UINT32_MAX)
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, (slotIdx % slotsPerSide) * VT_SLOT_SIZE, (slotIdx / slotsPerSide) * VT_SLOT_SIZE,
+                            VT_SLOT_SIZE, VT_SLOT_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, load->pixels.data());
+            uploads++;
+
+            vt->slots[slotIdx] = { load->key, app->frameIndex, load->pinned };
+            vt->residentPages[load->key] = slotIdx;
+
+            u32 vtIdx, mip, pageX, pageY;
+            SplitPageKey(load->key, vtIdx, mip, pageX, pageY);
+            VirtualTexture& texture = vt->textures[vtIdx];
+            texture.dirty = true;
+            if (load->pinned && !texture.ready)
+            {
+                texture.ready = true;
+                app->materialTableDirty = true;
+            }
+        }
+        else if (!load->ok)
+        {
+            ELOG("Failed reading a virtual texture page from %s", load->pageFilePath.c_str());
+        }
+
+        delete load;
+        vt->loads.erase(vt->loads.begin() + i);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Every page maps to itself when resident, else to the mapping of its parent,
+// so the shader always finds the finest resident ancestor in a single fetch
+static void UploadIndirection(App* app, u32 vtIdx)
+{
+    VirtualTextureSystem* vt = app->virtualTextureSystem;
+    VirtualTexture& texture = vt->textures[vtIdx];
+    const u32 slotsPerSide = VT_CACHE_SIZE / VT_SLOT_SIZE;
+
+    std::vector<u8> parentEntries;
+    ivec2 parentPages(1);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, vt->indirectionTexture);
+    for (i32 mip = texture.mipCount - 1; mip >= 0; --mip)
+    {
+        const ivec2 pages = GetPageCount(texture.size, mip);
+        std::vector<u8> entries(pages.x * pages.y * 4, 0);
+
+        for (i32 y = 0; y < pages.y; ++y)
+        for (i32 x = 0; x < pages.x; ++x)
+        {
+            u8* entry = &entries[(y * pages.x + x) * 4];
+            auto resident = vt->residentPages.find(MakePageKey(vtIdx, mip, x, y));
+            if (resident != vt->residentPages.end())
+            {
+                entry[0] = (u8)(resident->second % slotsPerSide);
+                entry[1] = (u8)(resident->second / slotsPerSide);
+                entry[2] = (u8)mip;
+                entry[3] = 255;
+            }
+            else if (!parentEntries.empty())
+            {
+                const i32 parentX = glm::min(x >> 1, parentPages.x - 1);
+                const i32 parentY = glm::min(y >> 1, parentPages.y - 1);
+                memcpy(entry, &parentEntries[(parentY * parentPages.x + parentX) * 4], 4);
+            }
+        }
+
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, mip, 0, 0, vtIdx, pages.x, pages.y, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entries.data());
+
+        parentEntries.swap(entries);
+        parentPages = pages;
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    texture.dirty = false;
+}
+
+void UpdateVirtualTexturing(App* app)
+{
+    ErrorGuardOGL error("UpdateVirtualTexturing()", __FILE__, __LINE__);
+
+    VirtualTextureSystem* vt = app->virtualTextureSystem;
+
+    FinishBuilds(app);
+
+    std::vector<u32> missing;
+    ReadBackFeedback(app, missing);
+
+    // coarser pages first, they unblock the most texels
+    std::sort(missing.begin(), missing.end(), [](u32 a, u32 b)
+    {
+        const u32 mipA = (a >> 12) & 0xf;
+        const u32 mipB = (b >> 12) & 0xf;
+        return mipA != mipB ? mipA > mipB : a < b;
+    });
+    missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+    for (u32 i = 0; i < missing.size() && vt->loads.size() < VT_MAX_PAGE_LOADS; ++i)
+        StartPageLoad(vt, missing[i], false);
+
+    UploadLoadedPages(app);
+
+    for (u32 vtIdx = 0; vtIdx < vt->textures.size(); ++vtIdx)
+        if (vt->textures[vtIdx].dirty && vt->textures[vtIdx].ready)
+            UploadIndirection(app, vtIdx);
+}
+
+static void CreateFeedbackTargets(VirtualTextureSystem* vt, ivec2 size)
+{
+    DestroyFeedbackTargets(vt);
+    vt->feedbackSize = size;
+
+    glGenTextures(1, &vt->feedbackColor);
+    glBindTexture(GL_TEXTURE_2D, vt->feedbackColor);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8UI, size.x, size.y);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenRenderbuffers(1, &vt->feedbackDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, vt->feedbackDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size.x, size.y);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &vt->feedbackFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, vt->feedbackFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, vt->feedbackColor, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, vt->feedbackDepth);
+    ASSERT(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE, "Incomplete virtual texture feedback framebuffer");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(VT_FEEDBACK_READBACKS, vt->readbackBuffers);
+    for (u32 i = 0; i < VT_FEEDBACK_READBACKS; ++i)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, vt->readbackBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size.x * size.y * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    vt->readbackHead = 0;
+}
+
+void RenderVirtualTextureFeedback(App* app)
+{
+    VirtualTextureSystem* vt = app->virtualTextureSystem;
+    if (vt->textures.empty())
+        return;
+
+    ErrorGuardOGL error("RenderVirtualTextureFeedback()", __FILE__, __LINE__);
+
+    const ivec2 size = glm::max(app->displaySize / VT_FEEDBACK_DIVISOR, ivec2(1));
+    if (size != vt->feedbackSize || vt->feedbackFramebuffer == 0)
+        CreateFeedbackTargets(vt, size);
+
+    // all the readbacks still in flight: skip a frame of feedback rather than stall
+    const u32 readback = vt->readbackHead;
+    if (vt->readbackFences[readback])
+        return;
+
+    glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Virtual texture feedback");
+
+    glBindFramebuffer(GL_FRAMEBUFFER, vt->feedbackFramebuffer);
+    glViewport(0, 0, size.x, size.y);
+    const GLuint clearValue[4] = { 0, 0, 0, 0 };
+    glClearBufferuiv(GL_COLOR, 0, clearValue);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    Program& program = app->programs[app->vtFeedbackProgramIdx];
+    glUseProgram(program.handle);
+
+    // derivatives are VT_FEEDBACK_DIVISOR times bigger than at full resolution
+    glUniform1f(program.uniforms.vtLodBias, -glm::log2((f32)VT_FEEDBACK_DIVISOR));
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, BINDING(0), app->globalParamsBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(4), app->materialBuffer.handle);
+
+    for (size_t m = 1; m < app->sceneObjects.size(); m++)
+    {
+        SceneObject& scObj = app->sceneObjects[m];
+        if (scObj.localParamsPage == UINT32_MAX)
+            continue;
+
+        Model& model = app->models[scObj.modelIdx];
+        Mesh& mesh = app->meshes[model.meshIdx];
+
+        const u32 nodeCount = GetModelNodeCount(model);
+        for (u32 n = 0; n < nodeCount; ++n)
+        {
+            u32 firstSubmesh, submeshCount;
+            GetModelNodeSubmeshes(model, mesh, n, firstSubmesh, submeshCount);
+
+            glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), GetUniformPageHandle(app, scObj.localParamsPage), GetNodeParamsOffset(app, scObj, n), scObj.localParamsSize);
+
+            for (u32 i = firstSubmesh; i < firstSubmesh + submeshCount; ++i)
+            {
+                glBindVertexArray(FindVAO(mesh, i, program));
+                glUniform1ui(program.uniforms.materialIdx, model.materialIdx[i]);
+
+                Submesh& submesh = mesh.submeshes[i];
+                glUniform1i(program.uniforms.flipTexCoordV, submesh.flipTexCoordV ? 1 : 0);
+                glUniform3fv(program.uniforms.positionScale, 1, &submesh.positionScale[0]);
+                glUniform3fv(program.uniforms.positionOffset, 1, &submesh.positionOffset[0]);
+                glDrawElements(GL_TRIANGLES, submesh.indexCount, submesh.indexType, (void*)(u64)submesh.indexOffset);
+            }
+        }
+    }
+    glBindVertexArray(0);
+    glUseProgram(0);
+
+    // into a pack buffer, mapped once its fence signals (see ReadBackFeedback)
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, vt->readbackBuffers[readback]);
+    glReadPixels(0, 0, size.x, size.y, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    vt->readbackFences[readback] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    vt->readbackHead = (readback + 1) % VT_FEEDBACK_READBACKS;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+
+    glPopDebugGroup();
+}
+
+void BindVirtualTextures(App* app)
+{
+    VirtualTextureSystem* vt = app->virtualTextureSystem;
+
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, vt->indirectionTexture);
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, vt->cacheTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+ivec4 GetVirtualTextureInfo(App* app, u32 texIdx)
+{
+    if (texIdx >= app->textures.size() || app->textures[texIdx].state != TextureState_Virtual)
+        return ivec4(-1);
+
+    const VirtualTexture& texture = app->virtualTextureSystem->textures[app->textures[texIdx].virtualIdx];
+    if (!texture.ready)
+        return ivec4(-1);
+
+    return ivec4(app->textures[texIdx].virtualIdx, texture.size.x, texture.size.y, texture.mipCount - 1);
+}
+
+void GetVirtualTexturingStats(App* app, u32& textureCount, u32& residentPages, u32& pageSlots)
+{
+    VirtualTextureSystem* vt = app->virtualTextureSystem;
+    textureCount = vt->textures.size();
+    residentPages = vt->residentPages.size();
+    pageSlots = vt->slots.size();
+}
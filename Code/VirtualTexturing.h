@@ -0,0 +1,57 @@
+#pragma once
+#include "engine.h"
+
+// Pages are VT_PAGE_SIZE texels wide plus a border on each side, so bilinear
+// filtering never reads the neighbouring slot of the page cache
+#define VT_PAGE_SIZE   128
+#define VT_PAGE_BORDER 4
+#define VT_SLOT_SIZE   (VT_PAGE_SIZE + 2 * VT_PAGE_BORDER)
+
+// Physical page cache (RGBA8), VT_CACHE_SIZE / VT_SLOT_SIZE slots per side
+#define VT_CACHE_SIZE  4096
+
+// Indirection: one RGBA8UI layer per virtual texture, a texel per page and a
+// level per mip. Bigger textures go through the regular streaming path.
+#define VT_MAX_SIZE           8192
+#define VT_INDIRECTION_SIZE   (VT_MAX_SIZE / VT_PAGE_SIZE)
+#define VT_INDIRECTION_LEVELS 7
+#define VT_MAX_COUNT          32
+
+// Textures smaller than this aren't worth the indirection
+#define VT_MIN_SIZE 1024
+
+// The feedback pass renders at 1/VT_FEEDBACK_DIVISOR of the display size
+#define VT_FEEDBACK_DIVISOR 8
+#define VT_FEEDBACK_READBACKS 3
+
+#define VT_MAX_PAGE_LOADS   32  // page reads in flight on the workers
+#define VT_MAX_PAGE_UPLOADS 16  // page uploads per frame
+
+// Bump it whenever the page file layout changes
+#define VT_PAGE_FILE_VERSION 1
+#define VT_CACHE_DIRECTORY "VirtualTextureCache"
+
+void InitVirtualTexturing(App* app);
+
+void ShutdownVirtualTexturing(App* app);
+
+// Builds (or finds in the cache) the page file of app->textures[texIdx] on a
+// worker. Textures outside [VT_MIN_SIZE, VT_MAX_SIZE] get streamed regularly.
+void RequestVirtualTexture(App* app, u32 texIdx, u32 flags);
+
+// Called once per frame: reads back the feedback of previous frames, loads the
+// pages it asks for, uploads finished ones (evicting the least recently
+// requested) and refreshes the indirection of the textures that changed.
+void UpdateVirtualTexturing(App* app);
+
+// Low resolution pass writing the (texture, mip, page) every pixel needs,
+// read back a few frames later without stalling
+void RenderVirtualTextureFeedback(App* app);
+
+void BindVirtualTextures(App* app);
+
+// x: virtual texture (-1 if texIdx isn't one, or isn't usable yet),
+// yz: size in texels, w: coarsest mip
+ivec4 GetVirtualTextureInfo(App* app, u32 texIdx);
+
+void GetVirtualTexturingStats(App* app, u32& textureCount, u32& residentPages, u32& pageSlots);
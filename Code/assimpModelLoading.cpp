@@ -1,263 +1,319 @@
 #include "assimpModelLoading.h"
+#include "Materials.h"
+#include "TextureRegistry.h"
+#include "JobSystem.h"
+#include <algorithm>
 #pragma warning(disable : 4996) //disable printf warning
 
-void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+// Flags every material map is loaded with
+#define ALBEDO_MAP_FLAGS   TextureFlags_Virtual
+#define NORMALS_MAP_FLAGS  TextureFlags_NormalMap
+
+static DecodedTexture* FindTexturePrefetch(ModelImport& import, const std::string& filepath)
 {
-    
-    std::vector<float> vertices;
-    std::vector<u32> indices;
+    const std::string canonicalPath = CanonicalizePath(filepath.c_str());
+    for (TexturePrefetch& prefetch : import.textures)
+        if (prefetch.filepath == canonicalPath)
+            return prefetch.decoded ? &prefetch.texture : NULL;
+    return NULL;
+}
 
-    bool hasTexCoords = false;
-    bool hasTangentSpace = false;
+static u32 LoadMaterialTexture(App* app, ModelImport& import, const std::string& filepath, u32 flags)
+{
+    if (filepath.empty())
+        return UINT32_MAX;
 
-    // process vertices
-    for (unsigned int i = 0; i < mesh->mNumVertices; i++)
-    {
-        vertices.push_back(mesh->mVertices[i].x);
-        vertices.push_back(mesh->mVertices[i].y);
-        vertices.push_back(mesh->mVertices[i].z);
-        vertices.push_back(mesh->mNormals[i].x);
-        vertices.push_back(mesh->mNormals[i].y);
-        vertices.push_back(mesh->mNormals[i].z);
-
-        if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
-        {
-            hasTexCoords = true;
-            vertices.push_back(mesh->mTextureCoords[0][i].x);
-            vertices.push_back(mesh->mTextureCoords[0][i].y);
-        }
+    return LoadTexture2D(app, filepath.c_str(), flags, FindTexturePrefetch(import, filepath));
+}
 
-        if (mesh->mTangents != nullptr && mesh->mBitangents)
-        {
-            hasTangentSpace = true;
-            vertices.push_back(mesh->mTangents[i].x);
-            vertices.push_back(mesh->mTangents[i].y);
-            vertices.push_back(mesh->mTangents[i].z);
-
-            // For some reason ASSIMP gives me the bitangents flipped.
-            // Maybe it's my fault, but when I generate my own geometry
-            // in other files (see the generation of standard assets)
-            // and all the bitangents have the orientation I expect,
-            // everything works ok.
-            // I think that (even if the documentation says the opposite)
-            // it returns a left-handed tangent space matrix.
-            // SOLUTION: I invert the components of the bitangent here.
-            vertices.push_back(-mesh->mBitangents[i].x);
-            vertices.push_back(-mesh->mBitangents[i].y);
-            vertices.push_back(-mesh->mBitangents[i].z);
-        }
+static void LoadMaterialTextures(App* app, ModelImport& import, const ImportedMaterial& importedMaterial, Material& material)
+{
+    material = importedMaterial.material;
+    material.albedoTextureIdx = LoadMaterialTexture(app, import, importedMaterial.albedoMap, ALBEDO_MAP_FLAGS);
+    material.emissiveTextureIdx = LoadMaterialTexture(app, import, importedMaterial.emissiveMap, 0);
+    material.specularTextureIdx = LoadMaterialTexture(app, import, importedMaterial.specularMap, 0);
+    material.normalsTextureIdx = LoadMaterialTexture(app, import, importedMaterial.normalsMap, NORMALS_MAP_FLAGS);
+    material.bumpTextureIdx = LoadMaterialTexture(app, import, importedMaterial.bumpMap, 0);
+}
+
+static void AddTexturePrefetch(ModelImport& import, const std::string& filepath, u32 flags)
+{
+    // virtual textures build their page file from the source image instead
+    if (filepath.empty() || (import.virtualTexturing && (flags & TextureFlags_Virtual)))
+        return;
+
+    const std::string canonicalPath = CanonicalizePath(filepath.c_str());
+    for (const TexturePrefetch& prefetch : import.textures)
+        if (prefetch.filepath == canonicalPath)
+            return;
+
+    TexturePrefetch prefetch = {};
+    prefetch.filepath = canonicalPath;
+    prefetch.flags = flags;
+    import.textures.push_back(prefetch);
+}
+
+// Fans out the decode of every map of the model as soon as the paths are
+// known. Maps other models loaded already are decoded for nothing, the
+// registry only finds them on the main thread.
+static void PrefetchMaterialTextures(ModelImport& import)
+{
+    for (const ImportedMaterial& importedMaterial : import.materials)
+    {
+        AddTexturePrefetch(import, importedMaterial.albedoMap, ALBEDO_MAP_FLAGS);
+        AddTexturePrefetch(import, importedMaterial.emissiveMap, 0);
+        AddTexturePrefetch(import, importedMaterial.specularMap, 0);
+        AddTexturePrefetch(import, importedMaterial.normalsMap, NORMALS_MAP_FLAGS);
+        AddTexturePrefetch(import, importedMaterial.bumpMap, 0);
     }
 
-    // process indices
-    for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+    for (TexturePrefetch& prefetch : import.textures)
     {
-        aiFace face = mesh->mFaces[i];
-        for (unsigned int j = 0; j < face.mNumIndices; j++)
+        TexturePrefetch* texture = &prefetch;
+        const bool compress = import.compressTextures;
+        const i32 atlasMaxTextureSize = import.atlasMaxTextureSize;
+
+        RunJob([texture, compress, atlasMaxTextureSize]()
         {
-            indices.push_back(face.mIndices[j]);
-        }
+            const bool isNormalMap = (texture->flags & TextureFlags_NormalMap) != 0;
+            texture->decoded = DecodeTextureFile(texture->filepath.c_str(), isNormalMap, compress, atlasMaxTextureSize, texture->texture);
+        }, &import.jobs);
     }
+}
 
-    // store the proper (previously proceessed) material for this mesh
-    submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
+static std::string MakeModelKey(const std::string& filepath, u32 importFlags)
+{
+    return filepath + "#" + std::to_string(importFlags);
+}
 
-    // create the vertex format
-    VertexBufferLayout vertexBufferLayout = {};
-    vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
-    vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float) });
-    vertexBufferLayout.stride = 6 * sizeof(float);
-    if (hasTexCoords)
-    {
-        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride });
-        vertexBufferLayout.stride += 2 * sizeof(float);
-    }
-    if (hasTangentSpace)
-    {
-        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride });
-        vertexBufferLayout.stride += 3 * sizeof(float);
+static void InitModelImport(App* app, ModelImport& import, const std::string& filepath, u32 importFlags)
+{
+    import.filepath = filepath;
+    import.importFlags = importFlags;
+    import.compressTextures = app->compressTextures;
+    import.virtualTexturing = app->virtualTexturing;
+    import.atlasMaxTextureSize = app->atlasMaxTextureSize;
+    import.cookMeshes = app->cookMeshes;
+    import.fastObjImport = app->fastObjImport;
+    import.materialsImported = PrefetchMaterialTextures;
+}
 
-        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride });
-        vertexBufferLayout.stride += 3 * sizeof(float);
-    }
+static u32 CreateModel(App* app, const std::string& filepath, u32 importFlags)
+{
+    app->meshes.push_back(Mesh{});
+    u32 meshIdx = (u32)app->meshes.size() - 1u;
 
-    // add the submesh into the mesh
-    Submesh submesh = {};
-    submesh.vertexBufferLayout = vertexBufferLayout;
-    submesh.vertices.swap(vertices);
-    submesh.indices.swap(indices);
-    myMesh->submeshes.push_back(submesh);
+    app->models.push_back(Model{});
+    Model& model = app->models.back();
+    model.meshIdx = meshIdx;
+    model.filepath = filepath;
+    model.importFlags = importFlags;
+    model.refCount = 1;
+    u32 modelIdx = (u32)app->models.size() - 1u;
+    app->modelsByKey[MakeModelKey(filepath, importFlags)] = modelIdx;
+
+    return modelIdx;
 }
 
-void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory)
+// The blobs already have the layout of the buffers, one upload each
+static void UploadMesh(Mesh& mesh, const ModelImport& import)
 {
-    aiString name;
-    aiColor3D diffuseColor;
-    aiColor3D emissiveColor;
-    aiColor3D specularColor;
-    ai_real shininess;
-    material->Get(AI_MATKEY_NAME, name);
-    material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuseColor);
-    material->Get(AI_MATKEY_COLOR_EMISSIVE, emissiveColor);
-    material->Get(AI_MATKEY_COLOR_SPECULAR, specularColor);
-    material->Get(AI_MATKEY_SHININESS, shininess);
-
-    myMaterial.name = name.C_Str();
-    myMaterial.albedo = vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b);
-    myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
-    myMaterial.smoothness = shininess / 256.0f;
-
-    aiString aiFilename;
-    if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
-    {
-        material->GetTexture(aiTextureType_DIFFUSE, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.albedoTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_EMISSIVE) > 0)
-    {
-        material->GetTexture(aiTextureType_EMISSIVE, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.emissiveTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_SPECULAR) > 0)
-    {
-        material->GetTexture(aiTextureType_SPECULAR, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.specularTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
-    {
-        material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.normalsTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_HEIGHT) > 0)
-    {
-        material->GetTexture(aiTextureType_HEIGHT, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.bumpTextureIdx = LoadTexture2D(app, filepath.str);
-    }
+    ErrorGuardOGL error("UploadMesh()", __FILE__, __LINE__);
+
+    glGenBuffers(1, &mesh.vertexBufferHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
+    glBufferData(GL_ARRAY_BUFFER, import.vertexDataSize, import.vertexData, GL_STATIC_DRAW);
 
-    //myMaterial.createNormalFromBump();
+    glGenBuffers(1, &mesh.indexBufferHandle);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, import.indexDataSize, import.indexData, GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+// Main thread part: materials (and their textures) and the GPU buffers
+static void FinishModelImport(App* app, ModelImport& import, u32 modelIdx)
 {
-    // process all the node's meshes (if any)
-    for (unsigned int i = 0; i < node->mNumMeshes; i++)
-    {
-        aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-        ProcessAssimpMesh(scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
-    }
+    // released before its import finished
+    if (app->models[modelIdx].refCount == 0)
+        return;
 
-    // then do the same for each of its children
-    for (unsigned int i = 0; i < node->mNumChildren; i++)
+    u32 baseMeshMaterialIndex = (u32)app->materials.size();
+    for (const ImportedMaterial& importedMaterial : import.materials)
     {
-        ProcessAssimpNode(scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+        app->materials.push_back(Material{});
+        LoadMaterialTextures(app, import, importedMaterial, app->materials.back());
     }
+
+    Model& model = app->models[modelIdx];
+    for (u32 materialIdx : import.submeshMaterialIdx)
+        model.materialIdx.push_back(baseMeshMaterialIndex + materialIdx);
+    model.nodes = std::move(import.nodes);
+
+    // the node transforms of the objects placed while it loaded
+    for (SceneObject& sceneObject : app->sceneObjects)
+        if (sceneObject.modelIdx == modelIdx)
+            MarkTransformDirty(sceneObject);
+
+    Mesh& mesh = app->meshes[model.meshIdx];
+    mesh = std::move(import.mesh);
+    UploadMesh(mesh, import);
+
+    app->materialTableDirty = true;
 }
 
-u32 LoadModel(App* app, const char* filename, vec3 position, vec3 scale)
+u32 AcquireModel(App* app, const char* filename, u32 importFlags)
 {
+    const std::string filepath = CanonicalizePath(filename);
 
-    const aiScene* scene = aiImportFile(filename,
-        aiProcess_Triangulate |
-        aiProcess_GenSmoothNormals |
-        aiProcess_CalcTangentSpace |
-        aiProcess_JoinIdenticalVertices |
-        aiProcess_PreTransformVertices |
-        aiProcess_ImproveCacheLocality |
-        aiProcess_OptimizeMeshes |
-        aiProcess_SortByPType);
-
-    if (!scene)
+    auto loaded = app->modelsByKey.find(MakeModelKey(filepath, importFlags));
+    if (loaded != app->modelsByKey.end())
     {
-        ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
-        return UINT32_MAX;
+        app->models[loaded->second].refCount++;
+        return loaded->second;
     }
 
-    app->sceneObjects.push_back(SceneObject{});
-    SceneObject& scObj = app->sceneObjects.back();
-    Mesh& mesh = scObj.mesh;
-    u32 meshIdx = (u32)app->sceneObjects.size() - 1u;
-    scObj.name = "Object " + std::to_string(meshIdx);
-    scObj.worldMatrix = IdentityMatrix;
-    scObj.worldMatrix[3].x = position.x;
-    scObj.worldMatrix[3].y = position.y;
-    scObj.worldMatrix[3].z = position.z;
+    ModelImport import;
+    InitModelImport(app, import, filepath, importFlags);
 
-    SetScaling(scObj.worldMatrix, scale.x, scale.y, scale.z);
+    const bool imported = ImportModel(import);
+    WaitForJobCounter(import.jobs);
 
-    scObj.rotationEuler = vec3(0, 0, 0);
-    scObj.rotationQuat = quat(0, 0, 0, 1);
+    if (!imported)
+    {
+        ELOG("Error loading mesh %s: %s", filepath.c_str(), import.error.c_str());
+        return UINT32_MAX;
+    }
 
-    app->models.push_back(Model{});
-    Model& model = app->models.back();
-    model.meshIdx = meshIdx;
-    u32 modelIdx = (u32)app->models.size() - 1u;
-    scObj.modelIdx = modelIdx;
+    u32 modelIdx = CreateModel(app, filepath, importFlags);
+    FinishModelImport(app, import, modelIdx);
+    return modelIdx;
+}
 
-    String directory = GetDirectoryPart(MakeString(filename));
+u32 AcquireModelAsync(App* app, const char* filename, u32 importFlags)
+{
+    const std::string filepath = CanonicalizePath(filename);
 
-    // Create a list of materials
-    u32 baseMeshMaterialIndex = (u32)app->materials.size();
-    for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+    auto loaded = app->modelsByKey.find(MakeModelKey(filepath, importFlags));
+    if (loaded != app->modelsByKey.end())
     {
-        app->materials.push_back(Material{});
-        Material& material = app->materials.back();
-        ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+        app->models[loaded->second].refCount++;
+        return loaded->second;
     }
 
-    ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
+    ModelImport* import = new ModelImport();
+    InitModelImport(app, *import, filepath, importFlags);
+    import->modelIdx = CreateModel(app, filepath, importFlags);
+    app->modelImports.push_back(import);
 
-    aiReleaseImport(scene);
+    RunJob([import]() { import->failed = !ImportModel(*import); }, &import->jobs);
 
-    u32 vertexBufferSize = 0;
-    u32 indexBufferSize = 0;
+    return import->modelIdx;
+}
 
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+void UpdateModelLoading(App* app)
+{
+    for (u32 i = 0; i < app->modelImports.size();)
     {
-        vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-        indexBufferSize += mesh.submeshes[i].indices.size() * sizeof(u32);
+        ModelImport* import = app->modelImports[i];
+        if (!IsJobCounterDone(import->jobs))
+        {
+            ++i;
+            continue;
+        }
+
+        // a failed import leaves an empty model, nothing gets drawn
+        if (import->failed)
+        {
+            ELOG("Error loading mesh %s: %s", import->filepath.c_str(), import->error.c_str());
+        }
+        else
+        {
+            FinishModelImport(app, *import, import->modelIdx);
+        }
+
+        delete import;
+        app->modelImports.erase(app->modelImports.begin() + i);
     }
+}
+
+void WaitForModelLoads(App* app)
+{
+    for (ModelImport* import : app->modelImports)
+        WaitForJobCounter(import->jobs);
 
-    
+    UpdateModelLoading(app);
+}
 
-    glGenBuffers(1, &mesh.vertexBufferHandle);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+void ReleaseModel(App* app, u32 modelIdx)
+{
+    Model& model = app->models[modelIdx];
+    ASSERT(model.refCount > 0, "Model released more times than it was acquired");
+
+    if (--model.refCount > 0)
+        return;
+
+    Mesh& mesh = app->meshes[model.meshIdx];
+    for (Submesh& submesh : mesh.submeshes)
+        for (Vao& vao : submesh.vaos)
+            glDeleteVertexArrays(1, &vao.handle);
+    glDeleteBuffers(1, &mesh.vertexBufferHandle);
+    glDeleteBuffers(1, &mesh.indexBufferHandle);
+    mesh = Mesh{};
+
+    // the material slots stay (nothing draws them), their textures are given back
+    std::vector<u32> materials = model.materialIdx;
+    std::sort(materials.begin(), materials.end());
+    materials.erase(std::unique(materials.begin(), materials.end()), materials.end());
+    for (u32 materialIdx : materials)
+        ReleaseMaterialTextures(app, app->materials[materialIdx]);
+
+    app->modelsByKey.erase(MakeModelKey(model.filepath, model.importFlags));
+    model.materialIdx.clear();
+    model.nodes.clear();
+
+    ILOG("Unloaded model %s", model.filepath.c_str());
+}
 
-    glGenBuffers(1, &mesh.indexBufferHandle);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
+static void PlaceSceneObject(App* app, u32 modelIdx, vec3 position, vec3 scale)
+{
+    app->sceneObjects.push_back(SceneObject{});
+    SceneObject& scObj = app->sceneObjects.back();
+    u32 sceneObjectIdx = (u32)app->sceneObjects.size() - 1u;
+    scObj.name = "Object " + std::to_string(sceneObjectIdx);
+    scObj.modelIdx = modelIdx;
+    scObj.worldMatrix = IdentityMatrix;
+    scObj.worldMatrix[3].x = position.x;
+    scObj.worldMatrix[3].y = position.y;
+    scObj.worldMatrix[3].z = position.z;
 
-    u32 indicesOffset = 0;
-    u32 verticesOffset = 0;
+    SetScaling(scObj.worldMatrix, scale.x, scale.y, scale.z);
 
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-    {
-        const void* verticesData = mesh.submeshes[i].vertices.data();
-        const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-        glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-        mesh.submeshes[i].vertexOffset = verticesOffset;
-        verticesOffset += verticesSize;
-
-        const void* indicesData = mesh.submeshes[i].indices.data();
-        const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-        mesh.submeshes[i].indexOffset = indicesOffset;
-        indicesOffset += indicesSize;
-    }
-    ErrorGuardOGL error("LoadModel()", __FILE__, __LINE__);
+    scObj.rotationEuler = vec3(0, 0, 0);
+    scObj.rotationQuat = quat(0, 0, 0, 1);
+}
 
+u32 LoadModel(App* app, const char* filename, vec3 position, vec3 scale, u32 importFlags)
+{
+    u32 modelIdx = AcquireModel(app, filename, importFlags);
+    if (modelIdx != UINT32_MAX)
+        PlaceSceneObject(app, modelIdx, position, scale);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return modelIdx;
+}
+
+u32 LoadModelAsync(App* app, const char* filename, vec3 position, vec3 scale, u32 importFlags)
+{
+    u32 modelIdx = AcquireModelAsync(app, filename, importFlags);
+    PlaceSceneObject(app, modelIdx, position, scale);
 
     return modelIdx;
+}
+
+void RemoveSceneObject(App* app, u32 sceneObjectIdx)
+{
+    ReleaseModel(app, app->sceneObjects[sceneObjectIdx].modelIdx);
+    app->sceneObjects.erase(app->sceneObjects.begin() + sceneObjectIdx);
+    app->objectParamsRelayout = true;
 }
\ No newline at end of file
@@ -1,10 +1,28 @@
 #pragma once
-#include <assimp/cimport.h>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
 #include "engine.h"
+#include "ModelImport.h"
 
-void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
-void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory);
-void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
-u32 LoadModel(App* app, const char* filename, vec3 position = vec3(0), vec3 scale = vec3(1));
\ No newline at end of file
+// Imports the model (mesh + materials) the first time a file is asked for with
+// these flags, afterwards just takes another reference on it
+u32 AcquireModel(App* app, const char* filename, u32 importFlags = MODEL_IMPORT_FLAGS);
+
+// Same, but the import runs on a worker. The model is empty (draws nothing)
+// until UpdateModelLoading() finishes it on the main thread.
+u32 AcquireModelAsync(App* app, const char* filename, u32 importFlags = MODEL_IMPORT_FLAGS);
+
+// Called once per frame: creates the materials and GPU buffers of the imports
+// the workers are done with
+void UpdateModelLoading(App* app);
+
+// Blocks until every pending import is finished
+void WaitForModelLoads(App* app);
+
+// Frees the buffers and gives back the textures once nothing references the model
+void ReleaseModel(App* app, u32 modelIdx);
+
+// Places a scene object referencing the model of the file, returns the model index
+u32 LoadModel(App* app, const char* filename, vec3 position = vec3(0), vec3 scale = vec3(1), u32 importFlags = MODEL_IMPORT_FLAGS);
+
+u32 LoadModelAsync(App* app, const char* filename, vec3 position = vec3(0), vec3 scale = vec3(1), u32 importFlags = MODEL_IMPORT_FLAGS);
+
+void RemoveSceneObject(App* app, u32 sceneObjectIdx);
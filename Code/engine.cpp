@@ -10,7 +10,19 @@
 #include <stb_image.h>
 #include <stb_image_write.h>
 #include <iostream>
+#include <chrono>
 #include "assimpModelLoading.h"
+#include "Materials.h"
+#include "TextureAtlas.h"
+#include "TextureCompression.h"
+#include "JobSystem.h"
+#include "TextureStreaming.h"
+#include "TextureResidency.h"
+#include "VirtualTexturing.h"
+#include "TextureRegistry.h"
+#include "Benchmarks.h"
+#include "AssetPackage.h"
+#include "UniformBlocks.h"
 
 GLuint CreateProgramFromSource(String programSource, const char* shaderName)
 {
@@ -80,6 +92,10 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
         glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
         ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
     }
+    else
+    {
+        CheckUniformBlockLayouts(programHandle, shaderName);
+    }
 
     glUseProgram(0);
 
@@ -91,6 +107,22 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
     return programHandle;
 }
 
+static void GetProgramUniformLocations(Program& program)
+{
+    ProgramUniforms& uniforms = program.uniforms;
+    uniforms.baseVertex = glGetUniformLocation(program.handle, "uBaseVertex");
+    uniforms.baseIndex = glGetUniformLocation(program.handle, "uBaseIndex");
+    uniforms.indexSize = glGetUniformLocation(program.handle, "uIndexSize");
+    uniforms.vertexStride = glGetUniformLocation(program.handle, "uVertexStride");
+    uniforms.attributeOffsets = glGetUniformLocation(program.handle, "uAttributeOffsets");
+    uniforms.attributeFormats = glGetUniformLocation(program.handle, "uAttributeFormats");
+    uniforms.materialIdx = glGetUniformLocation(program.handle, "uMaterialIdx");
+    uniforms.flipTexCoordV = glGetUniformLocation(program.handle, "uFlipTexCoordV");
+    uniforms.positionScale = glGetUniformLocation(program.handle, "uPositionScale");
+    uniforms.positionOffset = glGetUniformLocation(program.handle, "uPositionOffset");
+    uniforms.vtLodBias = glGetUniformLocation(program.handle, "uVtLodBias");
+}
+
 u32 LoadProgram(App* app, const char* filepath, const char* programName)
 {
     String programSource = ReadTextFile(filepath);
@@ -100,6 +132,7 @@ u32 LoadProgram(App* app, const char* filepath, const char* programName)
     program.filepath = filepath;
     program.programName = programName;
     program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    GetProgramUniformLocations(program);
 
 
     //put attributes automatically
@@ -159,8 +192,15 @@ u32 LoadProgram(App* app, const char* filepath, const char* programName)
 Image LoadImage(const char* filename)
 {
     Image img = {};
-    stbi_set_flip_vertically_on_load(true);
-    img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
+
+    // through ReadBinaryFile so packaged images are found too
+    std::vector<u8> fileBytes;
+    if (ReadBinaryFile(filename, fileBytes))
+    {
+        stbi_set_flip_vertically_on_load_thread(true);
+        img.pixels = stbi_load_from_memory(fileBytes.data(), (int)fileBytes.size(), &img.size.x, &img.size.y, &img.nchannels, 0);
+    }
+
     if (img.pixels)
     {
         img.stride = img.size.x * img.nchannels;
@@ -205,35 +245,116 @@ GLuint CreateTexture2DFromImage(Image image)
     return texHandle;
 }
 
-u32 LoadTexture2D(App* app, const char* filepath)
+u32 ComputeMipCount(ivec2 size)
 {
-    
-    for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
-        if (app->textures[texIdx].filepath == filepath)
-            return texIdx;
+    u32 mipCount = 1;
+    i32 maxSide = glm::max(size.x, size.y);
+    while (maxSide > 1)
+    {
+        maxSide >>= 1;
+        mipCount++;
+    }
+    return mipCount;
+}
+
+ivec2 GetMipSize(ivec2 size, u32 level)
+{
+    return glm::max(ivec2(size.x >> level, size.y >> level), ivec2(1));
+}
+
+u32 LoadTexture2D(App* app, const char* filepath, u32 flags, DecodedTexture* decoded)
+{
+    const std::string path = CanonicalizePath(filepath);
+
+    u64 contentHash;
+    u32 loadedTexIdx = AcquireTexture(app, path, flags, contentHash, decoded ? decoded->fileHash : 0);
+    if (loadedTexIdx != UINT32_MAX)
+        return loadedTexIdx;
+
+    const bool isNormalMap = (flags & TextureFlags_NormalMap) != 0;
+
+    if (app->virtualTexturing && (flags & TextureFlags_Virtual) && !(flags & TextureFlags_Immediate))
+    {
+        // turns into a virtual texture if it is big enough, else it is streamed
+        Texture tex = {};
+        tex.filepath = path;
+        tex.flags = flags;
+        tex.state = TextureState_Loading;
+
+        u32 texIdx = RegisterTexture(app, tex, contentHash);
+
+        RequestVirtualTexture(app, texIdx, flags);
+        return texIdx;
+    }
+
+    if (app->streamTextures && !(flags & TextureFlags_Immediate))
+    {
+        // the texture is usable right away, materials show a placeholder until
+        // its first mip arrives (see UpdateTextureStreaming)
+        Texture tex = {};
+        tex.filepath = path;
+        tex.flags = flags;
+        tex.state = TextureState_Loading;
+
+        u32 texIdx = RegisterTexture(app, tex, contentHash);
+
+        RequestTextureStream(app, texIdx, flags, decoded);
+        return texIdx;
+    }
+
+    if (decoded)
+    {
+        Texture tex = {};
+        tex.handle = CreateTexture2DFromDecoded(*decoded);
+        tex.filepath = path;
+        tex.image.size = decoded->size;
+        tex.image.nchannels = decoded->nchannels;
+        tex.internalFormat = decoded->internalFormat;
+        tex.mipCount = decoded->levels.size();
+        tex.flags = flags | TextureFlags_Immediate;
+
+        u32 texIdx = RegisterTexture(app, tex, contentHash);
+
+        std::cout << "Loaded " + path + " (decoded on a worker)" << std::endl;
+        return texIdx;
+    }
+
+    if (app->compressTextures)
+    {
+        Texture tex = {};
+        if (LoadCompressedTexture2D(app, path.c_str(), isNormalMap, tex))
+        {
+            tex.flags = flags | TextureFlags_Immediate;
+            u32 texIdx = RegisterTexture(app, tex, contentHash);
 
+            std::cout << "Loaded " + path + " (compressed)" << std::endl;
+            return texIdx;
+        }
+    }
 
-    Image image = LoadImage(filepath);
+    Image image = LoadImage(path.c_str());
     
 
     if (image.pixels)
     {
         Texture tex = {};
         tex.handle = CreateTexture2DFromImage(image);
-        tex.filepath = filepath;
+        tex.filepath = path;
         tex.image = image;
+        tex.internalFormat = (image.nchannels == 4) ? GL_RGBA8 : GL_RGB8;
+        tex.mipCount = ComputeMipCount(image.size);
+        tex.flags = flags | TextureFlags_Immediate;
 
-        u32 texIdx = app->textures.size();
-        app->textures.push_back(tex);
+        u32 texIdx = RegisterTexture(app, tex, contentHash);
 
         FreeImage(image);
 
-        std::cout << "Loaded " + std::string(filepath) << std::endl;
+        std::cout << "Loaded " + path << std::endl;
         return texIdx;
     }
     else
     {
-        std::cout << "Failed loading " + std::string(filepath) << std::endl;
+        std::cout << "Failed loading " + path << std::endl;
         return UINT32_MAX;
     }
 }
@@ -357,7 +478,10 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
                 const u32 offset = submesh.vertexBufferLayout.attributes[j].offset + submesh.vertexOffset; // attribute offset + vertex offset
                 const u32 stride = submesh.vertexBufferLayout.stride;
 
-                glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)offset);
+                const GLenum type = submesh.vertexBufferLayout.attributes[j].type;
+                const GLboolean normalized = submesh.vertexBufferLayout.attributes[j].normalized ? GL_TRUE : GL_FALSE;
+
+                glVertexAttribPointer(index, ncomp, type, normalized, stride, (void*)(u64)offset);
 
                 //ErrorGuardOGL error("FindVAO()", __FILE__, __LINE__);
 
@@ -378,6 +502,139 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
     return vaoHandle;
 }
 
+u32 GetModelNodeCount(const Model& model)
+{
+    return model.nodes.empty() ? 1u : (u32)model.nodes.size();
+}
+
+void GetModelNodeSubmeshes(const Model& model, const Mesh& mesh, u32 nodeIdx, u32& firstSubmesh, u32& submeshCount)
+{
+    if (model.nodes.empty())
+    {
+        firstSubmesh = 0;
+        submeshCount = (u32)mesh.submeshes.size();
+        return;
+    }
+
+    // (no submeshes until an async import is finished)
+    const ModelNode& node = model.nodes[nodeIdx];
+    firstSubmesh = node.firstSubmesh;
+    submeshCount = glm::min(node.submeshCount, (u32)mesh.submeshes.size() - glm::min(node.firstSubmesh, (u32)mesh.submeshes.size()));
+}
+
+u32 GetNodeParamsOffset(const App* app, const SceneObject& sceneObject, u32 nodeIdx)
+{
+    // the blocks of the nodes follow each other, each one aligned
+    return sceneObject.localParamsOffset + nodeIdx * Align(sceneObject.localParamsSize, app->uniformBlockAlignment);
+}
+
+// Attribute formats the pulling shader decodes (PULL_FORMAT_* in shaders.glsl)
+static GLint GetPullingFormat(const VertexBufferAttribute& attribute)
+{
+    switch (attribute.type)
+    {
+    case GL_SHORT:              return 1;
+    case GL_HALF_FLOAT:         return 2;
+    case GL_INT_2_10_10_10_REV: return 3;
+    default:                    return 0;
+    }
+}
+
+void BindVertexPullingSubmesh(const Mesh& mesh, u32 submeshIndex, const Program& program)
+{
+    const Submesh& submesh = mesh.submeshes[submeshIndex];
+
+    // The whole mesh buffers are bound (SSBO offsets have alignment restrictions),
+    // the submesh is selected through the base offsets instead
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(2), mesh.vertexBufferHandle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(3), mesh.indexBufferHandle);
+
+    // every format is a whole number of 32 bit words
+    GLint attributeOffsets[4] = { -1, -1, -1, -1 };
+    GLint attributeFormats[4] = { 0, 0, 0, 0 };
+    for (u32 i = 0; i < submesh.vertexBufferLayout.attributes.size(); ++i)
+    {
+        const VertexBufferAttribute& attribute = submesh.vertexBufferLayout.attributes[i];
+        if (attribute.location < ARRAY_COUNT(attributeOffsets))
+        {
+            attributeOffsets[attribute.location] = attribute.offset / sizeof(u32);
+            attributeFormats[attribute.location] = GetPullingFormat(attribute);
+        }
+    }
+
+    const u32 indexSize = (submesh.indexType == GL_UNSIGNED_SHORT) ? sizeof(u16) : sizeof(u32);
+    const ProgramUniforms& uniforms = program.uniforms;
+    glUniform1ui(uniforms.baseVertex, submesh.vertexOffset / sizeof(u32));
+    glUniform1ui(uniforms.baseIndex, submesh.indexOffset / indexSize);
+    glUniform1ui(uniforms.indexSize, indexSize);
+    glUniform1ui(uniforms.vertexStride, submesh.vertexBufferLayout.stride / sizeof(u32));
+    glUniform1iv(uniforms.attributeOffsets, ARRAY_COUNT(attributeOffsets), attributeOffsets);
+    glUniform1iv(uniforms.attributeFormats, ARRAY_COUNT(attributeFormats), attributeFormats);
+}
+
+static u64 GetCpuTimeNs()
+{
+    return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+}
+
+static f32 AccumulateAverage(f32 average, f32 sample)
+{
+    return (average == 0.0f) ? sample : average * 0.95f + sample * 0.05f;
+}
+
+void CreatePassTimer(PassTimer& timer)
+{
+    timer = {};
+    glGenQueries(GPU_TIMER_LATENCY, timer.queries);
+}
+
+void BeginPassTimer(PassTimer& timer, u32 tag)
+{
+    ASSERT(tag < ARRAY_COUNT(timer.gpuAverageMs), "Invalid pass timer tag");
+
+    // gather the queries issued in previous frames that are already resolved
+    for (u32 i = 0; i < GPU_TIMER_LATENCY; ++i)
+    {
+        if (!timer.queryInFlight[i])
+            continue;
+
+        GLint available = 0;
+        glGetQueryObjectiv(timer.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            GLuint64 elapsedNs = 0;
+            glGetQueryObjectui64v(timer.queries[i], GL_QUERY_RESULT, &elapsedNs);
+            f32& average = timer.gpuAverageMs[timer.queryTags[i]];
+            average = AccumulateAverage(average, (f32)elapsedNs / 1.0e6f);
+            timer.queryInFlight[i] = false;
+        }
+    }
+
+    timer.currentTag = tag;
+    timer.cpuBeginNs = GetCpuTimeNs();
+
+    // if the GPU is lagging too far behind just skip this frame's GPU sample
+    timer.gpuQueryActive = !timer.queryInFlight[timer.head];
+    if (timer.gpuQueryActive)
+        glBeginQuery(GL_TIME_ELAPSED, timer.queries[timer.head]);
+}
+
+void EndPassTimer(PassTimer& timer)
+{
+    if (timer.gpuQueryActive)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        timer.queryTags[timer.head] = timer.currentTag;
+        timer.queryInFlight[timer.head] = true;
+        timer.head = (timer.head + 1) % GPU_TIMER_LATENCY;
+        timer.gpuQueryActive = false;
+    }
+
+    f32& average = timer.cpuAverageMs[timer.currentTag];
+    average = AccumulateAverage(average, (f32)(GetCpuTimeNs() - timer.cpuBeginNs) / 1.0e6f);
+}
+
 //mat4x4 SetPosition(const vec3& translation)
 //{
 //    return translate(translation);
@@ -596,6 +853,14 @@ void Init(App* app)
 {
     ErrorGuardOGL error("Init()", __FILE__, __LINE__);
 
+    // optional, loose files are used when there's no package
+    MountAssetPackage(ASSET_PACKAGE_FILE);
+
+    InitJobSystem();
+    InitTextureRegistry(app);
+    InitTextureStreaming(app);
+    InitTextureResidency(app);
+    InitVirtualTexturing(app);
 
     if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 3))
         glDebugMessageCallback(OnGlError, app);
@@ -604,6 +869,13 @@ void Init(App* app)
     glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &app->maxUniformBufferSize);
     glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniformBlockAlignment);
 
+    // without S3TC every texture goes up uncompressed (RGBA8)
+    if (app->compressTextures && !IsBlockCompressionSupported())
+    {
+        ELOG("GL_EXT_texture_compression_s3tc is not supported, textures won't be block compressed");
+        app->compressTextures = false;
+    }
+
 
     // set camera variables
 
@@ -615,6 +887,14 @@ void Init(App* app)
     app->forwardRenderingProgramIdx = LoadProgram(app, "shaders.glsl", "FORWARD_RENDERING");
     app->deferredRenderingProgramIdx = LoadProgram(app, "shaders.glsl", "DEFERRED_RENDERING");
     app->screenRectProgramIdx = LoadProgram(app, "shaders.glsl", "SCREEN_RECT");
+    app->forwardPullingProgramIdx = LoadProgram(app, "shaders.glsl", "FORWARD_RENDERING_PULLING");
+    app->deferredPullingProgramIdx = LoadProgram(app, "shaders.glsl", "DEFERRED_RENDERING_PULLING");
+    app->vtFeedbackProgramIdx = LoadProgram(app, "shaders.glsl", "FORWARD_RENDERING_FEEDBACK");
+
+    // vertex pulling draws with no vertex attributes at all, but core profile
+    // still requires a VAO to be bound
+    glGenVertexArrays(1, &app->emptyVao);
+    CreatePassTimer(app->geometryPassTimer);
     
     {
 
@@ -752,11 +1032,12 @@ void Init(App* app)
 
 
     // - textures
-    app->whiteTexIdx = LoadTexture2D(app, "color_white.png");
-    app->blackTexIdx = LoadTexture2D(app, "color_black.png");
-    app->normalTexIdx = LoadTexture2D(app, "color_normal.png");
-    app->magentaTexIdx = LoadTexture2D(app, "color_magenta.png");
-    app->diceTexIdx = LoadTexture2D(app, "dice.png");
+    // (the placeholders stand in for streamed textures, so they can't be streamed themselves)
+    app->whiteTexIdx = LoadTexture2D(app, "color_white.png", TextureFlags_Immediate);
+    app->blackTexIdx = LoadTexture2D(app, "color_black.png", TextureFlags_Immediate);
+    app->normalTexIdx = LoadTexture2D(app, "color_normal.png", TextureFlags_Immediate);
+    app->magentaTexIdx = LoadTexture2D(app, "color_magenta.png", TextureFlags_Immediate);
+    app->diceTexIdx = LoadTexture2D(app, "dice.png", TextureFlags_Immediate);
 
 
     app->mode = Mode_TexturedMeshes;
@@ -768,7 +1049,8 @@ void Init(App* app)
     //glGenBuffers(1, &app->uniformBufferHandle);
     //glBindBuffer(GL_UNIFORM_BUFFER, app->uniformBufferHandle);
     //glBufferData(GL_UNIFORM_BUFFER, app->maxUniformBufferSize, NULL, GL_STREAM_DRAW);
-    app->uniformBuffer = CreateUniformBuffer(app->maxUniformBufferSize);
+    // the uniform pages of the objects are created as they're needed
+    app->globalParamsBuffer = CreateUniformBuffer(sizeof(GlobalParamsBlock));
 
 
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
@@ -776,12 +1058,21 @@ void Init(App* app)
     // load models
     
     
-    LoadModel(app, "Models/ScreenQuad/screenQuad.obj", vec3(0, 0, -100), vec3(50));
-    LoadModel(app, "Models/Mercedes/mercedes.obj", vec3(-11.1f, -7.5f, 16.f), vec3(5));
+    LoadModelAsync(app, "Models/ScreenQuad/screenQuad.obj", vec3(0, 0, -100), vec3(50));
+    LoadModelAsync(app, "Models/Mercedes/mercedes.obj", vec3(-11.1f, -7.5f, 16.f), vec3(5));
 
-    LoadModel(app, "Models/Patrick/Patrick.obj", vec3(-4.25, -1.3 , -3), vec3(0.8));
-    LoadModel(app, "Models/Patrick/Patrick.obj", vec3(0, 0, -3));
-    LoadModel(app, "Models/Patrick/Patrick.obj", vec3(0, 25, -30), vec3(10));
+    LoadModelAsync(app, "Models/Patrick/Patrick.obj", vec3(-4.25, -1.3 , -3), vec3(0.8));
+    LoadModelAsync(app, "Models/Patrick/Patrick.obj", vec3(0, 0, -3));
+    LoadModelAsync(app, "Models/Patrick/Patrick.obj", vec3(0, 25, -30), vec3(10));
+
+    // imported in parallel on the workers, the GPU uploads happen here
+    WaitForModelLoads(app);
+
+    // pack small textures into atlases, group the rest into arrays
+    // and send the materials to the GPU
+    BuildTextureAtlases(app);
+    BuildTextureArrays(app);
+    UploadMaterialTable(app);
 
     //load lights
 
@@ -913,6 +1204,16 @@ void Gui(App* app)
         ImGui::Separator();
     }
 
+    ImGui::Checkbox("Vertex Pulling", &app->vertexPulling);
+    if (ImGui::TreeNode("Geometry Pass Timings"))
+    {
+        const PassTimer& timer = app->geometryPassTimer;
+        ImGui::Text("VAO path:     GPU %.3f ms / CPU %.3f ms", timer.gpuAverageMs[0], timer.cpuAverageMs[0]);
+        ImGui::Text("Pulling path: GPU %.3f ms / CPU %.3f ms", timer.gpuAverageMs[1], timer.cpuAverageMs[1]);
+        ImGui::TreePop();
+    }
+    ImGui::Separator();
+
     if (ImGui::TreeNode("Deferred Textures"))
     {
         if (app->deferredTextures.size() > 0)
@@ -935,20 +1236,50 @@ void Gui(App* app)
 
     ImGui::Text("Loaded Textures");
 
+    u32 pendingTextures;
+    u64 streamedBytes;
+    GetTextureStreamingStats(app, pendingTextures, streamedBytes);
+    ImGui::Text("Streaming: %u pending, %.1f MB uploaded", pendingTextures, streamedBytes / (1024.0f * 1024.0f));
+
+    i32 budgetMB = (i32)(app->textureVramBudget / (1024 * 1024));
+    ImGui::Text("Texture VRAM: %.1f MB", GetResidentTextureBytes(app) / (1024.0f * 1024.0f));
+    if (ImGui::DragInt("VRAM Budget (MB)", &budgetMB, 1.0f, 16, 8192))
+        app->textureVramBudget = (u64)budgetMB * 1024 * 1024;
+
+    u32 virtualTextures, residentPages, pageSlots;
+    GetVirtualTexturingStats(app, virtualTextures, residentPages, pageSlots);
+    ImGui::Text("Virtual textures: %u, %u/%u pages resident", virtualTextures, residentPages, pageSlots);
+
+    u32 loadedTextures, sharedTextures;
+    GetTextureRegistryStats(app, loadedTextures, sharedTextures);
+    ImGui::Text("Textures: %u loaded, %u shared by content", loadedTextures, sharedTextures);
+
     if (ImGui::TreeNode("Textures"))
     {
         ImGui::DragFloat("Image Size", &imageSize, 0.1, 10, 100, "%.2f");
         if (app->textures.size() > 0)
             for (size_t i = 0; i < app->textures.size(); i++)
             {
-                ImGui::Separator();
                 Texture& t = app->textures[i];
+                if (t.state == TextureState_Unloaded)
+                    continue;
+
+                ImGui::Separator();
+                if (t.state == TextureState_Loading || t.state == TextureState_Failed || t.state == TextureState_Virtual)
+                {
+                    const char* status = t.state == TextureState_Loading ? "loading" : (t.state == TextureState_Failed ? "failed" : "virtual");
+                    ImGui::Text("(%s) %s", status, t.filepath.c_str());
+                    continue;
+                }
 
                 ImVec2 size = ImVec2(imageSize / t.image.size.x, imageSize / t.image.size.x);
 
-                ImGui::Image((void*)t.handle, ImVec2(t.image.size.x * size.x, t.image.size.y * size.y));
+                // atlased textures are a region of the page their handle views
+                const vec4& uv = t.uvScaleOffset;
+                ImGui::Image((void*)t.handle, ImVec2(t.image.size.x * size.x, t.image.size.y * size.y),
+                             ImVec2(uv.z, uv.w), ImVec2(uv.z + uv.x, uv.w + uv.y));
                 ImGui::SameLine();
-                ImGui::Text(t.filepath.c_str());
+                ImGui::Text("%s (%u KB, %u refs)", t.filepath.c_str(), (u32)(t.residentBytes / 1024), t.refCount);
             }
         ImGui::TreePop();
     }
@@ -988,7 +1319,13 @@ void Gui(App* app)
     ImGui::Separator();
 
     ImGui::Text("Scene Objects");
+    ImGui::Text("%u objects, %u models loaded", (u32)app->sceneObjects.size() - 1, (u32)app->modelsByKey.size());
+    ImGui::Text("Object data: %u of %u uniform pages (%u KB each)", app->uniformPagesUsed, UNIFORM_MAX_PAGE_COUNT, UNIFORM_PAGE_SIZE / 1024);
+    ImGui::Text("Uniform uploads: %u bytes last frame", app->uniformUploadBytes);
+    if (app->uniformDroppedBlocks > 0)
+        ImGui::Text("%u uniform blocks didn't fit, their objects aren't drawn", app->uniformDroppedBlocks);
     ImGui::Separator();
+    u32 removedSceneObjectIdx = UINT32_MAX;
     if (app->sceneObjects.size() > 0)
     for (size_t i = 1; i < app->sceneObjects.size(); i++)
     {
@@ -998,12 +1335,14 @@ void Gui(App* app)
         {
             if (ImGui::CollapsingHeader("Transform"))
             {
-                ImGui::DragFloat3("Translation", &scObj.worldMatrix[3][0], 0.05f, 0.0f, 0.0f, "%.2f");
+                if (ImGui::DragFloat3("Translation", &scObj.worldMatrix[3][0], 0.05f, 0.0f, 0.0f, "%.2f"))
+                    MarkTransformDirty(scObj);
 
                 vec3 newScale = GetScaling(scObj.worldMatrix);
                 if (ImGui::DragFloat3("Scaling", &newScale[0], 0.05f, 0.0f, 0.0f, "%.2f"))
                 {
                     SetScaling(scObj.worldMatrix, newScale.x, newScale.y, newScale.z);
+                    MarkTransformDirty(scObj);
                 }
 
                 ManageSceneObjectRotation(scObj);
@@ -1012,12 +1351,55 @@ void Gui(App* app)
                 //float newPositionZ = scObj.worldMatrix.translation().z;
             }
 
+            ImGui::Text("Model: %s (%u refs)", app->models[scObj.modelIdx].filepath.c_str(), app->models[scObj.modelIdx].refCount);
+            if (ImGui::TreeNode("Mesh Optimization"))
+            {
+                // simulated on import, see MeshProcessing.h
+                const Mesh& mesh = app->meshes[app->models[scObj.modelIdx].meshIdx];
+                for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+                {
+                    const Submesh& submesh = mesh.submeshes[j];
+                    ImGui::Text("Submesh %u (%u triangles, %u byte vertices, %u bit indices)", j, submesh.indexCount / 3,
+                                submesh.vertexBufferLayout.stride, (submesh.indexType == GL_UNSIGNED_SHORT) ? 16 : 32);
+
+                    const MeshDrawStats& before = submesh.unoptimizedStats;
+                    const MeshDrawStats& after = submesh.optimizedStats;
+                    if (after.acmr != 0.0f)
+                    {
+                        ImGui::Text("  ACMR      %.3f -> %.3f", before.acmr, after.acmr);
+                        ImGui::Text("  ATVR      %.3f -> %.3f", before.atvr, after.atvr);
+                        ImGui::Text("  Overdraw  %.3f -> %.3f", before.overdraw, after.overdraw);
+                        ImGui::Text("  Overfetch %.3f -> %.3f", before.overfetch, after.overfetch);
+                    }
+
+                    const QuantizationError& error = submesh.quantizationError;
+                    ImGui::Text("  Quantization error: position %g, normal %.2f deg, tangent %.2f deg, uv %g",
+                                error.position, error.normal, error.tangent, error.texCoord);
+                }
+                ImGui::TreePop();
+            }
+            if (ImGui::Button("Remove"))
+                removedSceneObjectIdx = i;
+
             ImGui::TreePop();
         }
     }
+    if (removedSceneObjectIdx != UINT32_MAX)
+        RemoveSceneObject(app, removedSceneObjectIdx);
     ImGui::Separator();
 
 
+    if (ImGui::TreeNode("Benchmarks"))
+    {
+        // results go to the log, these take a few seconds
+        if (ImGui::Button("Mesh interleaving (5M vertices)"))
+            RunMeshInterleaveBenchmark();
+        if (ImGui::Button("OBJ import (Assimp vs native)"))
+            RunObjImportBenchmark();
+        ImGui::TreePop();
+    }
+    ImGui::Separator();
+
     //ImGui::DragFloat3("CamPos", &app->camera.Position[0], 0.1f, -1000, 1000, "%f", 0);
     //ImGui::DragFloat3("CamRef", &app->camera.currentReference[0], 0.1f, -1000, 1000, "%f", 0);
     //
@@ -1033,6 +1415,13 @@ void Update(App* app)
 {
     // You can handle app->input keyboard/mouse here
 
+    app->frameIndex++;
+    UpdateModelLoading(app);
+    UpdateTextureStreaming(app);
+    UpdateTextureResidency(app);
+    UpdateVirtualTexturing(app);
+    UpdateTextureRegistry(app);
+
     app->camera.UpdateCamera(app);
     //std::cout << 1.f / app->deltaTime << " / " << 1.f / app->deltaTime * 10.f << " / " << 1.f / app->deltaTime * 100.f << " / " << 1.f / app->deltaTime * 1000.f<< std::endl;
 
@@ -1047,61 +1436,19 @@ void Update(App* app)
             const char* programName = program.programName.c_str();
             program.handle = CreateProgramFromSource(programSource, programName);
             program.lastWriteTimestamp = currentTimestamp;
+            GetProgramUniformLocations(program);
         }
     }
     
 
-    MapBuffer(app->uniformBuffer, GL_WRITE_ONLY);
+    float aspectRatio = (float)app->displaySize.x / (float)app->displaySize.y;
+    mat4x4 projectionMatrix = glm::perspective(glm::radians(app->camera.fov), aspectRatio, app->camera.zNear, app->camera.zFar);
+    mat4x4 view = glm::lookAt(app->camera.Position, app->camera.currentReference, vec3(0, 1, 0));
 
-    // update global params
-    app->globalParamsOffset = app->uniformBuffer.head;
-
-    //push camera position
-    PushVec3(app->uniformBuffer, app->camera.Position);
-
-    //push light count
-    PushUInt(app->uniformBuffer, app->lightObjects.size());
-
-    if (app->lightObjects.size() > 0);
-    for (size_t i = 0; i < app->lightObjects.size(); i++)
-    {
-        AlignHead(app->uniformBuffer, sizeof(vec4));
-
-        Light& light = app->lightObjects[i].light;
-
-        PushUInt(app->uniformBuffer, light.type);
-        PushVec3(app->uniformBuffer, light.color);
-        PushVec3(app->uniformBuffer, light.direction);
-        PushVec3(app->uniformBuffer, light.position);
-    }
-
-    app->globalParamsSize = app->uniformBuffer.head - app->globalParamsOffset;
-
-
-    // update local params
-    if (app->sceneObjects.size() > 0)
-        for (size_t i = 0; i < app->sceneObjects.size(); i++)
-        {
-            SceneObject& sceneObject = app->sceneObjects[i];
-            // update transform
-                float aspectRatio = (float)app->displaySize.x / (float)app->displaySize.y;
-                mat4x4 projectionMatrix = glm::perspective(glm::radians(app->camera.fov), aspectRatio, app->camera.zNear, app->camera.zFar);
-                mat4x4 view = glm::lookAt(app->camera.Position, app->camera.currentReference, vec3(0, 1, 0));
-            
-                //update transform and view matrices
-                //sceneObject.worldMatrix = IdentityMatrix; --> only when setting the mesh/object;
-                mat4x4 worldMat = sceneObject.worldMatrix;
-                mat4x4 viewMat = sceneObject.worldViewProjectionMatrix = projectionMatrix * view * sceneObject.worldMatrix;
-
-                AlignHead(app->uniformBuffer, app->uniformBlockAlignment);
-
-                sceneObject.localParamsOffset = app->uniformBuffer.head;
-                PushMat4(app->uniformBuffer, worldMat);
-                PushMat4(app->uniformBuffer, viewMat);
-                sceneObject.localParamsSize = app->uniformBuffer.head - sceneObject.localParamsOffset;
-        }
-
-    UnmapBuffer(app->uniformBuffer);
+    // the camera goes into the global block, the objects only upload what moved
+    app->uniformUploadBytes = 0;
+    UpdateGlobalParams(app, projectionMatrix * view);
+    UpdateObjectParams(app);
 
     //u32 bufferHead = app->globalParamsSize;
     //
@@ -1205,7 +1552,7 @@ void Render(App* app)
                 glUniform1i(app->programUniformTexture, 0);
 
                 // - bind the vao
-                Mesh quadMesh = app->sceneObjects[0].mesh;
+                Mesh& quadMesh = app->meshes[app->models[app->sceneObjects[0].modelIdx].meshIdx];
                 Submesh quadSubMesh = quadMesh.submeshes[0];
                 app->screenQuadVao = FindVAO(quadMesh, 0, currentProgram);
                 glBindVertexArray(app->screenQuadVao);
@@ -1223,6 +1570,8 @@ void Render(App* app)
         {
             //ErrorGuardOGL error("Render() [Mode_TexturedMeshes]", __FILE__, __LINE__);
 
+            RenderVirtualTextureFeedback(app);
+
             //bind frameBuffer object
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
             if (app->rendering_deferred)
@@ -1248,14 +1597,12 @@ void Render(App* app)
             
 
             ////use mesh textured shader
-            Program currentProgram = app->programs[app->forwardRenderingProgramIdx];
-            glUseProgram(currentProgram.handle);
+            u32 geometryProgramIdx = app->rendering_deferred ? app->deferredRenderingProgramIdx : app->forwardRenderingProgramIdx;
+            if (app->vertexPulling)
+                geometryProgramIdx = app->rendering_deferred ? app->deferredPullingProgramIdx : app->forwardPullingProgramIdx;
 
-            if (app->rendering_deferred)
-            {
-                currentProgram = app->programs[app->deferredRenderingProgramIdx];
-                glUseProgram(currentProgram.handle);
-            }
+            Program currentProgram = app->programs[geometryProgramIdx];
+            glUseProgram(currentProgram.handle);
             
             
 
@@ -1276,68 +1623,92 @@ void Render(App* app)
                         std::string groupName = "Light" + std::to_string(lo.Idx);
                         glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, groupName.c_str());
 
-                        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->uniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+                        glBindBufferBase(GL_UNIFORM_BUFFER, BINDING(0), app->globalParamsBuffer.handle);
 
                         glPopDebugGroup();
 
                     }
             }
 
+            BeginPassTimer(app->geometryPassTimer, app->vertexPulling ? 1 : 0);
+
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(4), app->materialBuffer.handle);
+            BindVirtualTextures(app);
+            app->boundAlbedoArray = 0;
+            app->boundAlbedoTexture = 0;
+
             //draw meshes
             if (app->sceneObjects.size() > 0)
             for (size_t m = 1; m < app->sceneObjects.size(); m++)
             {
                 SceneObject& scObj = app->sceneObjects[m];
+                if (scObj.localParamsPage == UINT32_MAX)
+                    continue;
 
-                Model& model = app->models[scObj.modelIdx]; //app->model does not exist
-                Mesh& mesh = scObj.mesh;
+                Model& model = app->models[scObj.modelIdx];
+                Mesh& mesh = app->meshes[model.meshIdx];
+                f32 screenSize = EstimateScreenSize(app, scObj);
 
-                for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+                const u32 nodeCount = GetModelNodeCount(model);
+                for (u32 n = 0; n < nodeCount; ++n)
                 {
-                    std::string groupName = "Object" + std::to_string(model.meshIdx);
-                    glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, groupName.c_str());
-
-                    //use uniform buffer
-                    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->uniformBuffer.handle, scObj.localParamsOffset, scObj.localParamsSize);
+                    u32 firstSubmesh, submeshCount;
+                    GetModelNodeSubmeshes(model, mesh, n, firstSubmesh, submeshCount);
 
-                    GLuint vao = FindVAO(mesh, i, currentProgram);
-                    glBindVertexArray(vao);
+                    for (u32 i = firstSubmesh; i < firstSubmesh + submeshCount; ++i)
+                    {
+                        std::string groupName = "Object" + std::to_string(model.meshIdx);
+                        glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, groupName.c_str());
 
-                    u32 submeshMaterialldx = model.materialIdx[i];
-                    Material& submeshMaterial = app->materials[submeshMaterialldx];
+                        //use uniform buffer
+                        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), GetUniformPageHandle(app, scObj.localParamsPage), GetNodeParamsOffset(app, scObj, n), scObj.localParamsSize);
 
-                    Texture* tex = &app->textures[submeshMaterial.albedoTextureIdx];
+                        if (app->vertexPulling)
+                        {
+                            glBindVertexArray(app->emptyVao);
+                            BindVertexPullingSubmesh(mesh, i, currentProgram);
+                        }
+                        else
+                        {
+                            GLuint vao = FindVAO(mesh, i, currentProgram);
+                            glBindVertexArray(vao);
+                        }
 
-                    glUniform1i(glGetUniformLocation(currentProgram.handle, "uTexture"), 0);
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, tex->handle);
+                        u32 submeshMaterialldx = model.materialIdx[i];
+                        BindMaterial(app, currentProgram, submeshMaterialldx);
+                        MarkMaterialDrawn(app, submeshMaterialldx, screenSize);
 
-                    if (app->rendering_deferred)
-                    {
-                        if (m == 1)
+                        if (app->rendering_deferred)
                         {
-                            glBindTexture(GL_TEXTURE_2D, app->colorAttachmentHandle);
-                        }
-                        
-                        glUniform1i(glGetUniformLocation(currentProgram.handle, "uDepthTexture"), 1); //set shader texture variable to GL_TEXTURE1
+                            glUniform1i(glGetUniformLocation(currentProgram.handle, "uDepthTexture"), 1); //set shader texture variable to GL_TEXTURE1
 
-                        glActiveTexture(GL_TEXTURE1);
-                        glBindTexture(GL_TEXTURE_2D, app->depthReadHandle);
-                    }
-                    
-                   
-                    
-                    glUniform1i(app->programUniformTexture, 0);
+                            glActiveTexture(GL_TEXTURE1);
+                            glBindTexture(GL_TEXTURE_2D, app->depthReadHandle);
+                        }
 
-                    Submesh& submesh = mesh.submeshes[i];
-                    glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-                    glBindTexture(GL_TEXTURE_2D, 0);
+                        Submesh& submesh = mesh.submeshes[i];
+                        glUniform1i(currentProgram.uniforms.flipTexCoordV, submesh.flipTexCoordV ? 1 : 0);
+                        glUniform3fv(currentProgram.uniforms.positionScale, 1, &submesh.positionScale[0]);
+                        glUniform3fv(currentProgram.uniforms.positionOffset, 1, &submesh.positionOffset[0]);
+                        if (app->vertexPulling)
+                            glDrawArrays(GL_TRIANGLES, 0, submesh.indexCount);
+                        else
+                            glDrawElements(GL_TRIANGLES, submesh.indexCount, submesh.indexType, (void*)(u64)submesh.indexOffset);
 
-                    glPopDebugGroup();
+                        glPopDebugGroup();
+                    }
                 }
                 //std::cout << "Next Render call --------------------------------------------------------------------" << std::endl;
             }
 
+            EndPassTimer(app->geometryPassTimer);
+            glBindVertexArray(0);
+
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
 
 
             if (app->rendering_deferred)
@@ -1359,7 +1730,7 @@ void Render(App* app)
                         std::string groupName = "Light" + std::to_string(lo.Idx);
                         glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, groupName.c_str());
 
-                        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->uniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+                        glBindBufferBase(GL_UNIFORM_BUFFER, BINDING(0), app->globalParamsBuffer.handle);
 
                         glPopDebugGroup();
 
@@ -1387,12 +1758,15 @@ void Render(App* app)
 
 
                 // - bind the vao
-                Mesh quadMesh = app->sceneObjects[0].mesh;
+                Mesh& quadMesh = app->meshes[app->models[app->sceneObjects[0].modelIdx].meshIdx];
                 Submesh quadSubMesh = quadMesh.submeshes[0];
                 app->screenQuadVao = FindVAO(quadMesh, 0, currentProgram);
                 glBindVertexArray(app->screenQuadVao);
 
-                glDrawElements(GL_TRIANGLES, quadSubMesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)quadSubMesh.indexOffset);
+                // packed like any other submesh (see PackModelImport())
+                glUniform3fv(currentProgram.uniforms.positionScale, 1, &quadSubMesh.positionScale[0]);
+                glUniform3fv(currentProgram.uniforms.positionOffset, 1, &quadSubMesh.positionOffset[0]);
+                glDrawElements(GL_TRIANGLES, quadSubMesh.indexCount, quadSubMesh.indexType, (void*)(u64)quadSubMesh.indexOffset);
 
                 glEnable(GL_DEPTH_TEST);
 
@@ -1408,6 +1782,19 @@ void Render(App* app)
 
 
 
+void Shutdown(App* app)
+{
+    WaitForModelLoads(app);
+    ShutdownVirtualTexturing(app);
+    ShutdownTextureResidency(app);
+    ShutdownTextureStreaming(app);
+    ShutdownTextureRegistry(app);
+    ShutdownJobSystem();
+    UnmountAssetPackage();
+    DestroyUniformPages(app);
+    glDeleteBuffers(1, &app->globalParamsBuffer.handle);
+}
+
 void Camera::SetValues()
 {
 
@@ -1427,6 +1814,11 @@ void Camera::SetValues()
 }
 
 
+void MarkTransformDirty(SceneObject& sceneObject)
+{
+    sceneObject.transformDirty = true;
+}
+
 void ManageSceneObjectRotation(SceneObject &scObj)
 {
     vec3 newRot = vec3(scObj.rotationEuler[0], scObj.rotationEuler[1], scObj.rotationEuler[2]);
@@ -1439,6 +1831,7 @@ void ManageSceneObjectRotation(SceneObject &scObj)
         scObj.worldMatrix = glm::rotate(scObj.worldMatrix, glm::radians(toRot[2]), vec3(0, 1, 0));
 
         scObj.rotationEuler = newRot;
+        MarkTransformDirty(scObj);
     }
 
     
@@ -7,6 +7,7 @@
 #include "platform.h"
 #include <glad/glad.h>
 #include "BufferManagement.h"
+#include <unordered_map>
 
 
 #define BINDING(b) b
@@ -34,11 +35,64 @@ struct Image
     i32   stride;
 };
 
+enum TextureState
+{
+    TextureState_Loading,   // decoding on a worker, nothing to sample yet
+    TextureState_Streaming, // mip tail resident, finer levels still uploading
+    TextureState_Resident,  // the whole mip chain is in VRAM
+    TextureState_Virtual,   // sampled through the virtual texturing page cache
+    TextureState_Failed,
+    TextureState_Unloaded   // released, the slot is reused by the next texture loaded
+};
+
+enum TextureFlags
+{
+    TextureFlags_NormalMap = 1 << 0,
+    TextureFlags_Immediate = 1 << 1, // load synchronously instead of streaming it in (also set
+                                     // on textures that were, their mips can't be dropped)
+    TextureFlags_Virtual   = 1 << 2  // candidate for virtual texturing (when enabled)
+};
+
 struct Texture
 {
     Image       image;
     GLuint      handle;
     std::string filepath;
+    GLenum      internalFormat;
+
+    TextureState state = TextureState_Resident;
+    u32          flags;
+    u32          mipCount = 1;
+    u32          baseLevel;  // finest level that can be sampled while streaming
+    u32          virtualIdx = UINT32_MAX;
+
+    // references taken by LoadTexture2D(), see TextureRegistry.h
+    u32          refCount;
+    u64          contentHash;
+
+    // residency: VRAM used and how it was last drawn
+    u64          residentBytes;
+    u64          lastUsedFrame;
+    f32          screenSize;  // pixels covered (height) by the biggest draw of that frame
+
+    // Once texture arrays are built, handle becomes a view of this layer
+    // (atlased textures only use a part of it, image.size stays their own)
+    u32         arrayIdx = UINT32_MAX;
+    u32         arrayLayer;
+    vec4        uvScaleOffset = vec4(1.0f, 1.0f, 0.0f, 0.0f);
+};
+
+// Textures of the same size and format share one GL_TEXTURE_2D_ARRAY so
+// draws with different materials don't need different texture bindings
+struct TextureArray
+{
+    GLuint handle;
+    ivec2  size;
+    GLenum internalFormat;
+    u32    mipCount;
+    u32    layerCount;
+    bool   atlas;
+    u32    droppedLevels;  // top mips evicted by the residency manager
 };
 
 
@@ -54,6 +108,23 @@ struct VertexShaderLayout
     std::vector<VertexShaderAttribute> attributes;
 };
 
+// Locations of the per-draw uniforms, looked up when the program is linked
+// (-1 for the ones it doesn't have)
+struct ProgramUniforms
+{
+    GLint baseVertex;
+    GLint baseIndex;
+    GLint indexSize;
+    GLint vertexStride;
+    GLint attributeOffsets;
+    GLint attributeFormats;
+    GLint materialIdx;
+    GLint flipTexCoordV;
+    GLint positionScale;
+    GLint positionOffset;
+    GLint vtLodBias;
+};
+
 struct Program
 {
     GLuint             handle;
@@ -61,7 +132,7 @@ struct Program
     std::string        programName;
     u64                lastWriteTimestamp; // What is this for?
     VertexShaderLayout vertexShaderLayout;
-    
+    ProgramUniforms    uniforms;
 };
 
 enum Mode
@@ -71,10 +142,30 @@ enum Mode
     Mode_Count
 };
 
+// Node of a model hierarchy (glTF, or Assimp with MODEL_IMPORT_FLAGS_KEEP_NODES)
+// drawing a range of the model submeshes with its own transform. Nodes
+// instancing the same mesh share the range, its vertices are uploaded once.
+struct ModelNode
+{
+    std::string name;
+    u32    parent;        // UINT32_MAX for the roots, parents come first
+    mat4x4 localMatrix;   // relative to the parent
+    mat4x4 modelMatrix;   // relative to the model
+    u32    firstSubmesh;
+    u32    submeshCount;
+};
+
+// Imported once per (file, import flags) and shared by every scene object
+// placing it, see AcquireModel()
 struct Model
 {
     u32 meshIdx;
     std::vector<u32> materialIdx;
+    std::vector<ModelNode> nodes;  // empty: all the submeshes, with the object transform
+
+    std::string filepath;
+    u32 importFlags;
+    u32 refCount;
 };
 
 struct Vao
@@ -87,25 +178,58 @@ struct VertexBufferAttribute
 {
     u8 location;
     u8 componentCount;
-    u8 offset;
+    u16 offset;
+    GLenum type = GL_FLOAT;   // GL_FLOAT, GL_HALF_FLOAT, GL_SHORT or GL_INT_2_10_10_10_REV
+    bool normalized = false;  // integers read as [-1, 1]
 };
 
 struct VertexBufferLayout
 {
     std::vector<VertexBufferAttribute> attributes;
-    u8 stride;
+    u16 stride;
 };
 
 
 
 
+// Measured by the CPU simulators of MeshProcessing.h, all 0 when the submesh
+// went through none of the reorders (glTF files)
+struct MeshDrawStats
+{
+    f32 acmr;       // transformed vertices per triangle
+    f32 atvr;       // transformed vertices per referenced vertex
+    f32 overdraw;   // shaded pixels per covered pixel
+    f32 overfetch;  // vertex bytes fetched per referenced vertex byte
+};
+
+// Largest difference between the float vertices and what the GPU reads back
+// from their packed formats
+struct QuantizationError
+{
+    f32 position;  // model units
+    f32 normal;    // degrees
+    f32 tangent;   // degrees
+    f32 texCoord;  // uv units
+};
+
 struct Submesh
 {
     VertexBufferLayout vertexBufferLayout;
-    std::vector<float> vertices;
+    std::vector<float> vertices;  // empty once packed, or when loaded from a cooked mesh
     std::vector<u32> indices;
     u32 vertexOffset;
     u32 indexOffset;
+    u32 indexCount;
+    GLenum indexType = GL_UNSIGNED_INT;
+    bool flipTexCoordV = false;  // uvs with a top left origin (glTF buffers uploaded as they are)
+
+    // snorm16 positions are relative to the submesh bounds:
+    // position = packed * positionScale + positionOffset
+    vec3 positionScale = vec3(1.0f);
+    vec3 positionOffset = vec3(0.0f);
+    QuantizationError quantizationError = {};
+    MeshDrawStats unoptimizedStats = {};
+    MeshDrawStats optimizedStats = {};
 
     std::vector<Vao> vaos;
 };
@@ -116,7 +240,8 @@ struct Mesh
     GLuint vertexBufferHandle;
     GLuint indexBufferHandle;
 
-    
+    // around the model space origin, computed on first use
+    f32 boundingRadius = -1.0f;
 };
 
 enum LightType
@@ -148,16 +273,20 @@ struct LightObject
 struct SceneObject
 {
     std::string name;
-    Mesh mesh;
     u32 modelIdx;
-    mat4x4 worldMatrix;
-    mat4x4 worldViewProjectionMatrix;
+    mat4x4 worldMatrix;  // call MarkTransformDirty() after changing it
 
     vec3 rotationEuler;
     quat rotationQuat;
 
+    // localParamsCount blocks, one per node of the model (see
+    // GetNodeParamsOffset()), in the uniform page localParamsPage,
+    // UINT32_MAX when they didn't fit. Rewritten only when dirty.
+    u32 localParamsPage;
     u32 localParamsOffset;
     u32 localParamsSize;
+    u32 localParamsCount;
+    bool transformDirty;
 };
 struct Material
 {
@@ -196,10 +325,31 @@ struct DeferredTexture
     std::string name;
     GLuint idx;
 };
+
+#define GPU_TIMER_LATENCY 4
+
+// Measures a render pass on the GPU (GL_TIME_ELAPSED) and on the CPU.
+// Queries are read back a few frames later to avoid stalling the pipeline,
+// and each sample is accumulated into the average of the tag it was taken with.
+struct PassTimer
+{
+    GLuint queries[GPU_TIMER_LATENCY];
+    u32    queryTags[GPU_TIMER_LATENCY];
+    bool   queryInFlight[GPU_TIMER_LATENCY];
+    u32    head;
+
+    u64    cpuBeginNs;
+    u32    currentTag;
+    bool   gpuQueryActive;
+
+    f32    gpuAverageMs[2];
+    f32    cpuAverageMs[2];
+};
 struct App
 {
     // Loop
     f32  deltaTime;
+    u64  frameIndex;
     bool isRunning;
 
     // Input
@@ -212,8 +362,46 @@ struct App
     ivec2 displaySize;
 
     std::vector<Texture>        textures;
+    std::vector<TextureArray>   textureArrays;
+    struct TextureRegistry*     textureRegistry;
+
+    // textures with the same file contents share one GL texture, whatever path
+    // they are loaded from (costs a read of every new file on the main thread)
+    bool dedupeTextureContents = true;
+
+    // textures up to this size (in both dimensions) get packed into atlases
+    i32 atlasMaxTextureSize = 64;
+
+    // bigger textures are block compressed (BC1/BC3/BC5) and cached on disk
+    bool compressTextures = true;
+
+    // textures are decoded on workers and uploaded through pixel buffers,
+    // smallest mips first, at most this many bytes per frame
+    bool streamTextures = true;
+    u32 textureStreamingBudget = 4 * 1024 * 1024;
+    struct TextureStreamer* textureStreamer;
+
+    // arrays of least recently drawn textures lose their top mips beyond this
+    u64 textureVramBudget = 512ull * 1024 * 1024;
+    struct TextureResidency* textureResidency;
+
+    // big albedo maps are split in pages streamed on demand, driven by a
+    // feedback pass (takes effect for textures loaded after it is set)
+    bool virtualTexturing = false;
+    struct VirtualTextureSystem* virtualTextureSystem;
     std::vector<Program>        programs;
     std::vector<Model>          models;
+    std::vector<Mesh>           meshes;
+    std::unordered_map<std::string, u32> modelsByKey;  // canonical path + import flags
+    std::vector<struct ModelImport*> modelImports;     // imports running on the workers
+
+    // models are cooked to a binary file after their first import, and mapped
+    // from it afterwards instead of going through Assimp (see CookedMesh.h)
+    bool cookMeshes = true;
+
+    // OBJ files go through the native parallel loader (see ObjLoader.h)
+    // instead of Assimp
+    bool fastObjImport = true;
     std::vector<Material>       materials;
     std::vector<SceneObject>    sceneObjects;
     std::vector<LightObject>    lightObjects;
@@ -226,8 +414,17 @@ struct App
     u32 forwardRenderingProgramIdx;
     u32 deferredRenderingProgramIdx;
     u32 screenRectProgramIdx;
+    u32 forwardPullingProgramIdx;
+    u32 deferredPullingProgramIdx;
+    u32 vtFeedbackProgramIdx;
 
     bool rendering_deferred = false;
+
+    // Programmable vertex pulling: meshes are fetched from SSBOs with
+    // gl_VertexID and only this empty VAO is ever bound
+    bool vertexPulling = false;
+    GLuint emptyVao;
+    PassTimer geometryPassTimer;
     
     // texture indices
     u32 diceTexIdx;
@@ -255,9 +452,22 @@ struct App
 
     int maxUniformBufferSize;
     int uniformBlockAlignment;
-    Buffer uniformBuffer;
-    u32 globalParamsOffset;
-    u32 globalParamsSize;
+
+    // Uniform blocks of the scene objects, paged (see UniformBlocks.h)
+    std::vector<Buffer> uniformPages;
+    u32 uniformPageIdx;          // page being written
+    u32 uniformOverflowBlocks;   // blocks that didn't fit so far
+    u32 uniformPagesUsed;        // last time the pages were rewritten
+    u32 uniformDroppedBlocks;    // last time the pages were rewritten
+    u32 uniformUploadBytes;      // last frame, global block included
+    bool objectParamsRelayout;   // objects removed, rewrite every block
+    Buffer globalParamsBuffer;
+
+    // Material table (one GpuMaterial per app->materials entry)
+    Buffer materialBuffer;
+    GLuint boundAlbedoArray;
+    GLuint boundAlbedoTexture;
+    bool materialTableDirty = false;
 
 
     GLuint combinedAttachmentHandle;
@@ -284,6 +494,9 @@ u32 CreateLight(App* app, LightType type, vec3 position, vec3 direction, vec3 co
 vec3 rotate(const vec3& vector, float degrees, const vec3& axis);
 void ManageSceneObjectRotation(SceneObject& scObj);
 
+// Its uniform blocks get uploaded again on the next Update()
+void MarkTransformDirty(SceneObject& sceneObject);
+
 void Init(App* app);
 
 void Gui(App* app);
@@ -292,6 +505,8 @@ void Update(App* app);
 
 void Render(App* app);
 
+void Shutdown(App* app);
+
 class ErrorGuardOGL {
 public:
     ErrorGuardOGL(const char* message, const char* file, int line) : msg(message), file(file), line(line) {
@@ -311,10 +526,31 @@ public:
 
 void OnGlError(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const char* message, const void* userParam);
 
-u32 LoadTexture2D(App* app, const char* filepath);
+u32 ComputeMipCount(ivec2 size);
+
+ivec2 GetMipSize(ivec2 size, u32 level);
+
+// decoded: the texture was already decoded on a worker (see LoadModelAsync),
+// its levels are taken over unless the texture is loaded already
+u32 LoadTexture2D(App* app, const char* filepath, u32 flags = 0, struct DecodedTexture* decoded = NULL);
 
 GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program);
 
+// Models without hierarchy are drawn as a single node with every submesh
+u32 GetModelNodeCount(const Model& model);
+void GetModelNodeSubmeshes(const Model& model, const Mesh& mesh, u32 nodeIdx, u32& firstSubmesh, u32& submeshCount);
+
+// Local params block of a node of the scene object, written by Update()
+u32 GetNodeParamsOffset(const App* app, const SceneObject& sceneObject, u32 nodeIdx);
+
+void BindVertexPullingSubmesh(const Mesh& mesh, u32 submeshIndex, const Program& program);
+
+void CreatePassTimer(PassTimer& timer);
+
+void BeginPassTimer(PassTimer& timer, u32 tag);
+
+void EndPassTimer(PassTimer& timer);
+
 mat4x4 SetPosition(const vec3& translation);
 
 void SetScaling(mat4x4& M, float x, float y, float z);
\ No newline at end of file
@@ -12,13 +12,26 @@
 #else
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
 #endif
 
 #include "engine.h"
+#include "AssetPackage.h"
 
-#include <GLFW/glfw3.h>
 #include <stdio.h>
+
+#define GLOBAL_FRAME_ARENA_SIZE MB(16)
+u8* GlobalFrameArenaMemory = NULL;
+u32 GlobalFrameArenaHead = 0;
+
+// Tools like the cooker build with PLATFORM_HEADLESS: no window, no GL context,
+// just the file and string functions below
+#ifndef PLATFORM_HEADLESS
+
+#include <GLFW/glfw3.h>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
@@ -27,10 +40,6 @@
 #define WINDOW_WIDTH  800
 #define WINDOW_HEIGHT 600
 
-#define GLOBAL_FRAME_ARENA_SIZE MB(16)
-u8* GlobalFrameArenaMemory = NULL;
-u32 GlobalFrameArenaHead = 0;
-
 void OnGlfwError(int errorCode, const char *errorMessage)
 {
 	fprintf(stderr, "glfw failed with error %d: %s\n", errorCode, errorMessage);
@@ -262,6 +271,8 @@ int main()
         GlobalFrameArenaHead = 0;
     }
 
+    Shutdown(&app);
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
@@ -274,6 +285,8 @@ int main()
     return 0;
 }
 
+#endif // PLATFORM_HEADLESS
+
 u32 Strlen(const char* string)
 {
     u32 len = 0;
@@ -349,6 +362,54 @@ String GetDirectoryPart(String path)
     return str;
 }
 
+std::string CanonicalizePath(const char* filepath)
+{
+    std::vector<std::string> parts;
+    u32 leadingParents = 0;
+    const bool absolute = filepath[0] == '/' || filepath[0] == '\\';
+
+    std::string part;
+    for (const char* c = filepath; ; ++c)
+    {
+        if (*c == '/' || *c == '\\' || *c == '\0')
+        {
+            if (part == "..")
+            {
+                if (!parts.empty())
+                    parts.pop_back();
+                else if (!absolute)
+                    leadingParents++;
+            }
+            else if (!part.empty() && part != ".")
+            {
+                parts.push_back(part);
+            }
+            part.clear();
+
+            if (*c == '\0')
+                break;
+        }
+        else
+        {
+#if defined(_WIN32)
+            part += (char)tolower((unsigned char)*c);
+#else
+            part += *c;
+#endif
+        }
+    }
+
+    std::string path = absolute ? "/" : "";
+    for (u32 i = 0; i < leadingParents; ++i)
+        path += "../";
+    for (u32 i = 0; i < parts.size(); ++i)
+    {
+        if (i > 0) path += '/';
+        path += parts[i];
+    }
+    return path;
+}
+
 String ReadTextFile(const char* filepath)
 {
     String fileText = {};
@@ -369,12 +430,259 @@ String ReadTextFile(const char* filepath)
     }
     else
     {
-        ELOG("fopen() failed reading file %s", filepath);
+        u64 size = 0;
+        if (FindPackagedFile(filepath, size))
+        {
+            fileText.len = (u32)size;
+            fileText.str = (char*)PushSize(fileText.len + 1);
+            if (!ReadPackagedFile(filepath, 0, fileText.str, size))
+                fileText.len = 0;
+            fileText.str[fileText.len] = '\0';
+        }
+        else
+        {
+            ELOG("fopen() failed reading file %s", filepath);
+        }
     }
 
     return fileText;
 }
 
+bool ReadBinaryFile(const char* filepath, std::vector<u8>& bytes)
+{
+    FILE* file = fopen(filepath, "rb");
+    if (!file)
+    {
+        u64 size = 0;
+        if (!FindPackagedFile(filepath, size))
+            return false;
+
+        bytes.resize((size_t)size);
+        return ReadPackagedFile(filepath, 0, bytes.data(), size);
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    bytes.resize(size > 0 ? (size_t)size : 0);
+    size_t readSize = fread(bytes.data(), 1, bytes.size(), file);
+    fclose(file);
+
+    return readSize == bytes.size();
+}
+
+bool ReadBinaryFileRange(const char* filepath, u64 offset, void* dst, u64 size)
+{
+    FILE* file = fopen(filepath, "rb");
+    if (!file)
+        return ReadPackagedFile(filepath, offset, dst, size);
+
+#ifdef _WIN32
+    int seekResult = _fseeki64(file, (__int64)offset, SEEK_SET);
+#else
+    int seekResult = fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+
+    size_t readSize = (seekResult == 0) ? fread(dst, 1, (size_t)size, file) : 0;
+    fclose(file);
+
+    return readSize == size;
+}
+
+bool WriteBinaryFile(const char* filepath, const void* data, u64 size)
+{
+    FILE* file = fopen(filepath, "wb");
+    if (!file)
+    {
+        ELOG("fopen() failed writing file %s", filepath);
+        return false;
+    }
+
+    size_t writtenSize = fwrite(data, 1, (size_t)size, file);
+    fclose(file);
+
+    return writtenSize == size;
+}
+
+bool AppendBinaryFile(const char* filepath, const void* data, u64 size)
+{
+    FILE* file = fopen(filepath, "ab");
+    if (!file)
+    {
+        ELOG("fopen() failed appending to file %s", filepath);
+        return false;
+    }
+
+    size_t writtenSize = fwrite(data, 1, (size_t)size, file);
+    fclose(file);
+
+    return writtenSize == size;
+}
+
+// Packaged files are compressed, they get decompressed into a heap copy instead
+static bool MapPackagedFile(const char* filepath, MappedFile& mapped)
+{
+    u64 size = 0;
+    if (!FindPackagedFile(filepath, size) || size == 0)
+        return false;
+
+    u8* data = (u8*)malloc((size_t)size);
+    if (!ReadPackagedFile(filepath, 0, data, size))
+    {
+        free(data);
+        return false;
+    }
+
+    mapped.data = data;
+    mapped.size = size;
+    mapped.packaged = true;
+    return true;
+}
+
+bool MapFile(const char* filepath, MappedFile& mapped)
+{
+    mapped = {};
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return MapPackagedFile(filepath, mapped);
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    // the view keeps the mapping alive once the handles are closed
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (mapping)
+        CloseHandle(mapping);
+    CloseHandle(file);
+
+    if (!view)
+        return false;
+
+    mapped.data = (const u8*)view;
+    mapped.size = (u64)size.QuadPart;
+#else
+    int file = open(filepath, O_RDONLY);
+    if (file < 0)
+        return MapPackagedFile(filepath, mapped);
+
+    struct stat attrib;
+    if (fstat(file, &attrib) != 0 || attrib.st_size == 0)
+    {
+        close(file);
+        return false;
+    }
+
+    void* view = mmap(NULL, (size_t)attrib.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+
+    if (view == MAP_FAILED)
+        return false;
+
+    mapped.data = (const u8*)view;
+    mapped.size = (u64)attrib.st_size;
+#endif
+
+    return true;
+}
+
+void UnmapFile(MappedFile& mapped)
+{
+    if (!mapped.data)
+        return;
+
+    if (mapped.packaged)
+    {
+        free((void*)mapped.data);
+        mapped = {};
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(mapped.data);
+#else
+    munmap((void*)mapped.data, (size_t)mapped.size);
+#endif
+
+    mapped = {};
+}
+
+void MakeDirectory(const char* dirpath)
+{
+#ifdef _WIN32
+    CreateDirectoryA(dirpath, NULL);
+#else
+    mkdir(dirpath, 0755);
+#endif
+}
+
+void ListFiles(const char* dirpath, std::vector<std::string>& files, bool recursive)
+{
+#ifdef _WIN32
+    const std::string pattern = std::string(dirpath) + "/*";
+
+    WIN32_FIND_DATAA findData;
+    HANDLE find = FindFirstFileA(pattern.c_str(), &findData);
+    if (find == INVALID_HANDLE_VALUE)
+        return;
+
+    do
+    {
+        const std::string name = findData.cFileName;
+        if (name == "." || name == "..")
+            continue;
+
+        const std::string path = std::string(dirpath) + "/" + name;
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            if (recursive)
+                ListFiles(path.c_str(), files, recursive);
+        }
+        else
+        {
+            files.push_back(path);
+        }
+    } while (FindNextFileA(find, &findData));
+
+    FindClose(find);
+#else
+    DIR* dir = opendir(dirpath);
+    if (!dir)
+        return;
+
+    while (struct dirent* entry = readdir(dir))
+    {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+
+        const std::string path = std::string(dirpath) + "/" + name;
+        struct stat attrib;
+        if (stat(path.c_str(), &attrib) != 0)
+            continue;
+
+        if (S_ISDIR(attrib.st_mode))
+        {
+            if (recursive)
+                ListFiles(path.c_str(), files, recursive);
+        }
+        else
+        {
+            files.push_back(path);
+        }
+    }
+
+    closedir(dir);
+#endif
+}
+
 u64 GetFileLastWriteTimestamp(const char* filepath)
 {
 #ifdef _WIN32
@@ -396,12 +704,18 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
     }
 #endif
 
+    u64 size = 0;
+    u64 timestamp = 0;
+    if (FindPackagedFile(filepath, size, &timestamp))
+        return timestamp;
+
     return 0;
 }
 
 void LogString(const char* str)
 {
-#ifdef _WIN32
+    // tools log to the console, nobody attaches a debugger to them
+#if defined(_WIN32) && !defined(PLATFORM_HEADLESS)
     OutputDebugStringA(str);
     OutputDebugStringA("\n");
 #else
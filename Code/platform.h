@@ -69,12 +69,74 @@ String MakePath(String dir, String filename);
 
 String GetDirectoryPart(String path);
 
+/**
+ * Resolves ./ and ../, backslashes and repeated slashes, so every way of writing a
+ * path gives the same string: "Models/Patrick/./Color.png", "Models\\Patrick//Color.png"
+ * and "Models/Other/../Patrick/Color.png" all become "Models/Patrick/Color.png"
+ * (lowercase on Windows, where paths are case insensitive).
+ */
+std::string CanonicalizePath(const char *filepath);
+
 /**
  * Reads a whole file and returns a string with its contents. The returned string
  * is temporary and should be copied if it needs to persist for several frames.
  */
 String ReadTextFile(const char *filepath);
 
+/**
+ * Reads a whole binary file into a heap buffer. Unlike ReadTextFile it doesn't use
+ * the frame arena, so it's safe for big assets and for worker threads.
+ * Returns false if the file could not be opened.
+ */
+bool ReadBinaryFile(const char *filepath, std::vector<u8>& bytes);
+
+/**
+ * Reads size bytes starting at offset into dst, for files too big to be read whole
+ * (page files...). Safe for worker threads. Returns false on short reads.
+ */
+bool ReadBinaryFileRange(const char *filepath, u64 offset, void* dst, u64 size);
+
+/**
+ * Writes a whole binary file, replacing it if it already exists.
+ */
+bool WriteBinaryFile(const char *filepath, const void* data, u64 size);
+
+/**
+ * Appends to a binary file, creating it if needed. Lets big files be written in parts.
+ */
+bool AppendBinaryFile(const char *filepath, const void* data, u64 size);
+
+/**
+ * Read-only view of a whole file mapped in memory, pages are brought in by the OS
+ * as they are touched. Safe for worker threads.
+ */
+struct MappedFile
+{
+    const u8* data;
+    u64       size;
+    bool      packaged;  // decompressed copy of a packaged file, not a mapping
+};
+
+/**
+ * Maps a whole file read-only. Returns false if it can't be opened or is empty.
+ * Files only found in the mounted asset package (see AssetPackage.h) get
+ * decompressed to the heap instead.
+ */
+bool MapFile(const char *filepath, MappedFile& mapped);
+
+void UnmapFile(MappedFile& mapped);
+
+/**
+ * Creates a directory (non recursively). Does nothing if it already exists.
+ */
+void MakeDirectory(const char *dirpath);
+
+/**
+ * Appends the paths ("dirpath/name") of the files in a directory, and of the
+ * files in its subdirectories when recursive.
+ */
+void ListFiles(const char *dirpath, std::vector<std::string>& files, bool recursive);
+
 /**
  * It retrieves a timestamp indicating the last time the file was modified.
  * Can be useful in order to check for file modifications to implement hot reloads.
@@ -7,6 +7,198 @@
 // The third parameter of the LoadProgram function in engine.cpp allows
 // chosing the shader you want to load by name.
 
+// Programmable vertex pulling variants: same shaders as their classic
+// counterparts, but vertices are fetched from storage buffers using
+// gl_VertexID instead of being fed through VAO attributes.
+#if defined(FORWARD_RENDERING_PULLING)
+#define FORWARD_RENDERING
+#define VERTEX_PULLING
+#elif defined(DEFERRED_RENDERING_PULLING)
+#define DEFERRED_RENDERING
+#define VERTEX_PULLING
+#endif
+
+// Virtual texture feedback: the forward vertex stage, with a fragment stage
+// writing the (virtual texture + 1, mip, page x, page y) each pixel needs
+#if defined(FORWARD_RENDERING_FEEDBACK)
+#define FORWARD_RENDERING
+#define VT_FEEDBACK
+#endif
+
+#if defined(VERTEX_PULLING) && defined(VERTEX)
+
+// The whole mesh vertex/index buffers are bound, the submesh is selected
+// with the base offsets below (all of them expressed in elements, not bytes).
+// Vertices are read as 32 bit words and decoded per attribute format.
+layout(binding = 2, std430) readonly buffer VertexData
+{
+	uint vertexData[];
+};
+
+layout(binding = 3, std430) readonly buffer IndexData
+{
+	uint indexData[];
+};
+
+#define PULL_FORMAT_FLOAT				0
+#define PULL_FORMAT_SNORM16				1	// 4 shorts, the last one padding
+#define PULL_FORMAT_HALF				2
+#define PULL_FORMAT_SNORM_2_10_10_10	3	// GL_INT_2_10_10_10_REV, normalized
+
+uniform uint uBaseVertex;			// first word of the submesh
+uniform uint uBaseIndex;			// first index of the submesh
+uniform uint uIndexSize;			// bytes per index, 2 or 4
+uniform uint uVertexStride;			// words per vertex
+uniform int  uAttributeOffsets[4];	// word offset per location, -1 if missing
+uniform int  uAttributeFormats[4];	// PULL_FORMAT_* per location
+
+vec3 aPosition;
+vec3 aNormal;
+vec2 aTexCoord;
+vec4 aTangent;	// w: handedness, bitangent = cross(aNormal, aTangent.xyz) * aTangent.w
+
+vec4 PullAttribute(uint vertexStart, int location, uint componentCount)
+{
+	int attributeOffset = uAttributeOffsets[location];
+	if (attributeOffset < 0)
+		return vec4(0.0);
+	uint i = vertexStart + uint(attributeOffset);
+
+	switch (uAttributeFormats[location])
+	{
+	case PULL_FORMAT_SNORM16:
+		return vec4(unpackSnorm2x16(vertexData[i]), unpackSnorm2x16(vertexData[i + 1]));
+	case PULL_FORMAT_HALF:
+		return vec4(unpackHalf2x16(vertexData[i]), 0.0, 0.0);
+	case PULL_FORMAT_SNORM_2_10_10_10:
+	{
+		int packed = int(vertexData[i]);
+		vec4 value = vec4(bitfieldExtract(packed, 0, 10), bitfieldExtract(packed, 10, 10),
+						  bitfieldExtract(packed, 20, 10), bitfieldExtract(packed, 30, 2));
+		return max(value / vec4(511.0, 511.0, 511.0, 1.0), vec4(-1.0));
+	}
+	}
+
+	vec4 value = vec4(0.0);
+	for (uint c = 0u; c < componentCount; ++c)
+		value[c] = uintBitsToFloat(vertexData[i + c]);
+	return value;
+}
+
+uint PullIndex(uint i)
+{
+	if (uIndexSize == 4u)
+		return indexData[i];
+	return (indexData[i >> 1] >> ((i & 1u) * 16u)) & 0xFFFFu;
+}
+
+void PullVertex()
+{
+	uint index = PullIndex(uBaseIndex + uint(gl_VertexID));
+	uint vertexStart = uBaseVertex + index * uVertexStride;
+
+	aPosition  = PullAttribute(vertexStart, 0, 3u).xyz;
+	aNormal    = PullAttribute(vertexStart, 1, 3u).xyz;
+	aTexCoord  = PullAttribute(vertexStart, 2, 2u).xy;
+	aTangent   = PullAttribute(vertexStart, 3, 4u);
+}
+
+#endif
+
+#if (defined(FORWARD_RENDERING) || defined(DEFERRED_RENDERING)) && defined(FRAGMENT)
+
+// Material table shared by all draws, indexed with uMaterialIdx. Texture maps
+// are (texture array, layer) pairs; only the albedo array is bound per draw.
+struct Material
+{
+	vec4  albedo;		// rgb: albedo, a: smoothness
+	vec4  emissive;
+	ivec4 albedoMap;	// x: texture array, y: layer
+	ivec4 emissiveMap;
+	ivec4 normalMap;
+	vec4  albedoUvScaleOffset;	// atlas placement: xy scale, zw offset
+	vec4  emissiveUvScaleOffset;
+	vec4  normalUvScaleOffset;
+	ivec4 albedoVirtual;		// x: virtual texture (-1 if none), yz: size, w: coarsest mip
+};
+
+layout(binding = 4, std430) readonly buffer MaterialTable
+{
+	Material uMaterials[];
+};
+
+uniform uint uMaterialIdx;
+layout(binding = 2) uniform sampler2DArray uAlbedoArray;
+layout(binding = 0) uniform sampler2D uAlbedoTexture; // streamed textures not in an array yet
+
+// Virtual texturing: a texel per page in the indirection (a layer per virtual
+// texture, a level per mip) holding the cache slot of the page and its mip.
+// Missing pages point to their finest resident ancestor.
+#define VT_PAGE_SIZE	128
+#define VT_PAGE_BORDER	4
+#define VT_SLOT_SIZE	(VT_PAGE_SIZE + 2 * VT_PAGE_BORDER)
+
+layout(binding = 5) uniform usampler2DArray uVtIndirection;
+layout(binding = 6) uniform sampler2D uVtPageCache;
+uniform float uVtLodBias;	// the feedback pass renders at a lower resolution
+
+int VirtualTextureMip(ivec4 vt, vec2 uv)
+{
+	vec2 texel = uv * vec2(vt.yz);
+	vec2 dx = dFdx(texel);
+	vec2 dy = dFdy(texel);
+	float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + uVtLodBias;
+	return clamp(int(floor(lod)), 0, vt.w);
+}
+
+ivec2 VirtualTexturePage(ivec4 vt, vec2 uv, int mip)
+{
+	ivec2 levelSize = max(vt.yz >> mip, ivec2(1));
+	ivec2 texel = clamp(ivec2(uv * vec2(levelSize)), ivec2(0), levelSize - 1);
+	return texel / VT_PAGE_SIZE;
+}
+
+vec4 SampleVirtualTexture(ivec4 vt, vec2 uv)
+{
+	int mip = VirtualTextureMip(vt, uv);
+	uvec4 entry = texelFetch(uVtIndirection, ivec3(VirtualTexturePage(vt, uv, mip), vt.x), mip);
+
+	// the page found may belong to a coarser mip than the one asked for
+	int residentMip = int(entry.z);
+	vec2 levelSize = vec2(max(vt.yz >> residentMip, ivec2(1)));
+	vec2 texel = clamp(uv * levelSize, vec2(0.0), levelSize - 0.5);
+	vec2 pageOrigin = floor(texel / float(VT_PAGE_SIZE)) * float(VT_PAGE_SIZE);
+
+	vec2 cacheTexel = vec2(entry.xy) * float(VT_SLOT_SIZE) + float(VT_PAGE_BORDER) + (texel - pageOrigin);
+	return textureLod(uVtPageCache, cacheTexel / vec2(textureSize(uVtPageCache, 0)), 0.0);
+}
+
+uvec4 VirtualTextureFeedback(vec2 texCoord)
+{
+	Material material = uMaterials[uMaterialIdx];
+	if (material.albedoVirtual.x < 0)
+		return uvec4(0);
+
+	vec2 uv = clamp(texCoord, 0.0, 1.0);
+	int mip = VirtualTextureMip(material.albedoVirtual, uv);
+	return uvec4(material.albedoVirtual.x + 1, mip, VirtualTexturePage(material.albedoVirtual, uv, mip));
+}
+
+vec4 SampleAlbedo(vec2 texCoord)
+{
+	Material material = uMaterials[uMaterialIdx];
+	if (material.albedoVirtual.x >= 0)
+		return SampleVirtualTexture(material.albedoVirtual, clamp(texCoord, 0.0, 1.0));
+
+	// clamping keeps the GL_CLAMP_TO_EDGE behaviour for atlased textures
+	vec2 uv = clamp(texCoord, 0.0, 1.0) * material.albedoUvScaleOffset.xy + material.albedoUvScaleOffset.zw;
+	if (material.albedoMap.x < 0)
+		return texture(uAlbedoTexture, uv);
+	return texture(uAlbedoArray, vec3(uv, float(material.albedoMap.y)));
+}
+
+#endif
+
 #define MAX_LIGHT_COUNT 8
 #ifdef DEFERRED_RENDERING
 
@@ -25,14 +217,16 @@ struct Light
 
 
 
+#ifndef VERTEX_PULLING
 layout(location = 0) in vec3 aPosition;	// world space
 layout(location = 1) in vec3 aNormal;	// world space
 layout(location = 2) in vec2 aTexCoord;
-layout(location = 3) in vec3 aTangent;
-layout(location = 4) in vec3 aBitangent;
+layout(location = 3) in vec4 aTangent;	// w: handedness, bitangent = cross(aNormal, aTangent.xyz) * aTangent.w
+#endif
 
 layout (binding = 0, std140) uniform globalParams
 {
+	mat4			uViewProjectionMatrix;	// camera, per frame
 	vec3			uCameraPosition;
 	unsigned int	uLightCount;
 	Light			uLight[MAX_LIGHT_COUNT];
@@ -40,10 +234,13 @@ layout (binding = 0, std140) uniform globalParams
 
 layout(binding = 1, std140) uniform localParams
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	mat4 uWorldMatrix;	// only rewritten when the object moves
 };
 
+uniform bool uFlipTexCoordV;	// glTF uvs (top left origin), images are loaded bottom up
+uniform vec3 uPositionScale;	// positions packed relative to the submesh bounds
+uniform vec3 uPositionOffset;
+
 out vec2 vTexCoord;
 out vec3 vPosition;
 out vec3 vNormal;
@@ -55,8 +252,13 @@ out vec3 vLightCol[MAX_LIGHT_COUNT];
 
 void main()
 {
-	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
+#ifdef VERTEX_PULLING
+	PullVertex();
+#endif
+
+	vec3 position = aPosition * uPositionScale + uPositionOffset;
+	vTexCoord = uFlipTexCoordV ? vec2(aTexCoord.x, 1.0 - aTexCoord.y) : aTexCoord;
+	vPosition = vec3(uWorldMatrix * vec4(position, 1.0));
 	vNormal =	vec3(uWorldMatrix * vec4(aNormal, 0.0));
 	vViewDir = uCameraPosition - vPosition;
 	vLightCount = uLightCount;
@@ -79,7 +281,7 @@ void main()
 
 	
 
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	gl_Position = uViewProjectionMatrix * uWorldMatrix * vec4(position, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -94,7 +296,6 @@ flat in unsigned int vLightCount;
 in vec3 vLightDir[MAX_LIGHT_COUNT];
 in vec3 vLightCol[MAX_LIGHT_COUNT];
 
-uniform sampler2D uTexture;
 uniform sampler2D uDepthTexture;
 
 layout(location = 0) out vec4 oPosition;
@@ -106,7 +307,7 @@ void main()
 {
 		
 	oPosition = vec4(vPosition, 1);
-	oColor = texture(uTexture, vTexCoord);
+	oColor = SampleAlbedo(vTexCoord);
 	oNormal = vec4(normalize(vNormal), 1);
 	oDepth = texture(uDepthTexture, vTexCoord);
 }
@@ -136,14 +337,16 @@ struct Light
 
 
 
+#ifndef VERTEX_PULLING
 layout(location = 0) in vec3 aPosition;	// world space
 layout(location = 1) in vec3 aNormal;	// world space
 layout(location = 2) in vec2 aTexCoord;
-layout(location = 3) in vec3 aTangent;
-layout(location = 4) in vec3 aBitangent;
+layout(location = 3) in vec4 aTangent;	// w: handedness, bitangent = cross(aNormal, aTangent.xyz) * aTangent.w
+#endif
 
 layout (binding = 0, std140) uniform globalParams
 {
+	mat4			uViewProjectionMatrix;	// camera, per frame
 	vec3			uCameraPosition;
 	unsigned int	uLightCount;
 	Light			uLight[MAX_LIGHT_COUNT];
@@ -151,10 +354,13 @@ layout (binding = 0, std140) uniform globalParams
 
 layout(binding = 1, std140) uniform localParams
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	mat4 uWorldMatrix;	// only rewritten when the object moves
 };
 
+uniform bool uFlipTexCoordV;	// glTF uvs (top left origin), images are loaded bottom up
+uniform vec3 uPositionScale;	// positions packed relative to the submesh bounds
+uniform vec3 uPositionOffset;
+
 out vec2 vTexCoord;
 out vec3 vPosition;
 out vec3 vNormal;
@@ -166,8 +372,13 @@ out vec3 vLightCol[MAX_LIGHT_COUNT];
 
 void main()
 {
-	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
+#ifdef VERTEX_PULLING
+	PullVertex();
+#endif
+
+	vec3 position = aPosition * uPositionScale + uPositionOffset;
+	vTexCoord = uFlipTexCoordV ? vec2(aTexCoord.x, 1.0 - aTexCoord.y) : aTexCoord;
+	vPosition = vec3(uWorldMatrix * vec4(position, 1.0));
 	vNormal =	vec3(uWorldMatrix * vec4(aNormal, 0.0));
 	vViewDir = uCameraPosition - vPosition;
 	vLightCount = uLightCount;
@@ -190,7 +401,7 @@ void main()
 
 	
 
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	gl_Position = uViewProjectionMatrix * uWorldMatrix * vec4(position, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -205,13 +416,22 @@ flat in unsigned int vLightCount;
 in vec3 vLightDir[MAX_LIGHT_COUNT];
 in vec3 vLightCol[MAX_LIGHT_COUNT];
 
-uniform sampler2D uTexture;
+#ifdef VT_FEEDBACK
+
+layout(location = 0) out uvec4 oFeedback;
+
+void main()
+{
+	oFeedback = VirtualTextureFeedback(vTexCoord);
+}
+
+#else
 
 layout(location = 0) out vec4 oColor;
 
 void main()
 {
-	vec4 col = texture(uTexture, vTexCoord);
+	vec4 col = SampleAlbedo(vTexCoord);
 	vec3 totalColor = vec3(0);
 
 	if (vLightCount > 0)
@@ -224,6 +444,8 @@ void main()
 	oColor = vec4(totalColor, 1);
 }
 
+#endif // VT_FEEDBACK
+
 #endif
 #endif
 
@@ -251,11 +473,11 @@ struct Light
 layout(location = 0) in vec3 aPosition;	// world space
 layout(location = 1) in vec3 aNormal;	// world space
 layout(location = 2) in vec2 aTexCoord;
-layout(location = 3) in vec3 aTangent;
-layout(location = 4) in vec3 aBitangent;
+layout(location = 3) in vec4 aTangent;	// w: handedness, bitangent = cross(aNormal, aTangent.xyz) * aTangent.w
 
 layout (binding = 0, std140) uniform globalParams
 {
+	mat4			uViewProjectionMatrix;	// camera, per frame
 	vec3			uCameraPosition;
 	unsigned int	uLightCount;
 	Light			uLight[MAX_LIGHT_COUNT];
@@ -263,10 +485,12 @@ layout (binding = 0, std140) uniform globalParams
 
 layout(binding = 1, std140) uniform localParams
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	mat4 uWorldMatrix;	// only rewritten when the object moves
 };
 
+uniform vec3 uPositionScale;	// positions packed relative to the submesh bounds
+uniform vec3 uPositionOffset;
+
 out vec2 vTexCoord;
 out vec3 vViewDir;
 vec3 vPosition;
@@ -278,8 +502,9 @@ out vec3 vLightCol[MAX_LIGHT_COUNT];
 
 void main()
 {
+	vec3 position = aPosition * uPositionScale + uPositionOffset;
 	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
+	vPosition = vec3(uWorldMatrix * vec4(position, 1.0));
 	vViewDir = uCameraPosition - vPosition;
 	vLightCount = uLightCount;
 
@@ -299,7 +524,7 @@ void main()
 			vLightCol[i] = uLight[i].color;
 		}
 
-	gl_Position = vec4(aPosition.x, aPosition.y, 0.0 , 1.0);
+	gl_Position = vec4(position.x, position.y, 0.0 , 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////